@@ -37,6 +37,9 @@ typedef struct Class {
 	int	cidr_len;
 	int	cidr_amount;
 	struct _patricia_tree_t *ip_limits;
+#endif
+#ifdef USE_METRICS
+	unsigned long long sendq;	/* summed up by metrics_class() */
 #endif
 	struct Class *next;
 } aClass;
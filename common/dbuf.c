@@ -348,12 +348,18 @@ int	dbuf_get(dbuf *dyn, char *buf, int length)
 }
 
 /*
+** dbuf_copy
+**	Like dbuf_get, but leaves the buffer untouched.  Returns the
+**	number of bytes copied into buf.
+*/
 int	dbuf_copy(dbuf *dyn, char *buf, int length)
 {
 	register dbufbuf	*d = dyn->head;
 	register char	*s;
 	register int	chunk, len = length, dlen = dyn->length;
 
+	if (!d || !dlen)
+		return 0;
 	s = d->data + dyn->offset;
 	chunk = MIN(DBUFSIZ - dyn->offset, dlen);
 
@@ -379,7 +385,6 @@ int	dbuf_copy(dbuf *dyn, char *buf, int length)
 	    }
 	return length - len;
 }
-*/
 
 /*
 ** dbuf_getmsg
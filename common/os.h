@@ -141,6 +141,13 @@
 # endif
 #endif
 
+#ifdef HAVE_SYS_MMAN_H
+# include <sys/mman.h>
+# if defined(MAP_ANONYMOUS) && !defined(MAP_ANON)
+#  define MAP_ANON MAP_ANONYMOUS
+# endif
+#endif
+
 #ifdef HAVE_STROPTS_H
 # include <stropts.h>
 #endif
@@ -31,7 +31,7 @@ static const volatile char rcsid[] = "@(#)$Id: parse.c,v 1.97 2010/08/12 16:29:3
 /* max parameters accepted */
 #define MPAR 15
 
-#define _m(f) {f, 0, 0, 0L, 0L}
+#define _m(f) {f, 0, 0, 0L, 0L, NULL}
 /* commands should be sorted by their average usage count */
 /* handlers are for: server, client, oper, service, unregistered */
 struct Message msgtab[] = {
@@ -561,6 +561,67 @@ aClient	*find_target(char *name, aClient *cptr)
 	return acptr;
 }
 
+/*
+** cmdprof_call
+**	Calls the handler and accounts the time it took, when SET CMDPROF
+**	is on; the loop watchdog is told too.  handler->prof is looked at only
+**	afterwards, as the handler may be SET CMDPROF RESET itself, and the
+**	sender's name is saved before, as it may be gone after.
+*/
+static	int	cmdprof_call(struct Cmd *handler, char *cmd, aClient *cptr,
+	aClient *from, int parc, char *parv[])
+{
+	struct	CmdProf	*prof;
+	unsigned long long start;
+	char	name[HOSTLEN+1];
+	u_long	usec, n;
+	int	ret, b;
+
+	if (iconf.watchdog > 0)
+		strncpyzt(name, *from->name ? from->name : from->sockhost,
+			  sizeof(name));
+	start = loop_usec();
+	ret = (*handler->handler)(cptr, from, parc, parv);
+	usec = loop_usec() - start;
+
+	if (iconf.watchdog > 0)
+		loop_command(cmd, name, usec);
+	if (!iconf.cmdprof)	/* SET CMDPROF OFF itself */
+		return ret;
+	if (!(prof = handler->prof))
+	    {
+		prof = handler->prof =
+			(struct CmdProf *)MyMalloc(sizeof(struct CmdProf));
+		bzero((char *)prof, sizeof(struct CmdProf));
+	    }
+	prof->calls++;
+	prof->usec += usec;
+	if (usec > prof->max)
+		prof->max = usec;
+	for (b = 0, n = usec; n && b < CMDPROF_BUCKETS - 1; n >>= 1)
+		b++;
+	prof->hist[b]++;
+	return ret;
+}
+
+/*
+** cmdprof_reset
+**	Forgets the handler timings (SET CMDPROF RESET).
+*/
+void	cmdprof_reset(void)
+{
+	struct	Message	*mptr;
+	int	i;
+
+	for (mptr = msgtab; mptr->cmd; mptr++)
+		for (i = 0; i < STAT_MAX; i++)
+			if (mptr->handlers[i].prof)
+			    {
+				MyFree(mptr->handlers[i].prof);
+				mptr->handlers[i].prof = NULL;
+			    }
+}
+
 /*
  * parse a buffer.
  * Return values:
@@ -576,7 +637,7 @@ int	parse(aClient *cptr, char *buffer, char *bufend)
 	Reg	struct	Message *mptr = NULL;
 	int	ret;
 	int	status = STAT_UNREG;
-	struct Cmd	*handler;
+	struct Cmd	*handler = NULL;
 	CmdHandler	fhandler = m_nop;
 
 	Debug((DEBUG_DEBUG, "Parsing %s: %s",
@@ -765,6 +826,7 @@ int	parse(aClient *cptr, char *buffer, char *bufend)
 		from->user->last = timeofday;
 	Debug((DEBUG_DEBUG, "Function(%d): %#x = %s parc %d parv %#x",
 		status, fhandler, mptr->cmd, i, para));
+	TRACE(TRACE_PARSE, TEV_PARSE, cptr->fd, mptr - msgtab, status, i);
 	if (fhandler != m_nop && fhandler != m_nopriv
 		&& fhandler != m_unreg &&
 		mptr->minparams > 0 && 
@@ -794,7 +856,13 @@ int	parse(aClient *cptr, char *buffer, char *bufend)
 		**   >=0 if protocol message processing was successful. The return
 		**       value indicates the penalty score.
 		*/
-		ret = (*fhandler)(cptr, from, i, para);
+		loop_cmd = mptr->cmd;	/* for the loop watchdog */
+		loop_from = from;
+		if (iconf.cmdprof)
+			ret = cmdprof_call(handler, mptr->cmd, cptr, from,
+					   i, para);
+		else
+			ret = (*fhandler)(cptr, from, i, para);
 	}
 	/*
         ** Add penalty score for sucessfully parsed command if issued by
@@ -47,6 +47,7 @@ EXTERN aClient *find_userhost (char *user, char *host, aClient *cptr,
 				   int *count);
 EXTERN aClient *find_person (char *name, aClient *cptr);
 EXTERN int parse (aClient *cptr, char *buffer, char *bufend);
+EXTERN void cmdprof_reset (void);
 EXTERN char *getfield (char *irc_newline);
 EXTERN int m_nop(aClient *, aClient *, int, char **);
 EXTERN int m_nopriv(aClient *, aClient *, int, char **);
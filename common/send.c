@@ -33,7 +33,10 @@ static	char	sendbuf[2048];
 
 static	void	vsendto_prefix_one(aClient *, aClient *, char *, va_list);
 static	char	psendbuf[2048];
-static	int	sentalong[MAXCONNECTIONS];
+static	u_int	sentalong[MAXCONNECTIONS];
+static	u_int	sentserial = 0;	/* sentalong[fd] == sentserial: already sent */
+
+int	sendq_hold = 0;		/* set while a netsplit is processed */
 
 /*
 ** dead_link
@@ -55,6 +58,8 @@ static	int	dead_link(aClient *to, char *pattern, ...)
 	va_end(va);
 
 	SetDead(to);
+	TRACE(TRACE_CONN, TEV_DEADLINK, to->fd, to->exitc,
+	      DBufLength(&to->sendQ), 0);
 	/*
 	 * If because of BUFFERPOOL problem then clean dbufs now so that
 	 * notices don't hurt operators below.
@@ -188,6 +193,8 @@ tryagain:
 			)
 		{
 			/* Anyway, 10% increase. */
+			TRACE(TRACE_MEM, TEV_POOLGROW, -1, poolsize,
+			      poolsize * 1.1, 0);
 			poolsize *= 1.1;
 			sendto_flag(SCH_NOTICE,
 				    "New poolsize %u. (reached)",
@@ -219,8 +226,13 @@ tryagain:
 	** Also stops us from deliberately building a large sendQ and then
 	** trying to flood that link with data (possible during the net
 	** relinking done by servers with a large load).
+	** While sendq_hold is set, what is queued is written only once
+	** half of the sendQ is used, so that the QUITs of a netsplit go
+	** out to each client in a few large writes (see exit_split_users).
 	*/
-	if (DBufLength(&to->sendQ)/1024 > to->lastsq)
+	if (sendq_hold ?
+	    DBufLength(&to->sendQ) > get_sendq(to, CBurst(to)) / 2 :
+	    DBufLength(&to->sendQ)/1024 > to->lastsq)
 		send_queued(to);
 	return 0;
 }
@@ -302,7 +314,11 @@ int	send_queued(aClient *to)
 		(void)dbuf_delete(&to->sendQ, rlen);
 		to->lastsq = DBufLength(&to->sendQ)/1024;
 		if (rlen < len) /* ..or should I continue until rlen==0? */
+		    {
+			TRACE(TRACE_SEND, TEV_PARTIAL, to->fd, rlen, len,
+			      DBufLength(&to->sendQ));
 			break;
+		    }
 
 #ifdef	ZIP_LINKS
 		if (DBufLength(&to->sendQ) == 0 && more)
@@ -339,9 +355,10 @@ static	aClient	anon;
 void initanonymous(void)
 {
 	memset(&ausr, 0, sizeof(anUser));
-	strcpy(ausr.username, "anonymous");
+	ausr.username = "anonymous";
 	strcpy(ausr.uid, "0ANONYM");
-	strcpy(ausr.host, "anonymous.");
+	ausr.host = "anonymous.";
+	ausr.sip = "";
 	ausr.server = "anonymous.";
 
 	memset(&anon, 0, sizeof(aClient));
@@ -380,14 +397,15 @@ static	int	vsendprep(char *pattern, va_list va)
 /*
  * sendpreprep: takes care of building the string according to format & args,
  *		and of adding a complete prefix if necessary
+ *		(to is NULL when building for any local client)
  */
 static	int	vsendpreprep(aClient *to, aClient *from, char *pattern, va_list va)
 {
 	int	len;
 
 	Debug((DEBUG_L10, "sendpreprep(%#x(%s),%#x(%s),%s)",
-		to, to->name, from, from->name, pattern));
-	if (to && from && MyClient(to) && IsPerson(from) &&
+		to, to ? to->name : "*", from, from->name, pattern));
+	if (from && (!to || MyClient(to)) && IsPerson(from) &&
 	    !strncmp(pattern, ":%s", 3))
 	{
 		char	*par = va_arg(va, char *);
@@ -661,7 +679,12 @@ void	sendto_common_channels(aClient *user, char *pattern, ...)
 	else
 	    {
 		/* This part optimized for client servers */
-		bzero((char *)&sentalong[0], sizeof(int) * MAXCONNECTIONS);
+		if (++sentserial == 0)
+		    {
+			/* wrapped, start over */
+			bzero((char *)&sentalong[0], sizeof(sentalong));
+			sentserial = 1;
+		    }
 		if (MyConnect(user))
 		    {
 			va_list	va;
@@ -669,7 +692,7 @@ void	sendto_common_channels(aClient *user, char *pattern, ...)
 			len = vsendpreprep(user, user, pattern, va);
 			va_end(va);
 			(void)send_message(user, psendbuf, len);
-			sentalong[user->fd] = 1;
+			sentalong[user->fd] = sentserial;
 		    }
 		if (!user->user)
 			return;
@@ -686,9 +709,10 @@ void	sendto_common_channels(aClient *user, char *pattern, ...)
 				cptr = lp->value.cptr;
 				if (user == cptr)
 					continue;
-				if (!cptr->user || sentalong[cptr->fd])
+				if (!cptr->user ||
+				    sentalong[cptr->fd] == sentserial)
 					continue;
-				sentalong[cptr->fd]++;
+				sentalong[cptr->fd] = sentserial;
 #ifndef DEBUGMODE
 				if (!len) /* This saves little cpu,
 					     but breaks the debug code.. */
@@ -748,6 +772,46 @@ void	sendto_channel_butserv(aChannel *chptr, aClient *from, char *pattern, ...)
 	return;
 }
 
+/*
+** sendprep_block
+**	Appends the message, formatted as sendto_channel_butserv() would
+**	for local clients, to block which holds len bytes already.
+**	Returns the new length of block, which must have room for another
+**	BUFSIZE bytes.
+*/
+int	sendprep_block(char *block, int len, aChannel *chptr, aClient *from,
+		       char *pattern, ...)
+{
+	va_list	va;
+	int	mlen;
+
+	if (IsAnonymous(chptr) && IsClient(from))
+		from = &anon;
+	va_start(va, pattern);
+	mlen = vsendpreprep(NULL, from, pattern, va);
+	va_end(va);
+	bcopy(psendbuf, block + len, mlen);
+	return len + mlen;
+}
+
+/*
+** sendto_channel_block
+**	Sends a block of lines built by sendprep_block() to all local
+**	clients on the channel, so that a burst of messages for a channel
+**	is formatted once and queued once per member.
+*/
+void	sendto_channel_block(aChannel *chptr, char *block, int len)
+{
+	Reg	Link	*lp;
+	Reg	aClient	*acptr;
+
+	if (len <= 0)
+		return;
+	for (lp = chptr->clist; lp; lp = lp->next)
+		if (MyClient(acptr = lp->value.cptr))
+			(void)send_message(acptr, block, len);
+}
+
 /*
 ** send a msg to all ppl on servers/hosts that match a specified mask
 ** (used for enhanced PRIVMSGs)
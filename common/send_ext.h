@@ -21,6 +21,12 @@
     defined in common/send.c.
  */
 
+/*  External definitions for global variables.
+ */
+#ifndef SEND_C
+extern int sendq_hold;
+#endif /* SEND_C */
+
 /*  External definitions for global functions.
  */
 #ifndef SEND_C
@@ -46,6 +52,9 @@ EXTERN int sendto_serv_v (aClient *one, int ver, char *pattern, ...);
 EXTERN void sendto_common_channels (aClient *user, char *pattern, ...);
 EXTERN void sendto_channel_butserv (aChannel *chptr, aClient *from,
 				    char *pattern, ...);
+EXTERN int sendprep_block (char *block, int len, aChannel *chptr,
+			   aClient *from, char *pattern, ...);
+EXTERN void sendto_channel_block (aChannel *chptr, char *block, int len);
 EXTERN void sendto_match_servs (aChannel *chptr, aClient *from,
 				char *format, ...);
 EXTERN int sendto_match_servs_v (aChannel *chptr, aClient *from, int ver,
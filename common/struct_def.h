@@ -359,6 +359,7 @@ struct	ListItem	{
 #ifdef XLINE
 #define CONF_XLINE		0x800000
 #endif
+#define	CONF_RESOLVER		0x1000000
 #define	CONF_OPS		CONF_OPERATOR
 #define	CONF_SERVER_MASK	(CONF_CONNECT_SERVER | CONF_NOCONNECT_SERVER |\
 				 CONF_ZCONNECT_SERVER)
@@ -375,6 +376,7 @@ struct	ListItem	{
 #ifdef XLINE
 #define CFLAG_XEXEMPT		0x00080
 #endif
+#define CFLAG_KNEW		0x00100	/* K: line added by the last rehash */
 
 #define IsConfRestricted(x)	((x)->flags & CFLAG_RESTRICTED)
 #define IsConfRNoDNS(x)		((x)->flags & CFLAG_RNODNS)
@@ -455,18 +457,20 @@ struct	User	{
 	u_int	hashv;
 	aClient	*uhnext;
 	aClient	*bcptr;
-	char	username[USERLEN+1];
 	char	uid[UIDLEN+1];
-	char	host[HOSTLEN+1];
+	/*
+	** username, host and sip are interned strings, shared by all
+	** the users having the same value (see make_istr() in hash.c);
+	** never write to them, use set_istr().
+	*/
+	char	*username;
+	char	*host;
+	char	*sip;		/* ip as a string */
 	char	*server;
 	u_int	hhashv;		/* hostname hash value */
 	u_int	iphashv;	/* IP hash value */
 	struct User *hhnext;	/* next entry in hostname hash */
 	struct User *iphnext;	/* next entry in IP hash */
-				/* sip MUST be the last in this struct!!! */
-	char	sip[1];		/* ip as a string, big enough for ipv6
-				 * allocated to real size in make_user */
-
 };
 
 struct	Server	{
@@ -509,56 +513,56 @@ struct	Service	{
 };
 
 struct Client	{
+	/*
+	** The fields are ordered by how often they are looked at when
+	** walking lists of clients: the first cache line holds what
+	** client list and local connection scans need, the second one
+	** the rest of the part shared by all clients.
+	*/
 	struct	Client *next,*prev, *hnext;
+	aClient	*from;		/* == self, if Local Client, *NEVER* NULL! */
 	anUser	*user;		/* ...defined, if this is a User */
 	aServer	*serv;		/* ...defined, if this is a server */
-	aService *service;
-	u_int	hashv;		/* raw hash value */
 	long	flags;		/* client flags */
-	aClient	*from;		/* == self, if Local Client, *NEVER* NULL! */
 	int	fd;		/* >= 0, for local clients */
-	int	hopcount;	/* number of servers to this 0 = local */
 	short	status;		/* Client type */
+	aService *service;
 	char	*name;		/* Pointer to unique name of the client */
+	char	*info;		/* Free form additional client information */
+	u_int	hashv;		/* raw hash value */
+	int	hopcount;	/* number of servers to this 0 = local */
 	char	namebuf[NICKLEN+1]; /* nick of the client */
 	char	username[USERLEN+1]; /* username here now for auth stuff */
-	char	*info;		/* Free form additional client information */
 	/*
 	** The following fields are allocated only for local clients
 	** (directly connected to *this* server with a socket.
 	** The first of them *MUST* be the "count"--it is the field
 	** to which the allocation is tied to! *Never* refer to
 	** these fields, if (from != self).
+	** Those used by the main loop (check_pings(), read_message(),
+	** flush_connections()) come first, the bulky ones last.
 	*/
 	int	count;		/* Amount of data in buffer */
-	char	buffer[BUFSIZE]; /* Incoming message buffer */
+	int	ping;
+	dbuf	sendQ;		/* Outgoing message queue--if socket full */
+	dbuf	recvQ;		/* Hold for data incoming yet to be parsed */
+	time_t	lasttime;	/* last time we received data */
+	time_t	firsttime;	/* time client was created */
+	time_t	since;		/* last time we parsed something */
+	Link	*confs;		/* Configuration record associated */
+	aClient	*acpt;		/* listening client which we accepted from */
+	struct	hostent	*hostp;
 #ifdef	ZIP_LINKS
 	aZdata	*zip;		/* zip data */
 #endif
+	int	authfd;		/* fd for rfc931 authentication */
 	short	lastsq;		/* # of 2k blocks when sendqueued called last*/
-	dbuf	sendQ;		/* Outgoing message queue--if socket full */
-	dbuf	recvQ;		/* Hold for data incoming yet to be parsed */
+	char	exitc;
 	long	sendM;		/* Statistics: protocol messages send */
 	long	receiveM;	/* Statistics: protocol messages received */
 	unsigned long long	sendB;		/* Statistics: total bytes send */
 	unsigned long long	receiveB;	/* Statistics: total bytes received */
-	time_t	lasttime;	/* last time we received data */
-	time_t	firsttime;	/* time client was created */
-	time_t	since;		/* last time we parsed something */
-	aClient	*acpt;		/* listening client which we accepted from */
-	Link	*confs;		/* Configuration record associated */
-	int	ping;
-	int	authfd;		/* fd for rfc931 authentication */
 	char	*auth;
-	u_short	port;		/* and the remote port# too :-) */
-	struct	IN_ADDR	ip;	/* keep real ip# too */
-	struct	hostent	*hostp;
-	char	sockhost[HOSTLEN+1]; /* This is the host name from the socket
-				  ** and after which the connection was
-				  ** accepted.
-				  */
-	char	passwd[PASSWDLEN+1];
-	char	exitc;
 	char	*reason;	/* additional exit message */
 #ifdef XLINE
 	/* Those logically should be in anUser struct, but would be null for
@@ -567,7 +571,14 @@ struct Client	{
 	char	*user2;	/* 2nd param of USER */
 	char	*user3;	/* 3rd param of USER */
 #endif
-
+	u_short	port;		/* and the remote port# too :-) */
+	struct	IN_ADDR	ip;	/* keep real ip# too */
+	char	sockhost[HOSTLEN+1]; /* This is the host name from the socket
+				  ** and after which the connection was
+				  ** accepted.
+				  */
+	char	passwd[PASSWDLEN+1];
+	char	buffer[BUFSIZE]; /* Incoming message buffer */
 };
 
 #define	CLIENT_LOCAL_SIZE sizeof(aClient)
@@ -636,12 +647,23 @@ struct	SMode	{
 
 typedef	int	(*CmdHandler)(aClient *, aClient *, int, char **);
 
+/* handler timing, see SET CMDPROF */
+#define	CMDPROF_BUCKETS	20	/* bucket n < 2^n usec, the last is open */
+
+struct	CmdProf {
+	u_int		calls;
+	u_long		max;		/* usec */
+	unsigned long long usec;	/* total */
+	u_int		hist[CMDPROF_BUCKETS];
+};
+
 struct	Cmd {
 	CmdHandler	handler;	/* command */
 	u_int		count;		/* total count */
 	u_int		rcount;		/* remote count */
 	u_long		bytes;
 	u_long		rbytes;
+	struct CmdProf	*prof;		/* allocated when first timed */
 };
 
 struct	Message	{
@@ -790,11 +812,11 @@ struct Channel	{
 #define	ME	me.name
 #define	MES	me.serv->sid
 
-#define	GotDependantClient(x)	(x->prev &&				\
-		 		 ((IsRegisteredUser(x->prev) &&		\
-				  x->prev->user->servp == x->serv) ||	\
-				  (IsService(x->prev) &&		\
-				  x->prev->service->servp == x->serv)))
+#define	DependsOn(x, s)		((IsRegisteredUser(x) &&		\
+				  (x)->user->servp == (s)->serv) ||	\
+				 (IsService(x) &&			\
+				  (x)->service->servp == (s)->serv))
+#define	GotDependantClient(x)	(x->prev && DependsOn(x->prev, x))
 
 #define	IsMasked(x)		(x && x->serv && x->serv->maskedby != x)
 
@@ -999,6 +1021,10 @@ typedef enum ServerChannels {
 #define TSET_POOLSIZE 0x002
 #define TSET_CACCEPT 0x004
 #define TSET_SPLIT 0x008
+#define TSET_CMDPROF 0x010
+#define TSET_WATCHDOG 0x020
+#define TSET_CAPTURE 0x040
+#define TSET_TRACE 0x080
 #define TSET_SHOWALL (int) ~0
 
 /* Runtime configuration structure */
@@ -1009,6 +1035,10 @@ typedef struct
 	int split_minservers;
 	int split_minusers;
 	int caccept;	/* 0: off, 1: on, 2: split */
+	int cmdprof;	/* 0: off, 1: time command handlers */
+	int watchdog;	/* slow main loop threshold (msec), 0: off */
+	int capture;	/* 0: off, 1: traffic captured (USE_CAPTURE) */
+	int trace;	/* TRACE_* categories traced (USE_TRACE) */
 } iconf_t;
 
 /* O:line flags, used also in is_allowed() */
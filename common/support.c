@@ -638,6 +638,9 @@ char	*MyMalloc(size_t x)
 {
 	char *ret = (char *)malloc(x);
 
+# ifdef	BENCH_COMPILE
+	bench_allocs++;
+# endif
 	if (!ret)
 	    {
 # ifndef	CLIENT_COMPILE
@@ -654,6 +657,9 @@ char	*MyRealloc(char *x, size_t y)
 {
 	char *ret = (char *)realloc(x, y);
 
+# ifdef	BENCH_COMPILE
+	bench_allocs++;
+# endif
 	if (!ret)
 	    {
 # ifndef CLIENT_COMPILE
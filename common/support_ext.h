@@ -31,6 +31,9 @@
 #ifdef INET6
 EXTERN char ipv6string[INET6_ADDRSTRLEN];
 #endif
+#ifdef BENCH_COMPILE
+EXTERN u_long bench_allocs;	/* MyMalloc() and MyRealloc() calls */
+#endif
 EXTERN char *mystrdup (char *s);
 #if !defined(HAVE_STRTOKEN)
 EXTERN char *strtoken (char **save, char *str, char *fs);
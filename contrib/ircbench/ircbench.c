@@ -0,0 +1,1630 @@
+/************************************************************************
+ *   IRC - Internet Relay Chat, contrib/ircbench/ircbench.c
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 1, or (at your option)
+ *   any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * ircbench: load generator for a locally started ircd.
+ *
+ * One process drives all the clients and fake server links through a
+ * single poll() loop, so that runs with the same options and seed do the
+ * same thing.  Messages carry the time they were sent, which gives the
+ * delivery latency when they come back to another client; as the
+ * clocks are the same, no synchronisation is needed.
+ *
+ * See the README for the scenarios and the ircd.conf lines they need.
+ *
+ * The replay scenario plays back a traffic capture made by ircd (SET
+ * CAPTURE, see ircd/s_capture.c), the file format is in s_capture_def.h.
+ */
+
+#ifndef lint
+static const volatile char rcsid[] = "@(#)$Id$";
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+
+#include "s_capture_def.h"
+
+#define	MAXSAMPLES	(1 << 20)	/* latency samples kept */
+#define	MAXJOIN		32		/* channels per client */
+#define	NJOINBATCH	40		/* members per NJOIN line */
+#define	SETUPTIMEOUT	120		/* seconds to get all clients in */
+
+/* what a connection is */
+#define	C_CLIENT	0
+#define	C_LINK		1
+#define	C_REPLAY	2	/* replays a captured connection */
+
+/* connection states */
+#define	S_CONNECT	0	/* non blocking connect() */
+#define	S_REG		1	/* NICK/USER or PASS/SERVER sent */
+#define	S_BURST		2	/* link: receiving the ircd burst */
+#define	S_UP		3	/* registered (client), burst done (link) */
+#define	S_DEAD		4
+
+typedef	struct	Conn	aConn;
+
+struct	Conn	{
+	int	fd;
+	int	kind, state, idx;
+	char	nick[64];		/* or server name */
+	char	sid[5];			/* links */
+	char	in[16384];
+	int	inlen;
+	char	*out;
+	int	outlen, outsize;
+	int	chan[MAXJOIN];		/* channel numbers joined */
+	int	nchan, joined;
+	unsigned long long next;	/* next message, usec */
+	unsigned long long qsent;	/* pending query, usec (0: none) */
+	int	nicks;			/* nick changes, for unique nicks */
+	int	closing;		/* close once out is written */
+};
+
+/* options */
+static	char	*host = "127.0.0.1";
+static	int	port = 6667;
+static	char	*pidarg =
+#ifdef IRCDPID_PATH
+	IRCDPID_PATH;
+#else
+	NULL;
+#endif
+static	int	nclients = 100, nchannels = 20, perclient = 3;
+static	double	zipf_s = 1.0, rate = 1.0, nickrate = 0.0, quitrate = 0.0;
+static	int	duration = 30, msglen = 64, nlinks = 1, burstusers = 10000;
+static	char	*linkname = "bench.irc.local", *linkpass = "bench";
+static	char	*prefix = "b";
+static	unsigned long long seed = 1;
+static	char	*scenario = "chat";
+static	char	*capfile = NULL;
+static	int	fastreplay = 0, window = 10;
+
+/* state */
+static	aConn	*conns = NULL;		/* clients, then links */
+static	int	nconns = 0;
+static	double	*zipf_cdf = NULL;
+static	unsigned long long rng;
+static	char	ircdsid[5] = "";
+static	pid_t	ircdpid = -1;
+
+/* counters */
+static	unsigned long sent, delivered, received, lines, queries, errors;
+static	unsigned int *samples = NULL;
+static	unsigned long nsamples, seen;	/* kept, offered */
+
+static	void	usage(void)
+{
+	fprintf(stderr,
+"usage: ircbench [options] [scenario]\n"
+"scenarios: chat (default), flood, massjoin, who, list, burst-in, burst-out,\n"
+"           replay\n"
+"  -h host      ircd address (%s)\n"
+"  -p port      ircd port (%d)\n"
+"  -P pid|file  ircd pid, or pid file, for CPU and memory use (%s)\n"
+"  -c clients   number of clients (%d)\n"
+"  -C channels  number of channels (%d)\n"
+"  -j joins     channels joined by each client (%d)\n"
+"  -z s         exponent of the Zipf channel sizes (%.2f)\n"
+"  -r rate      messages (or queries) per second per client (%.2f)\n"
+"  -m bytes     message length (%d)\n"
+"  -n rate      nick changes per second per client (%.2f)\n"
+"  -q rate      quits (and reconnects) per second per client (%.2f)\n"
+"  -t seconds   duration of the measure (%d)\n"
+"  -L links     fake server links for burst-in (%d)\n"
+"  -U users     users in the burst of each link (%d)\n"
+"  -N name      fake server name (%s)\n"
+"  -w password  fake server password (%s)\n"
+"  -x prefix    client nick prefix (%s)\n"
+"  -s seed      random seed (%llu)\n"
+"  -f file      capture to replay\n"
+"  -F           replay as fast as possible, not at the original pace\n"
+"  -W seconds   replay phase length (%d)\n",
+		host, port, pidarg ? pidarg : "none", nclients, nchannels,
+		perclient, zipf_s, rate, msglen, nickrate, quitrate, duration,
+		nlinks, burstusers, linkname, linkpass, prefix, seed, window);
+	exit(2);
+}
+
+/*
+** Time, randomness.
+*/
+static	unsigned long long	now_usec(void)
+{
+#ifdef CLOCK_MONOTONIC
+	struct	timespec ts;
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#else
+	struct	timeval tv;
+
+	(void)gettimeofday(&tv, NULL);
+	return (unsigned long long)tv.tv_sec * 1000000 + tv.tv_usec;
+#endif
+}
+
+/* xorshift64*, so that a seed gives the same run everywhere */
+static	unsigned long long	rnd(void)
+{
+	rng ^= rng >> 12;
+	rng ^= rng << 25;
+	rng ^= rng >> 27;
+	return rng * 2685821657736338717ULL;
+}
+
+/* uniform in [0, 1) */
+static	double	rnd01(void)
+{
+	return (rnd() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* exponential delay (usec) for events happening r times per second */
+static	unsigned long long	rnd_delay(double r)
+{
+	double	u = rnd01();
+
+	if (r <= 0)
+		return ~0ULL >> 1;
+	return (unsigned long long)(-1e6 * log1p(-u) / r);
+}
+
+/* channel number, popularity following Zipf's law */
+static	int	zipf(void)
+{
+	double	u = rnd01();
+	int	lo = 0, hi = nchannels - 1, mid;
+
+	while (lo < hi)
+	    {
+		mid = (lo + hi) / 2;
+		if (zipf_cdf[mid] < u)
+			lo = mid + 1;
+		else
+			hi = mid;
+	    }
+	return lo;
+}
+
+static	void	zipf_init(void)
+{
+	double	sum = 0;
+	int	i;
+
+	zipf_cdf = (double *)malloc(nchannels * sizeof(double));
+	for (i = 0; i < nchannels; i++)
+		sum += 1.0 / pow(i + 1, zipf_s);
+	for (i = 0; i < nchannels; i++)
+		zipf_cdf[i] = (i ? zipf_cdf[i - 1] : 0) +
+			(1.0 / pow(i + 1, zipf_s)) / sum;
+	zipf_cdf[nchannels - 1] = 1.0;
+}
+
+/*
+** Latency samples (reservoir sampling past MAXSAMPLES).
+*/
+static	void	sample(unsigned long long usec)
+{
+	unsigned long long i;
+
+	seen++;
+	if (nsamples < MAXSAMPLES)
+	    {
+		samples[nsamples++] = (unsigned int)usec;
+		return;
+	    }
+	if ((i = rnd() % seen) < MAXSAMPLES)
+		samples[i] = (unsigned int)usec;
+}
+
+static	int	ucmp(const void *a, const void *b)
+{
+	unsigned int x = *(const unsigned int *)a, y = *(const unsigned int *)b;
+
+	return (x < y) ? -1 : (x > y);
+}
+
+static	void	report_latency(char *what)
+{
+	if (nsamples == 0)
+	    {
+		printf("%s latency ms: none\n", what);
+		return;
+	    }
+	qsort(samples, nsamples, sizeof(unsigned int), ucmp);
+	printf("%s latency ms: p50 %.3f p90 %.3f p99 %.3f max %.3f\n", what,
+	       samples[(nsamples - 1) * 50 / 100] / 1000.0,
+	       samples[(nsamples - 1) * 90 / 100] / 1000.0,
+	       samples[(nsamples - 1) * 99 / 100] / 1000.0,
+	       samples[nsamples - 1] / 1000.0);
+}
+
+/*
+** ircd CPU time (usec) and memory (kB), from /proc.
+*/
+static	void	ircd_find(void)
+{
+	FILE	*fp;
+	char	*end;
+	long	l;
+
+	if (!pidarg)
+		return;
+	l = strtol(pidarg, &end, 10);
+	if (*end == '\0' && l > 0)
+	    {
+		ircdpid = (pid_t)l;
+		return;
+	    }
+	if ((fp = fopen(pidarg, "r")))
+	    {
+		if (fscanf(fp, "%ld", &l) == 1 && l > 0)
+			ircdpid = (pid_t)l;
+		fclose(fp);
+	    }
+	if (ircdpid > 0 && kill(ircdpid, 0) < 0 && errno == ESRCH)
+		ircdpid = -1;
+}
+
+static	long long	ircd_cpu(void)
+{
+	char	path[64], buf[1024], *p;
+	unsigned long utime, stime;
+	FILE	*fp;
+	int	i;
+
+	if (ircdpid <= 0)
+		return -1;
+	sprintf(path, "/proc/%d/stat", (int)ircdpid);
+	if (!(fp = fopen(path, "r")))
+		return -1;
+	p = fgets(buf, sizeof(buf), fp);
+	fclose(fp);
+	/* the command may have spaces, start after it */
+	if (!p || !(p = strrchr(buf, ')')))
+		return -1;
+	for (i = 0; i < 12 && p; i++)
+		p = strchr(p + 1, ' ');
+	if (!p || sscanf(p, "%lu %lu", &utime, &stime) != 2)
+		return -1;
+	return (long long)(utime + stime) * 1000000 / sysconf(_SC_CLK_TCK);
+}
+
+static	void	ircd_mem(long *rss, long *hwm)
+{
+	char	path[64], buf[256];
+	FILE	*fp;
+
+	*rss = *hwm = -1;
+	if (ircdpid <= 0)
+		return;
+	sprintf(path, "/proc/%d/status", (int)ircdpid);
+	if (!(fp = fopen(path, "r")))
+		return;
+	while (fgets(buf, sizeof(buf), fp))
+		if (!strncmp(buf, "VmRSS:", 6))
+			*rss = atol(buf + 6);
+		else if (!strncmp(buf, "VmHWM:", 6))
+			*hwm = atol(buf + 6);
+	fclose(fp);
+}
+
+/*
+** The measure: counters are reset by measure_start(), measure_end()
+** prints what they are the same for all the scenarios.
+*/
+static	unsigned long long mstart;
+static	long long cstart;
+
+static	void	measure_start(void)
+{
+	sent = delivered = received = lines = queries = errors = 0;
+	nsamples = seen = 0;
+	cstart = ircd_cpu();
+	mstart = now_usec();
+}
+
+static	double	measure_end(void)
+{
+	double	secs = (now_usec() - mstart) / 1e6;
+	long long cend = ircd_cpu();
+	long	rss, hwm;
+
+	if (secs <= 0)
+		secs = 1e-6;
+	printf("elapsed: %.3f s\n", secs);
+	if (cstart >= 0 && cend >= 0)
+		printf("ircd cpu: %.3f s (%.1f%%)\n", (cend - cstart) / 1e6,
+		       (cend - cstart) / 1e4 / secs);
+	else
+		printf("ircd cpu: n/a\n");
+	ircd_mem(&rss, &hwm);
+	if (rss >= 0)
+		printf("ircd rss: %ld kB (max %ld kB)\n", rss, hwm);
+	else
+		printf("ircd rss: n/a\n");
+	if (errors)
+		printf("errors: %lu\n", errors);
+	return secs;
+}
+
+/*
+** Connections.
+*/
+static	void	sendf(aConn *c, char *fmt, ...)
+{
+	va_list	va;
+	int	len;
+
+	if (c->fd < 0)
+		return;
+	while (1)
+	    {
+		va_start(va, fmt);
+		len = vsnprintf(c->out + c->outlen, c->outsize - c->outlen,
+				fmt, va);
+		va_end(va);
+		if (c->outlen + len + 2 < c->outsize)
+			break;
+		c->outsize = (c->outsize + len + 2) * 2;
+		c->out = (char *)realloc(c->out, c->outsize);
+	    }
+	c->outlen += len;
+	c->out[c->outlen++] = '\r';
+	c->out[c->outlen++] = '\n';
+}
+
+/* raw bytes */
+static	void	conn_write(aConn *c, char *buf, int len)
+{
+	if (c->fd < 0)
+		return;
+	if (c->outlen + len > c->outsize)
+	    {
+		c->outsize = (c->outlen + len) * 2;
+		c->out = (char *)realloc(c->out, c->outsize);
+	    }
+	memcpy(c->out + c->outlen, buf, len);
+	c->outlen += len;
+}
+
+static	void	conn_flush(aConn *c)
+{
+	int	n;
+
+	if (c->fd < 0 || c->state == S_CONNECT || c->outlen == 0)
+		return;
+	n = write(c->fd, c->out, c->outlen);
+	if (n < 0)
+	    {
+		if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+		    {
+			close(c->fd);
+			c->fd = -1;
+			c->state = S_DEAD;
+			errors++;
+		    }
+		return;
+	    }
+	if (n < c->outlen)
+		memmove(c->out, c->out + n, c->outlen - n);
+	c->outlen -= n;
+}
+
+static	void	conn_open(aConn *c)
+{
+	struct	sockaddr_in sin;
+	struct	hostent *hp;
+	int	on = 1;
+
+	c->inlen = c->outlen = 0;
+	c->closing = 0;
+	c->joined = 0;
+	c->qsent = 0;
+	c->state = S_DEAD;
+	if ((c->fd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+	    {
+		perror("socket");
+		exit(1);
+	    }
+	(void)setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+	(void)fcntl(c->fd, F_SETFL, O_NONBLOCK);
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_port = htons(port);
+	if (inet_aton(host, &sin.sin_addr) == 0)
+	    {
+		if (!(hp = gethostbyname(host)))
+		    {
+			fprintf(stderr, "ircbench: unknown host %s\n", host);
+			exit(1);
+		    }
+		memcpy(&sin.sin_addr, hp->h_addr, sizeof(sin.sin_addr));
+	    }
+	if (connect(c->fd, (struct sockaddr *)&sin, sizeof(sin)) < 0 &&
+	    errno != EINPROGRESS)
+	    {
+		perror("connect");
+		exit(1);
+	    }
+	c->state = S_CONNECT;
+}
+
+/* PASS and SERVER of a fake link */
+static	void	link_register(aConn *c, char *info)
+{
+	sendf(c, "PASS %s 0211030000 IRC|aCEFJKMRTu P", linkpass);
+	sendf(c, "SERVER %s 1 %s :%s", c->nick, c->sid, info);
+}
+
+/* what is sent once connected, replayed connections have it already */
+static	void	conn_register(aConn *c)
+{
+	if (c->kind == C_CLIENT)
+	    {
+		sendf(c, "NICK %s", c->nick);
+		sendf(c, "USER %s 0 * :ircbench", prefix);
+	    }
+	else if (c->kind == C_LINK)
+		link_register(c, "ircbench");
+	c->state = (c->kind == C_REPLAY) ? S_UP : S_REG;
+}
+
+static	void	client_nick(aConn *c)
+{
+	if (c->nicks)
+		snprintf(c->nick, sizeof(c->nick), "%s%dn%d", prefix, c->idx,
+			 c->nicks);
+	else
+		snprintf(c->nick, sizeof(c->nick), "%s%d", prefix, c->idx);
+}
+
+/* the channels of a client, Zipf distributed, all different */
+static	void	client_channels(aConn *c, int n)
+{
+	int	i, j, ch, tries;
+
+	c->nchan = 0;
+	if (n > nchannels)
+		n = nchannels;
+	if (n > MAXJOIN)
+		n = MAXJOIN;
+	for (i = 0; i < n; i++)
+		for (tries = 0; tries < 100; tries++)
+		    {
+			ch = zipf();
+			for (j = 0; j < c->nchan; j++)
+				if (c->chan[j] == ch)
+					break;
+			if (j == c->nchan)
+			    {
+				c->chan[c->nchan++] = ch;
+				break;
+			    }
+		    }
+}
+
+static	void	client_join(aConn *c)
+{
+	int	i;
+
+	for (i = 0; i < c->nchan; i++)
+		sendf(c, "JOIN #%s%d", prefix, c->chan[i]);
+}
+
+/*
+** Line handling.
+*/
+
+/* what a scenario wants to know about */
+static	void	(*on_privmsg)(aConn *, char *) = NULL;
+static	void	(*on_numeric)(aConn *, int, char *) = NULL;
+static	void	(*on_link)(aConn *, char *, char *) = NULL;
+static	void	(*on_pong)(aConn *, char *) = NULL;
+static	unsigned long rclosed;	/* replayed connections closed by ircd */
+
+static	void	parse_line(aConn *c, char *line)
+{
+	char	*prefix_, *cmd, *rest, *p;
+
+	lines++;
+	prefix_ = NULL;
+	if (*line == ':')
+	    {
+		prefix_ = line + 1;
+		if (!(p = strchr(line, ' ')))
+			return;
+		*p++ = '\0';
+		line = p;
+	    }
+	cmd = line;
+	if ((p = strchr(line, ' ')))
+	    {
+		*p++ = '\0';
+		rest = p;
+	    }
+	else
+		rest = "";
+
+	if (!strcmp(cmd, "PING"))
+	    {
+		if (c->kind == C_LINK || c->sid[0])
+			sendf(c, ":%s PONG %s %s", c->sid, c->sid, rest);
+		else
+			sendf(c, "PONG %s", rest);
+		return;
+	    }
+	if (c->kind == C_REPLAY)
+	    {
+		/* what the replay gets back doesn't matter */
+		if (!strcmp(cmd, "ERROR"))
+		    {
+			close(c->fd);
+			c->fd = -1;
+			c->state = S_DEAD;
+			rclosed++;
+		    }
+		return;
+	    }
+	if (!strcmp(cmd, "ERROR"))
+	    {
+		fprintf(stderr, "ircbench: %s: ERROR %s\n", c->nick, rest);
+		close(c->fd);
+		c->fd = -1;
+		c->state = S_DEAD;
+		errors++;
+		return;
+	    }
+	if (c->kind == C_LINK)
+	    {
+		if (on_link)
+			on_link(c, prefix_, line);
+		else if (c->state == S_REG && !strcmp(cmd, "SERVER"))
+			c->state = S_BURST;
+		else if (c->state == S_BURST && !strcmp(cmd, "EOB") &&
+			 prefix_ && !strcmp(prefix_, ircdsid))
+			c->state = S_UP;
+		if (!strcmp(cmd, "SERVER") && !*ircdsid)
+		    {
+			/* SERVER name hopcount SID :info */
+			if ((p = strchr(rest, ' ')) &&
+			    (p = strchr(p + 1, ' ')))
+				strncpy(ircdsid, p + 1, 4);
+		    }
+		return;
+	    }
+	if (!strcmp(cmd, "PONG"))
+	    {
+		if (on_pong)
+			on_pong(c, rest);
+		return;
+	    }
+	if (!strcmp(cmd, "PRIVMSG"))
+	    {
+		delivered++;
+		if (on_privmsg && (p = strstr(rest, " :")))
+			on_privmsg(c, p + 2);
+		return;
+	    }
+	if (cmd[0] >= '0' && cmd[0] <= '9')
+	    {
+		int	num = atoi(cmd);
+
+		switch (num)
+		    {
+		case 1:
+			c->state = S_UP;
+			break;
+		case 366:
+			c->joined++;
+			break;
+		case 433: /* nick in use, someone left it there */
+			c->nicks++;
+			client_nick(c);
+			sendf(c, "NICK %s", c->nick);
+			break;
+		case 465: /* banned */
+		case 471: case 473: case 474: case 475:
+			errors++;
+			break;
+		    }
+		if (on_numeric)
+			on_numeric(c, num, rest);
+	    }
+}
+
+static	void	conn_read(aConn *c)
+{
+	char	*s, *e;
+	int	n;
+
+	n = read(c->fd, c->in + c->inlen, sizeof(c->in) - c->inlen - 1);
+	if (n <= 0)
+	    {
+		if (n < 0 && (errno == EAGAIN || errno == EINTR))
+			return;
+		if (c->state != S_DEAD && c->kind != C_REPLAY)
+			errors++;
+		else if (c->state != S_DEAD)
+			rclosed++;
+		close(c->fd);
+		c->fd = -1;
+		c->state = S_DEAD;
+		return;
+	    }
+	received += n;
+	c->inlen += n;
+	c->in[c->inlen] = '\0';
+	for (s = c->in; (e = strchr(s, '\n')); s = e + 1)
+	    {
+		*e = '\0';
+		if (e > s && e[-1] == '\r')
+			e[-1] = '\0';
+		parse_line(c, s);
+		if (c->fd < 0)
+			return;
+	    }
+	c->inlen -= s - c->in;
+	if (c->inlen == sizeof(c->in) - 1)
+		c->inlen = 0;	/* a line too long, forget it */
+	else if (c->inlen)
+		memmove(c->in, s, c->inlen);
+}
+
+/*
+** The loop: runs until deadline (usec) or until done() says so; tick()
+** is called at every turn.
+*/
+static	struct pollfd *pfds = NULL;
+static	int	*pidx = NULL;
+
+static	void	run(unsigned long long deadline, int (*done)(void),
+	void (*tick)(unsigned long long))
+{
+	unsigned long long now;
+	int	i, n, err;
+	socklen_t len;
+
+	if (!pfds)
+	    {
+		pfds = (struct pollfd *)malloc(nconns * sizeof(struct pollfd));
+		pidx = (int *)malloc(nconns * sizeof(int));
+	    }
+	while ((now = now_usec()) < deadline && !(done && done()))
+	    {
+		if (tick)
+			tick(now);
+		for (i = 0, n = 0; i < nconns; i++)
+		    {
+			if (conns[i].fd < 0)
+				continue;
+			conn_flush(&conns[i]);
+			if (conns[i].fd < 0)
+				continue;
+			if (conns[i].closing && !conns[i].outlen &&
+			    conns[i].state != S_CONNECT)
+			    {
+				close(conns[i].fd);
+				conns[i].fd = -1;
+				conns[i].state = S_DEAD;
+				continue;
+			    }
+			pfds[n].fd = conns[i].fd;
+			pfds[n].events = POLLIN;
+			if (conns[i].outlen || conns[i].state == S_CONNECT)
+				pfds[n].events |= POLLOUT;
+			pfds[n].revents = 0;
+			pidx[n++] = i;
+		    }
+		if (poll(pfds, n, tick ? 2 : 50) <= 0)
+			continue;
+		for (i = 0; i < n; i++)
+		    {
+			aConn	*c = &conns[pidx[i]];
+
+			if (!pfds[i].revents || c->fd < 0)
+				continue;
+			if (c->state == S_CONNECT)
+			    {
+				len = sizeof(err);
+				if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR,
+					       &err, &len) < 0 || err)
+				    {
+					fprintf(stderr, "ircbench: connect: "
+						"%s\n", strerror(err));
+					exit(1);
+				    }
+				conn_register(c);
+				continue;
+			    }
+			if (pfds[i].revents & (POLLIN|POLLHUP|POLLERR))
+				conn_read(c);
+			if (c->fd >= 0 && (pfds[i].revents & POLLOUT))
+				conn_flush(c);
+		    }
+	    }
+}
+
+/*
+** Setting up clients.
+*/
+static	int	want_joins;
+
+static	int	state_clients(int state)
+{
+	int	i, n;
+
+	for (i = 0, n = 0; i < nclients; i++)
+		if (conns[i].state == state)
+			n++;
+	return n;
+}
+
+static	int	clients_ready(void)
+{
+	int	i;
+
+	for (i = 0; i < nclients; i++)
+	    {
+		if (conns[i].state == S_DEAD)
+		    {
+			fprintf(stderr, "ircbench: %s lost during setup\n",
+				conns[i].nick);
+			exit(1);
+		    }
+		if (conns[i].state != S_UP ||
+		    (want_joins && conns[i].joined < conns[i].nchan))
+			return 0;
+	    }
+	return 1;
+}
+
+/* joined: whether the clients also join their channels */
+static	void	setup_clients(int joined)
+{
+	unsigned long long t = now_usec();
+	int	i, j;
+
+	for (i = 0; i < nclients; i++)
+	    {
+		aConn	*c = &conns[i];
+
+		client_nick(c);
+		client_channels(c, perclient);
+		conn_open(c);
+		/* don't hammer the listener, ircd accepts a few at once */
+		if (i % 50 == 49)
+			run(now_usec() + 20000, NULL, NULL);
+	    }
+	want_joins = 0;
+	run(t + SETUPTIMEOUT * 1000000ULL, clients_ready, NULL);
+	if (!clients_ready())
+	    {
+		fprintf(stderr, "ircbench: only %d of %d clients registered\n",
+			state_clients(S_UP), nclients);
+		exit(1);
+	    }
+	if (!joined)
+		return;
+	for (i = 0; i < nclients; i++)
+	    {
+		client_join(&conns[i]);
+		if (i % 50 == 49)
+			run(now_usec() + 20000, NULL, NULL);
+	    }
+	want_joins = 1;
+	run(now_usec() + SETUPTIMEOUT * 1000000ULL, clients_ready, NULL);
+	if (!clients_ready())
+	    {
+		for (i = 0, j = 0; i < nclients; i++)
+			j += conns[i].joined;
+		fprintf(stderr, "ircbench: clients did not join (%d joins)\n",
+			j);
+		exit(1);
+	    }
+	printf("setup: %d clients, %d channels in %.3f s\n", nclients,
+	       nchannels, (now_usec() - t) / 1e6);
+}
+
+/*
+** chat, flood: clients talk in their channels, change nick, quit.
+*/
+static	void	chat_privmsg(aConn *c, char *text)
+{
+	unsigned long long t;
+
+	if (sscanf(text, "B %llu", &t) == 1)
+		sample(now_usec() - t);
+}
+
+static	void	chat_tick(unsigned long long now)
+{
+	static	char	pad[512];
+	aConn	*c;
+	int	i;
+
+	if (!pad[0])
+		memset(pad, 'x', sizeof(pad) - 1);
+	for (i = 0; i < nclients; i++)
+	    {
+		c = &conns[i];
+		if (c->state == S_DEAD)
+		    {
+			/* quit earlier, back in */
+			c->nicks++;
+			client_nick(c);
+			conn_open(c);
+			continue;
+		    }
+		if (c->state != S_UP || now < c->next)
+			continue;
+		c->next = now + rnd_delay(rate + nickrate + quitrate);
+		if (rnd01() * (rate + nickrate + quitrate) < rate)
+		    {
+			char	stamp[64];
+			int	len;
+
+			if (c->nchan == 0)
+				continue;
+			len = sprintf(stamp, "B %llu %lu", now_usec(), sent);
+			sendf(c, "PRIVMSG #%s%d :%s %.*s", prefix,
+			      c->chan[rnd() % c->nchan], stamp,
+			      msglen > len ? msglen - len - 1 : 0, pad);
+			sent++;
+		    }
+		else if (rnd01() * (nickrate + quitrate) < nickrate)
+		    {
+			c->nicks++;
+			client_nick(c);
+			sendf(c, "NICK %s", c->nick);
+		    }
+		else
+		    {
+			sendf(c, "QUIT :ircbench");
+			conn_flush(c);
+			close(c->fd);
+			c->fd = -1;
+			c->state = S_DEAD;
+		    }
+	    }
+}
+
+/* joins after a reconnection */
+static	void	chat_numeric(aConn *c, int num, char *rest)
+{
+	if (num == 1)
+		client_join(c);
+}
+
+static	void	do_chat(void)
+{
+	double	secs;
+	int	i;
+
+	setup_clients(1);
+	on_privmsg = chat_privmsg;
+	on_numeric = chat_numeric;
+	for (i = 0; i < nclients; i++)
+		conns[i].next = now_usec() + rnd_delay(rate + nickrate +
+						       quitrate);
+	measure_start();
+	run(now_usec() + duration * 1000000ULL, NULL, chat_tick);
+	secs = measure_end();
+	printf("sent: %lu msgs, %.1f/s\n", sent, sent / secs);
+	printf("delivered: %lu msgs, %.1f/s\n", delivered, delivered / secs);
+	report_latency("delivery");
+}
+
+/*
+** massjoin: all the clients join the same channel at once.
+*/
+static	unsigned long long joinsent;
+
+static	void	massjoin_numeric(aConn *c, int num, char *rest)
+{
+	if (num == 366)
+		sample(now_usec() - joinsent);
+}
+
+static	int	massjoin_done(void)
+{
+	int	i;
+
+	for (i = 0; i < nclients; i++)
+		if (conns[i].joined < 1)
+			return 0;
+	return 1;
+}
+
+static	void	do_massjoin(void)
+{
+	double	secs;
+	int	i;
+
+	setup_clients(0);
+	on_numeric = massjoin_numeric;
+	measure_start();
+	joinsent = now_usec();
+	for (i = 0; i < nclients; i++)
+		sendf(&conns[i], "JOIN #%smass", prefix);
+	run(now_usec() + duration * 1000000ULL, massjoin_done, NULL);
+	secs = measure_end();
+	for (i = 0, queries = 0; i < nclients; i++)
+		queries += conns[i].joined;
+	printf("joined: %lu of %d, %.1f/s\n", queries, nclients,
+	       queries / secs);
+	printf("received: %lu lines, %.1f/s\n", lines, lines / secs);
+	report_latency("join");
+}
+
+/*
+** who, list: clients ask for WHO on one of their channels, or LIST,
+** and wait for the end of the reply before asking again.
+*/
+static	int	query_end;
+
+static	void	query_numeric(aConn *c, int num, char *rest)
+{
+	if (num != query_end || !c->qsent)
+		return;
+	sample(now_usec() - c->qsent);
+	c->qsent = 0;
+	queries++;
+}
+
+static	void	query_tick(unsigned long long now)
+{
+	aConn	*c;
+	int	i;
+
+	for (i = 0; i < nclients; i++)
+	    {
+		c = &conns[i];
+		if (c->state != S_UP || c->qsent || now < c->next)
+			continue;
+		c->next = now + rnd_delay(rate);
+		c->qsent = now;
+		if (query_end == 315)
+			sendf(c, "WHO #%s%d", prefix,
+			      c->chan[rnd() % c->nchan]);
+		else
+			sendf(c, "LIST");
+		sent++;
+	    }
+}
+
+static	void	do_query(void)
+{
+	double	secs;
+	int	i;
+
+	setup_clients(1);
+	on_numeric = query_numeric;
+	for (i = 0; i < nclients; i++)
+		conns[i].next = now_usec() + rnd_delay(rate);
+	measure_start();
+	run(now_usec() + duration * 1000000ULL, NULL, query_tick);
+	secs = measure_end();
+	printf("queries: %lu sent, %lu answered, %.1f/s\n", sent, queries,
+	       queries / secs);
+	printf("received: %lu lines, %.1f/s, %lu bytes\n", lines,
+	       lines / secs, received);
+	report_latency("answer");
+}
+
+/*
+** burst-in: fake servers link and burst users and channels to ircd.
+*/
+static	void	link_setup(aConn *c, int i)
+{
+	c->kind = C_LINK;
+	c->idx = i;
+	if (nlinks > 1)
+		snprintf(c->nick, sizeof(c->nick), "l%d.%s", i, linkname);
+	else
+		snprintf(c->nick, sizeof(c->nick), "%s", linkname);
+	if (strlen(linkname) + 4 >= sizeof(c->nick))
+	    {
+		fprintf(stderr, "ircbench: -N name too long\n");
+		exit(1);
+	    }
+	snprintf(c->sid, sizeof(c->sid), "9%02dB", i % 100);
+}
+
+/* base 36 UID of a burst user */
+static	void	mkuid(char *buf, char *sid, int n)
+{
+	static	char	b36[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+	int	i;
+
+	strcpy(buf, sid);
+	buf[4] = 'A' + (n / (36 * 36 * 36 * 36)) % 26;
+	for (i = 8; i > 4; i--, n /= 36)
+		buf[i] = b36[n % 36];
+	buf[9] = '\0';
+}
+
+static	int	links_state(int state)
+{
+	int	i;
+
+	for (i = nclients; i < nconns; i++)
+		if (conns[i].state != state)
+			return 0;
+	return 1;
+}
+
+static	int	links_burst(void)
+{
+	int	i;
+
+	for (i = nclients; i < nconns; i++)
+		if (conns[i].state == S_DEAD)
+		    {
+			fprintf(stderr, "ircbench: link %s lost\n",
+				conns[i].nick);
+			exit(1);
+		    }
+	return links_state(S_UP);
+}
+
+static	int	pongs;
+
+static	void	burstin_link(aConn *c, char *prefix_, char *line)
+{
+	if (c->state == S_REG && !strncmp(line, "SERVER", 6))
+		c->state = S_BURST;
+	else if (c->state == S_BURST && !strncmp(line, "EOB", 3) &&
+		 prefix_ && !strcmp(prefix_, ircdsid))
+		c->state = S_UP;
+	else if (c->state == S_UP && !strncmp(line, "PONG", 4))
+	    {
+		sample(now_usec() - mstart);
+		pongs++;
+	    }
+}
+
+static	int	burstin_done(void)
+{
+	links_burst();
+	return pongs == nlinks;
+}
+
+static	void	do_burstin(void)
+{
+	char	**members, uid[10];
+	int	*nmembers, l, u, ch, k, j;
+	unsigned long users = 0, bytes = 0;
+	double	secs;
+
+	on_link = burstin_link;
+	for (l = 0; l < nlinks; l++)
+		conn_open(&conns[nclients + l]);
+	run(now_usec() + SETUPTIMEOUT * 1000000ULL, links_burst, NULL);
+	if (!links_state(S_UP))
+	    {
+		fprintf(stderr, "ircbench: links did not come up\n");
+		exit(1);
+	    }
+
+	/* the burst, written in the buffers before the clock starts */
+	members = (char **)malloc(nchannels * sizeof(char *));
+	nmembers = (int *)malloc(nchannels * sizeof(int));
+	for (l = 0; l < nlinks; l++)
+	    {
+		aConn	*c = &conns[nclients + l];
+
+		for (ch = 0; ch < nchannels; ch++)
+		    {
+			members[ch] = (char *)malloc(burstusers * 11 + 1);
+			members[ch][0] = '\0';
+			nmembers[ch] = 0;
+		    }
+		for (u = 0; u < burstusers; u++)
+		    {
+			aConn	tmp;
+
+			mkuid(uid, c->sid, u);
+			sendf(c, ":%s UNICK %sl%du%d %s %s h%d.%s 10.%d.%d.%d "
+			      "+i :ircbench", c->sid, prefix, l, u, uid,
+			      prefix, u, linkname, l, (u >> 8) & 255, u & 255);
+			client_channels(&tmp, perclient);
+			for (k = 0; k < tmp.nchan; k++)
+			    {
+				ch = tmp.chan[k];
+				sprintf(members[ch] + strlen(members[ch]),
+					"%s%s%s", nmembers[ch] ? "," : "",
+					nmembers[ch] ? "" : "@", uid);
+				nmembers[ch]++;
+			    }
+		    }
+		for (ch = 0; ch < nchannels; ch++)
+		    {
+			char	*p = members[ch], *q;
+
+			/* NJOINBATCH members per line */
+			while (*p)
+			    {
+				for (q = p, j = 0; *q && j < NJOINBATCH; q++)
+					if (*q == ',')
+						j++;
+				if (*q)
+					q[-1] = '\0';
+				sendf(c, ":%s NJOIN #%s%d :%s", c->sid, prefix,
+				      ch, p);
+				p = q;
+			    }
+			free(members[ch]);
+		    }
+		sendf(c, ":%s EOB", c->sid);
+		sendf(c, "PING :%s", c->nick);
+		users += burstusers;
+		bytes += c->outlen;
+	    }
+	free(members);
+	free(nmembers);
+
+	pongs = 0;
+	measure_start();
+	run(now_usec() + duration * 1000000ULL, burstin_done, NULL);
+	secs = measure_end();
+	printf("burst: %d links, %lu users, %lu bytes\n", nlinks, users,
+	       bytes);
+	if (pongs < nlinks)
+		printf("burst: not done after %d s (%d of %d)\n", duration,
+		       pongs, nlinks);
+	else
+		printf("burst: %.1f users/s, %.1f kB/s\n", users / secs,
+		       bytes / 1024.0 / secs);
+	report_latency("burst");
+}
+
+/*
+** burst-out: with clients on, a fake server links, the time ircd takes
+** to send it all its burst is measured.
+*/
+static	int	burstout_done(void)
+{
+	return links_burst();
+}
+
+static	void	do_burstout(void)
+{
+	double	secs;
+
+	setup_clients(1);
+	measure_start();
+	conn_open(&conns[nclients]);
+	run(now_usec() + duration * 1000000ULL, burstout_done, NULL);
+	secs = measure_end();
+	if (!links_state(S_UP))
+		printf("burst: not done after %d s\n", duration);
+	printf("burst: %lu lines, %lu bytes, %.1f lines/s, %.1f kB/s\n",
+	       lines, received, lines / secs, received / 1024.0 / secs);
+}
+
+/*
+** replay: the connections of a capture are opened again and send what
+** was read from them, at the original pace (or as fast as possible with
+** -F).  The capture is cut in phases of -W seconds; at the end of each,
+** once everything is written, the control client (conns[0]) waits for
+** the answer to a PING, then the phase is reported.  Idle time between
+** phases is skipped.
+**
+** Clients which were already registered when the capture started are
+** registered again with their nick.  Server links are linked again as
+** fake links, with the captured name and SID and the -w password, and
+** end their (empty) burst at once; ircd answers what comes from users
+** and servers it never got with KILLs and SQUITs, which are ignored.
+** Services, and links of captures which do not have their SID, are left
+** out: their data is counted as skipped.
+*/
+static	char	*rbuf;			/* the capture */
+static	size_t	rlen, rpos;		/* rpos: next record */
+static	u_int	rbase;			/* smallest connection serial */
+static	int	*rmap;			/* serial - rbase: conns index */
+static	u_int	rmapsize;
+static	unsigned long long rstart, rend;	/* capture time span */
+static	unsigned long rrecords, ropened, rresumed, rlinked, rskipped, rlost;
+
+static	int	phase, rdone;
+static	unsigned long long pt0;		/* capture time the phase starts */
+static	unsigned long long pwall;	/* when it was started */
+static	unsigned long long psync;	/* sync PING sent (0: not yet) */
+static	long long pcpu;
+static	unsigned long precords, pbytes;
+
+/* the record at pos, 0 if there is none */
+static	int	rec_get(size_t pos, aCapRec *r)
+{
+	if (pos + sizeof(*r) > rlen)
+		return 0;
+	memcpy(r, rbuf + pos, sizeof(*r));
+	r->sec = ntohl(r->sec);
+	r->usec = ntohl(r->usec);
+	r->conn = ntohl(r->conn);
+	r->len = ntohs(r->len);
+	if (pos + sizeof(*r) + r->len > rlen)
+		return 0;
+	return 1;
+}
+
+static	unsigned long long	rec_time(aCapRec *r)
+{
+	return (unsigned long long)r->sec * 1000000 + r->usec;
+}
+
+/* reads the capture, returns the number of connections in it */
+static	int	replay_load(void)
+{
+	FILE	*fp;
+	aCapRec	r;
+	u_int	last = 0;
+	size_t	pos, size = 1 << 20, n;
+	int	nopen = 0;
+
+	if (!capfile || !(fp = fopen(capfile, "r")))
+	    {
+		fprintf(stderr, "ircbench: cannot read %s\n",
+			capfile ? capfile : "a capture (-f)");
+		exit(1);
+	    }
+	rbuf = (char *)malloc(size);
+	rlen = 0;
+	while ((n = fread(rbuf + rlen, 1, size - rlen, fp)) > 0)
+		if ((rlen += n) == size)
+			rbuf = (char *)realloc(rbuf, size *= 2);
+	fclose(fp);
+	if (rlen < sizeof(aCapHead) ||
+	    memcmp(rbuf, CAPTURE_MAGIC, strlen(CAPTURE_MAGIC)))
+	    {
+		fprintf(stderr, "ircbench: %s is not a capture\n", capfile);
+		exit(1);
+	    }
+	rbase = ~0;
+	for (pos = sizeof(aCapHead); rec_get(pos, &r);
+	     pos += sizeof(r) + r.len)
+	    {
+		if (r.type == CAP_OPEN)
+		    {
+			if (r.conn < rbase)
+				rbase = r.conn;
+			if (r.conn > last)
+				last = r.conn;
+			nopen++;
+		    }
+		if (!rrecords++)
+			rstart = rec_time(&r);
+		rend = rec_time(&r);
+	    }
+	if (pos != rlen)
+		fprintf(stderr, "ircbench: %s: truncated, %lu bytes ignored\n",
+			capfile, (unsigned long)(rlen - pos));
+	rlen = pos;
+	if (!nopen)
+	    {
+		fprintf(stderr, "ircbench: %s: no connection\n", capfile);
+		exit(1);
+	    }
+	rmapsize = last - rbase + 1;
+	rmap = (int *)calloc(rmapsize, sizeof(int));
+	nopen = 0;
+	for (pos = sizeof(aCapHead); rec_get(pos, &r);
+	     pos += sizeof(r) + r.len)
+		if (r.type == CAP_OPEN)
+			rmap[r.conn - rbase] = 1 + nopen++;
+	return nopen;
+}
+
+static	void	replay_record(aCapRec *r, char *data)
+{
+	char	info[256], name[64], user[64];
+	aConn	*c;
+
+	precords++;
+	pbytes += r->len;
+	if (r->conn < rbase || r->conn - rbase >= rmapsize ||
+	    !rmap[r->conn - rbase])
+		return;
+	c = &conns[rmap[r->conn - rbase]];
+	switch (r->type)
+	    {
+	case CAP_OPEN:
+		/* "ip port name user [sid]" */
+		snprintf(info, sizeof(info), "%.*s", (int)r->len, data);
+		if ((r->kind != CAPK_NEW && r->kind != CAPK_CLIENT &&
+		     r->kind != CAPK_SERVER) || (r->kind == CAPK_SERVER &&
+		     sscanf(info, "%*s %*s %63s %*s %4s", name, c->sid) != 2))
+		    {
+			c->nicks = 1;	/* not replayed */
+			break;
+		    }
+		conn_open(c);
+		ropened++;
+		if (r->kind == CAPK_SERVER)
+		    {
+			strcpy(c->nick, name);
+			link_register(c, "ircbench replay");
+			sendf(c, ":%s EOB", c->sid);
+			rlinked++;
+		    }
+		else if (r->kind == CAPK_CLIENT)
+		    {
+			if (sscanf(info, "%*s %*s %63s %63s", name, user) == 2)
+			    {
+				sendf(c, "NICK %s", name);
+				/* without the ~ ircd added */
+				sendf(c, "USER %s 0 * :ircbench replay",
+				      user + (user[0] == '~' && user[1]));
+			    }
+			rresumed++;
+		    }
+		break;
+	case CAP_DATA:
+		if (c->nicks)
+			rskipped += r->len;
+		else if (c->fd < 0)
+			rlost += r->len;
+		else
+			conn_write(c, data, r->len);
+		break;
+	case CAP_CLOSE:
+		c->closing = 1;
+		break;
+	    }
+}
+
+static	void	phase_start(unsigned long long now)
+{
+	aCapRec	r;
+
+	if (!rec_get(rpos, &r))
+	    {
+		rdone = 1;
+		return;
+	    }
+	/* skip idle phases */
+	phase = (rec_time(&r) - rstart) / (window * 1000000ULL);
+	pt0 = rstart + phase * window * 1000000ULL;
+	pwall = now;
+	psync = 0;
+	pcpu = ircd_cpu();
+	precords = pbytes = 0;
+}
+
+static	void	replay_tick(unsigned long long now)
+{
+	aCapRec	r;
+	int	i;
+
+	if (psync)
+	    {
+		if (now - psync > SETUPTIMEOUT * 1000000ULL)
+		    {
+			fprintf(stderr, "ircbench: no answer to the sync of "
+				"phase %d\n", phase);
+			exit(1);
+		    }
+		return;
+	    }
+	while (rec_get(rpos, &r))
+	    {
+		if (rec_time(&r) >= pt0 + window * 1000000ULL)
+			break;
+		if (!fastreplay && rec_time(&r) - pt0 > now - pwall)
+			return;
+		replay_record(&r, rbuf + rpos + sizeof(r));
+		rpos += sizeof(r) + r.len;
+	    }
+	/* all of the phase is out, wait for it to be written */
+	for (i = 1; i < nconns; i++)
+		if (conns[i].fd >= 0 &&
+		    (conns[i].outlen || conns[i].state == S_CONNECT))
+			return;
+	sendf(&conns[0], "PING :sync%d", phase);
+	psync = now;
+}
+
+static	void	replay_pong(aConn *c, char *rest)
+{
+	char	tag[32];
+	unsigned long long now = now_usec();
+	long long cpu = ircd_cpu();
+
+	sprintf(tag, "sync%d", phase);
+	if (c != &conns[0] || !psync || !strstr(rest, tag))
+		return;
+	printf("phase %4d +%5ds: %7lu records %9.1f kB, wall %7.3f s, "
+	       "sync %7.3f ms", phase, phase * window, precords,
+	       pbytes / 1024.0, (now - pwall) / 1e6, (now - psync) / 1e3);
+	if (pcpu >= 0 && cpu >= 0)
+		printf(", ircd cpu %.3f s", (cpu - pcpu) / 1e6);
+	printf("\n");
+	fflush(stdout);
+	phase_start(now);
+}
+
+static	int	replay_done(void)
+{
+	return rdone;
+}
+
+static	void	do_replay(void)
+{
+	double	secs;
+
+	setup_clients(0);
+	on_pong = replay_pong;
+	rpos = sizeof(aCapHead);
+	measure_start();
+	phase_start(now_usec());
+	run(~0ULL, replay_done, replay_tick);
+	secs = measure_end();
+	printf("replay: %lu records, %.3f s captured, %.3f s replayed\n",
+	       rrecords, (rend - rstart) / 1e6, secs);
+	printf("connections: %lu opened (%lu clients resumed, %lu links), "
+	       "%lu closed by ircd\n", ropened, rresumed, rlinked, rclosed);
+	if (rskipped || rlost)
+		printf("bytes not replayed: %lu skipped (services, links "
+		       "without SID), %lu after ircd closed\n", rskipped,
+		       rlost);
+}
+
+int	main(int argc, char *argv[])
+{
+	struct	rlimit rl;
+	int	c, i;
+
+	while ((c = getopt(argc, argv, "h:p:P:c:C:j:z:r:m:n:q:t:L:U:N:w:x:s:f:FW:"))
+	       != -1)
+		switch (c)
+		    {
+		case 'h': host = optarg; break;
+		case 'p': port = atoi(optarg); break;
+		case 'P': pidarg = optarg; break;
+		case 'c': nclients = atoi(optarg); break;
+		case 'C': nchannels = atoi(optarg); break;
+		case 'j': perclient = atoi(optarg); break;
+		case 'z': zipf_s = atof(optarg); break;
+		case 'r': rate = atof(optarg); break;
+		case 'm': msglen = atoi(optarg); break;
+		case 'n': nickrate = atof(optarg); break;
+		case 'q': quitrate = atof(optarg); break;
+		case 't': duration = atoi(optarg); break;
+		case 'L': nlinks = atoi(optarg); break;
+		case 'U': burstusers = atoi(optarg); break;
+		case 'N': linkname = optarg; break;
+		case 'w': linkpass = optarg; break;
+		case 'x': prefix = optarg; break;
+		case 's': seed = strtoull(optarg, NULL, 10); break;
+		case 'f': capfile = optarg; break;
+		case 'F': fastreplay = 1; break;
+		case 'W': window = atoi(optarg); break;
+		default: usage();
+		    }
+	if (optind < argc)
+		scenario = argv[optind];
+	if (!strcmp(scenario, "flood"))
+	    {
+		/* everyone in one channel */
+		nchannels = 1;
+		perclient = 1;
+	    }
+	if (nclients < 0 || nchannels < 1 || perclient < 0 || nlinks < 1 ||
+	    nlinks > 99 || burstusers < 1 || duration < 1 || msglen > 400 ||
+	    strlen(prefix) > 5 || window < 1)
+		usage();
+	if (strcmp(scenario, "chat") && strcmp(scenario, "flood") &&
+	    strcmp(scenario, "massjoin") && strcmp(scenario, "who") &&
+	    strcmp(scenario, "list") && strcmp(scenario, "burst-in") &&
+	    strcmp(scenario, "burst-out") && strcmp(scenario, "replay"))
+		usage();
+
+	/* enough descriptors for everyone */
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0)
+	    {
+		rl.rlim_cur = rl.rlim_max;
+		(void)setrlimit(RLIMIT_NOFILE, &rl);
+	    }
+	(void)signal(SIGPIPE, SIG_IGN);
+	rng = seed ? seed : 1;
+	zipf_init();
+	samples = (unsigned int *)malloc(MAXSAMPLES * sizeof(unsigned int));
+	ircd_find();
+
+	if (!strcmp(scenario, "burst-in"))
+		nclients = 0;
+	else if (!strcmp(scenario, "replay"))
+	    {
+		/* the control client, then the replayed connections */
+		nclients = 1;
+		nlinks = replay_load();
+	    }
+	else if (!strcmp(scenario, "burst-out"))
+		nlinks = 1;
+	else
+		nlinks = 0;
+	nconns = nclients + nlinks;
+	conns = (aConn *)calloc(nconns, sizeof(aConn));
+	for (i = 0; i < nconns; i++)
+	    {
+		conns[i].fd = -1;
+		conns[i].idx = i;
+		conns[i].outsize = 4096;
+		conns[i].out = (char *)malloc(conns[i].outsize);
+		if (i >= nclients && strcmp(scenario, "replay"))
+			link_setup(&conns[i], i - nclients);
+		else if (i >= nclients)
+		    {
+			conns[i].kind = C_REPLAY;
+			sprintf(conns[i].nick, "replay%d", i);
+		    }
+	    }
+
+	printf("scenario: %s\n", scenario);
+	if (!strcmp(scenario, "replay"))
+		printf("options: -f %s -W %d%s (%d connections)\n", capfile,
+		       window, fastreplay ? " -F" : "", nlinks);
+	else
+		printf("options: -c %d -C %d -j %d -z %.2f -r %.2f -m %d "
+		       "-n %.2f -q %.2f -t %d -L %d -U %d -s %llu\n", nclients,
+		       nchannels, perclient, zipf_s, rate, msglen, nickrate,
+		       quitrate, duration, nlinks, burstusers, seed);
+	if (ircdpid <= 0)
+		printf("ircd pid: unknown, no CPU nor memory figures\n");
+	fflush(stdout);
+
+	if (!strcmp(scenario, "chat") || !strcmp(scenario, "flood"))
+		do_chat();
+	else if (!strcmp(scenario, "massjoin"))
+		do_massjoin();
+	else if (!strcmp(scenario, "who"))
+	    {
+		query_end = 315;
+		do_query();
+	    }
+	else if (!strcmp(scenario, "list"))
+	    {
+		query_end = 323;
+		do_query();
+	    }
+	else if (!strcmp(scenario, "burst-in"))
+		do_burstin();
+	else if (!strcmp(scenario, "replay"))
+		do_replay();
+	else
+		do_burstout();
+	return errors ? 1 : 0;
+}
@@ -0,0 +1,237 @@
+/************************************************************************
+ *   IRC - Internet Relay Chat, contrib/ircdtrace/ircdtrace.c
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 1, or (at your option)
+ *   any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * ircdtrace: decodes a trace ring dump made by ircd (SET TRACE DUMP, see
+ * ircd/s_trace.c), one event per line, oldest first.  The dump carries
+ * the names of its events and commands, see s_trace_def.h.
+ */
+
+#ifndef lint
+static const volatile char rcsid[] = "@(#)$Id$";
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+
+#include "s_trace_def.h"
+
+#define	MAXEVENT	256
+#define	MAXCMD		512
+#define	MAXARGS		3
+
+static	struct	{
+	char	*cat, *name;
+	char	*args[MAXARGS];
+	unsigned long count;
+} events[MAXEVENT];
+static	char	*cmds[MAXCMD];
+static	int	ncmds = 0;
+
+/* options */
+static	char	*catsel = NULL, *evsel = NULL;
+static	int	fdsel = -2, relative = 0, summary = 0;
+
+static	void	usage(void)
+{
+	fprintf(stderr,
+"usage: ircdtrace [-c cat,...] [-e event,...] [-f fd] [-r] [-s] dumpfile\n"
+"  -c cats      only these categories (CONN, PARSE, SEND, MEM)\n"
+"  -e events    only these events (accept, parse...)\n"
+"  -f fd        only this descriptor\n"
+"  -r           times relative to the first event\n"
+"  -s           count of each event at the end\n");
+	exit(2);
+}
+
+/* whether word is in the comma separated list */
+static	int	inlist(char *list, char *word)
+{
+	size_t	len = strlen(word);
+	char	*p;
+
+	for (p = list; p; p = strchr(p, ','))
+	    {
+		if (*p == ',')
+			p++;
+		if (!strncasecmp(p, word, len) &&
+		    (p[len] == ',' || p[len] == '\0'))
+			return 1;
+	    }
+	return 0;
+}
+
+/* the event and command tables */
+static	void	read_tables(char *buf)
+{
+	char	*line, *next, *p;
+	int	ev, i, cmdpart = 0;
+
+	for (line = buf; *line; line = next)
+	    {
+		if (!(next = strchr(line, '\n')))
+			break;
+		*next++ = '\0';
+		if (!strcmp(line, "-"))
+		    {
+			cmdpart = 1;
+			continue;
+		    }
+		if (cmdpart)
+		    {
+			if (ncmds < MAXCMD)
+				cmds[ncmds++] = line;
+			continue;
+		    }
+		/* "event category name args..." */
+		ev = atoi(line);
+		if (ev <= 0 || ev >= MAXEVENT || !(p = strchr(line, ' ')))
+			continue;
+		events[ev].cat = strtok(p + 1, " ");
+		events[ev].name = strtok(NULL, " ");
+		for (i = 0; i < MAXARGS; i++)
+			events[ev].args[i] = strtok(NULL, " ");
+	    }
+}
+
+static	void	print_arg(char *desc, int val)
+{
+	char	*type = strchr(desc, ':');
+	int	len = type ? type - desc : (int)strlen(desc);
+
+	printf(" %.*s=", len, desc);
+	if (type && type[1] == 'c')
+		printf("%c", (val > ' ' && val < 127) ? val : '-');
+	else if (type && type[1] == 'm' && val >= 0 && val < ncmds)
+		printf("%s", cmds[val]);
+	else
+		printf("%d", val);
+}
+
+int	main(int argc, char *argv[])
+{
+	aTraceHead head;
+	aTraceRec rec;
+	unsigned long long t, first = 0, last = 0;
+	unsigned long shown = 0;
+	char	*tables, tbuf[64];
+	time_t	when;
+	FILE	*fp;
+	u_int	n, len;
+	int	c, i;
+
+	while ((c = getopt(argc, argv, "c:e:f:rs")) != -1)
+		switch (c)
+		    {
+		case 'c': catsel = optarg; break;
+		case 'e': evsel = optarg; break;
+		case 'f': fdsel = atoi(optarg); break;
+		case 'r': relative = 1; break;
+		case 's': summary = 1; break;
+		default: usage();
+		    }
+	if (optind != argc - 1)
+		usage();
+	if (!(fp = fopen(argv[optind], "r")))
+	    {
+		perror(argv[optind]);
+		exit(1);
+	    }
+	if (fread(&head, sizeof(head), 1, fp) != 1 ||
+	    memcmp(head.magic, TRACE_MAGIC, strlen(TRACE_MAGIC)))
+	    {
+		fprintf(stderr, "ircdtrace: %s is not a trace dump\n",
+			argv[optind]);
+		exit(1);
+	    }
+	len = ntohl(head.tables);
+	tables = (char *)malloc(len + 1);
+	if (fread(tables, 1, len, fp) != len)
+	    {
+		fprintf(stderr, "ircdtrace: %s: truncated\n", argv[optind]);
+		exit(1);
+	    }
+	tables[len] = '\0';
+	read_tables(tables);
+
+	when = (time_t)ntohl(head.dumped);
+	strftime(tbuf, sizeof(tbuf), "%Y-%m-%d %H:%M:%S", localtime(&when));
+	printf("# dumped %s, %u events, %u older ones lost\n", tbuf,
+	       ntohl(head.records), ntohl(head.lost));
+	for (n = 0; n < ntohl(head.records); n++)
+	    {
+		if (fread(&rec, sizeof(rec), 1, fp) != 1)
+		    {
+			fprintf(stderr, "ircdtrace: %s: truncated\n",
+				argv[optind]);
+			break;
+		    }
+		rec.sec = ntohl(rec.sec);
+		rec.usec = ntohl(rec.usec);
+		rec.event = ntohs(rec.event);
+		rec.fd = (short)ntohs(rec.fd);
+		for (i = 0; i < MAXARGS; i++)
+			rec.arg[i] = (int)ntohl(rec.arg[i]);
+		t = (unsigned long long)rec.sec * 1000000 + rec.usec;
+		if (!first)
+			first = last = t;
+		if (rec.event >= MAXEVENT || !events[rec.event].name)
+		    {
+			printf("unknown event %u\n", rec.event);
+			continue;
+		    }
+		if ((catsel && !inlist(catsel, events[rec.event].cat)) ||
+		    (evsel && !inlist(evsel, events[rec.event].name)) ||
+		    (fdsel != -2 && rec.fd != fdsel))
+			continue;
+		events[rec.event].count++;
+		shown++;
+		if (relative)
+			printf("%12.6f", (t - first) / 1e6);
+		else
+		    {
+			when = (time_t)rec.sec;
+			strftime(tbuf, sizeof(tbuf), "%H:%M:%S",
+				 localtime(&when));
+			printf("%s.%06u", tbuf, rec.usec);
+		    }
+		printf(" %+10.6f %-15s fd %3d", (t - last) / 1e6,
+		       events[rec.event].name, rec.fd);
+		for (i = 0; i < MAXARGS && events[rec.event].args[i]; i++)
+			print_arg(events[rec.event].args[i], rec.arg[i]);
+		printf("\n");
+		last = t;
+	    }
+	fclose(fp);
+	if (summary)
+	    {
+		printf("# %lu events shown, %.6f s\n", shown,
+		       (last - first) / 1e6);
+		for (i = 0; i < MAXEVENT; i++)
+			if (events[i].count)
+				printf("# %-15s %lu\n", events[i].name,
+				       events[i].count);
+	    }
+	return 0;
+}
@@ -32,6 +32,12 @@ static const volatile char rcsid[] = "@(#)$Id: ircdwatch.c,v 1.10 2004/10/02 01:
 #include "os.h"
 #include "config.h"
 
+#if defined(__linux__) && (defined(IRCDWATCH_HUP_ON_CONFIG_CHANGE) || \
+    defined(IRCDWATCH_UPGRADE_ON_BINARY_CHANGE))
+# include <sys/inotify.h>
+# define IRCDWATCH_INOTIFY
+#endif
+
 /* 
  * Try and find the correct name to use with getrlimit() for setting
  * the max.  number of files allowed to be open by this process. 
@@ -54,7 +60,16 @@ static const volatile char rcsid[] = "@(#)$Id: ircdwatch.c,v 1.10 2004/10/02 01:
 #define PID_LEN 7 /* overkill, but hey */
 #define MAX_OPEN_FILEDESCRIPTORS_WILD_GUESS 256
 
+/* let a file being written settle before acting on it */
+#define SETTLE_DELAY 2
+
 static int want_to_quit = 0;
+static int sigpipe[2] = { -1, -1 };   /* signals wake up select() */
+static pid_t ircd_pid = 0;            /* the ircd we watch, 0 if none */
+static int pid_fd = -1;               /* pidfd for it, if not our child */
+static time_t ircd_started = 0;
+static time_t respawn_at = 0;
+static int backoff = 0;
 
 static void finalize(int i)
 {
@@ -119,19 +134,21 @@ static int daemonize(void)
 
 static void sig_handler (int signo) 
 {
+  int saved_errno = errno;
+
   if (signo == SIGHUP) {
     want_to_quit = 1;
-    return;
   }
 
-  if (signo == SIGALRM) {
-
 #ifndef POSIX_SIGNALS
-    (void)signal(SIGALRM, &sig_handler);
+  (void)signal(signo, &sig_handler);
 #endif
 
-    return;
+  /* whatever it is, the main loop has something to look at */
+  if (sigpipe[1] >= 0) {
+    (void)write(sigpipe[1], "", 1);
   }
+  errno = saved_errno;
 }
 
 
@@ -148,19 +165,15 @@ static void set_up_signals(void)
     perror("sigaction");
   }
 
-  if (sigaction(SIGALRM, &act, NULL) < 0) {
+  if (sigaction(SIGCHLD, &act, NULL) < 0) {
     perror("sigaction");
   }
 #else
   (void)signal(SIGHUP, &sig_handler);
-  (void)signal(SIGALRM, &sig_handler);
+  (void)signal(SIGCHLD, &sig_handler);
 #endif
-
-  /* ignore it if child processes die */
-  signal(SIGCHLD, SIG_IGN);
 }
 
-#if 0 /* seems unused */
 static int write_my_pid(void)
 {
   FILE *f;
@@ -175,10 +188,10 @@ static int write_my_pid(void)
 
   return(0);
 }
-#endif
 
 
-#ifdef IRCDWATCH_HUP_ON_CONFIG_CHANGE
+#if defined(IRCDWATCH_HUP_ON_CONFIG_CHANGE) || \
+    defined(IRCDWATCH_UPGRADE_ON_BINARY_CHANGE)
 static int file_modified(char *s)
 {
   struct stat st;
@@ -191,9 +204,14 @@ static int file_modified(char *s)
 
 #endif
 
-static int spawn (char *cmd) 
+/*
+ * ircd is started with /dev/null as stdin: without a tty it does not
+ * fork, and stays our child so that we know at once when it exits.
+ */
+static pid_t spawn (char *cmd) 
 {
   pid_t pid;
+  int fd;
 
   pid = fork();
 
@@ -205,10 +223,17 @@ static int spawn (char *cmd)
   }
 
   if (pid == 0) {
-    execl("/bin/sh", "sh", "-c", cmd, (char *) NULL);
+    (void)setsid();
+    if ((fd = open("/dev/null", O_RDWR)) >= 0) {
+      (void)dup2(fd, 0);
+      if (fd > 2) {
+	close(fd);
+      }
+    }
+    execl(cmd, cmd, (char *) NULL);
     _exit(127);
   }
-  return(0);
+  return(pid);
 }
 
 static int read_pid(char *pid_filename) 
@@ -313,33 +338,220 @@ static int ircd_running (void)
 }
 
 #ifdef IRCDWATCH_HUP_ON_CONFIG_CHANGE
+/*
+ * the new ircd.conf is checked with chkconf first, ircd is only told
+ * to reload it if there was no error.
+ */
 static void hup_ircd (void)
 {
+  pid_t pid;
+  int status, fd;
+
+  pid = fork();
+  if (pid == -1) {
+    return;
+  }
+  if (pid == 0) {
+    if ((fd = open("/dev/null", O_RDWR)) >= 0) {
+      (void)dup2(fd, 0);
+      (void)dup2(fd, 1);
+      (void)dup2(fd, 2);
+    }
+    execl(CHKCONF_PATH, CHKCONF_PATH, IRCDCONF_PATH, (char *) NULL);
+    _exit(127);
+  }
+  while (waitpid(pid, &status, 0) < 0) {
+    if (errno != EINTR) {
+      return;
+    }
+  }
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+#ifdef IRCDWATCH_USE_SYSLOG
+    syslog(LOG_ERR, "config changed, but chkconf found errors, not HUPing ircd");
+#endif
+    return;
+  }
+
+  if (ircd_pid > 0 && kill(ircd_pid, SIGHUP) < 0 && errno == EPERM) {
+#ifdef IRCDWATCH_USE_SYSLOG
+    syslog(LOG_ERR, "not allowed to send SIGHUP to ircd");
+#endif
+    finalize(1);
+  }
+
+#ifdef IRCDWATCH_USE_SYSLOG
+  syslog(LOG_NOTICE, "config change, HUPing ircd");
+#endif
+}
+#endif
+
+#ifdef IRCDWATCH_UPGRADE_ON_BINARY_CHANGE
+/*
+ * a new binary was installed: SIGUSR2 makes ircd hand its connections
+ * over to it (see RESTART UPGRADE), the new pid shows in ircd.pid.
+ */
+static void upgrade_ircd (void)
+{
+  if (ircd_pid <= 0 || !file_executable(IRCD_PATH)) {
+    return;
+  }
+  if (kill(ircd_pid, SIGUSR2) == 0) {
+#ifdef IRCDWATCH_USE_SYSLOG
+    syslog(LOG_NOTICE, "%s changed, upgrading ircd", IRCD_PATH);
+#endif
+  }
+}
+#endif
+
+/*
+ * start watching pid: waitpid() tells when our own child exits, a
+ * pidfd (or else polling) is used for an ircd we did not start.
+ */
+static void watch_ircd (pid_t pid, int child)
+{
+  if (pid_fd >= 0) {
+    close(pid_fd);
+    pid_fd = -1;
+  }
+  ircd_pid = pid;
+  ircd_started = time(NULL);
+#if defined(__linux__) && defined(SYS_pidfd_open)
+  if (!child) {
+    pid_fd = syscall(SYS_pidfd_open, pid, 0);
+  }
+#endif
+}
+
+/*
+ * ircd is gone: either it was upgraded and a new one runs already, or
+ * it has to be started again.  Quick deaths in a row make us wait
+ * longer and longer before doing so.
+ */
+static void ircd_gone (int status)
+{
+  time_t now = time(NULL);
   int pid;
-  int res;
-  
-  if (file_exists(IRCDPID_PATH)) {
-    pid = read_pid(IRCDPID_PATH);
-    if (pid > 0) {
-      res = kill(pid, SIGHUP);
-      if (res < 0 && errno == EPERM) {
+
+  if (pid_fd >= 0) {
+    close(pid_fd);
+    pid_fd = -1;
+  }
+  pid = read_pid(IRCDPID_PATH);
+  if (pid > 0 && pid != ircd_pid && verify_pid(pid)) {
 #ifdef IRCDWATCH_USE_SYSLOG
-	syslog(LOG_ERR, "not allowed to send SIGHUP to ircd");
+    syslog(LOG_NOTICE, "ircd upgraded, now running as pid %d", pid);
 #endif
-	finalize(1);
-      }
-    }
+    watch_ircd(pid, 0);
+    return;
+  }
+
+#ifdef IRCDWATCH_USE_SYSLOG
+  if (status == -1) {
+    syslog(LOG_ERR, "ircd (pid %d) is gone", (int) ircd_pid);
+  } else if (WIFSIGNALED(status)) {
+    syslog(LOG_ERR, "ircd (pid %d) killed by signal %d",
+	   (int) ircd_pid, WTERMSIG(status));
+  } else {
+    syslog(LOG_ERR, "ircd (pid %d) exited with status %d",
+	   (int) ircd_pid, WEXITSTATUS(status));
+  }
+#endif
+  ircd_pid = 0;
+  if (now - ircd_started >= IRCDWATCH_STABLE_TIME) {
+    backoff = 0;
+  } else if (backoff == 0) {
+    backoff = 1;
+  } else if ((backoff *= 2) > IRCDWATCH_MAX_BACKOFF) {
+    backoff = IRCDWATCH_MAX_BACKOFF;
+  }
+  respawn_at = now + backoff;
+  if (backoff) {
+#ifdef IRCDWATCH_USE_SYSLOG
+    syslog(LOG_ERR, "restart storm, waiting %d seconds", backoff);
+#endif
+  }
+}
+
+static void respawn_ircd (void)
+{
+  pid_t pid;
+  int i;
+
+  /* someone may have started it meanwhile */
+  i = ircd_running();
+  if (i == 1 && (pid = read_pid(IRCDPID_PATH)) > 0) {
+    watch_ircd(pid, 0);
+    return;
+  }
+
+#ifdef IRCDWATCH_USE_SYSLOG
+  syslog(LOG_ERR, "spawning %s", IRCD_PATH);
+#endif
+
+  if ((pid = spawn(IRCD_PATH)) > 0) {
+    watch_ircd(pid, 1);
+  } else {
+    respawn_at = time(NULL) + IRCDWATCH_POLLING_INTERVAL;
   }
 }
+
+#ifdef IRCDWATCH_INOTIFY
+/*
+ * watch the directories: editors and install(1) replace files.
+ */
+static int set_up_inotify (void)
+{
+  char dir[1024], *p;
+  int fd;
+
+  if ((fd = inotify_init()) < 0) {
+    return(-1);
+  }
+#ifdef IRCDWATCH_HUP_ON_CONFIG_CHANGE
+  strncpy(dir, IRCDCONF_PATH, sizeof(dir) - 1);
+  dir[sizeof(dir) - 1] = '\0';
+  if ((p = strrchr(dir, '/'))) {
+    *p = '\0';
+  }
+  (void)inotify_add_watch(fd, dir, IN_CLOSE_WRITE|IN_MOVED_TO);
+#endif
+#ifdef IRCDWATCH_UPGRADE_ON_BINARY_CHANGE
+  strncpy(dir, IRCD_PATH, sizeof(dir) - 1);
+  dir[sizeof(dir) - 1] = '\0';
+  if ((p = strrchr(dir, '/'))) {
+    *p = '\0';
+  }
+  (void)inotify_add_watch(fd, dir, IN_CLOSE_WRITE|IN_MOVED_TO);
 #endif
+  return(fd);
+}
+
+static char *basename_of (char *path)
+{
+  char *p = strrchr(path, '/');
 
+  return(p ? p + 1 : path);
+}
+#endif
 
 static void daemon_run (void) 
 {
   int i;
+  pid_t pid;
+  int status;
+  time_t now;
+  time_t conf_at = 0, bin_at = 0;      /* pending changes */
+  int inotify_fd = -1;
 #ifdef IRCDWATCH_HUP_ON_CONFIG_CHANGE
-  int last_config_time = 0;
+  int last_config_time;
+#endif
+#ifdef IRCDWATCH_UPGRADE_ON_BINARY_CHANGE
+  int last_binary_time;
 #endif
+  char buf[4096];
+  fd_set rfds;
+  struct timeval tv;
+  int maxfd, wait;
 
   /* is ircdwatch already running? */
   i = ircdwatch_running();
@@ -352,6 +564,14 @@ static void daemon_run (void)
     exit(0);
   }
 
+  if (pipe(sigpipe) < 0) {
+    perror("pipe");
+    exit(1);
+  }
+  (void)fcntl(sigpipe[0], F_SETFL, O_NONBLOCK);
+  (void)fcntl(sigpipe[1], F_SETFL, O_NONBLOCK);
+  set_up_signals();
+
   /* is ircd running? */
   i = ircd_running();
   if (i == -1) {
@@ -362,7 +582,9 @@ static void daemon_run (void)
     fprintf(stderr, "ircd not running. attempting to start ircd...\n");
     if (file_exists(IRCD_PATH)) {
       if (file_executable(IRCD_PATH)) {
-	spawn(IRCD_PATH);
+	if ((pid = spawn(IRCD_PATH)) > 0) {
+	  watch_ircd(pid, 1);
+	}
       } else {
 	fprintf(stderr, "%s not executable\n", IRCD_PATH);
 	exit(1);
@@ -371,11 +593,13 @@ static void daemon_run (void)
       fprintf(stderr, "%s does not exist\n", IRCD_PATH);
       exit(1);      
     }
+  } else {
+    watch_ircd(read_pid(IRCDPID_PATH), 0);
   }
 
-  set_up_signals();
   closelog();
   /*  daemonize(); */
+  (void)write_my_pid();
 
 #ifdef IRCDWATCH_USE_SYSLOG
   openlog(IRCDWATCH_SYSLOG_IDENT, 
@@ -385,41 +609,132 @@ static void daemon_run (void)
   syslog(LOG_NOTICE, "starting ircdwatch daemon");
 #endif
 
-  alarm(IRCDWATCH_POLLING_INTERVAL);
-  pause();
+#ifdef IRCDWATCH_INOTIFY
+  inotify_fd = set_up_inotify();
+#endif
+#ifdef IRCDWATCH_HUP_ON_CONFIG_CHANGE
+  last_config_time = file_modified(IRCDCONF_PATH);
+#endif
+#ifdef IRCDWATCH_UPGRADE_ON_BINARY_CHANGE
+  last_binary_time = file_modified(IRCD_PATH);
+#endif
 
   while (!want_to_quit) {
-    if (! ircd_running() ) {
+    now = time(NULL);
 
-#ifdef IRCDWATCH_USE_SYSLOG
-      syslog(LOG_ERR, "spawning %s", IRCD_PATH);
-#endif
-
-      spawn(IRCD_PATH);
+    /* wake up for whatever comes first */
+    wait = IRCDWATCH_POLLING_INTERVAL;
+    if (ircd_pid == 0 && respawn_at - now < wait) {
+      wait = respawn_at - now;
+    }
+    if (conf_at && conf_at - now < wait) {
+      wait = conf_at - now;
+    }
+    if (bin_at && bin_at - now < wait) {
+      wait = bin_at - now;
+    }
+    if (wait < 0) {
+      wait = 0;
     }
 
-#ifdef IRCDWATCH_HUP_ON_CONFIG_CHANGE
-    i = file_modified(IRCDCONF_PATH);
-    if (i != -1) {
-
-      if (last_config_time == 0) {
-	last_config_time = i;
-      } 
+    FD_ZERO(&rfds);
+    FD_SET(sigpipe[0], &rfds);
+    maxfd = sigpipe[0];
+    if (pid_fd >= 0) {
+      FD_SET(pid_fd, &rfds);
+      if (pid_fd > maxfd) {
+	maxfd = pid_fd;
+      }
+    }
+    if (inotify_fd >= 0) {
+      FD_SET(inotify_fd, &rfds);
+      if (inotify_fd > maxfd) {
+	maxfd = inotify_fd;
+      }
+    }
+    tv.tv_sec = wait;
+    tv.tv_usec = 0;
+    if (select(maxfd + 1, &rfds, NULL, NULL, &tv) < 0) {
+      FD_ZERO(&rfds);
+    }
+    now = time(NULL);
 
-      else if (i > last_config_time) {
-	last_config_time = i;	
-	hup_ircd();
+    if (FD_ISSET(sigpipe[0], &rfds)) {
+      while (read(sigpipe[0], buf, sizeof(buf)) > 0)
+	;
+    }
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+      if (pid == ircd_pid) {
+	ircd_gone(status);
+      }
+    }
+    if (pid_fd >= 0 && FD_ISSET(pid_fd, &rfds)) {
+      ircd_gone(-1);
+    }
+    /* an ircd we did not start, and cannot get a pidfd for */
+    if (ircd_pid > 0 && pid_fd < 0 && kill(ircd_pid, 0) < 0 &&
+	errno == ESRCH) {
+      ircd_gone(-1);
+    }
+    if (ircd_pid == 0 && now >= respawn_at) {
+      respawn_ircd();
+    }
 
-#ifdef IRCDWATCH_USE_SYSLOG
-	syslog(LOG_NOTICE, "config change, HUPing ircd");
+#ifdef IRCDWATCH_INOTIFY
+    if (inotify_fd >= 0 && FD_ISSET(inotify_fd, &rfds)) {
+      struct inotify_event *ev;
+      int n, off;
+
+      n = read(inotify_fd, buf, sizeof(buf));
+      for (off = 0; off + (int) sizeof(*ev) <= n;
+	   off += sizeof(*ev) + ev->len) {
+	ev = (struct inotify_event *) (buf + off);
+	if (!ev->len) {
+	  continue;
+	}
+#ifdef IRCDWATCH_HUP_ON_CONFIG_CHANGE
+	if (!strcmp(ev->name, basename_of(IRCDCONF_PATH))) {
+	  conf_at = now + SETTLE_DELAY;
+	}
+#endif
+#ifdef IRCDWATCH_UPGRADE_ON_BINARY_CHANGE
+	if (!strcmp(ev->name, basename_of(IRCD_PATH))) {
+	  bin_at = now + SETTLE_DELAY;
+	}
 #endif
-
       }
     }
 #endif
 
-    alarm(IRCDWATCH_POLLING_INTERVAL);
-    pause();
+    /* without inotify, or if it missed something */
+#ifdef IRCDWATCH_HUP_ON_CONFIG_CHANGE
+    i = file_modified(IRCDCONF_PATH);
+    if (i != -1 && i != last_config_time) {
+      last_config_time = i;
+      if (!conf_at) {
+	conf_at = now + SETTLE_DELAY;
+      }
+    }
+    if (conf_at && now >= conf_at) {
+      conf_at = 0;
+      last_config_time = file_modified(IRCDCONF_PATH);
+      hup_ircd();
+    }
+#endif
+#ifdef IRCDWATCH_UPGRADE_ON_BINARY_CHANGE
+    i = file_modified(IRCD_PATH);
+    if (i != -1 && i != last_binary_time) {
+      last_binary_time = i;
+      if (!bin_at) {
+	bin_at = now + SETTLE_DELAY;
+      }
+    }
+    if (bin_at && now >= bin_at) {
+      bin_at = 0;
+      last_binary_time = file_modified(IRCD_PATH);
+      upgrade_ircd();
+    }
+#endif
   }
   return;
 }
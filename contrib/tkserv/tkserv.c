@@ -3,7 +3,7 @@
 **
 ** Copyright (c) 1998 Kaspar 'Kasi' Landsberg, <kl@berlin.Snafu.DE> 
 **
-** File     : tkserv.c v1.3.6
+** File     : tkserv.c v1.4.0
 ** Author   : Kaspar 'Kasi' Landsberg, <kl@snafu.de>
 ** Desc.    : Temporary K-line Service.
 **            For further info see the README file.
@@ -47,12 +47,23 @@
 /* don't change this either(?) */
 #define TKS_MAXARGS 250
 
+/*
+** Max. lifetime in hours, the server caps tklines at TKLINE_MAXTIME
+** seconds anyway (which config.h always defines).
+*/
+#if TKLINE_MAXTIME < 3600
+#define TKS_MAXLIFETIME 1
+#elif TKLINE_MAXTIME / 3600 < 767
+#define TKS_MAXLIFETIME (TKLINE_MAXTIME / 3600)
+#else
+#define TKS_MAXLIFETIME 767
+#endif
+
 /* The version information */
-#define TKS_VERSION "Hello, I'm TkServ v1.3.6+ircd211"
+#define TKS_VERSION "Hello, I'm TkServ v1.4.0+ircd211"
 
 static char *nuh;
-int fd = -1, tklined = 0;
-static char delimiter[2] = { IRCDCONF_DELIMITER, '\0' };
+int fd = -1;
 
 /*
 ** Returns the current time in a formated way.
@@ -104,18 +115,6 @@ void tks_log(char *text, ...)
     fclose(tks_logf);
 }
 
-/* an optimized system() function */
-void exec_cmd(char *cmd, ...)
-{
-    char command[TKS_MAXBUFFER];
-    va_list va;
-
-    va_start(va, cmd);
-    vsprintf(command, cmd, va);
-    system(command);
-    va_end(va);
-}
-
 /* sends a string (<= TKS_MAXBUFFER) to the server */
 void sendto_server(char *buf, ...)
 {
@@ -182,18 +181,17 @@ void process_server_output(char *line)
     }
 
     /* 
-    ** After successfull registering, backup the ircd.conf file
-    ** and set the perms of the log file -- the easy way.
+    ** After successfull registering, set the perms of the log
+    ** file -- the easy way.
     */
     if ((*args[0] == ':') && (!strcmp(args[1], "SERVSET")))
     {
         chmod(TKSERV_ACCESSFILE, S_IRUSR | S_IWRITE);
         chmod(TKSERV_LOGFILE, S_IRUSR | S_IWRITE);
-        exec_cmd("cp "CPATH" "TKSERV_IRCD_CONFIG_BAK);
         tks_log("Registration successful.");
     }
         
-    /* We do only react upon PINGs, SQUERYs and &NOTICES */
+    /* We do only react upon PINGs and SQUERYs */
     if (!strcmp(args[0], "PING"))
     {
         service_pong();
@@ -203,11 +201,6 @@ void process_server_output(char *line)
     {
         service_squery(args);
     }
-    
-    if (!strcmp(args[0], "&NOTICES"))
-    {
-        service_notice(args);
-    }
 } 
 
 /* reformats the server output */
@@ -401,7 +394,7 @@ int is_authorized(char *pwd, char *host)
 #endif
     FILE *fp;
     char buffer[TKS_MAXBUFFER + 1];
-    char *access_uh, *access_pwd;
+    char *access_uh = NULL, *access_pwd = NULL;
     char *token, *uh, *ch, *tlds = NULL;
     int retv = 0; /* 0 not authorized (perhaps *yet*); negative: errors */
 
@@ -415,15 +408,12 @@ int is_authorized(char *pwd, char *host)
 
             if (token)
             {
-                access_uh  = (char *) strdup(token);
+                /* skip the '!', the pointer is free()d later on */
+                access_uh  = (char *) strdup((*token == '!') ? token + 1 : token);
                 if (access_uh == NULL)
                 {
                     retv = -2;
                 }
-                else if (*access_uh == '!')
-                {
-                    access_uh++;
-                }
             }
 
             token = (char *) strtok(NULL, " ");
@@ -556,187 +546,118 @@ int is_authorized(char *pwd, char *host)
     return(retv);
 }
 
-/*************** ircd.conf section ****************/
+/*************** tkline section ****************/
+
+/*
+** The tklines are kept by the ircd itself (TKLINE/UNTKLINE), which
+** also journals them over a restart.  We only remember what we have
+** set, so that we can take it back when its lifetime is over.
+*/
+struct tks_tkline
+{
+    char *user;
+    char *host;
+    time_t expire;
+    struct tks_tkline *next;
+};
+
+static struct tks_tkline *tks_tklines = NULL;
 
-/* Appends new tklines to the ircd.conf file */
+/* Sets a tkline on the server and schedules its expiration */
 int add_tkline(char *host, char *user, char *reason, int lifetime)
 {
-    FILE *iconf;
+    struct tks_tkline *tk;
 
-    if (iconf = fopen(CPATH, "a"))
+    for (tk = tks_tklines; tk; tk = tk->next)
     {
-        time_t now;
-
-        now = time(NULL);
-
-        fprintf(iconf, "K%c%s%c%s%c%s%c0%c # %d %u tkserv\n",
-		IRCDCONF_DELIMITER, host,
-		IRCDCONF_DELIMITER, reason,
-		IRCDCONF_DELIMITER, user,
-		IRCDCONF_DELIMITER, IRCDCONF_DELIMITER,
-		lifetime, now);
-        fclose(iconf);
-        rehash(1);
-        tks_log("K%c%s%c%s%c%s%c0%c added for %d hour(s) by %s.",
-		IRCDCONF_DELIMITER, host,
-		IRCDCONF_DELIMITER, reason,
-		IRCDCONF_DELIMITER, user,
-		IRCDCONF_DELIMITER, IRCDCONF_DELIMITER,
-		lifetime, nuh);
-        return(1);
+        if (!strcasecmp(tk->host, host) && !strcasecmp(tk->user, user))
+        {
+            break;
+        }
     }
-    else
+
+    if (!tk)
     {
-        tks_log("Couldn't write to "CPATH);
+        if (!(tk = (struct tks_tkline *) malloc(sizeof(*tk))) ||
+            !(tk->user = (char *) strdup(user)) ||
+            !(tk->host = (char *) strdup(host)))
+        {
+            tks_log("Out of memory.");
+            return(0);
+        }
+        tk->next = tks_tklines;
+        tks_tklines = tk;
     }
 
-    return(0);
+    tk->expire = time(NULL) + lifetime * 60 * 60;
+    sendto_server("TKLINE %dh %s@%s :%s\n", lifetime, user, host, reason);
+    tks_log("TKLINE %s@%s :%s added for %d hour(s) by %s.",
+            user, host, reason, lifetime, nuh);
+
+    return(1);
 }
 
-/* Check for expired tklines in the ircd.conf file */
-int check_tklines(char *host, char *user, int lifetime)
+/*
+** Removes the tkline for user@host from the server, and returns how
+** many of ours it was.  UNTKLINE is sent anyway, the tkline may well
+** have been set before we were started.
+*/
+int del_tkline(char *host, char *user)
 {
-    FILE *iconf, *iconf_tmp;
-    
-    if ((iconf = fopen(CPATH, "r")) && (iconf_tmp = fopen(TKSERV_IRCD_CONFIG_TMP, "w")))
-    {
-        int count = 0, found = 0;
-        time_t now;
-        char buffer[TKS_MAXBUFFER + 1];
-        char buf_tmp[TKS_MAXBUFFER + 1];
-        
-        /* just in case... */
-        chmod(TKSERV_IRCD_CONFIG_TMP, S_IRUSR | S_IWRITE);
+    struct tks_tkline *tk, **prev;
+    int count = 0;
 
-        now = time(NULL);
-
-        while (fgets(buffer, TKS_MAXBUFFER, iconf))
-        {
-            if ((*buffer != 'K') || (!strstr(buffer, "tkserv")))
-            {
-                /* buffer could contain %s,%d etc..., expecially with IPv6
-                ** style config - mro
-                */
-                fputs(buffer, iconf_tmp);
-            }
-            else
-            {
-                /*
-                ** If lifetime has a value of -1, look for matching
-                ** tklines and remove them. Otherwise, perform
-                ** the expiration check.
-                */
-                if (lifetime == -1)
-                {
-                    char *token;
-                    char buf[TKS_MAXBUFFER + 1];
-
-                    strcpy(buf, buffer);
-
-                    token = (char *) strtok(buf, delimiter);
-                    token = (char *) strtok(NULL, delimiter);
-                    
-                    if (!strcasecmp(token, host))
-                    {
-                        token = (char *) strtok(NULL, delimiter);
-                        token = (char *) strtok(NULL, delimiter);
-                        
-                        if (!strcasecmp(token, user))
-                        {
-                            count++;
-                            found = 1;
-                        }
-                        else
-                        {
-                            fputs(buffer, iconf_tmp);
-                        }
-                    }
-                    else
-                    {
-                        fputs(buffer, iconf_tmp);
-                    }
-                }
-                else
-                {
-                    char *ch, *token;
-                    char buf[TKS_MAXBUFFER + 1];
-                    unsigned long int lifetime, then;
-                
-                    strcpy(buf, buffer);
-
-                    ch       = (char *) strrchr(buf, '#');
-                    token    = (char *) strtok(ch, " ");
-                    token    = (char *) strtok(NULL, " ");
-                    lifetime = strtoul(token, NULL, 0);
-                    token    = (char *) strtok(NULL, " ");
-                    then     = strtoul(token, NULL, 0);
-            
-                    if (!(((now - then) / (60 * 60)) >= lifetime))
-                    {
-                        fputs(buffer, iconf_tmp);
-                    }
-                    else
-                    {
-                        found = 1;
-                    }
-                }
-            }
-        }
-        
-        fclose(iconf);
-        fclose(iconf_tmp);
-        exec_cmd("cp %s %s", TKSERV_IRCD_CONFIG_TMP,CPATH);
-        unlink(TKSERV_IRCD_CONFIG_TMP);
-        
-        if (found)
+    for (prev = &tks_tklines; (tk = *prev); )
+    {
+        if (!strcasecmp(tk->host, host) && !strcasecmp(tk->user, user))
         {
-            rehash(-1);
+            *prev = tk->next;
+            free(tk->user);
+            free(tk->host);
+            free(tk);
+            count++;
+            continue;
         }
-        return(count);
-    }
-    else
-    {
-        tks_log("Error while checking for expired tklines...");
+        prev = &tk->next;
     }
+
+    sendto_server("UNTKLINE %s@%s\n", user, host);
+
+    return(count);
 }
 
-/* reloads the ircd.conf file  -- the easy way */
-void rehash(int what)
+/* Takes back the tklines whose lifetime is over */
+void expire_tklines(void)
 {
-    exec_cmd("kill -HUP `cat "PPATH"`");
+    struct tks_tkline *tk, **prev;
+    time_t now;
 
-    if (what != -1)
+    now = time(NULL);
+
+    for (prev = &tks_tklines; (tk = *prev); )
     {
-        tklined = what;
+        if (tk->expire <= now)
+        {
+            *prev = tk->next;
+            sendto_server("UNTKLINE %s@%s\n", tk->user, tk->host);
+            tks_log("TKLINE %s@%s expired.", tk->user, tk->host);
+            free(tk->user);
+            free(tk->host);
+            free(tk);
+            continue;
+        }
+        prev = &tk->next;
     }
 }
 
-/*************** end of ircd.conf section **************/
+/*************** end of tkline section **************/
     
 /*************** The service command section *************/
 
-/* On PING, send PONG and check for expired tklines */
+/* On PING, send PONG */
 void service_pong(void)
 {
     sendto_server("PONG %s\n", TKSERV_NAME);
-    check_tklines(NULL, NULL, 0);
-}
-
-/* 
-** If we get a rehash, tell the origin that the tklines are active/removed 
-** and check for expired tklines... 
-*/
-void service_notice(char **args)
-{
-    if ((!strcmp(args[4], "reloading") && (!strcmp(args[5], "ircd.conf"))) ||
-        (!strcmp(args[3], "rehashing") && (!strcmp(args[4], "Server"))))
-    {
-        if (tklined)
-        {
-            sendto_user("TK-line%s.", (tklined > 1) ? "(s) removed" : " active");
-            tklined = 0;
-        }
-    }
 }
 
 /* parse the received SQUERY */
@@ -906,13 +827,14 @@ void squery_tkline(char **args)
 
     /*
     ** A lifetime of -1 means that user wants to remove a tkline.
-    ** A lifetime between 1 and 768 means the user wants to add a tkline.
-    ** Any other value for the lifetime means the user didnt RTFM and is
-    ** rejected.
+    ** A lifetime between 1 and TKS_MAXLIFETIME means the user wants to
+    ** add a tkline.  Any other value for the lifetime means the user
+    ** didnt RTFM and is rejected.
     */
-    if ((lifetime >= 768) || (lifetime < -1) || (lifetime == 0))
+    if ((lifetime > TKS_MAXLIFETIME) || (lifetime < -1) || (lifetime == 0))
     {
-        sendto_user("<lifetime> must be greater than 0 and less than 768.");
+        sendto_user("<lifetime> must be greater than 0 and at most %d.",
+                    TKS_MAXLIFETIME);
         return;
     }
 
@@ -995,19 +917,19 @@ void squery_tkline(char **args)
     {
         int i;
 
-        i = check_tklines(host, user, lifetime);
+        i = del_tkline(host, user);
 
-        sendto_user("%d tkline%s for \"%s@%s\" found.", i, 
-                    (i > 1) ? "s" : "", user, host);
-
-        if (i > 0)
-        {
-            rehash(2);
-        }
+        sendto_user("%d tkline%s for \"%s@%s\" found, TK-line(s) removed.",
+                    i, (i > 1) ? "s" : "", user, host);
+        tks_log("UNTKLINE %s@%s by %s.", user, host, nuh);
     }
-    else if (!add_tkline(host, user, reason, lifetime))
+    else if (add_tkline(host, user, reason, lifetime))
+    {
+        sendto_user("TK-line active.");
+    }
+    else
     {
-        sendto_user("Error while trying to edit the "CPATH" file.");
+        sendto_user("Error while trying to set the tkline.");
     }
 }
 
@@ -1145,13 +1067,10 @@ int main(int argc, char *argv[])
             exit(1);
         }
     }
-    /* register the service with SERVICE_WANT_NOTICE */
+    /* register the service with SERVICE_WANT_TKLINE */
     sendto_server("PASS %s\n", TKSERV_PASSWORD);
-    sendto_server("SERVICE %s %s 33554432 :%s\n", TKSERV_NAME, TKSERV_DIST, TKSERV_DESC);
-    sendto_server("SERVSET 33619968\n");
-
-    timeout.tv_usec = 1000;
-    timeout.tv_sec  = 10;
+    sendto_server("SERVICE %s %s 1048576 :%s\n", TKSERV_NAME, TKSERV_DIST, TKSERV_DESC);
+    sendto_server("SERVSET 1114112\n");
 
     /* daemonization... i'm sure it's not complete */
     switch (fork())
@@ -1179,12 +1098,23 @@ int main(int argc, char *argv[])
         FD_ZERO(&write_set);
         FD_SET(fd, &read_set);
 
-        if (select(FD_SETSIZE, &read_set, &write_set, NULL, &timeout) == -1)
+        /* wake up now and then to expire our tklines */
+        timeout.tv_usec = 0;
+        timeout.tv_sec  = 10;
+
+        if (select(fd + 1, &read_set, &write_set, NULL, &timeout) == -1)
         {
             perror("select");
         }
+
+        expire_tklines();
+
+        if (!FD_ISSET(fd, &read_set))
+        {
+            continue;
+        }
         
-        if (!server_output(fd, buffer))
+        if (server_output(fd, buffer) <= 0)
         {
             tks_log("Connection closed.");
             tks_log("Last server output was: %s", last_buf);
@@ -0,0 +1,376 @@
+/************************************************************************
+ *   IRC - Internet Relay Chat, iauth/a_cache.c
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 1, or (at your option)
+ *   any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef lint
+static const volatile char rcsid[] = "@(#)$Id$";
+#endif
+
+#include "os.h"
+#include "a_defines.h"
+#define A_CACHE_C
+#include "a_externs.h"
+#undef A_CACHE_C
+
+static	aVEntry	*vc_hash[VC_HASHSIZE];
+static	aVCache	*caches = NULL;
+
+/* what is saved for each entry */
+struct	vcsnap
+{
+	time_t	expire;
+	u_char	addr[16];
+	u_char	verdict;
+	u_char	data[4];
+};
+
+/*
+ * vc_addr
+ *
+ *	Returns 0 if ip is an address, stored v4 mapped if need be.
+ */
+static	int	vc_addr(char *ip, u_char *addr)
+{
+	if (inet_pton(AF_INET, ip, addr + 12) == 1)
+	{
+		bzero((char *)addr, 10);
+		addr[10] = addr[11] = 0xff;
+		return 0;
+	}
+	return (inet_pton(AF_INET6, ip, addr) == 1) ? 0 : -1;
+}
+
+static	u_int	vc_bucket(aVCache *vc, u_char *addr)
+{
+	u_int h = (u_int)((u_long)vc >> 4);
+	int i;
+
+	for (i = 0; i < 16; i++)
+		h = (h << 5) + h + addr[i];
+	return h % VC_HASHSIZE;
+}
+
+static	aVEntry	*vc_find(aVCache *vc, u_char *addr)
+{
+	aVEntry *ve;
+
+	for (ve = vc_hash[vc_bucket(vc, addr)]; ve; ve = ve->hnext)
+		if (ve->cache == vc && !memcmp(ve->addr, addr, 16))
+			return ve;
+	return NULL;
+}
+
+static	void	vc_unlink(aVEntry *ve)
+{
+	aVCache *vc = ve->cache;
+
+	if (ve->prev)
+		ve->prev->next = ve->next;
+	else
+		vc->head = ve->next;
+	if (ve->next)
+		ve->next->prev = ve->prev;
+	else
+		vc->tail = ve->prev;
+}
+
+static	void	vc_link(aVEntry *ve)
+{
+	aVCache *vc = ve->cache;
+
+	ve->prev = NULL;
+	if ((ve->next = vc->head))
+		vc->head->prev = ve;
+	else
+		vc->tail = ve;
+	vc->head = ve;
+}
+
+static	void	vc_del(aVEntry *ve)
+{
+	aVEntry **last;
+
+	for (last = &vc_hash[vc_bucket(ve->cache, ve->addr)]; *last;
+	     last = &(*last)->hnext)
+		if (*last == ve)
+		{
+			*last = ve->hnext;
+			break;
+		}
+	vc_unlink(ve);
+	ve->cache->count -= 1;
+	free(ve);
+}
+
+/*
+ * vc_add
+ *
+ *	Add (or replace) the entry for addr, making room if the cache is
+ *	full: expired entries first, then the least recently used.
+ */
+static	void	vc_add(aVCache *vc, u_char *addr, time_t expire, u_char verdict,
+		       u_char *data)
+{
+	aVEntry *ve;
+	u_int h;
+
+	if (!(ve = vc_find(vc, addr)))
+	{
+		if (vc->tail && vc->tail->expire < time(NULL))
+			vc_del(vc->tail);
+		else if (vc->count >= vc->max && vc->tail)
+		{
+			vc_del(vc->tail);
+			vc->evicted += 1;
+		}
+		ve = (aVEntry *)malloc(sizeof(aVEntry));
+		bzero((char *)ve, sizeof(aVEntry));
+		ve->cache = vc;
+		bcopy(addr, ve->addr, 16);
+		h = vc_bucket(vc, addr);
+		ve->hnext = vc_hash[h];
+		vc_hash[h] = ve;
+		vc->count += 1;
+		if (vc->count > vc->highest)
+			vc->highest = vc->count;
+	}
+	else
+		vc_unlink(ve);
+	vc_link(ve);
+	ve->expire = expire;
+	ve->verdict = verdict;
+	if (data)
+		bcopy(data, ve->data, 4);
+}
+
+/*
+ * vc_path
+ *
+ *	Workers each have their own snapshot.
+ */
+static	char	*vc_path(void)
+{
+	static char path[256];
+
+	if (iauth_worker < 0)
+		return IAUTHCACHE_PATH;
+	sprintf(path, "%.240s.%d", IAUTHCACHE_PATH, iauth_worker);
+	return path;
+}
+
+/*
+ * vc_load
+ *
+ *	Get what was saved for this cache by a previous iauth.
+ */
+static	void	vc_load(aVCache *vc)
+{
+	struct vcsnap vs;
+	char magic[8], tag[512];
+	u_short len;
+	u_int count;
+	time_t now = time(NULL);
+	FILE *fp;
+
+	if (!(fp = fopen(vc_path(), "r")))
+		return;
+	if (fread(magic, 8, 1, fp) != 1 || memcmp(magic, VC_MAGIC, 8))
+	{
+		fclose(fp);
+		return;
+	}
+	while (fread(&len, sizeof(len), 1, fp) == 1 && len < sizeof(tag) &&
+	       fread(tag, len, 1, fp) == 1 &&
+	       fread(&count, sizeof(count), 1, fp) == 1)
+	{
+		tag[len] = '\0';
+		if (strcmp(tag, vc->tag))
+		{
+			if (fseek(fp, (long)count * sizeof(vs), SEEK_CUR))
+				break;
+			continue;
+		}
+		/* saved oldest first, so that the LRU order is kept */
+		while (count-- && fread(&vs, sizeof(vs), 1, fp) == 1)
+		{
+			if (vs.expire < now)
+				continue;
+			vc_add(vc, vs.addr, MIN(vs.expire, now + vc->ttl),
+			       vs.verdict, vs.data);
+			vc->loaded += 1;
+		}
+		break;
+	}
+	fclose(fp);
+	sendto_log(ALOG_DMISC, LOG_NOTICE, "Cache for %s: %u entries loaded.",
+		   vc->tag, vc->loaded);
+}
+
+/*
+ * vc_open
+ *
+ *	Get the cache for an instance, whose popt should be set.  Its size
+ *	is given by the "cachesize" option, ttl is in seconds.
+ */
+aVCache	*vc_open(AnInstance *self, u_int ttl)
+{
+	static int first = 1;
+	aVCache *vc;
+	char *ch, tag[512];
+
+	sprintf(tag, "%.30s %.470s", self->mod->name,
+		(self->popt) ? self->popt : "");
+	for (vc = caches; vc; vc = vc->nextc)
+		if (!strcmp(vc->tag, tag))
+		{
+			vc->refs += 1;
+			return vc;
+		}
+	vc = (aVCache *)malloc(sizeof(aVCache));
+	bzero((char *)vc, sizeof(aVCache));
+	vc->tag = mystrdup(tag);
+	vc->refs = 1;
+	vc->ttl = ttl;
+	vc->max = VC_MAX;
+	if ((ch = strstr(self->opt, "cachesize=")))
+		vc->max = atoi(ch + 10);
+	if (vc->max == 0)
+		vc->max = 1;
+	vc->nextc = caches;
+	caches = vc;
+	vc_load(vc);
+	if (first)
+	{
+		/* most of the time, iauth exits when ircd goes away */
+		atexit(vc_save);
+		first = 0;
+	}
+	return vc;
+}
+
+/*
+ * vc_close
+ *
+ *	An instance no longer uses its cache.
+ */
+void	vc_close(aVCache *vc)
+{
+	aVCache **last;
+
+	if (--vc->refs > 0)
+		return;
+	while (vc->head)
+		vc_del(vc->head);
+	for (last = &caches; *last; last = &(*last)->nextc)
+		if (*last == vc)
+		{
+			*last = vc->nextc;
+			break;
+		}
+	free(vc->tag);
+	free(vc);
+}
+
+/*
+ * vc_get
+ *
+ *	Returns the entry for ip if there is one which hasn't expired.
+ */
+aVEntry	*vc_get(aVCache *vc, char *ip)
+{
+	aVEntry *ve;
+	u_char addr[16];
+
+	if (vc_addr(ip, addr) || !(ve = vc_find(vc, addr)))
+		return NULL;
+	if (ve->expire < time(NULL))
+	{
+		vc_del(ve);
+		return NULL;
+	}
+	vc_unlink(ve);
+	vc_link(ve);
+	return ve;
+}
+
+/*
+ * vc_put
+ *
+ *	Remember the verdict (and data, 4 bytes, if any) for ip.
+ */
+void	vc_put(aVCache *vc, char *ip, u_char verdict, u_char *data)
+{
+	u_char addr[16];
+
+	if (vc_addr(ip, addr) == 0)
+		vc_add(vc, addr, time(NULL) + vc->ttl, verdict, data);
+}
+
+/*
+ * vc_save
+ *
+ *	Write all caches to disk, for the next iauth.
+ */
+void	vc_save(void)
+{
+	struct vcsnap vs;
+	aVCache *vc;
+	aVEntry *ve;
+	u_short len;
+	u_int count;
+	time_t now = time(NULL);
+	char tmp[300];
+	FILE *fp;
+
+	if (!caches)
+		return;
+	sprintf(tmp, "%.290s.tmp", vc_path());
+	if (!(fp = fopen(tmp, "w")))
+	{
+		sendto_log(ALOG_DMISC, LOG_ERR, "Cannot write %s: %s", tmp,
+			   strerror(errno));
+		return;
+	}
+	fwrite(VC_MAGIC, 8, 1, fp);
+	for (vc = caches; vc; vc = vc->nextc)
+	{
+		for (count = 0, ve = vc->tail; ve; ve = ve->prev)
+			if (ve->expire >= now)
+				count++;
+		len = strlen(vc->tag);
+		fwrite(&len, sizeof(len), 1, fp);
+		fwrite(vc->tag, len, 1, fp);
+		fwrite(&count, sizeof(count), 1, fp);
+		bzero((char *)&vs, sizeof(vs));
+		for (ve = vc->tail; ve; ve = ve->prev)
+		{
+			if (ve->expire < now)
+				continue;
+			vs.expire = ve->expire;
+			bcopy(ve->addr, vs.addr, 16);
+			vs.verdict = ve->verdict;
+			bcopy(ve->data, vs.data, 4);
+			fwrite(&vs, sizeof(vs), 1, fp);
+		}
+	}
+	if (fclose(fp) || rename(tmp, vc_path()))
+	{
+		sendto_log(ALOG_DMISC, LOG_ERR, "Cannot write %s: %s", tmp,
+			   strerror(errno));
+		(void)unlink(tmp);
+	}
+}
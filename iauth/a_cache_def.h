@@ -0,0 +1,55 @@
+/************************************************************************
+ *   IRC - Internet Relay Chat, iauth/a_cache_def.h
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 1, or (at your option)
+ *   any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+** Verdicts of modules (open proxy, listed in a DNSBL..) on client
+** addresses.  All caches share one hash table; each has its own time to
+** live, size limit and LRU list.  Instances of a module with the same
+** options share a cache, and caches are saved to IAUTHCACHE_PATH so that
+** they survive iauth being restarted.
+*/
+#define	VC_HASHSIZE	8191	/* buckets, for all caches */
+#define	VC_MAX		20000	/* default "cachesize" */
+#define	VC_SAVE		300	/* seconds between snapshots */
+#define	VC_MAGIC	"IAUTHVC1"
+
+typedef struct VEntry aVEntry;
+typedef struct VCache aVCache;
+
+struct VEntry
+{
+	aVEntry	*hnext;		/* hash chain */
+	aVEntry	*prev, *next;	/* LRU list, most recently used first */
+	aVCache	*cache;
+	u_char	addr[16];	/* IPv4 addresses are stored v4 mapped */
+	time_t	expire;
+	u_char	verdict;	/* module defined */
+	u_char	data[4];	/* module defined */
+};
+
+struct VCache
+{
+	aVCache	*nextc;
+	char	*tag;		/* module name and options */
+	int	refs;		/* instances using it */
+	u_int	ttl;		/* seconds */
+	u_int	max;		/* entries allowed */
+	aVEntry	*head, *tail;	/* LRU list */
+	/* stats */
+	u_int	count, highest, loaded, evicted;
+};
@@ -0,0 +1,37 @@
+/************************************************************************
+ *   IRC - Internet Relay Chat, iauth/a_cache_ext.h
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 1, or (at your option)
+ *   any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*  This file contains external definitions for global variables and functions
+    defined in iauth/a_cache.c.
+ */
+
+/*  External definitions for global functions.
+ */
+#ifndef A_CACHE_C
+# define EXTERN extern
+#else /* A_CACHE_C */
+# define EXTERN
+#endif /* A_CACHE_C */
+
+EXTERN aVCache *vc_open (AnInstance *, u_int);
+EXTERN void vc_close (aVCache *);
+EXTERN aVEntry *vc_get (aVCache *, char *);
+EXTERN void vc_put (aVCache *, char *, u_char, u_char *);
+EXTERN void vc_save (void);
+
+#undef EXTERN
@@ -32,6 +32,7 @@ static aModule *Mlist[16];
 #define DEFAULT_TIMEOUT 30
 
 u_int	debuglevel = 0;
+u_int	workers = 0;
 
 AnInstance *instances = NULL;
 
@@ -154,6 +155,18 @@ char	*conf_read(char *cfile)
 						 cfile);
 				continue;
 			    }
+			if (!strncmp("workers = ", buffer, 10))
+			    {
+				if (sscanf(buffer, "workers = %u",
+					   &workers) != 1 ||
+				    workers > MAXWORKERS)
+				    {
+					conf_err(lnnb, "Invalid setting.",
+						 cfile);
+					workers = 0;
+				    }
+				continue;
+			    }
 			/* debugmode setting */
 			if (!strncmp("debuglvl = 0x", buffer, 13))
 			    {
@@ -504,6 +517,8 @@ char	*conf_read(char *cfile)
 		aTarget *ttmp;
 		char *err;
 
+		if (workers)
+			printf("\nWorkers: %u\n", workers);
 		printf("\nModule(s) loaded:\n");
 		while (itmp)
 		    {
@@ -548,17 +563,9 @@ char	*conf_read(char *cfile)
 			itmp = itmp->nexti;
 		    }
 	    }
-	else
-	{
-		while (itmp)
-		{
-			if (itmp->mod->init)
-			{
-				itmp->mod->init(itmp);
-			}
-			itmp = itmp->nexti;
-		}
-	}
+	else if (workers == 0)
+		/* otherwise done by each worker, see main() */
+		conf_init();
 
 	ch = o_all;
 	if (o_req) *ch++ = 'R';
@@ -569,6 +576,16 @@ char	*conf_read(char *cfile)
 	return o_all;
 }
 
+/* conf_init: initialize the module instances */
+void	conf_init(void)
+{
+	AnInstance *itmp;
+
+	for (itmp = instances; itmp; itmp = itmp->nexti)
+		if (itmp->mod->init)
+			itmp->mod->init(itmp);
+}
+
 /* conf_match: check if an instance is to be applied to a connection
    Returns -1: no match, and never will
             0: got a match, doIt[tm]
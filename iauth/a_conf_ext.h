@@ -25,6 +25,7 @@
  */
 #ifndef A_CONF_C
 extern u_int	debuglevel;
+extern u_int	workers;
 extern AnInstance *instances;
 #endif /* A_CONF_C */
 
@@ -38,6 +39,7 @@ extern AnInstance *instances;
 
 EXTERN char *conf_read (char *);
 EXTERN int conf_match (u_int, AnInstance *);
+EXTERN void conf_init(void);
 EXTERN void conf_ircd(void);
 
 #undef EXTERN
@@ -36,5 +36,6 @@
 #include "common_def.h"	/* for isdigit, isalpha etc. */
 
 #include "a_conf_def.h"
+#include "a_cache_def.h"
 #include "a_struct_def.h"
 #include "a_log_def.h"
@@ -24,6 +24,7 @@
 #include "match_ext.h"
 #include "support_ext.h"
 
+#include "a_cache_ext.h"
 #include "a_conf_ext.h"
 #include "a_io_ext.h"
 #include "a_log_ext.h"
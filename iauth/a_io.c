@@ -26,37 +26,388 @@ static const volatile char rcsid[] = "@(#)$Id: a_io.c,v 1.31 2005/01/03 17:33:55
 #define A_IO_C
 #include "a_externs.h"
 #undef A_IO_C
+#if defined(IAUTH_EPOLL)
+# include <sys/epoll.h>
+#endif
 
 anAuthData 	cldata[MAXCONNECTIONS]; /* index == ircd fd */
 static int	cl_highest = -1;
-#if defined(USE_POLL)
+#if defined(USE_POLL) && !defined(IAUTH_EPOLL)
 static int	fd2cl[MAXCONNECTIONS]; /* fd -> cl mapping */
 #endif
 
 #define IOBUFSIZE 4096
-static char		iobuf[IOBUFSIZE+1];
-static char		rbuf[IOBUFSIZE+1];	/* incoming ircd stream */
-static int		iob_len = 0, rb_len = 0;
+static char		iobuf[IOBUFSIZE+1];	/* incoming ircd stream */
+static int		iob_len = 0;
+
+/*
+** Lines for ircd are queued here and written at once by io_flush(),
+** before waiting for events, rather than with a write() each.
+*/
+#define OBUFSIZE	65536
+static char		obuf[OBUFSIZE];
+static int		ob_len = 0;
+
+/*
+** Entries having a module timeout, in a heap ordered on the timeout, so
+** that loop_io() doesn't have to look at all of them every time.
+*/
+static int	theap[MAXCONNECTIONS];
+static int	tslot[MAXCONNECTIONS];	/* position in theap + 1, 0 if none */
+static time_t	twhen[MAXCONNECTIONS];	/* timeout as sorted in theap */
+static int	tcount = 0;
+
+#if defined(IAUTH_EPOLL)
+# define IO_EVENTS	64		/* events read at once */
+static int	epfd = -1;
+static int	evfd[MAXCONNECTIONS];	/* fd registered for the entry */
+static u_int	evmask[MAXCONNECTIONS];
+#endif
+
+/*
+** Descriptors used by a module instance for all the entries it works on
+** (such as a database connection) rather than by a single one, see
+** io_watch().
+*/
+static struct
+{
+	AnInstance *self;	/* NULL if the slot is free */
+	int	fd;
+	u_int	events;		/* IO_READ, IO_WRITE */
+	void	(*func)(AnInstance *, u_int);
+} watch[MAXI];
+static int	nwatch = 0;
+
+int	iauth_worker = -1;		/* which one we are, if any */
+static int	wkfd[MAXWORKERS];	/* master side of the workers' pipe */
+static char	wkbuf[MAXWORKERS][IOBUFSIZE];	/* partial replies */
+static int	wklen[MAXWORKERS];
+#define	WKOUTSIZE	65536
+static char	wkout[MAXWORKERS][WKOUTSIZE];	/* not yet taken by worker */
+static int	wkolen[MAXWORKERS];
 
 void	init_io(void)
 {
     bzero((char *) cldata, sizeof(cldata));
 }
 
-/* sendto_ircd() functions */
-void	vsendto_ircd(char *pattern, va_list va)
+/*
+ * timer_move
+ *
+ *	put back in order the timer heap entry at position pos
+ */
+static	void	next_io(int, AnInstance *);
+
+static	void	timer_move(int pos)
+{
+	int cl = theap[pos], c;
+
+	while (pos > 0 && twhen[theap[(pos - 1) / 2]] > twhen[cl])
+	    {
+		theap[pos] = theap[(pos - 1) / 2];
+		tslot[theap[pos]] = pos + 1;
+		pos = (pos - 1) / 2;
+	    }
+	while ((c = 2 * pos + 1) < tcount)
+	    {
+		if (c + 1 < tcount && twhen[theap[c + 1]] < twhen[theap[c]])
+			c++;
+		if (twhen[theap[c]] >= twhen[cl])
+			break;
+		theap[pos] = theap[c];
+		tslot[theap[pos]] = pos + 1;
+		pos = c;
+	    }
+	theap[pos] = cl;
+	tslot[cl] = pos + 1;
+}
+
+/*
+ * timer_set
+ *
+ *	make the timer heap agree with cldata[cl].timeout
+ */
+static	void	timer_set(int cl)
+{
+	time_t when = (cldata[cl].instance) ? cldata[cl].timeout : 0;
+	int pos;
+
+	if (tslot[cl] ? (twhen[cl] == when) : (when == 0))
+		return;
+	if (tslot[cl])
+	    {
+		pos = tslot[cl] - 1;
+		tslot[cl] = 0;
+		if (pos != --tcount)
+		    {
+			theap[pos] = theap[tcount];
+			timer_move(pos);
+		    }
+	    }
+	if (when)
+	    {
+		twhen[cl] = when;
+		theap[tcount] = cl;
+		timer_move(tcount++);
+	    }
+}
+
+/*
+ * io_sync
+ *
+ *	called after modules had a chance to change an entry, to update
+ *	the timer heap and (for epoll) the descriptor being waited for.
+ */
+static	void	io_sync(int cl)
+{
+#if defined(IAUTH_EPOLL)
+	struct epoll_event ev;
+	int fd = -1;
+
+	timer_set(cl);
+	if (epfd < 0)
+		return;
+	ev.events = 0;
+	if (cldata[cl].rfd > 0)
+	    {
+		fd = cldata[cl].rfd;
+		ev.events = EPOLLIN;
+	    }
+	else if (cldata[cl].wfd > 0)
+	    {
+		fd = cldata[cl].wfd;
+		ev.events = EPOLLOUT;
+	    }
+	if (evfd[cl] >= 0 && evfd[cl] != fd)
+		/* may already be gone with close() */
+		(void)epoll_ctl(epfd, EPOLL_CTL_DEL, evfd[cl], &ev);
+	evfd[cl] = fd;
+	if (fd < 0)
+		return;
+	/*
+	** even if the fd didn't change, it may have been closed and
+	** reopened, so always try to modify before adding.
+	*/
+	ev.data.u32 = cl;
+	if (epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev) < 0 &&
+	    epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+	    {
+		sendto_log(ALOG_IRCD, LOG_CRIT,
+			   "io_sync(): epoll_ctl(%d) for #%d failed: %s",
+			   fd, cl, strerror(errno));
+		exit(1);
+	    }
+	evmask[cl] = ev.events;
+#else
+	timer_set(cl);
+#endif
+}
+
+#if defined(IAUTH_EPOLL)
+/*
+ * watch_sync
+ *
+ *	register a watched descriptor with epoll.
+ */
+static	void	watch_sync(int w)
 {
-	char	ibuf[4096];
+	struct epoll_event ev;
 
-	vsprintf(ibuf, pattern, va);
-	DebugLog((ALOG_DSPY, 0, "To ircd: [%s]", ibuf));
-	strcat(ibuf, "\n");
-	if (write(0, ibuf, strlen(ibuf)) != strlen(ibuf))
+	ev.events = ((watch[w].events & IO_READ) ? EPOLLIN : 0) |
+		    ((watch[w].events & IO_WRITE) ? EPOLLOUT : 0);
+	ev.data.u32 = MAXCONNECTIONS + 1 + w;
+	if (epoll_ctl(epfd, EPOLL_CTL_MOD, watch[w].fd, &ev) < 0 &&
+	    epoll_ctl(epfd, EPOLL_CTL_ADD, watch[w].fd, &ev) < 0)
 	    {
+		sendto_log(ALOG_IRCD, LOG_CRIT,
+			   "watch_sync(): epoll_ctl(%d) for %s failed: %s",
+			   watch[w].fd, watch[w].self->mod->name,
+			   strerror(errno));
+		exit(1);
+	    }
+}
+#endif
+
+/*
+ * io_watch
+ *
+ *	have func() called with the events (IO_READ, IO_WRITE) found on fd,
+ *	a descriptor the instance uses for all its entries.  An instance
+ *	has at most one, a negative fd (or no events) stops watching it,
+ *	which has to be done before closing it.
+ */
+void	io_watch(AnInstance *self, int fd, u_int events,
+		 void (*func)(AnInstance *, u_int))
+{
+	int	w, slot = -1;
+
+	for (w = 0; w < nwatch; w++)
+	    {
+		if (watch[w].self == self)
+			break;
+		if (watch[w].self == NULL && slot < 0)
+			slot = w;
+	    }
+	if (w == nwatch)
+	    {
+		if (fd < 0 || events == 0)
+			return;
+		if (slot >= 0)
+			w = slot;
+		else if (nwatch < MAXI)
+			nwatch++;
+		else
+		    {
+			sendto_log(ALOG_IRCD, LOG_CRIT,
+				   "io_watch(): no room for %s", self->mod->name);
+			exit(1);
+		    }
+	    }
+#if defined(IAUTH_EPOLL)
+	else if (epfd >= 0 && (watch[w].fd != fd || events == 0))
+	    {
+		struct epoll_event ev;
+
+		(void)epoll_ctl(epfd, EPOLL_CTL_DEL, watch[w].fd, &ev);
+	    }
+#endif
+	if (fd < 0 || events == 0)
+	    {
+		watch[w].self = NULL;
+		return;
+	    }
+	watch[w].self = self;
+	watch[w].fd = fd;
+	watch[w].events = events;
+	watch[w].func = func;
+#if defined(IAUTH_EPOLL)
+	if (epfd >= 0)
+		watch_sync(w);
+#endif
+}
+
+/*
+ * io_done
+ *
+ *	for a module done with an entry outside of its work() function,
+ *	typically from the function given to io_watch().
+ */
+void	io_done(u_int cl)
+{
+	next_io(cl, cldata[cl].instance);
+	io_sync(cl);
+}
+
+/*
+ * io_timeouts
+ *
+ *	call the modules whose timeout has been reached
+ */
+static	void	io_timeouts(time_t now)
+{
+	int due[MAXCONNECTIONS], ndue = 0, cl, i;
+
+	/* entries set again in the past will be called next time */
+	while (tcount && twhen[theap[0]] < now)
+	    {
+		due[ndue++] = cl = theap[0];
+		tslot[cl] = 0;
+		if (--tcount)
+		    {
+			theap[0] = theap[tcount];
+			timer_move(0);
+		    }
+	    }
+	for (i = 0; i < ndue; i++)
+	    {
+		cl = due[i];
+		if (cldata[cl].timeout && cldata[cl].timeout < now &&
+		    cldata[cl].instance)
+		    {
+			DebugLog((ALOG_DIO, 0,
+				  "io_loop(): module %s timeout [%d]",
+				  cldata[cl].instance->mod->name, cl));
+			if (cldata[cl].instance->mod->timeout(cl) != 0)
+				next_io(cl, cldata[cl].instance);
+		    }
+		io_sync(cl);
+	    }
+}
+
+/*
+ * io_wait
+ *
+ *	how long (msec) to wait for events, at most 5 seconds.
+ */
+static	int	io_wait(void)
+{
+	struct timeval tv;
+	long ms;
+
+	if (tcount == 0)
+		return 5000;
+	/* timeouts are reached once the second after has started */
+	gettimeofday(&tv, NULL);
+	ms = (twhen[theap[0]] + 1 - tv.tv_sec) * 1000 - tv.tv_usec / 1000;
+	return (ms < 0) ? 0 : (ms > 5000) ? 5000 : ms;
+}
+
+/*
+ * io_flush
+ *
+ *	write what is queued for ircd, keeping what it won't take yet.
+ */
+static	void	io_flush(void)
+{
+	int	len;
+
+	if (ob_len == 0)
+		return;
+	if ((len = write(0, obuf, ob_len)) <= 0)
+	    {
+		if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK ||
+				errno == EINTR))
+			return;
 		sendto_log(ALOG_DMISC, LOG_NOTICE, "Daemon exiting. [w %s]",
 			   strerror(errno));
 		exit(0);
 	    }
+	DebugLog((ALOG_DIO, 0, "io_flush(): wrote %d of %d bytes", len,
+		  ob_len));
+	if ((ob_len -= len))
+		bcopy(obuf + len, obuf, ob_len);
+}
+
+/*
+ * io_room
+ *
+ *	make sure there are len bytes available in obuf.
+ */
+static	void	io_room(int len)
+{
+	if (ob_len + len <= OBUFSIZE)
+		return;
+	io_flush();
+	if (ob_len + len > OBUFSIZE)
+	    {
+		sendto_log(ALOG_DMISC, LOG_NOTICE,
+			   "Daemon exiting. [w buffer full]");
+		exit(0);
+	    }
+}
+
+/* sendto_ircd() functions */
+void	vsendto_ircd(char *pattern, va_list va)
+{
+	int	len;
+
+	io_room(4096);
+	len = vsnprintf(obuf + ob_len, 4095, pattern, va);
+	if (len > 4094)
+		len = 4094;
+	DebugLog((ALOG_DSPY, 0, "To ircd: [%.*s]", len, obuf + ob_len));
+	obuf[ob_len + len] = '\n';
+	ob_len += len + 1;
 }
 
 void	sendto_ircd(char *pattern, ...)
@@ -203,23 +554,24 @@ static	void	next_io(int cl, AnInstance *last)
  */
 static	void	parse_ircd(void)
 {
-	char *ch, *chp, *buf = iobuf;
+	char *ch, *chp, *buf = iobuf, *end = iobuf + iob_len;
 	int cl = -1, ncl;
+	AnInstance *itmp;
 
-	iobuf[iob_len] = '\0';
-	while ((ch = index(buf, '\n')))
+	while ((ch = memchr(buf, '\n', end - buf)))
 	    {
 		*ch = '\0';
 		DebugLog((ALOG_DSPY, 0, "parse_ircd(): got [%s]", buf));
 
-		cl = atoi(chp = buf);
+		for (cl = 0, chp = buf; isdigit(*chp); chp++)
+			cl = cl * 10 + *chp - '0';
 		if (cl >= MAXCONNECTIONS)
 		    {
 			sendto_log(ALOG_IRCD, LOG_CRIT,
 			   "Recompile iauth, (fatal %d>=%d)", cl, MAXCONNECTIONS);
 			exit(1);
 		    }
-		while (*chp++ != ' ');
+		while (*chp && *chp++ != ' ');
 		switch (chp[0])
 		    {
 		case 'C': /* new connection */
@@ -354,6 +706,8 @@ static	void	parse_ircd(void)
 			cldata[cl].instance = NULL;
 			cldata[cl].authuser = NULL;
 			cldata[cl].inbuffer = NULL;
+			io_sync(cl);
+			io_sync(ncl);
 			/*
 			** this is the ugly part of having a slave (considering
 			** that ircd remaps fd's: there is lag between the
@@ -468,19 +822,183 @@ static	void	parse_ircd(void)
 			/* RPL_HELLO to be exact, but who cares. */
 			strConnLen = sprintf(strConn, ":%s 020 * :", chp+2);
 			break;
+		case 'S': /* statistics, asked by the master process */
+			for (itmp = instances; itmp; itmp = itmp->nexti)
+				if (itmp->mod->stats)
+					itmp->mod->stats(itmp);
+			break;
 		default:
 			sendto_log(ALOG_IRCD, LOG_ERR, "Unexpected data [%s]",
 				   chp);
 			break;
 		    }
 
+		io_sync(cl);
 		buf = ch+1;
 	    }
-	rb_len = 0; iob_len = 0;
-	if (strlen(buf))
-		bcopy(buf, rbuf, rb_len = strlen(buf));
+	/* keep the partial line for the next read */
+	if ((iob_len = end - buf) && buf != iobuf)
+		bcopy(buf, iobuf, iob_len);
 }
 
+/*
+ * io_read
+ *
+ *	data (or an error) is waiting on the entry's rfd
+ */
+static	void	io_read(int i)
+{
+	int len;
+
+	len = recv(cldata[i].rfd, cldata[i].inbuffer + cldata[i].buflen,
+		   INBUFSIZE - cldata[i].buflen, 0);
+	DebugLog((ALOG_DIO, 0, "io_loop(): i = #%d: recv(%d) returned %d, errno = %d", i, cldata[i].rfd, len, errno));
+	if (len < 0)
+	    {
+		cldata[i].instance->mod->clean(i);
+		next_io(i, cldata[i].instance);
+	    }
+	else
+	    {
+		cldata[i].buflen += len;
+		if (cldata[i].instance->mod->work(i) != 0)
+			next_io(i, cldata[i].instance);
+		else if (len == 0)
+		    {
+			cldata[i].instance->mod->clean(i);
+			next_io(i, cldata[i].instance);
+		    }
+	    }
+}
+
+/*
+ * io_ircd
+ *
+ *	data from the ircd..
+ */
+static	void	io_ircd(void)
+{
+	int i;
+
+	while (1)
+	    {
+		if ((i=recv(0,iobuf+iob_len,IOBUFSIZE-iob_len,0)) <= 0)
+		    {
+			DebugLog((ALOG_DIO, 0, "io_loop(): recv(0) returned %d, errno = %d", i, errno));
+			break;
+		    }
+		iob_len += i;
+		DebugLog((ALOG_DIO, 0,
+			  "io_loop(): got %d bytes from ircd [%d]", i,
+			  iob_len));
+		parse_ircd();
+	    }
+	if (i == 0)
+	    {
+		sendto_log(ALOG_DMISC, LOG_NOTICE,
+			   "Daemon exiting. [r]");
+		exit(0);
+	    }
+}
+
+#if defined(IAUTH_EPOLL)
+/*
+ * loop_io
+ *
+ *	epoll() loop: descriptors are registered by io_sync() as modules
+ *	change them, so only entries with something to do are looked at.
+ */
+void	loop_io(void)
+{
+	static u_int ircdmask = EPOLLIN;
+	struct epoll_event ev[IO_EVENTS];
+	int i, n, cl, ircd = 0;
+
+	if (epfd < 0)
+	    {
+		if ((epfd = epoll_create(MAXCONNECTIONS)) < 0)
+		    {
+			sendto_log(ALOG_IRCD, LOG_CRIT,
+				   "fatal epoll_create error: %s",
+				   strerror(errno));
+			exit(1);
+		    }
+		ev[0].events = EPOLLIN;
+		ev[0].data.u32 = MAXCONNECTIONS;	/* ircd stream */
+		(void)epoll_ctl(epfd, EPOLL_CTL_ADD, 0, &ev[0]);
+		for (i = 0; i < MAXCONNECTIONS; i++)
+		    {
+			evfd[i] = -1;
+			if (cldata[i].rfd > 0 || cldata[i].wfd > 0)
+				io_sync(i);
+		    }
+		for (i = 0; i < nwatch; i++)
+			if (watch[i].self)
+				watch_sync(i);
+	    }
+
+	io_timeouts(time(NULL));
+	io_flush();
+	if (ircdmask != (ob_len ? EPOLLIN|EPOLLOUT : EPOLLIN))
+	    {
+		/* ircd isn't keeping up, wait until it does */
+		ev[0].events = ircdmask ^= EPOLLOUT;
+		ev[0].data.u32 = MAXCONNECTIONS;
+		(void)epoll_ctl(epfd, EPOLL_CTL_MOD, 0, &ev[0]);
+	    }
+
+	n = epoll_wait(epfd, ev, IO_EVENTS, io_wait());
+	DebugLog((ALOG_DIO, 0, "io_loop(): epoll_wait() returned %d, errno = %d",
+		  n, errno));
+	if (n == -1)
+	{
+		if (errno == EINTR)
+		{
+			return;
+		}
+		else
+		{
+			sendto_log(ALOG_IRCD, LOG_CRIT,
+				   "fatal epoll_wait error: %s",
+				   strerror(errno));
+			exit(1);
+		}
+	}
+
+	for (i = 0; i < n; i++)
+	    {
+		cl = ev[i].data.u32;
+		if (cl == MAXCONNECTIONS)
+		    {
+			/* done last, as with select() and poll() */
+			if (ev[i].events & (EPOLLIN|EPOLLHUP|EPOLLERR))
+				ircd = 1;
+			continue;
+		    }
+		if (cl > MAXCONNECTIONS)
+		    {
+			cl -= MAXCONNECTIONS + 1;
+			if (watch[cl].self)
+				watch[cl].func(watch[cl].self,
+				       ((ev[i].events & (EPOLLIN|EPOLLHUP|EPOLLERR))
+					? IO_READ : 0) |
+				       ((ev[i].events & EPOLLOUT) ? IO_WRITE : 0));
+			continue;
+		    }
+		if (cldata[cl].rfd > 0 && evmask[cl] == EPOLLIN)
+			io_read(cl);
+		else if (cldata[cl].wfd > 0 && evmask[cl] == EPOLLOUT)
+		    {
+			if (cldata[cl].instance->mod->work(cl) != 0)
+				next_io(cl, cldata[cl].instance);
+		    }
+		io_sync(cl);
+	    }
+
+	if (ircd)
+		io_ircd();
+}
+#else /* IAUTH_EPOLL */
 /*
  * loop_io
  *
@@ -526,9 +1044,11 @@ void	loop_io(void)
         struct pollfd   poll_fdarray[MAXCONNECTIONS];
         struct pollfd * pfd     = poll_fdarray;
         int        nbr_pfds = 0;
+        int        wpfd;
 #endif
 
 	int i, nfds = 0;
+	u_int ready;
 	struct timeval wait;
 	time_t now = time(NULL);
 
@@ -543,22 +1063,34 @@ void	loop_io(void)
 	pfd->fd  = -1;
 #endif  /* USE_POLL */
 
+	io_timeouts(now);
+	io_flush();
 	SET_READ_EVENT(0); nfds = 1;		/* ircd stream */
+	if (ob_len)
+		SET_WRITE_EVENT(0);
+	for (i = 0; i < nwatch; i++)
+	    {
+		if (watch[i].self == NULL)
+			continue;
+		if (watch[i].events & IO_READ)
+			SET_READ_EVENT(watch[i].fd);
+		if (watch[i].events & IO_WRITE)
+			SET_WRITE_EVENT(watch[i].fd);
+#if !defined(USE_POLL)
+		if (watch[i].fd > highfd)
+			highfd = watch[i].fd;
+#endif
+		nfds++;
+	    }
+#if defined(USE_POLL)
+	wpfd = nbr_pfds;	/* entries' descriptors come after these */
+#endif
 #if defined(USE_POLL) && defined(IAUTH_DEBUG)
 	for (i = 0; i < MAXCONNECTIONS; i++)
 		fd2cl[i] = -1; /* sanity */
 #endif
 	for (i = 0; i <= cl_highest; i++)
 	    {
-		if (cldata[i].timeout && cldata[i].timeout < now &&
-		    cldata[i].instance /* shouldn't be needed.. but it is */)
-		    {
-			DebugLog((ALOG_DIO, 0,
-				  "io_loop(): module %s timeout [%d]",
-				  cldata[i].instance->mod->name, i));
-			if (cldata[i].instance->mod->timeout(i) != 0)
-				next_io(i, cldata[i].instance);
-		    }
 		if (cldata[i].rfd > 0)
 		    {
 			SET_READ_EVENT(cldata[i].rfd);
@@ -584,7 +1116,8 @@ void	loop_io(void)
 	    }
 
 	DebugLog((ALOG_DIO, 0, "io_loop(): checking for %d fd's", nfds));
-	wait.tv_sec = 5; wait.tv_usec = 0;
+	i = io_wait();
+	wait.tv_sec = i / 1000; wait.tv_usec = (i % 1000) * 1000;
 #if !defined(USE_POLL)
 	nfds = select(highfd + 1, (SELECT_FDSET_TYPE *)&read_set,
 		      (SELECT_FDSET_TYPE *)&write_set, 0, &wait);
@@ -617,11 +1150,50 @@ void	loop_io(void)
 	/* no matter select() or poll() this is also fd # 0 */
 	if (TST_READ_EVENT(0))
 		nfds--;
+#if !defined(USE_POLL)
+	if (TST_WRITE_EVENT(0))
+#else
+	else if (TST_WRITE_EVENT(0))
+#endif
+		nfds--;	/* io_flush() will see to it */
+
+	/* descriptors of instances, as they were when we started waiting */
+	for (i = 0; i < nwatch; i++)
+	    {
+		if (watch[i].self == NULL)
+			continue;
+#if defined(USE_POLL)
+		for (pfd = poll_fdarray + 1; pfd != poll_fdarray + wpfd &&
+			     pfd->fd != watch[i].fd; pfd++)
+			;
+		if (pfd == poll_fdarray + wpfd)
+			continue;
+#endif
+		ready = 0;
+		if (TST_READ_EVENT(watch[i].fd))
+		    {
+			ready |= IO_READ;
+			nfds--;
+		    }
+		if (TST_WRITE_EVENT(watch[i].fd))
+		    {
+			ready |= IO_WRITE;
+#if !defined(USE_POLL)
+			nfds--;	/* select() counts each of them */
+#endif
+		    }
+#if defined(USE_POLL)
+		if (ready == IO_WRITE)
+			nfds--;
+#endif
+		if (ready)
+			watch[i].func(watch[i].self, ready);
+	    }
 
 #if !defined(USE_POLL)
 	for (i = 0; i <= cl_highest && nfds; i++)
 #else
-	for (pfd = poll_fdarray+1; pfd != poll_fdarray+nbr_pfds && nfds; pfd++)
+	for (pfd = poll_fdarray+wpfd; pfd != poll_fdarray+nbr_pfds && nfds; pfd++)
 #endif
 	    {
 #if defined(USE_POLL)
@@ -647,35 +1219,15 @@ void	loop_io(void)
 		    }
 		if (cldata[i].rfd > 0 && TST_READ_EVENT(cldata[i].rfd))
 		    {
-			int len;
- 
-			len = recv(cldata[i].rfd,
-				   cldata[i].inbuffer + cldata[i].buflen,
-				   INBUFSIZE - cldata[i].buflen, 0);
-			DebugLog((ALOG_DIO, 0, "io_loop(): i = #%d: recv(%d) returned %d, errno = %d", i, cldata[i].rfd, len, errno));
-			if (len < 0)
-			    {
-				cldata[i].instance->mod->clean(i);
-				next_io(i, cldata[i].instance);
-			    }
-			else
-			    {
-				cldata[i].buflen += len;
-				if (cldata[i].instance->mod->work(i) != 0)
-					next_io(i, cldata[i].instance);
-				else if (len == 0)
-				    {
-					cldata[i].instance->mod->clean(i);
-					next_io(i, cldata[i].instance);
-				    }
-			    }
+			io_read(i);
+			io_sync(i);
 			nfds--;
 		    }
 		else if (cldata[i].wfd > 0 && TST_WRITE_EVENT(cldata[i].wfd))
 		    {
 			if (cldata[i].instance->mod->work(i) != 0)
 				next_io(i, cldata[i].instance);
-			
+			io_sync(i);
 			nfds--;
 		    }
 	    }
@@ -689,30 +1241,7 @@ void	loop_io(void)
 	pfd = poll_fdarray;
 #endif
 	if (TST_READ_EVENT(0))
-	    {
-		/* data from the ircd.. */
-		while (1)
-		    {
-			if (rb_len)
-				bcopy(rbuf, iobuf, iob_len = rb_len);
-			if ((i=recv(0,iobuf+iob_len,IOBUFSIZE-iob_len,0)) <= 0)
-			    {
-				DebugLog((ALOG_DIO, 0, "io_loop(): recv(0) returned %d, errno = %d", i, errno));
-				break;
-			    }
-			iob_len += i;
-			DebugLog((ALOG_DIO, 0,
-				  "io_loop(): got %d bytes from ircd [%d]", i,
-				  iob_len));
-			parse_ircd();
-		    }
-		if (i == 0)
-		    {
-			sendto_log(ALOG_DMISC, LOG_NOTICE,
-				   "Daemon exiting. [r]");
-			exit(0);
-		    }
-	    }
+		io_ircd();
 
 #if 0
 /* stupid code that tries to find a bug, but does nothing --Q */
@@ -736,6 +1265,7 @@ void	loop_io(void)
 #endif
 #endif
 }
+#endif /* IAUTH_EPOLL */
 
 /*
  * set_non_blocking (ripped from ircd/s_bsd.c)
@@ -829,3 +1359,275 @@ int	tcp_connect(char *ourIP, char *theirIP, u_short port, char **error)
 	return fd;
 }
 
+/*
+ * udp_connect
+ *
+ *	utility function for use in modules, creates a datagram socket
+ *	connected to an IP/port, so that only replies from there are read.
+ *
+ *	Returns the fd
+ */
+int	udp_connect(char *theirIP, u_short port, char **error)
+{
+	int fd;
+	static char errbuf[BUFSIZ];
+	struct SOCKADDR_IN sk;
+
+	fd = socket(AFINET, SOCK_DGRAM, 0);
+	if (fd < 0)
+	    {
+		sprintf(errbuf, "socket() failed: %s", strerror(errno));
+		*error = errbuf;
+		return -1;
+	    }
+	set_non_blocking(fd, theirIP, port);
+	bzero((char *)&sk, sizeof(sk));
+	sk.SIN_FAMILY = AFINET;
+#if defined(INET6)
+	if(!inetpton(AF_INET6, theirIP, sk.sin6_addr.s6_addr))
+		bcopy(minus_one, sk.sin6_addr.s6_addr, IN6ADDRSZ);
+#else
+	sk.sin_addr.s_addr = inetaddr(theirIP);
+#endif
+	sk.SIN_PORT = htons(port);
+	if (connect(fd, (SAP)&sk, sizeof(sk)) < 0)
+	    {
+		sprintf(errbuf, "connect() to %s %u failed: %s", theirIP, port,
+			strerror(errno));
+		*error = errbuf;
+		close(fd);
+		return -1;
+	    }
+	*error = NULL;
+	return fd;
+}
+
+/*
+ * worker_flush
+ *
+ *	write as much of what is queued for a worker as it will take
+ */
+static	void	worker_flush(int w)
+{
+	int	len;
+
+	if (wkolen[w] == 0)
+		return;
+	if ((len = write(wkfd[w], wkout[w], wkolen[w])) <= 0)
+	    {
+		if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK ||
+				errno == EINTR))
+			return;
+		sendto_log(ALOG_DMISC, LOG_NOTICE,
+			   "Daemon exiting. [w worker %d %s]", w,
+			   strerror(errno));
+		exit(0);
+	    }
+	if ((wkolen[w] -= len))
+		bcopy(wkout[w] + len, wkout[w], wkolen[w]);
+}
+
+/*
+ * worker_write
+ *
+ *	pass a line from ircd to a worker, queueing it if the worker is
+ *	busy: the master must never block on one of them.
+ */
+static	void	worker_write(int w, char *line, int len)
+{
+	if (wkolen[w] + len > WKOUTSIZE)
+	    {
+		worker_flush(w);
+		if (wkolen[w] + len > WKOUTSIZE)
+		    {
+			sendto_log(ALOG_IRCD|ALOG_DMISC, LOG_CRIT,
+				   "Worker %d is not keeping up (fatal)", w);
+			exit(1);
+		    }
+	    }
+	bcopy(line, wkout[w] + wkolen[w], len);
+	wkolen[w] += len;
+}
+
+/*
+ * loop_master
+ *
+ *	what the master process does when there are workers: hand each line
+ *	from ircd to the worker of its entry, and relay the replies.
+ */
+static	void	loop_master(int n)
+{
+	fd_set	read_set, write_set;
+	struct timeval wait;
+	time_t nextst = time(NULL) + 90;
+	char *ch, *buf, *end, *chp;
+	int i, w, cl, len, highfd;
+
+	while (1)
+	    {
+		FD_ZERO(&read_set);
+		FD_ZERO(&write_set);
+		FD_SET(0, &read_set);
+		io_flush();
+		if (ob_len)
+			FD_SET(0, &write_set);
+		highfd = 0;
+		for (w = 0; w < n; w++)
+		    {
+			worker_flush(w);
+			FD_SET(wkfd[w], &read_set);
+			if (wkolen[w])
+				FD_SET(wkfd[w], &write_set);
+			if (wkfd[w] > highfd)
+				highfd = wkfd[w];
+		    }
+		wait.tv_sec = 5; wait.tv_usec = 0;
+		if (select(highfd + 1, (SELECT_FDSET_TYPE *)&read_set,
+			   (SELECT_FDSET_TYPE *)&write_set, 0, &wait) < 0)
+		    {
+			if (errno == EINTR)
+				continue;
+			sendto_log(ALOG_IRCD, LOG_CRIT,
+				   "fatal select error: %s", strerror(errno));
+			exit(1);
+		    }
+
+		if (time(NULL) > nextst)
+		    {
+			/* workers reply with their modules' statistics */
+			sendto_ircd("s");
+			for (w = 0; w < n; w++)
+				worker_write(w, "0 S\n", 4);
+			nextst = time(NULL) + 60;
+		    }
+
+		for (w = 0; w < n; w++)
+		    {
+			if (!FD_ISSET(wkfd[w], &read_set))
+				continue;
+			len = recv(wkfd[w], wkbuf[w] + wklen[w],
+				   IOBUFSIZE - wklen[w], 0);
+			if (len == 0)
+			    {
+				sendto_log(ALOG_IRCD|ALOG_DMISC, LOG_CRIT,
+					   "Worker %d exited.", w);
+				exit(1);
+			    }
+			if (len < 0)
+				continue;
+			wklen[w] += len;
+			/* only whole lines, or they'd get mixed up */
+			for (ch = wkbuf[w] + wklen[w]; ch > wkbuf[w]; ch--)
+				if (ch[-1] == '\n')
+					break;
+			if (ch == wkbuf[w] && wklen[w] == IOBUFSIZE)
+				ch = wkbuf[w] + wklen[w];
+			if ((len = ch - wkbuf[w]) == 0)
+				continue;
+			io_room(len);
+			bcopy(wkbuf[w], obuf + ob_len, len);
+			ob_len += len;
+			if ((wklen[w] -= len))
+				bcopy(wkbuf[w] + len, wkbuf[w], wklen[w]);
+		    }
+
+		if (!FD_ISSET(0, &read_set))
+			continue;
+		while (1)
+		    {
+			if ((i = recv(0, iobuf + iob_len, IOBUFSIZE - iob_len,
+				      0)) <= 0)
+				break;
+			iob_len += i;
+			buf = iobuf;
+			end = iobuf + iob_len;
+			while ((ch = memchr(buf, '\n', end - buf)))
+			    {
+				for (cl = 0, chp = buf; isdigit(*chp); chp++)
+					cl = cl * 10 + *chp - '0';
+				/*
+				** 'M' is for everyone.  'R' (no longer sent by
+				** ircd) would need both entries in one worker.
+				*/
+				if (chp[0] == ' ' && chp[1] == 'M')
+					for (w = 0; w < n; w++)
+						worker_write(w, buf,
+							     ch + 1 - buf);
+				else
+					worker_write(cl % n, buf,
+						     ch + 1 - buf);
+				buf = ch + 1;
+			    }
+			/* keep what's left of the last line */
+			iob_len = end - buf;
+			if (iob_len && buf != iobuf)
+				bcopy(buf, iobuf, iob_len);
+		    }
+		if (i == 0)
+		    {
+			sendto_log(ALOG_DMISC, LOG_NOTICE,
+				   "Daemon exiting. [r]");
+			exit(0);
+		    }
+	    }
+}
+
+/*
+ * start_workers
+ *
+ *	fork n worker processes, each one checking the clients of the ircd
+ *	fd's (entries) having the same remainder by n.  Each one gets its own
+ *	pipe in place of the ircd one (fd 0), and the master passes data
+ *	along.  Only returns in the workers.
+ */
+void	start_workers(int n)
+{
+	int sp[2], w, j, val;
+
+	io_flush();	/* or the workers would send it again */
+
+	for (w = 0; w < n; w++)
+	    {
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, sp) < 0)
+		    {
+			sendto_log(ALOG_IRCD, LOG_CRIT,
+				   "socketpair() failed: %s", strerror(errno));
+			exit(1);
+		    }
+		/* same as what ircd does for its own pipe to us */
+		set_non_blocking(sp[0], "worker", w);
+		set_non_blocking(sp[1], "worker", w);
+		val = IAUTH_BUFFER;
+		for (j = 0; j < 2; j++)
+		    {
+			(void)setsockopt(sp[j], SOL_SOCKET, SO_SNDBUF,
+					 (void *)&val, sizeof(val));
+			(void)setsockopt(sp[j], SOL_SOCKET, SO_RCVBUF,
+					 (void *)&val, sizeof(val));
+		    }
+		switch (fork())
+		    {
+		case -1:
+			sendto_log(ALOG_IRCD, LOG_CRIT, "fork() failed: %s",
+				   strerror(errno));
+			exit(1);
+		case 0:
+			for (j = 0; j < w; j++)
+				close(wkfd[j]);
+			close(sp[0]);
+			(void)dup2(sp[1], 0);
+			close(sp[1]);
+			iauth_worker = w;
+			ob_len = 0;
+			return;
+		default:
+			close(sp[1]);
+			wkfd[w] = sp[0];
+		    }
+	    }
+	sendto_log(ALOG_DMISC, LOG_NOTICE, "Started %d workers.", n);
+	/* the workers save their caches once we're gone */
+	(void)signal(SIGTERM, SIG_DFL);
+	loop_master(n);
+}
+
@@ -25,6 +25,7 @@
  */
 #ifndef A_IO_C
 extern anAuthData      cldata[MAXCONNECTIONS];
+extern int	iauth_worker;
 #endif /* A_IO_C */
 
 /*  External definitions for global functions.
@@ -41,6 +42,11 @@ EXTERN void sendto_ircd (char *, ...);
 EXTERN void init_io (void);
 EXTERN void loop_io (void);
 EXTERN int tcp_connect (char *, char *, u_short, char **);
+EXTERN int udp_connect (char *, u_short, char **);
+EXTERN void start_workers (int);
+EXTERN void io_watch (AnInstance *, int, u_int,
+		      void (*)(AnInstance *, u_int));
+EXTERN void io_done (u_int);
 
 EXTERN char strConn[256];
 EXTERN int strConnLen;
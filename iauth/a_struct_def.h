@@ -23,6 +23,7 @@ typedef struct AuthData anAuthData;
 #define INBUFSIZE 4096		/* I/O buffer size */
 #define MAXI 16			/* maximum number of instances */
 #define BDSIZE ((MAXI + 7) / 8)	/* bit data size */
+#define MAXWORKERS 16		/* maximum number of worker processes */
 
 struct AuthData
 {
@@ -71,3 +72,7 @@ struct AuthData
 #define SetBit(v,n)	v[n/8] |=  (1 << (n % 8))
 #define UnsetBit(v,n)	v[n/8] &= ~(1 << (n % 8))
 #define CheckBit(v,n)	(v[n/8] & (1 << (n % 8)))
+
+/* events given to io_watch() */
+#define	IO_READ		0x1
+#define	IO_WRITE	0x2
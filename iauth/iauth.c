@@ -27,7 +27,7 @@ static const volatile char rcsid[] = "@(#)$Id: iauth.c,v 1.19 2014/04/19 12:26:2
 #include "a_externs.h"
 #undef IAUTH_C
 
-static int do_log = 0;
+static int do_log = 0, do_die = 0;
 
 static	RETSIGTYPE	dummy(int s)
 {
@@ -77,6 +77,11 @@ static	RETSIGTYPE	s_log(int s)
         do_log = 1;
 }
 
+static	RETSIGTYPE	s_die(int s)
+{
+	do_die = 1;
+}
+
 static	void	init_signals(void)
 {
 	/* from ircd/ircd.c setup_signals() */
@@ -110,6 +115,10 @@ static	void	init_signals(void)
 	act.sa_handler = s_log;
 	(void)sigaddset(&act.sa_mask, SIGUSR2);
 	(void)sigaction(SIGUSR2, &act, NULL);
+	/* ircd asks us to go, with the caches saved */
+	act.sa_handler = s_die;
+	(void)sigaddset(&act.sa_mask, SIGTERM);
+	(void)sigaction(SIGTERM, &act, NULL);
 #else
 # ifndef	HAVE_RELIABLE_SIGNALS
 	(void)signal(SIGPIPE, dummy);
@@ -129,6 +138,7 @@ static	void	init_signals(void)
 	(void)signal(SIGINT, s_restart);
 */
 	(void)signal(SIGUSR2, s_log);
+	(void)signal(SIGTERM, s_die);
 #endif
 }
 
@@ -157,7 +167,7 @@ void	write_pidfile(void)
 
 int	main(int argc, char *argv[])
 {
-	time_t	nextst = time(NULL) + 90;
+	time_t	nextst = time(NULL) + 90, nextsave = time(NULL) + VC_SAVE;
 	char *xopt;
 
 	if (argc == 2 && !strcmp(argv[1], "-X"))
@@ -206,16 +216,30 @@ int	main(int argc, char *argv[])
 	init_io();
 	sendto_ircd("V %s", make_version());
 	sendto_ircd("O %s", xopt);
-	conf_ircd();
+	if (workers)
+	    {
+		write_pidfile();
+		/*
+		** modules are initialized in each worker, so that they
+		** don't share connections, and the first one tells ircd.
+		*/
+		start_workers(workers);
+		conf_init();
+	    }
+	if (iauth_worker <= 0)
+	    {
+		conf_ircd();
 
 #if defined(IAUTH_DEBUG)
-	if (debuglevel & ALOG_DIRCD)
-		sendto_ircd("G 1");
-	else
+		if (debuglevel & ALOG_DIRCD)
+			sendto_ircd("G 1");
+		else
 #endif
-		sendto_ircd("G 0");
+			sendto_ircd("G 0");
+	    }
 
-	write_pidfile();
+	if (!workers)
+		write_pidfile();
 	while (1)
 	    {
 		loop_io();
@@ -228,7 +252,21 @@ int	main(int argc, char *argv[])
 			do_log = 0;
 		    }
 
-		if (time(NULL) > nextst)
+		if (do_die)
+		    {
+			sendto_log(ALOG_DMISC, LOG_NOTICE,
+				   "Got SIGTERM, exiting.");
+			exit(0);	/* vc_save() is called at exit */
+		    }
+
+		if (time(NULL) > nextsave)
+		    {
+			vc_save();
+			nextsave = time(NULL) + VC_SAVE;
+		    }
+
+		/* workers' statistics are asked for by the master */
+		if (time(NULL) > nextst && !workers)
 		    {
 			AnInstance *itmp = instances;
 
@@ -31,14 +31,11 @@ static const volatile char rcsid[] = "@(#)$Id: mod_dnsbl.c,v 1.1 2014/08/25 14:0
 /****************************** PRIVATE *************************************/
 
 #define CACHETIME 30
-
-struct hostlog
-{
-	struct hostlog *next;
-	char ip[HOSTLEN+1];
-	u_char state; /* 0 = not found, 1 = found, 2 = timeout */
-	time_t expire;
-};
+#define	DNSBL_MAXZONES	32	/* one bit each in dnsbl_query.pending */
+#define	DNSBL_MAXNS	3	/* nameservers read from resolv.conf */
+#define	DNSBL_RESEND	3	/* seconds before asking again */
+#define	DNSBL_PACKETSZ	512
+#define	DNSBL_PORT	53
 
 #define OPT_LOG		0x001
 #define OPT_DENY	0x002
@@ -56,22 +53,45 @@ struct dnsbl_list
 
 struct dnsbl_private
 {
-	struct hostlog *cache;
+	aVCache *cache;		/* verdicts are OK, DNSBL_FOUND, DNSBL_FAILED */
 	char *reason;
 	u_int lifetime;
 	u_char options;
 	/* stats */
-	u_int chitc, chito, chitn, cmiss, cnow, cmax;
+	u_int chitc, chito, chitn, cmiss;
 	u_int found, failed, good, total, rejects;
 	struct dnsbl_list *host_list;
+	char *zone[DNSBL_MAXZONES];
+	u_int nzones;
+};
+
+/*
+** A check in progress: one query per zone, all sent at once on the same
+** socket (cldata[cl].rfd), with consecutive ids starting at 'id'.
+*/
+struct dnsbl_query
+{
+	u_char addr[16];
+	u_char alen;
+	u_short id;
+	u_int pending;		/* zones without an answer yet */
+	u_char failed;		/* a zone could not be checked */
+	u_int ns;		/* nameserver in use */
+	time_t deadline;	/* set by the instance timeout */
 };
 
+static	struct dnsbl_query	*queries[MAXCONNECTIONS];
+static	char	*nameservers[DNSBL_MAXNS];
+static	int	nscount = 0;
+
+static	void	dnsbl_clean(u_int);
+
 /*
  * dnsbl_succeed
  *
  * Found a host in DNSBL. Deal with it.
  */
-static	void	dnsbl_succeed(u_int cl, char *listname, char *result)
+static	void	dnsbl_succeed(u_int cl, char *listname, u_char *result)
 {
 	struct dnsbl_private *mydata = cldata[cl].instance->data;
 	char *reason = mydata->reason;
@@ -96,10 +116,9 @@ static	void	dnsbl_succeed(u_int cl, char *listname, char *result)
  *
  * Add an entry to the cache.
  */
-static	void	dnsbl_add_cache(u_int cl, u_int state)
+static	void	dnsbl_add_cache(u_int cl, u_int state, u_char *result)
 {
 	struct dnsbl_private *mydata = cldata[cl].instance->data;
-	struct hostlog *next;
 
 	if (state == DNSBL_FOUND)
 	mydata->found++;
@@ -111,19 +130,10 @@ static	void	dnsbl_add_cache(u_int cl, u_int state)
 	if (mydata->lifetime == 0)
 		return;
 
-	mydata->cnow ++;
-	if (mydata->cnow > mydata->cmax)
-		mydata->cmax = mydata->cnow;
-
-	next = mydata->cache;
-	mydata->cache = (struct hostlog *)malloc(sizeof(struct hostlog));
-	mydata->cache->expire = time(NULL) + mydata->lifetime;
-	strcpy(mydata->cache->ip, cldata[cl].itsip);
-	mydata->cache->state = state;
-	mydata->cache->next = next;
+	vc_put(mydata->cache, cldata[cl].itsip, state, result);
 	DebugLog((ALOG_DNSBLC, 0,
 		"dnsbl_add_cache(%d): new cache %s, result=%d",
-		cl, mydata->cache->ip, state));
+		cl, cldata[cl].itsip, state));
 }
 
 /*
@@ -134,8 +144,7 @@ static	void	dnsbl_add_cache(u_int cl, u_int state)
 static	int	dnsbl_check_cache(u_int cl)
 {
 	struct dnsbl_private *mydata = cldata[cl].instance->data;
-	struct hostlog **last, *pl;
-	time_t now = time(NULL);
+	aVEntry *ve;
 
 	if (!mydata || mydata->lifetime == 0)
 				return 0;
@@ -144,44 +153,221 @@ static	int	dnsbl_check_cache(u_int cl)
 		"dnsbl_check_cache(%d): Checking cache for %s",
 		cl, cldata[cl].itsip));
 
-	last = &(mydata->cache);
-	while ((pl = *last))
+	if ((ve = vc_get(mydata->cache, cldata[cl].itsip)))
 	{
-		DebugLog((ALOG_DNSBLC, 0, "dnsbl_check_cache(%d): cache %s",
-			cl, pl->ip));
-		if (pl->expire < now)
+		DebugLog((ALOG_DNSBLC, 0,
+			"dnsbl_check_cache(%d): match (%u)",
+			cl, ve->verdict));
+		if (ve->verdict == DNSBL_FOUND)
 		{
-			DebugLog((ALOG_DNSBLC, 0,
-				"dnsbl_check_cache(%d): free %s (%d < %d)",
-				cl, pl->ip, pl->expire, now));
-			*last = pl->next;
-			free(pl);
-			mydata->cnow --;
-			continue;
+			dnsbl_succeed(cl, "cached", ve->data);
+			mydata->chito++;
 		}
-		if (!strcasecmp(pl->ip, cldata[cl].itsip))
-		{
-			DebugLog((ALOG_DNSBLC, 0,
-				"dnsbl_check_cache(%d): match (%u)",
-				cl, pl->state));
-			pl->expire = now + mydata->lifetime; /* dubious */
-			if (pl->state == 1)
-			{
-				dnsbl_succeed(cl, "cached", "");
-				mydata->chito++;
-			}
-			else if (pl->state == 0)
-				mydata->chitn++;
-			else
-				mydata->chitc++;
+		else if (ve->verdict == OK)
+			mydata->chitn++;
+		else
+			mydata->chitc++;
+		return -1;
+	}
+	mydata->cmiss++;
+	return 0;
+}
+
+/*
+ * dnsbl_parse_ip
+ *
+ * Returns the length of the address (4 or 16), 0 if it isn't one.
+ */
+static	int	dnsbl_parse_ip(char *ip, u_char *addr)
+{
+	if (inet_pton(AF_INET, ip, addr) == 1)
+		return 4;
+	if (inet_pton(AF_INET6, ip, addr) != 1)
+		return 0;
+	if (IN6_IS_ADDR_V4MAPPED((struct in6_addr *)addr))
+	{
+		bcopy(addr + 12, addr, 4);
+		return 4;
+	}
+	return 16;
+}
+
+/*
+ * dnsbl_mkquery
+ *
+ * Build the query for the A record of the address in a zone, IPv6
+ * addresses are reversed nibble by nibble.
+ * Returns the length of the query, -1 if the name doesn't fit.
+ */
+static	int	dnsbl_mkquery(u_char *buf, struct dnsbl_query *q, u_int zone,
+			      char *host)
+{
+	char name[DNSBL_PACKETSZ], *s;
+	u_char *p, *lp;
+	int i;
+
+	if (strlen(host) > 255)
+		return -1;
+	if (q->alen == 4)
+		sprintf(name, "%u.%u.%u.%u.%s", q->addr[3], q->addr[2],
+			q->addr[1], q->addr[0], host);
+	else
+	{
+		for (s = name, i = 15; i >= 0; i--, s += 4)
+			sprintf(s, "%x.%x.", q->addr[i] & 0xf, q->addr[i] >> 4);
+		strcpy(s, host);
+	}
+
+	bzero((char *)buf, 12);
+	buf[0] = (q->id + zone) >> 8;
+	buf[1] = (q->id + zone) & 0xff;
+	buf[2] = 0x01;		/* recursion desired */
+	buf[5] = 1;		/* one question */
+	for (p = buf + 12, s = name; *s; )
+	{
+		lp = p++;
+		while (*s && *s != '.')
+			*p++ = *s++;
+		if (p - lp - 1 == 0 || p - lp - 1 > 63)
 			return -1;
+		*lp = p - lp - 1;
+		if (*s)
+			s++;
+	}
+	*p++ = 0;
+	*p++ = 0; *p++ = 1;	/* type A */
+	*p++ = 0; *p++ = 1;	/* class IN */
+	return p - buf;
+}
+
+/*
+ * dnsbl_send
+ *
+ * Send the queries for all the zones not answered yet.
+ */
+static	int	dnsbl_send(u_int cl)
+{
+	struct dnsbl_private *mydata = cldata[cl].instance->data;
+	struct dnsbl_query *q = queries[cl];
+	u_char buf[DNSBL_PACKETSZ];
+	u_int i;
+	int len;
+
+	for (i = 0; i < mydata->nzones; i++)
+	{
+		if (!(q->pending & (1 << i)))
+			continue;
+		if ((len = dnsbl_mkquery(buf, q, i, mydata->zone[i])) < 0)
+		{
+			q->pending &= ~(1 << i);
+			continue;
 		}
-		last = &(pl->next);
+		DebugLog((ALOG_DNSBL, 0, "dnsbl_send(%d): %s in %s to %s",
+			cl, cldata[cl].itsip, mydata->zone[i],
+			nameservers[q->ns]));
+		if (send(cldata[cl].rfd, buf, len, 0) != len)
+			return -1;
 	}
-	mydata->cmiss++;
 	return 0;
 }
 
+/*
+ * dnsbl_skipname
+ */
+static	u_char	*dnsbl_skipname(u_char *p, u_char *end)
+{
+	while (p < end)
+	{
+		if (*p == 0)
+			return p + 1;
+		if ((*p & 0xc0) == 0xc0)
+			return (p + 2 <= end) ? p + 2 : NULL;
+		p += *p + 1;
+	}
+	return NULL;
+}
+
+/*
+ * dnsbl_answer
+ *
+ * Parse an answer from the nameserver.
+ * Returns -1 if it's garbage, DNSBL_FOUND (with result set) if an A
+ * record came back, DNSBL_FAILED on server failure, OK otherwise.
+ */
+static	int	dnsbl_answer(u_char *buf, int len, u_short *id, u_char *result)
+{
+	u_char *p = buf + 12, *end = buf + len;
+	int qd, an, type, rdlen;
+
+	if (len < 12 || !(buf[2] & 0x80))	/* not an answer */
+		return -1;
+	*id = (buf[0] << 8) | buf[1];
+	switch (buf[3] & 0x0f)
+	{
+	case 0:
+		break;
+	case 3:		/* no such name: not listed */
+		return OK;
+	default:
+		return DNSBL_FAILED;
+	}
+	qd = (buf[4] << 8) | buf[5];
+	an = (buf[6] << 8) | buf[7];
+	while (qd-- > 0)
+	{
+		if (!(p = dnsbl_skipname(p, end)) || p + 4 > end)
+			return -1;
+		p += 4;
+	}
+	while (an-- > 0)
+	{
+		if (!(p = dnsbl_skipname(p, end)) || p + 10 > end)
+			return -1;
+		type = (p[0] << 8) | p[1];
+		rdlen = (p[8] << 8) | p[9];
+		p += 10;
+		if (p + rdlen > end)
+			return -1;
+		if (type == 1 && rdlen == 4)
+		{
+			bcopy(p, result, 4);
+			return DNSBL_FOUND;
+		}
+		p += rdlen;
+	}
+	return OK;
+}
+
+/*
+ * dnsbl_read_resolv
+ *
+ * Get the nameservers out of resolv.conf, 127.0.0.1 if there is none.
+ */
+static	void	dnsbl_read_resolv(void)
+{
+	FILE *fp;
+	char line[256], addr[64];
+
+	if ((fp = fopen("/etc/resolv.conf", "r")))
+	{
+		while (nscount < DNSBL_MAXNS && fgets(line, sizeof(line), fp))
+		{
+			if (sscanf(line, "nameserver %63s", addr) != 1)
+				continue;
+#if !defined(INET6)
+			if (index(addr, ':'))
+				continue;
+#endif
+			nameservers[nscount++] = strdup(addr);
+			sendto_log(ALOG_DMISC, LOG_NOTICE,
+				"dnsbl_init: using nameserver %s", addr);
+		}
+		fclose(fp);
+	}
+	if (nscount == 0)
+		nameservers[nscount++] = strdup("127.0.0.1");
+}
+
 /******************************** PUBLIC ************************************/
 
 /*
@@ -197,6 +383,7 @@ static	char	*dnsbl_init(AnInstance *self)
 	struct dnsbl_list *l;
 	char tmpbuf[255], cbuf[32], *s;
 	static char txtbuf[255];
+	int i;
 	
 	if (self->opt == NULL)
 		return "Aie! no option(s): nothing to be done!";
@@ -204,7 +391,6 @@ static	char	*dnsbl_init(AnInstance *self)
 	mydata = (struct dnsbl_private *) malloc(sizeof(struct dnsbl_private));
 	bzero((char *) mydata, sizeof(struct dnsbl_private));
 	self->data = mydata;
-	mydata->cache = NULL;
 	mydata->host_list = NULL;
 	mydata->lifetime = CACHETIME;
 	
@@ -262,14 +448,21 @@ static	char	*dnsbl_init(AnInstance *self)
 		DebugLog((ALOG_DNSBL, 0, "dnsbl_init: Aie! No DNSBL host: nothing to be done!"));
 		return "Aie! No DNSBL host: nothing to be done!";
 	}
-	
-	if (strstr(self->opt, "cache"))
+	/* the list was built backwards */
+	for (l = mydata->host_list; l; l = l->next)
+		mydata->nzones++;
+	if (mydata->nzones > DNSBL_MAXZONES)
+		return "Aie! Too many DNSBL hosts!";
+	for (i = mydata->nzones, l = mydata->host_list; l; l = l->next)
+		mydata->zone[--i] = l->host;
+	if (nscount == 0)
 	{
-		char *ch = index(self->opt, '=');
-		
-		if (ch)
-			mydata->lifetime = atoi(++ch);
+		dnsbl_read_resolv();
+		srandom(time(NULL) ^ getpid());
 	}
+	
+	if (strstr(self->opt, "cache="))
+		mydata->lifetime = atoi(strstr(self->opt, "cache=") + 6);
 	sprintf(cbuf, ",cache=%d", mydata->lifetime);
 	strcat(tmpbuf, cbuf);
 	sprintf(cbuf, ", Cache %d (min)", mydata->lifetime);
@@ -294,6 +487,8 @@ static	char	*dnsbl_init(AnInstance *self)
 	mydata->reason = mystrdup(self->reason);
 	}
 	self->popt = strdup(tmpbuf + 1);
+	if (mydata->lifetime)
+		mydata->cache = vc_open(self, mydata->lifetime);
 	return txtbuf + 2;
 }
 
@@ -313,6 +508,8 @@ void	dnsbl_release(AnInstance *self)
 	n = l->next;
 	free(l);
 	}
+	if (mydata->cache)
+		vc_close(mydata->cache);
 
 	free(mydata);
 	free(self->popt);
@@ -345,11 +542,10 @@ static	void	dnsbl_stats(AnInstance *self)
 static	int	dnsbl_start(u_int cl)
 {
 	struct dnsbl_private *mydata = cldata[cl].instance->data;
-	struct dnsbl_list *l, *m;
-	char *req;
-	char *ip, *c1, *c2, *c3;
-	int  ipl;
-	struct hostent *hst = NULL;
+	struct dnsbl_query *q;
+	u_char addr[16];
+	int alen, fd;
+	char *error;
 	
 	if (cldata[cl].state & A_DENY)
 	{
@@ -359,51 +555,50 @@ static	int	dnsbl_start(u_int cl)
 		return -1;
 	}
 
-	if (strchr(cldata[cl].itsip,':'))
+	if (!(alen = dnsbl_parse_ip(cldata[cl].itsip, addr)))
 	{
 		DebugLog((ALOG_DNSBL, 0,
-			"dnsbl_start(%d): %s is IPv6, skipping ",
+			"dnsbl_start(%d): %s is not an address, skipping ",
 			cl, cldata[cl].itsip));
 		return -1;
 	}
 
 	if (dnsbl_check_cache(cl))
 		return -1;
-	
-	ip = strdup(cldata[cl].itsip);
-	ipl = strlen(ip);
-	DebugLog((ALOG_DNSBL, 0, "dnsbl_start(%d): checking %s", cl, ip));
-
-	strtok(ip, ".");
-	c3 = strtok(NULL, ".");
-	c2 = strtok(NULL, ".");
-	c1 = strtok(NULL, ".");
 
-	for (l = mydata->host_list; l && !hst; l = l->next)
+	if ((fd = udp_connect(nameservers[0], DNSBL_PORT, &error)) < 0)
 	{
-		req = malloc(strlen(l->host) + ipl + 3);
-		sprintf( req, "%s.%s.%s.%s.%s", c1, c2, c3, ip, l->host);
-		DebugLog((ALOG_DNSBL, 0,
-			"dnsbl_start(%d): gethostbyname() for %s",
-			cl, req ));
-		hst = gethostbyname(req);
-		m = l;
-		free(req);
+		sendto_log(ALOG_IRCD|ALOG_DMISC, LOG_ERR,
+			"dnsbl_start(%d): udp_connect() failed: %s",
+			cl, error);
+		return -1;
 	}
+	q = queries[cl] = (struct dnsbl_query *)
+		malloc(sizeof(struct dnsbl_query));
+	bzero((char *)q, sizeof(struct dnsbl_query));
+	bcopy(addr, q->addr, alen);
+	q->alen = alen;
+	q->id = random() & 0xffff;
+	q->pending = (mydata->nzones == DNSBL_MAXZONES) ? ~0 :
+		(1 << mydata->nzones) - 1;
+	q->deadline = cldata[cl].timeout;
+	cldata[cl].rfd = fd;
 	mydata->total++;
 
-	if (hst)
-		dnsbl_succeed(cl, m->host, hst->h_addr_list[0]);
-	else
+	DebugLog((ALOG_DNSBL, 0, "dnsbl_start(%d): checking %s in %d lists",
+		cl, cldata[cl].itsip, mydata->nzones));
+	if (dnsbl_send(cl) < 0)
 	{
-		DebugLog((ALOG_DNSBL, 0,
-			"dnsbl_start(%d): gethostbyname() reported %s",
-			cl, hstrerror(h_errno) ));
-		dnsbl_add_cache(cl, DNSBL_FAILED);
+		sendto_log(ALOG_IRCD|ALOG_DMISC, LOG_ERR,
+			"dnsbl_start(%d): send() failed: %s",
+			cl, strerror(errno));
+		dnsbl_add_cache(cl, DNSBL_FAILED, NULL);
+		dnsbl_clean(cl);
+		return -1;
 	}
-
-	free(ip);
-	return -1;
+	if (cldata[cl].timeout > time(NULL) + DNSBL_RESEND)
+		cldata[cl].timeout = time(NULL) + DNSBL_RESEND;
+	return 0;
 }
 
 /*
@@ -417,12 +612,42 @@ static	int	dnsbl_start(u_int cl)
  */
 static	int	dnsbl_work(u_int cl)
 {
-	/*
-	** There' nothing to do here
-	*/
-	DebugLog((ALOG_DNSBL, 0,
-		"dnsbl_work(%d) invoked but why?", cl ));
-	return 0;
+	struct dnsbl_private *mydata = cldata[cl].instance->data;
+	struct dnsbl_query *q = queries[cl];
+	u_char result[4];
+	u_short id, zone;
+	int r;
+
+	/* one datagram per recv(), and one answer per datagram */
+	r = dnsbl_answer((u_char *)cldata[cl].inbuffer, cldata[cl].buflen,
+			 &id, result);
+	cldata[cl].buflen = 0;
+	zone = id - q->id;
+	if (r < 0 || zone >= mydata->nzones || !(q->pending & (1 << zone)))
+	{
+		DebugLog((ALOG_DNSBL, 0,
+			"dnsbl_work(%d): unexpected answer (%d, %u)",
+			cl, r, id));
+		return 0;
+	}
+	q->pending &= ~(1 << zone);
+	DebugLog((ALOG_DNSBL, 0, "dnsbl_work(%d): %s answered %d", cl,
+		mydata->zone[zone], r));
+
+	if (r == DNSBL_FOUND)
+	{
+		/* no need to wait for the other lists */
+		dnsbl_succeed(cl, mydata->zone[zone], result);
+		dnsbl_add_cache(cl, DNSBL_FOUND, result);
+	}
+	else if (r == DNSBL_FAILED)
+		q->failed = 1;
+	if (r != DNSBL_FOUND && q->pending)
+		return 0;
+	if (r != DNSBL_FOUND)
+		dnsbl_add_cache(cl, q->failed ? DNSBL_FAILED : OK, NULL);
+	dnsbl_clean(cl);
+	return -1;
 }
 
 /*
@@ -435,10 +660,14 @@ static	int	dnsbl_work(u_int cl)
 static	void	dnsbl_clean(u_int cl)
 {
 	DebugLog((ALOG_DNSBL, 0, "dnsbl_clean(%d): cleaning up", cl));
-	/*
-	** only one of rfd and wfd may be set at the same time,
-	** in any case, they would be the same fd, so only close() once
-	*/
+	if (cldata[cl].rfd)
+		close(cldata[cl].rfd);
+	cldata[cl].rfd = 0;
+	if (queries[cl])
+	{
+		free(queries[cl]);
+		queries[cl] = NULL;
+	}
 }
 
 /*
@@ -451,7 +680,33 @@ static	void	dnsbl_clean(u_int cl)
  */
 static	int	dnsbl_timeout(u_int cl)
 {
+	struct dnsbl_query *q = queries[cl];
+	time_t now = time(NULL);
+	char *error;
+	int fd;
+
+	if (q && now < q->deadline)
+	{
+		/*
+		** ask again what is still missing, from the next nameserver.
+		*/
+		q->ns = (q->ns + 1) % nscount;
+		if ((fd = udp_connect(nameservers[q->ns], DNSBL_PORT,
+				      &error)) >= 0)
+		{
+			close(cldata[cl].rfd);
+			cldata[cl].rfd = fd;
+			if (dnsbl_send(cl) == 0)
+			{
+				cldata[cl].timeout = MIN(now + DNSBL_RESEND,
+							 q->deadline);
+				return 0;
+			}
+		}
+	}
 	DebugLog((ALOG_DNSBL, 0, "dnsbl_timeout(%d): calling dnsbl_clean ", cl));
+	if (q)
+		dnsbl_add_cache(cl, DNSBL_FAILED, NULL);
 	dnsbl_clean(cl);
 	return -1;
 }
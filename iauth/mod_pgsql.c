@@ -35,19 +35,405 @@ static const volatile char rcsid[] = "@(#)$Id: mod_pgsql.c,v 1.1 2014/09/03 10:5
 
 /****************************** PRIVATE *************************************/
 
-static PGconn *conn = NULL;
-static char connstring[1024];
+/*
+** Queries are sent without waiting for the previous ones to be answered
+** (libpq pipeline mode, when available), prepared statements are used,
+** and the connection is watched by loop_io() through io_watch().  The
+** queries in flight are kept in a ring, in the order answers will come.
+*/
+#define CACHETIME	1	/* minutes */
+#define	PG_QUEUE	1024	/* queries in the ring, a power of 2 */
+#define	PG_RETRYMIN	2	/* seconds before connecting again.. */
+#define	PG_RETRYMAX	120	/* ..doubled after each failure, up to this */
 
 #define OPT_LOG         0x001
 #define OPT_DENY        0x002
 
+#define	PG_DOWN		0
+#define	PG_CONNECTING	1
+#define	PG_READY	2
+
+#define	PGQ_PREPLOG	1	/* prepare the statements */
+#define	PGQ_PREPCHECK	2
+#define	PGQ_LOG		3	/* log a connection */
+#define	PGQ_CHECK	4	/* look for a kline */
+#define	PGQ_SYNC	5	/* end of a pipeline segment */
+
+struct pgsql_query
+{
+	u_int	cl;
+	u_char	what;		/* PGQ_* */
+	u_char	found, failed;
+	char	ip[HOSTLEN+1];
+};
+
 struct pgsql_private
 {
-	u_char options;
+	PGconn	*conn;
+	char	*connstring;
+	u_char	state;		/* PG_DOWN, PG_CONNECTING, PG_READY */
+	time_t	retry;		/* when to connect again, if PG_DOWN */
+	u_int	backoff;
+	aVCache	*cache;		/* verdicts are 1 if klined, 0 if not */
+	u_int	lifetime;
+	struct pgsql_query *queue;
+	u_int	qhead;		/* oldest query not answered */
+	u_int	qsent;		/* next query to send */
+	u_int	qtail;		/* next free */
+	u_char	options;
 	/* stats */
-	u_int logged, denied;
+	u_int logged, denied, cached, failed, skipped, timeouts, connects;
+	u_int inflight;		/* highest number of queries in the ring */
 };
 
+static	void	pgsql_event(AnInstance *, u_int);
+
+/*
+ * pgsql_error
+ *
+ *	libpq messages end with a newline, which the log doesn't want.
+ */
+static	char	*pgsql_error(char *s)
+{
+	static char buf[256];
+	char *ch;
+
+	if (BadPtr(s))
+		return "?";
+	strncpyzt(buf, s, sizeof(buf));
+	if ((ch = index(buf, '\n')))
+		*ch = '\0';
+	return buf;
+}
+
+/*
+ * pgsql_deny
+ */
+static	void	pgsql_deny(u_int cl, struct pgsql_private *mydata,
+			   char *reason)
+{
+	mydata->denied++;
+	if (!reason)
+	{
+		reason = "Denied access (SQL)";
+	}
+	cldata[cl].state |= A_DENY;
+	sendto_ircd("k %d %s %u :%s", cl, cldata[cl].itsip,
+		cldata[cl].itsport, reason);
+}
+
+/*
+ * pgsql_queue
+ *
+ *	Add a query to the ring, returns its slot.
+ */
+static	u_int	pgsql_queue(struct pgsql_private *mydata, u_int cl, u_char what)
+{
+	struct pgsql_query *q = &mydata->queue[mydata->qtail % PG_QUEUE];
+
+#if !defined(LIBPQ_HAS_PIPELINING)
+	/* queries are sent one at a time */
+	if (what == PGQ_SYNC)
+		return 0;
+#endif
+	q->cl = cl;
+	q->what = what;
+	q->found = q->failed = 0;
+	if (what == PGQ_LOG || what == PGQ_CHECK)
+		strcpy(q->ip, cldata[cl].itsip);
+	if (mydata->qtail - mydata->qhead >= mydata->inflight)
+		mydata->inflight = mydata->qtail - mydata->qhead + 1;
+	return mydata->qtail++ % PG_QUEUE;
+}
+
+/*
+ * pgsql_fail
+ *
+ *	The connection is unusable: drop it, and let entries which were
+ *	waiting for an answer go on.
+ */
+static	void	pgsql_fail(AnInstance *self, char *what)
+{
+	struct pgsql_private *mydata = self->data;
+	struct pgsql_query *q;
+	u_int head = mydata->qhead, tail = mydata->qtail;
+
+	sendto_log(ALOG_IRCD, LOG_ERR, "pgsql: %s, retrying in %us: %s",
+		what, mydata->backoff,
+		pgsql_error(PQerrorMessage(mydata->conn)));
+	io_watch(self, -1, 0, NULL);
+	PQfinish(mydata->conn);
+	mydata->conn = NULL;
+	mydata->state = PG_DOWN;
+	mydata->retry = time(NULL) + mydata->backoff;
+	mydata->backoff = MIN(mydata->backoff * 2, PG_RETRYMAX);
+	mydata->qhead = mydata->qsent = mydata->qtail = 0;
+	for (; head != tail; head++)
+	{
+		q = &mydata->queue[head % PG_QUEUE];
+		if (q->what == PGQ_CHECK && cldata[q->cl].instance == self &&
+		    cldata[q->cl].mod_status == head % PG_QUEUE + 1)
+		{
+			mydata->failed++;
+			io_done(q->cl);
+		}
+	}
+}
+
+/*
+ * pgsql_connect
+ *
+ *	Start connecting, the statements are prepared first thing once
+ *	connected.
+ */
+static	void	pgsql_connect(AnInstance *self)
+{
+	struct pgsql_private *mydata = self->data;
+
+	mydata->connects++;
+	mydata->conn = PQconnectStart(mydata->connstring);
+	if (!mydata->conn || PQstatus(mydata->conn) == CONNECTION_BAD ||
+	    PQsocket(mydata->conn) < 0)
+	{
+		pgsql_fail(self, "connection failed");
+		return;
+	}
+	mydata->state = PG_CONNECTING;
+	if (mydata->options & OPT_LOG)
+	{
+		pgsql_queue(mydata, 0, PGQ_PREPLOG);
+		pgsql_queue(mydata, 0, PGQ_SYNC);
+	}
+	if (mydata->options & OPT_DENY)
+	{
+		pgsql_queue(mydata, 0, PGQ_PREPCHECK);
+		pgsql_queue(mydata, 0, PGQ_SYNC);
+	}
+	/* PQconnectPoll() is first called once the socket is writable */
+	io_watch(self, PQsocket(mydata->conn), IO_WRITE, pgsql_event);
+}
+
+/*
+ * pgsql_send
+ *
+ *	Send what is waiting in the ring, and see what to wait for.
+ */
+static	void	pgsql_send(AnInstance *self)
+{
+	struct pgsql_private *mydata = self->data;
+	struct pgsql_query *q;
+	const char *param[1];
+	int r = 1;
+
+	if (mydata->state != PG_READY)
+		return;
+	while (mydata->qsent != mydata->qtail)
+	{
+#if !defined(LIBPQ_HAS_PIPELINING)
+		if (mydata->qsent != mydata->qhead)
+			break;
+#endif
+		q = &mydata->queue[mydata->qsent % PG_QUEUE];
+		param[0] = q->ip;
+		switch (q->what)
+		{
+		/* CREATE TABLE ircd_conn (ip cidr, date timestamp); */
+		case PGQ_PREPLOG:
+			r = PQsendPrepare(mydata->conn, "iauth_log",
+				"INSERT INTO ircd_conn (ip,date) VALUES ($1,now())",
+				1, NULL);
+			break;
+		/* CREATE TABLE ircd_kline (ip cidr); */
+		case PGQ_PREPCHECK:
+			r = PQsendPrepare(mydata->conn, "iauth_check",
+				"SELECT ip FROM ircd_kline WHERE $1<<=ip LIMIT 1",
+				1, NULL);
+			break;
+		case PGQ_LOG:
+			r = PQsendQueryPrepared(mydata->conn, "iauth_log", 1,
+				param, NULL, NULL, 0);
+			break;
+		case PGQ_CHECK:
+			r = PQsendQueryPrepared(mydata->conn, "iauth_check",
+				1, param, NULL, NULL, 0);
+			break;
+#if defined(LIBPQ_HAS_PIPELINING)
+		case PGQ_SYNC:
+			r = PQpipelineSync(mydata->conn);
+			break;
+#endif
+		}
+		if (!r)
+		{
+			pgsql_fail(self, "cannot send");
+			return;
+		}
+		mydata->qsent++;
+	}
+	if ((r = PQflush(mydata->conn)) < 0)
+	{
+		pgsql_fail(self, "cannot send");
+		return;
+	}
+	/* PQflush() returns 1 if it couldn't send everything */
+	io_watch(self, PQsocket(mydata->conn), IO_READ | (r ? IO_WRITE : 0),
+		pgsql_event);
+}
+
+/*
+ * pgsql_done
+ *
+ *	All results of a query were read.
+ */
+static	void	pgsql_done(AnInstance *self, struct pgsql_query *q, u_int slot)
+{
+	struct pgsql_private *mydata = self->data;
+
+	switch (q->what)
+	{
+	case PGQ_PREPLOG:
+	case PGQ_PREPCHECK:
+		if (q->failed)
+			sendto_log(ALOG_IRCD, LOG_ERR,
+				"pgsql: cannot prepare %s statement",
+				(q->what == PGQ_PREPLOG) ? "log" : "check");
+		break;
+	case PGQ_LOG:
+		if (q->failed)
+			mydata->failed++;
+		else
+			mydata->logged++;
+		break;
+	case PGQ_CHECK:
+		if (!q->failed && mydata->cache)
+			vc_put(mydata->cache, q->ip, q->found, NULL);
+		/* is the entry still waiting for this answer? */
+		if (cldata[q->cl].instance != self ||
+		    cldata[q->cl].mod_status != slot + 1)
+			break;
+		if (q->failed)
+			mydata->failed++;
+		else if (q->found)
+			pgsql_deny(q->cl, mydata, self->reason);
+		io_done(q->cl);
+		break;
+	}
+}
+
+/*
+ * pgsql_results
+ *
+ *	Read the results which have arrived.
+ */
+static	void	pgsql_results(AnInstance *self)
+{
+	struct pgsql_private *mydata = self->data;
+	struct pgsql_query *q;
+	PGresult *res;
+	u_int slot;
+
+	while (mydata->qhead != mydata->qsent && !PQisBusy(mydata->conn))
+	{
+		slot = mydata->qhead % PG_QUEUE;
+		q = &mydata->queue[slot];
+		res = PQgetResult(mydata->conn);
+		if (q->what == PGQ_SYNC)
+		{
+			/* not followed by NULL, unlike queries */
+			if (!res)
+				break;
+			PQclear(res);
+			mydata->qhead++;
+			continue;
+		}
+		if (!res)
+		{
+			mydata->qhead++;
+			pgsql_done(self, q, slot);
+			continue;
+		}
+		switch (PQresultStatus(res))
+		{
+		case PGRES_TUPLES_OK:
+			if (PQntuples(res) > 0)
+				q->found = 1;
+			break;
+		case PGRES_COMMAND_OK:
+			break;
+#if defined(LIBPQ_HAS_PIPELINING)
+		case PGRES_PIPELINE_ABORTED:
+			/* an earlier query failed, and was logged */
+			q->failed = 1;
+			break;
+#endif
+		default:
+			q->failed = 1;
+			sendto_log(ALOG_IRCD, LOG_NOTICE,
+				"pgsql: query failed for %s: %s",
+				(q->what >= PGQ_LOG) ? q->ip : "prepare",
+				pgsql_error(PQresultErrorMessage(res)));
+			break;
+		}
+		PQclear(res);
+	}
+}
+
+/*
+ * pgsql_event
+ *
+ *	Called by loop_io() when the connection is ready.
+ */
+static	void	pgsql_event(AnInstance *self, u_int events)
+{
+	struct pgsql_private *mydata = self->data;
+
+	if (mydata->state == PG_CONNECTING)
+	{
+		switch (PQconnectPoll(mydata->conn))
+		{
+		case PGRES_POLLING_READING:
+			io_watch(self, PQsocket(mydata->conn), IO_READ,
+				pgsql_event);
+			return;
+		case PGRES_POLLING_WRITING:
+			io_watch(self, PQsocket(mydata->conn), IO_WRITE,
+				pgsql_event);
+			return;
+		case PGRES_POLLING_OK:
+			break;
+		default:
+			pgsql_fail(self, "connection failed");
+			return;
+		}
+		if (PQsetnonblocking(mydata->conn, 1) < 0
+#if defined(LIBPQ_HAS_PIPELINING)
+		    || !PQenterPipelineMode(mydata->conn)
+#endif
+		    )
+		{
+			pgsql_fail(self, "cannot set up connection");
+			return;
+		}
+		sendto_log(ALOG_IRCD, LOG_NOTICE, "pgsql: connected");
+		mydata->state = PG_READY;
+		mydata->backoff = PG_RETRYMIN;
+		pgsql_send(self);
+		return;
+	}
+	if ((events & IO_READ) && !PQconsumeInput(mydata->conn))
+	{
+		pgsql_fail(self, "connection lost");
+		return;
+	}
+	pgsql_results(self);
+	if (PQstatus(mydata->conn) == CONNECTION_BAD)
+	{
+		pgsql_fail(self, "connection lost");
+		return;
+	}
+	pgsql_send(self);
+}
+
 /******************************** PUBLIC ************************************/
 
 /*
@@ -60,9 +446,10 @@ struct pgsql_private
 char *pgsql_init(AnInstance *self)
 {
 	struct pgsql_private *mydata;
-	char tmpbuf[80];
-	static char txtbuf[80];
-	char *ch;
+	PQconninfoOption *info, *o;
+	char tmpbuf[160], *db = NULL, *host = NULL;
+	static char txtbuf[160];
+	char *ch, *connstring;
 	int myopt = 0;
 
 	if (!self->opt)
@@ -72,7 +459,7 @@ char *pgsql_init(AnInstance *self)
 
 	if ((ch = strstr(self->opt, "conn=")))
 	{
-		sprintf(connstring, "%s", ch+5);
+		connstring = ch+5;
 		/* so "log" or "reject" will not be found within conn= */
 		*ch = '\0';
 	}
@@ -81,37 +468,69 @@ char *pgsql_init(AnInstance *self)
 		return "Aie! set connection info";
 	}
 
+	if (!(info = PQconninfoParse(connstring, NULL)))
+	{
+		return "Aie! bad connection info";
+	}
+
 	tmpbuf[0] = txtbuf[0] = '\0';
 
 	if (strstr(self->opt, "log"))
 	{
 		myopt |= OPT_LOG;
-		strcat(tmpbuf, "log ");
-		strcat(txtbuf, "Log ");
+		strcat(tmpbuf, ",log");
+		strcat(txtbuf, ", Log");
 	}
 	if (strstr(self->opt, "reject"))
 	{
 		myopt |= OPT_DENY;
-		strcat(tmpbuf, "reject ");
-		strcat(txtbuf, "Reject ");
+		strcat(tmpbuf, ",reject");
+		strcat(txtbuf, ", Reject");
 	}
 	
 	if (myopt == 0)
 	{
+		PQconninfoFree(info);
 		return "Aie! unknown option(s): nothing to be done!";
 	}
 
-	conn = PQconnectdb(connstring);
-	if (!conn || PQstatus(conn) != CONNECTION_OK)
-	{
-		return "pgsql_init: connection could not be established";
-	}
-
 	mydata = (struct pgsql_private *) malloc(sizeof(struct pgsql_private));
 	bzero((char *) mydata, sizeof(struct pgsql_private));
 	mydata->options = myopt;
-	self->popt = mystrdup(tmpbuf);
+	mydata->connstring = mystrdup(connstring);
+	mydata->queue = (struct pgsql_query *)
+		malloc(PG_QUEUE * sizeof(struct pgsql_query));
+	mydata->backoff = PG_RETRYMIN;
+
+	mydata->lifetime = CACHETIME;
+	if ((myopt & OPT_DENY) && strstr(self->opt, "cache="))
+		mydata->lifetime = atoi(strstr(self->opt, "cache=") + 6);
+	if (myopt & OPT_DENY)
+	{
+		sprintf(tmpbuf + strlen(tmpbuf), ",cache=%d",
+			mydata->lifetime);
+		sprintf(txtbuf + strlen(txtbuf), ", Cache %d (min)",
+			mydata->lifetime);
+	}
+	mydata->lifetime *= 60;
+
+	/* caches are shared by popt, which tells which database is used */
+	for (o = info; o->keyword; o++)
+		if (!strcmp(o->keyword, "dbname"))
+			db = o->val;
+		else if (!strcmp(o->keyword, "host"))
+			host = o->val;
+	sprintf(tmpbuf + strlen(tmpbuf), ",db=%.60s@%.60s",
+		BadPtr(db) ? "-" : db, BadPtr(host) ? "-" : host);
+	PQconninfoFree(info);
+
+	self->popt = mystrdup(tmpbuf + 1);
 	self->data = mydata;
+	if ((myopt & OPT_DENY) && mydata->lifetime)
+		mydata->cache = vc_open(self, mydata->lifetime);
+
+	/* connecting is done later, by loop_io() */
+	pgsql_connect(self);
 
 	return txtbuf+2;
 }
@@ -125,7 +544,13 @@ void pgsql_release(AnInstance *self)
 {
 	struct pgsql_private *mydata = self->data;
 	
-	PQfinish(conn);
+	io_watch(self, -1, 0, NULL);
+	if (mydata->conn)
+		PQfinish(mydata->conn);
+	if (mydata->cache)
+		vc_close(mydata->cache);
+	free(mydata->queue);
+	free(mydata->connstring);
 	free(mydata);
 	free(self->popt);
 }
@@ -139,14 +564,17 @@ void pgsql_stats(AnInstance *self)
 {
 	struct pgsql_private *mydata = self->data;
 
-	sendto_ircd("S pgsql logged %u denied %u", mydata->logged,
-		mydata->denied);
+	sendto_ircd("S pgsql logged %u denied %u cached %u failed %u skipped %u timeouts %u connects %u inflight %u/%u",
+		mydata->logged, mydata->denied, mydata->cached,
+		mydata->failed, mydata->skipped, mydata->timeouts,
+		mydata->connects, mydata->qtail - mydata->qhead,
+		mydata->inflight);
 }
 
 /*
  * pgsql_start
  *
- *	This procedure is called to start the socks check procedure.
+ *	This procedure is called to start the pgsql check procedure.
  *	Returns 0 if everything went fine,
  *	-1 otherwise (nothing to be done, or failure)
  *
@@ -156,12 +584,10 @@ void pgsql_stats(AnInstance *self)
  */
 int pgsql_start(u_int cl)
 {
-	struct pgsql_private *mydata = cldata[cl].instance->data;
-	char message[1024];
-	char messagetmp[1024];
-	PGresult *res;
-	ExecStatusType retc;
-	char *reason = cldata[cl].instance->reason;
+	AnInstance *self = cldata[cl].instance;
+	struct pgsql_private *mydata = self->data;
+	aVEntry *ve;
+	u_int slot;
 
 	if (cldata[cl].state & A_DENY)
 	{
@@ -170,77 +596,47 @@ int pgsql_start(u_int cl)
                 return -1;
 	}
 
-	if (PQstatus(conn) == CONNECTION_BAD)
+	if (mydata->state == PG_DOWN && time(NULL) >= mydata->retry)
+		pgsql_connect(self);
+	/* the ring takes at most 3 queries per entry */
+	if (mydata->state == PG_DOWN ||
+	    mydata->qtail - mydata->qhead > PG_QUEUE - 3)
 	{
-		char *s = PQerrorMessage(conn);
-
-		sendto_log(ALOG_IRCD, LOG_ERR, "pgsql_start(%d) conn bad %s",
-			cl, BadPtr(s) ? "?" : s);
-
-		/* If connection to db is broken somehow, restarting
-		 * iauth will revive it, will it not? --B. */
-       		exit(1);
+		mydata->skipped++;
+		return -1;
 	}
 
-	/*
-	 * Clean interface would be two blocks of { new message, PQexec(),
-	 * PQresultStatus(), PQclear(), parsing result }, one doing logging,
-	 * another checking for klines. By using little trick of concatenation
-	 * I save on one PQexec(), but only due to fact we don't need output
-	 * from inserting into database. Quoting libpq manual:
-	 *     "PQexec can return only one PGresult structure. If the submitted
-	 *      query string contains multiple SQL commands, all but the last
-	 *      PGresult are discarded by PQexec."
-	 *
-	 * When extending this module, write another block of code. --B.
-	 */
-
-	/* Logging of IP and date into database:
-	 * 	CREATE TABLE ircd_conn (ip cidr, date timestamp); */
+	/* Logging of IP and date into database, nobody waits for it */
 	if (mydata->options & OPT_LOG)
-	{
-		mydata->logged++;
-		sprintf(message,
-			"INSERT INTO ircd_conn (ip,date) VALUES ('%s',now());",
-			cldata[cl].itsip);
-		retc = PGRES_COMMAND_OK;
-	}
-	/* Querying for klined IPs/nets from database:
-	 * 	CREATE TABLE ircd_kline (ip cidr); */
-	if (mydata->options & OPT_DENY)
-	{
-		sprintf((mydata->options & OPT_LOG) ? messagetmp : message,
-			"SELECT ip FROM ircd_kline WHERE '%s'<<=ip LIMIT 1;",
-			cldata[cl].itsip);
-		if (mydata->options & OPT_LOG)
-		{
-			strcat(message, messagetmp);
-		}
-		retc = PGRES_TUPLES_OK;
-	}
+		pgsql_queue(mydata, cl, PGQ_LOG);
 
-	DebugLog((ALOG_DPGSQL, 0, "pgsql_start(%d): %s", cl, message));
-	res = PQexec(conn, message);
-	if (!res || PQresultStatus(res) != retc)
+	/* Querying for klined IPs/nets from database */
+	if ((mydata->options & OPT_DENY) && mydata->cache &&
+	    (ve = vc_get(mydata->cache, cldata[cl].itsip)))
 	{
-		sendto_log(ALOG_IRCD, LOG_NOTICE,
-			"pgsql_start(%d) PQexec failed: %s", cl,
-			PQresultErrorMessage(res));
-		PQclear(res);
-		return -1;
+		mydata->cached++;
+		if (ve->verdict)
+			pgsql_deny(cl, mydata, self->reason);
 	}
-	if ((mydata->options & OPT_DENY) && PQntuples(res) == 1)
+	else if (mydata->options & OPT_DENY)
 	{
-		mydata->denied++;
-		if (!reason)
+		DebugLog((ALOG_DPGSQL, 0, "pgsql_start(%d): checking %s", cl,
+			cldata[cl].itsip));
+		slot = pgsql_queue(mydata, cl, PGQ_CHECK);
+		pgsql_queue(mydata, cl, PGQ_SYNC);
+		pgsql_send(self);
+		if (mydata->state == PG_DOWN)
 		{
-			reason = "Denied access (SQL)";
+			mydata->failed++;
+			return -1;
 		}
-		cldata[cl].state |= A_DENY;
-		sendto_ircd("k %d %s %u :%s", cl, cldata[cl].itsip,
-			cldata[cl].itsport, reason);
+		/* pgsql_done() will tell when the answer came */
+		cldata[cl].mod_status = slot + 1;
+		return 0;
 	}
-	PQclear(res);
+	if (mydata->options & OPT_LOG)
+		pgsql_queue(mydata, cl, PGQ_SYNC);
+	pgsql_send(self);
 
 	return -1;
 }
@@ -257,9 +653,8 @@ int pgsql_start(u_int cl)
 int pgsql_work(u_int cl)
 {
 	DebugLog((ALOG_DPGSQL, 0, "pgsql_work(%d): doing nothing", cl));
-	/* Since we hazardously (and in a blocking way) do all work
-	** in pgsql_start(), we have nothing to do here. In fact it
-	** should never be even called. */
+	/* Entries have no descriptor, answers are read by pgsql_event()
+	** for all of them. In fact it should never be even called. */
 	return -1;
 }
 
@@ -273,7 +668,8 @@ int pgsql_work(u_int cl)
 void pgsql_clean(u_int cl)
 {
 	DebugLog((ALOG_DPGSQL, 0, "pgsql_clean(%d): cleaning up", cl));
-	/* so far we don't have anything to clean */
+	/* the answer will be ignored when it comes */
+	cldata[cl].mod_status = 0;
 }
 
 /*
@@ -286,10 +682,12 @@ void pgsql_clean(u_int cl)
  */
 int pgsql_timeout(u_int cl)
 {
+	struct pgsql_private *mydata = cldata[cl].instance->data;
+
 	DebugLog((ALOG_DPGSQL, 0, "pgsql_timeout(%d): calling pgsql_clean ", cl));
+	mydata->timeouts++;
 	pgsql_clean(cl);
-	/* Since it hardly can timeout, let's assume things are okay --B. */
-	return 0;
+	return -1;
 }
 
 aModule Module_pgsql =
@@ -34,14 +34,6 @@ static	int	socks_start(u_int cl);
 #define CACHETIME 30
 #define SOCKSPORT (cldata[cl].instance->port)
 
-struct proxylog
-{
-	struct proxylog *next;
-	char ip[HOSTLEN+1];
-	u_char state; /* 0 = no proxy, 1 = open proxy, 2 = closed proxy */
-	time_t expire;
-};
-
 #define OPT_LOG     	0x001
 #define OPT_DENY    	0x002
 #define OPT_PARANOID	0x004
@@ -63,11 +55,11 @@ struct proxylog
 
 struct socks_private
 {
-	struct proxylog *cache;
+	aVCache *cache;		/* verdicts are PROXY_* */
 	u_int lifetime;
 	u_char options;
 	/* stats */
-	u_int chitc, chito, chitn, cmiss, cnow, cmax;
+	u_int chitc, chito, chitn, cmiss;
 	u_int noproxy, open, closed;
 };
 
@@ -108,7 +100,6 @@ static	void	socks_open_proxy(int cl, char *strver)
 static	void	socks_add_cache(int cl, int state)
 {
 	struct socks_private *mydata = cldata[cl].instance->data;
-	struct proxylog *next;
 
 	if (state == PROXY_OPEN)
 	{
@@ -128,21 +119,10 @@ static	void	socks_add_cache(int cl, int state)
 		return;
 	}
 
-	mydata->cnow += 1;
-	if (mydata->cnow > mydata->cmax)
-	{
-		mydata->cmax = mydata->cnow;
-	}
-
-	next = mydata->cache;
-	mydata->cache = (struct proxylog *)malloc(sizeof(struct proxylog));
-	mydata->cache->expire = time(NULL) + mydata->lifetime;
-	strcpy(mydata->cache->ip, cldata[cl].itsip);
-	mydata->cache->state = state;
-	mydata->cache->next = next;
+	vc_put(mydata->cache, cldata[cl].itsip, state, NULL);
 	DebugLog((ALOG_DSOCKSC, 0,
 		"socks_add_cache(%d): new cache %s, open=%d",
-		cl, mydata->cache->ip, state));
+		cl, cldata[cl].itsip, state));
 }
 
 /*
@@ -153,8 +133,7 @@ static	void	socks_add_cache(int cl, int state)
 static	int	socks_check_cache(u_int cl)
 {
 	struct socks_private *mydata = cldata[cl].instance->data;
-	struct proxylog **last, *pl;
-	time_t now = time(NULL);
+	aVEntry *ve;
 
 	if (mydata->lifetime == 0)
 	{
@@ -165,43 +144,25 @@ static	int	socks_check_cache(u_int cl)
 		"socks_check_cache(%d): Checking cache for %s",
 		cl, cldata[cl].itsip));
 
-	last = &(mydata->cache);
-	while ((pl = *last))
+	if ((ve = vc_get(mydata->cache, cldata[cl].itsip)))
 	{
-		DebugLog((ALOG_DSOCKSC, 0, "socks_check_cache(%d): cache %s",
-			cl, pl->ip));
-		if (pl->expire < now)
+		DebugLog((ALOG_DSOCKSC, 0,
+			"socks_check_cache(%d): match (%u)",
+			cl, ve->verdict));
+		if (ve->verdict == PROXY_OPEN)
 		{
-			DebugLog((ALOG_DSOCKSC, 0,
-				"socks_check_cache(%d): free %s (%d < %d)",
-				cl, pl->ip, pl->expire, now));
-			*last = pl->next;
-			free(pl);
-			mydata->cnow -= 1;
-			continue;
+			socks_open_proxy(cl, "C");
+			mydata->chito += 1;
 		}
-		if (!strcasecmp(pl->ip, cldata[cl].itsip))
+		else if (ve->verdict == PROXY_NONE)
 		{
-			DebugLog((ALOG_DSOCKSC, 0,
-				"socks_check_cache(%d): match (%u)",
-				cl, pl->state));
-			pl->expire = now + mydata->lifetime; /* dubious */
-			if (pl->state == 1)
-			{
-				socks_open_proxy(cl, "C");
-				mydata->chito += 1;
-			}
-			else if (pl->state == 0)
-			{
-				mydata->chitn += 1;
-			}
-			else
-			{
-				mydata->chitc += 1;
-			}
-			return -1;
+			mydata->chitn += 1;
+		}
+		else
+		{
+			mydata->chitc += 1;
 		}
-		last = &(pl->next);
+		return -1;
 	}
 	mydata->cmiss += 1;
 	return 0;
@@ -521,6 +482,7 @@ static	char	*socks_init(AnInstance *self)
 	struct socks_private *mydata;
 	char tmpbuf[80], cbuf[32];
 	static char txtbuf[80];
+	char *ch;
 
 	if (self->opt == NULL)
 	{
@@ -529,7 +491,6 @@ static	char	*socks_init(AnInstance *self)
 
 	mydata = (struct socks_private *) malloc(sizeof(struct socks_private));
 	bzero((char *) mydata, sizeof(struct socks_private));
-	mydata->cache = NULL;
 	mydata->lifetime = CACHETIME;
 
 	tmpbuf[0] = txtbuf[0] = '\0';
@@ -597,14 +558,9 @@ static	char	*socks_init(AnInstance *self)
 		return "Aie! unknown option(s): nothing to be done!";
 	}
 
-	if (strstr(self->opt, "cache"))
+	if ((ch = strstr(self->opt, "cache=")))
 	{
-		char *ch = index(self->opt, '=');
-
-		if (ch)
-		{
-			mydata->lifetime = atoi(ch+1);
-		}
+		mydata->lifetime = atoi(ch+6);
 	}
 	sprintf(cbuf, ",cache=%d", mydata->lifetime);
 	strcat(tmpbuf, cbuf);
@@ -614,6 +570,10 @@ static	char	*socks_init(AnInstance *self)
 
 	self->popt = mystrdup(tmpbuf);
 	self->data = mydata;
+	if (mydata->lifetime)
+	{
+		mydata->cache = vc_open(self, mydata->lifetime);
+	}
 	return txtbuf+2;
 }
 
@@ -624,8 +584,12 @@ static	char	*socks_init(AnInstance *self)
  */
 static	void	socks_release(AnInstance *self)
 {
-	struct sock_private *mydata = self->data;
+	struct socks_private *mydata = self->data;
 
+	if (mydata->cache)
+	{
+		vc_close(mydata->cache);
+	}
 	free(mydata);
 	free(self->popt);
 }
@@ -645,7 +609,9 @@ static	void	socks_stats(AnInstance *self)
 	sendto_ircd("S socks:%u cache open %u closed %u noproxy %u miss %u (%u <= %u)",
 		self->port,
 		mydata->chito, mydata->chitc, mydata->chitn,
-		mydata->cmiss, mydata->cnow, mydata->cmax);
+		mydata->cmiss,
+		(mydata->cache) ? mydata->cache->count : 0,
+		(mydata->cache) ? mydata->cache->highest : 0);
 }
 
 /*
@@ -35,14 +35,6 @@ static	int	proxy_start(u_int cl);
 #define CACHETIME 30
 #define PROXYPORT (cldata[cl].instance->port)
 
-struct proxylog
-{
-	struct proxylog *next;
-	char ip[HOSTLEN+1];
-	u_char state; /* 0 = no proxy, 1 = open proxy, 2 = closed proxy */
-	time_t expire;
-};
-
 #define OPT_LOG     	0x001
 #define OPT_DENY    	0x002
 #define OPT_CAREFUL 	0x008
@@ -53,11 +45,11 @@ struct proxylog
 
 struct proxy_private
 {
-	struct proxylog *cache;
+	aVCache *cache;		/* verdicts are PROXY_* */
 	u_int lifetime;
 	u_char options;
 	/* stats */
-	u_int chitc, chito, chitn, cmiss, cnow, cmax;
+	u_int chitc, chito, chitn, cmiss;
 	u_int noproxy, open, closed;
 };
 
@@ -98,7 +90,6 @@ static	void	proxy_open_proxy(int cl)
 static	void	proxy_add_cache(int cl, int state)
 {
 	struct proxy_private *mydata = cldata[cl].instance->data;
-	struct proxylog *next;
 
 	if (state == PROXY_OPEN)
 	{
@@ -118,21 +109,10 @@ static	void	proxy_add_cache(int cl, int state)
 		return;
 	}
 
-	mydata->cnow += 1;
-	if (mydata->cnow > mydata->cmax)
-	{
-		mydata->cmax = mydata->cnow;
-	}
-
-	next = mydata->cache;
-	mydata->cache = (struct proxylog *)malloc(sizeof(struct proxylog));
-	mydata->cache->expire = time(NULL) + mydata->lifetime;
-	strcpy(mydata->cache->ip, cldata[cl].itsip);
-	mydata->cache->state = state;
-	mydata->cache->next = next;
+	vc_put(mydata->cache, cldata[cl].itsip, state, NULL);
 	DebugLog((ALOG_DSOCKSC, 0,
 		"webproxy_add_cache(%d): new cache %s, open=%d",
-		cl, mydata->cache->ip, state));
+		cl, cldata[cl].itsip, state));
 }
 
 /*
@@ -143,8 +123,7 @@ static	void	proxy_add_cache(int cl, int state)
 static	int	proxy_check_cache(u_int cl)
 {
 	struct proxy_private *mydata = cldata[cl].instance->data;
-	struct proxylog **last, *pl;
-	time_t now = time(NULL);
+	aVEntry *ve;
 
 	if (mydata->lifetime == 0)
 	{
@@ -155,43 +134,25 @@ static	int	proxy_check_cache(u_int cl)
 		"webproxy_check_cache(%d): Checking cache for %s",
 		cl, cldata[cl].itsip));
 
-	last = &(mydata->cache);
-	while ((pl = *last))
+	if ((ve = vc_get(mydata->cache, cldata[cl].itsip)))
 	{
-		DebugLog((ALOG_DSOCKSC, 0, "webproxy_check_cache(%d): cache %s",
-			cl, pl->ip));
-		if (pl->expire < now)
+		DebugLog((ALOG_DSOCKSC, 0,
+			"webproxy_check_cache(%d): match (%u)",
+			cl, ve->verdict));
+		if (ve->verdict == PROXY_OPEN)
 		{
-			DebugLog((ALOG_DSOCKSC, 0,
-				"webproxy_check_cache(%d): free %s (%d < %d)",
-				cl, pl->ip, pl->expire, now));
-			*last = pl->next;
-			free(pl);
-			mydata->cnow -= 1;
-			continue;
+			proxy_open_proxy(cl);
+			mydata->chito += 1;
 		}
-		if (!strcasecmp(pl->ip, cldata[cl].itsip))
+		else if (ve->verdict == PROXY_NONE)
 		{
-			DebugLog((ALOG_DSOCKSC, 0,
-				"webproxy_check_cache(%d): match (%u)",
-				cl, pl->state));
-			pl->expire = now + mydata->lifetime; /* dubious */
-			if (pl->state == 1)
-			{
-				proxy_open_proxy(cl);
-				mydata->chito += 1;
-			}
-			else if (pl->state == 0)
-			{
-				mydata->chitn += 1;
-			}
-			else
-			{
-				mydata->chitc += 1;
-			}
-			return -1;
+			mydata->chitn += 1;
 		}
-		last = &(pl->next);
+		else
+		{
+			mydata->chitc += 1;
+		}
+		return -1;
 	}
 	mydata->cmiss += 1;
 	return 0;
@@ -321,7 +282,6 @@ static	char	*proxy_init(AnInstance *self)
 
 	mydata = (struct proxy_private *) malloc(sizeof(struct proxy_private));
 	bzero((char *) mydata, sizeof(struct proxy_private));
-	mydata->cache = NULL;
 	mydata->lifetime = CACHETIME;
 
 	tmpbuf[0] = txtbuf[0] = '\0';
@@ -371,6 +331,10 @@ static	char	*proxy_init(AnInstance *self)
 
 	self->popt = mystrdup(tmpbuf);
 	self->data = mydata;
+	if (mydata->lifetime)
+	{
+		mydata->cache = vc_open(self, mydata->lifetime);
+	}
 	return txtbuf+2;
 }
 
@@ -383,6 +347,10 @@ static	void	proxy_release(AnInstance *self)
 {
 	struct proxy_private *mydata = self->data;
 
+	if (mydata->cache)
+	{
+		vc_close(mydata->cache);
+	}
 	free(mydata);
 	free(self->popt);
 }
@@ -402,7 +370,9 @@ static	void	proxy_stats(AnInstance *self)
 	sendto_ircd("S %s:%u cache open %u closed %u noproxy %u miss %u"
 		" (%u <= %u)", self->mod->name, self->port,
 		mydata->chito, mydata->chitc, mydata->chitn,
-		mydata->cmiss, mydata->cnow, mydata->cmax);
+		mydata->cmiss,
+		(mydata->cache) ? mydata->cache->count : 0,
+		(mydata->cache) ? mydata->cache->highest : 0);
 }
 
 /*
@@ -0,0 +1,1062 @@
+/************************************************************************
+ *   IRC - Internet Relay Chat, ircd/bench.c
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 1, or (at your option)
+ *   any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * Microbenchmarks of the primitives ircd spends its time in: match(),
+ * collapse(), mycmp(), the nick and channel hash tables, dbufs,
+ * dopacket()/parse(), send formatting and patricia lookups, and the
+ * walks of check_pings()/flush_connections() and of the client list.
+ *
+ * ircd-bench is linked with the objects of ircd but ircd.o, of which
+ * main() and the globals are replaced here.  A small server is set up
+ * in memory: a configuration file written in /tmp, a few local clients
+ * registered through dopacket(), channels.
+ * The corpora below are made of real world masks, hosts and lines.
+ *
+ * Each benchmark is run for about -t milliseconds, -r times, and the
+ * median is kept.  Allocations are MyMalloc() and MyRealloc() calls
+ * (support.c counts them when compiled with BENCH_COMPILE).
+ */
+
+#ifndef lint
+static const volatile char rcsid[] = "@(#)$Id$";
+#endif
+
+#include "os.h"
+#include "s_defines.h"
+#define IRCD_C
+#include "s_externs.h"
+#undef IRCD_C
+
+#define	BENCH_ROUNDS	5	/* runs of each benchmark, median kept */
+#define	BENCH_TIME	200	/* milliseconds per run */
+#define	BENCH_CLIENTS	50	/* local clients, all on #bench */
+#define	BENCH_NICKS	20000	/* remote clients in the hash table */
+#define	BENCH_CHANNELS	5000	/* channels in the hash table */
+#define	BENCH_NETS	2000	/* networks in the patricia tree */
+#define	BENCH_MAXLINES	4096	/* lines read with -l */
+#define	BENCH_SCANLOCAL	50000	/* local clients of the scan benchmarks */
+#define	BENCH_SCANLIST	500000	/* remote clients of the scan benchmarks */
+
+/*
+** What ircd.c provides to the rest of the server.
+*/
+aClient	me;
+aClient	*client = &me;
+istat_t	istat;
+iconf_t	iconf;
+char	**myargv;
+int	rehashed = 0;
+int	portnum = -1;
+char	*configfile = NULL;
+int	debuglevel = -1;
+int	bootopt = BOOT_STANDALONE|BOOT_NOIAUTH;
+int	serverbooting = 1;
+int	firstrejoindone = 0;
+char	*debugmode = "";
+char	*sbrk0;
+char	*tunefile = NULL;
+char	*dnsfile = NULL;
+#ifdef DELAY_CLOSE
+time_t	nextdelayclose = 0;
+#endif
+time_t	nextconnect = 0;
+time_t	nextgarbage = 1;
+time_t	nextping = 1;
+time_t	nextdnscheck = 0;
+time_t	nextexpire = 1;
+time_t	nextdnssave = 0;
+time_t	nextiarestart = 0;
+time_t	nextpreference = 0;
+#ifdef TKLINE
+time_t	nexttkexpire = 0;
+#endif
+aClient	*ListenerLL = NULL;
+
+RETSIGTYPE s_die(int s)
+{
+	exit(-1);
+}
+
+void	restart(char *mesg)
+{
+	fprintf(stderr, "ircd-bench: restart: %s\n", mesg);
+	exit(-1);
+}
+
+RETSIGTYPE s_restart(int s)
+{
+	exit(-1);
+}
+
+void	server_reboot(void)
+{
+	exit(-1);
+}
+
+void	ircd_writetune(char *filename)
+{
+}
+
+void	ircd_readtune(char *filename)
+{
+}
+
+time_t	calculate_preference(time_t currenttime)
+{
+	return currenttime + 60;
+}
+
+/*
+** Corpora.
+*/
+
+/* channel bans and K-line masks, as found on a network */
+static	char	*masks[] = {
+	"*!*@*.fios.verizon.net",
+	"*!*@dsl-189-148-*.prod-infinitum.com.mx",
+	"*!~*@*",
+	"*!*@192.168.*",
+	"bad*!*@*",
+	"*!*@*.cable.virginm.net",
+	"*!*@c-98-207-*.hsd1.ca.comcast.net",
+	"*!*@*.dynamic-ip.hinet.net",
+	"*!*ident@*.de",
+	"*!?????@*",
+	"*!*@*.compute-1.amazonaws.com",
+	"*!*@static.88-198-*.clients.your-server.de",
+	"*!*@p5B0C*.dip0.t-ipconnect.de",
+	"*!*@*.red.bezeqint.net",
+	"*!*@ppp-94-66-*.home.otenet.gr",
+	"*!*@*.airtelbroadband.in",
+	"*!*@li*.members.linode.com",
+	"*!*@vps-*.vps.ovh.net",
+	"*bot*!*@*",
+	"*!*@*.ph.ph.cox.net",
+	"*!*@host86-164-*.range86-164.btcentralplus.com",
+	"*!*@10.*",
+	"*!*@*.tor-exit.*",
+	"guest*!*@*",
+	"*!*@*.edu",
+	"*!*@nat-wlan.uni-kl.de",
+	"*!*sshd@*",
+	"*!*@*.res.rr.com",
+	"*!*@*.pools.spcsdns.net",
+	"*!*@*.mobile.att.net",
+	"*!~u*@*.ip.tele2.*",
+	"*!*@*.telia.com",
+};
+#define	NMASKS	(sizeof(masks) / sizeof(char *))
+
+static	char	*hosts[] = {
+	"pool-71-181-44-16.cmdnnj.fios.verizon.net",
+	"dsl-189-148-22-10-dyn.prod-infinitum.com.mx",
+	"cpc1-brig17-2-0-cust423.3-3.cable.virginm.net",
+	"ip68-98-112-35.ph.ph.cox.net",
+	"host86-164-210-12.range86-164.btcentralplus.com",
+	"c-98-207-153-8.hsd1.ca.comcast.net",
+	"ec2-54-210-1-22.compute-1.amazonaws.com",
+	"static.88-198-12-34.clients.your-server.de",
+	"p5B0C3A1F.dip0.t-ipconnect.de",
+	"bzq-79-180-200-30.red.bezeqint.net",
+	"ppp-94-66-58-225.home.otenet.gr",
+	"abts-kk-dynamic-004.250.168.122.airtelbroadband.in",
+	"111-240-12-5.dynamic-ip.hinet.net",
+	"nat-wlan.uni-kl.de",
+	"vps-123456.vps.ovh.net",
+	"li123-45.members.linode.com",
+	"cpe-66-108-43-98.nyc.res.rr.com",
+	"irc.example.org",
+	"192.168.1.23",
+	"10.12.4.200",
+	"h-98-128-172-41.na.cust.bahnhof.se",
+	"dyn-163-53.mobile.att.net",
+	"78-72-113-22-no152.tbcn.telia.com",
+	"m90-132-110-19.cust.tele2.se",
+	"gateway.cs.example.edu",
+	"74-219-12-7.pools.spcsdns.net",
+	"unaffiliated.example.net",
+	"2a01:e35:8b2c:4a10:1d2:3c4d:5e6f:7a8b",
+};
+#define	NHOSTS	(sizeof(hosts) / sizeof(char *))
+
+static	char	*nicks[] = {
+	"Alice", "bob", "[Kalt]", "syrk", "Q", "chopin", "bif", "Beeth",
+	"jv", "Vesa", "dl", "ircbot", "{Guest}_42", "FooBar\\", "nobody",
+	"Wiz^", "a_very_long_nick", "Kilroy", "zz", "guest1234",
+};
+#define	NNICKS	(sizeof(nicks) / sizeof(char *))
+
+static	char	*idents[NNICKS * NHOSTS], *uidents[NNICKS * NHOSTS];
+#define	NIDENTS	(sizeof(idents) / sizeof(char *))
+static	char	*smasks[NMASKS];	/* as typed, before collapse() */
+
+/* lines sent by bench0 to the others */
+static	char	*clines[] = {
+	"PING :bench.irc.local",
+	"PRIVMSG bench1 :hey, are you coming to the meeting later today?",
+	"PRIVMSG #bench :lol yes that's exactly what I meant, see above",
+	"NOTICE bench2 :\001VERSION irssi v1.4.5 - running on Linux x86_64\001",
+	"PRIVMSG #small :ok",
+	"MODE #bench",
+	"TOPIC #small",
+	"ISON bench1 bench2 bench3 nobody alice bob",
+	"USERHOST bench1 bench2 bench3",
+	"WHOIS bench1",
+	"AWAY :gone fishing",
+	"AWAY",
+	"NAMES #small",
+	"WHO #small",
+	"PONG :bench.irc.local",
+	"PRIVMSG bench3,bench4 :two at once",
+	"FOO bar",
+	"MODE bench0 +i",
+};
+#define	NCLINES	(sizeof(clines) / sizeof(char *))
+
+/* what clients say */
+static	char	*texts[] = {
+	"hi",
+	"lol yes that's exactly what I meant, see above",
+	"\001ACTION goes to get some coffee, back in 5 minutes\001",
+	"Could someone explain why the build fails with -Werror on gcc "
+	"12? The log says something about a maybe-uninitialized variable "
+	"in the resolver, and it only happens with -O2 and LTO enabled.",
+};
+#define	NTEXTS	(sizeof(texts) / sizeof(char *))
+
+static	char	**lines = NULL;		/* -l */
+static	int	nlines = 0;
+
+/*
+** The server.
+*/
+static	aClient	*locals[BENCH_CLIENTS];
+static	aClient	**remotes;
+static	aChannel **channels;
+static	char	**chnames, **missnames;
+static	patricia_tree_t *tree;
+static	struct	IN_ADDR *addrs;
+#define	NADDRS	4096
+
+static	void	bench_conf(void)
+{
+	static	char	path[] = "/tmp/ircd-bench.XXXXXX";
+	FILE	*fp;
+	int	fd;
+
+	if ((fd = mkstemp(path)) < 0 || !(fp = fdopen(fd, "w")))
+	    {
+		perror(path);
+		exit(1);
+	    }
+	fprintf(fp, "M:bench.irc.local::Benchmarks:6667:000B\n");
+	fprintf(fp, "A:ircd-bench:::::BenchNet\n");
+	fprintf(fp, "Y:1:90::%d:10000000:%d.%d:%d.%d:\n", BENCH_CLIENTS * 2,
+		BENCH_CLIENTS * 2, BENCH_CLIENTS * 2, BENCH_CLIENTS * 2,
+		BENCH_CLIENTS * 2);
+	fprintf(fp, "I:::::1\n");
+	fclose(fp);
+	configfile = path;
+	if (initconf(0) == -1)
+	    {
+		fprintf(stderr, "ircd-bench: initconf() failed\n");
+		exit(1);
+	    }
+	(void)unlink(path);
+}
+
+/* what setup_me() of ircd.c does */
+static	void	bench_me(void)
+{
+	strncpyzt(me.username, "bench", sizeof(me.username));
+	strcpy(me.sockhost, "bench.irc.local");
+	me.lasttime = me.since = me.firsttime = timeofday;
+	me.authfd = -1;
+	me.auth = me.username;
+	me.acpt = me.from = &me;
+	me.fd = -1;
+	SetMe(&me);
+	me.serv->snum = find_server_num(ME);
+	(void)make_user(&me);
+	istat.is_users++;
+	me.user->flags |= FLAGS_OPER;
+	me.serv->up = &me;
+	me.serv->maskedby = &me;
+	me.serv->version |= SV_UID;
+	me.user->server = find_server_string(me.serv->snum);
+	set_istr(&me.user->username, "bench", USERLEN);
+	set_istr(&me.user->host, me.name, HOSTLEN);
+	SetEOB(&me);
+	istat.is_eobservers = 1;
+	(void)add_to_client_hash_table(me.name, &me);
+	(void)add_to_sid_hash_table(me.serv->sid, &me);
+	strncpyzt(me.serv->verstr, PATCHLEVEL, sizeof(me.serv->verstr));
+	setup_server_channels(&me);
+}
+
+static	void	bench_packet(aClient *cptr, char *line)
+{
+	char	buf[BUFSIZE];
+	int	len;
+
+	len = snprintf(buf, sizeof(buf), "%s\r\n", line);
+	if (dopacket(cptr, buf, len) == FLUSH_BUFFER)
+	    {
+		fprintf(stderr, "ircd-bench: client lost on \"%s\"\n", line);
+		exit(1);
+	    }
+}
+
+/* the port clients came through, as in main() for inetd */
+static	aClient	*bench_listener(void)
+{
+	aClient	*tmp;
+	aConfItem *aconf;
+
+	tmp = make_client(NULL);
+	make_server(tmp);
+	tmp->flags = FLAGS_LISTEN;
+	tmp->acpt = tmp;
+	tmp->from = tmp;
+	tmp->firsttime = timeofday;
+	SetMe(tmp);
+	(void)strcpy(tmp->serv->namebuf, "*");
+	aconf = make_conf();
+	aconf->status = CONF_LISTEN_PORT;
+	aconf->port = 6667;
+	tmp->confs = make_link();
+	tmp->confs->next = NULL;
+	tmp->confs->value.aconf = aconf;
+	return tmp;
+}
+
+/*
+** A client, as add_connection() makes it, then registered.  The other
+** side of the socket is kept in peers[] for bench_drain().
+*/
+static	int	peers[BENCH_CLIENTS];
+
+static	aClient	*bench_client(aClient *listener, int lfd, int i)
+{
+	struct	SOCKADDR_IN sk;
+	SOCK_LEN_TYPE len = sizeof(sk);
+	aClient	*cptr;
+	char	buf[64];
+	int	fd;
+
+	if ((peers[i] = socket(AFINET, SOCK_STREAM, 0)) < 0 ||
+	    getsockname(lfd, (SAP)&sk, &len) < 0 ||
+	    connect(peers[i], (SAP)&sk, len) < 0 ||
+	    (fd = accept(lfd, NULL, NULL)) < 0)
+	    {
+		perror("ircd-bench: client");
+		exit(1);
+	    }
+	if (fd >= MAXCONNECTIONS)
+	    {
+		fprintf(stderr, "ircd-bench: too many descriptors\n");
+		exit(1);
+	    }
+	cptr = make_client(NULL);
+	cptr->acpt = listener;
+	listener->confs->value.aconf->clients++;
+	cptr->fd = fd;
+	set_non_blocking(fd, cptr);
+	if (fd > highest_fd)
+		highest_fd = fd;
+	local[fd] = cptr;
+	add_fd(fd, &fdall);
+	add_client_to_list(cptr);
+	sprintf(buf, "NICK bench%d", i);
+	bench_packet(cptr, buf);
+	sprintf(buf, "USER u%d 0 * :benchmark client", i);
+	bench_packet(cptr, buf);
+	if (!IsPerson(cptr))
+	    {
+		fprintf(stderr, "ircd-bench: bench%d not registered\n", i);
+		exit(1);
+	    }
+	return cptr;
+}
+
+/*
+** A child reads what the server sends to its clients, so that sendQs
+** are written out as they would be, without the reading being timed.
+*/
+static	void	bench_drain(void)
+{
+	struct	pollfd pfd[BENCH_CLIENTS];
+	char	buf[65536];
+	int	i, left = BENCH_CLIENTS;
+
+	switch (fork())
+	    {
+	case -1:
+		perror("ircd-bench: fork");
+		exit(1);
+	case 0:
+		break;
+	default:
+		for (i = 0; i < BENCH_CLIENTS; i++)
+			(void)close(peers[i]);
+		return;
+	    }
+	for (i = 0; i < BENCH_CLIENTS; i++)
+	    {
+		(void)close(locals[i]->fd);
+		pfd[i].fd = peers[i];
+		pfd[i].events = POLLIN;
+	    }
+	while (left > 0 && poll(pfd, BENCH_CLIENTS, -1) >= 0)
+		for (i = 0; i < BENCH_CLIENTS; i++)
+			if (pfd[i].revents && read(pfd[i].fd, buf,
+						   sizeof(buf)) <= 0)
+			    {
+				(void)close(pfd[i].fd);
+				pfd[i].fd = -1;
+				left--;
+			    }
+	_exit(0);
+}
+
+static	void	bench_setup(void)
+{
+	struct	SOCKADDR_IN sk;
+	aClient	*listener;
+	char	buf[128], *p;
+	int	i, lfd;
+
+	timeofday = time(NULL);
+	initanonymous();
+	initstats();
+	initruntimeconf();
+	inithashtables();
+	initlists();
+	initclass();
+	initwhowas();
+	make_server(&me);
+	version = make_version();
+	bench_conf();
+	isupport = make_isupport();
+	bench_me();
+	check_class();
+	dbuf_init();
+	serverbooting = 0;
+
+	for (i = 0; i < NIDENTS; i++)
+	    {
+		sprintf(buf, "%s!~%.8s@%s", nicks[i % NNICKS],
+			nicks[(i / NNICKS + i) % NNICKS], hosts[i / NNICKS]);
+		idents[i] = mystrdup(buf);
+		uidents[i] = mystrdup(buf);
+		for (p = uidents[i]; *p; p++)
+			*p = toupper(*p);
+	    }
+	for (i = 0; i < NMASKS; i++)
+	    {
+		sprintf(buf, "**%s**", masks[i]);
+		smasks[i] = mystrdup(buf);
+	    }
+
+	listener = bench_listener();
+	bzero((char *)&sk, sizeof(sk));
+#ifdef INET6
+	sk.SIN_FAMILY = AF_INET6;
+	sk.SIN_ADDR = in6addr_loopback;
+#else
+	sk.SIN_FAMILY = AF_INET;
+	sk.SIN_ADDR.s_addr = htonl(INADDR_LOOPBACK);
+#endif
+	if ((lfd = socket(AFINET, SOCK_STREAM, 0)) < 0 ||
+	    bind(lfd, (SAP)&sk, sizeof(sk)) < 0 || listen(lfd, 5) < 0)
+	    {
+		perror("ircd-bench: listen");
+		exit(1);
+	    }
+	for (i = 0; i < BENCH_CLIENTS; i++)
+		locals[i] = bench_client(listener, lfd, i);
+	(void)close(lfd);
+	bench_drain();
+	for (i = 0; i < BENCH_CLIENTS; i++)
+	    {
+		bench_packet(locals[i], "JOIN #bench");
+		if (i < 3)
+			bench_packet(locals[i], "JOIN #small");
+	    }
+
+	/* hash tables the size of a network */
+	remotes = (aClient **)MyMalloc(BENCH_NICKS * sizeof(aClient *));
+	for (i = 0; i < BENCH_NICKS; i++)
+	    {
+		remotes[i] = make_client(&me);
+		sprintf(remotes[i]->namebuf, "%s%d", nicks[i % NNICKS], i);
+		(void)add_to_client_hash_table(remotes[i]->name, remotes[i]);
+	    }
+	missnames = (char **)MyMalloc(BENCH_NICKS * sizeof(char *));
+	for (i = 0; i < BENCH_NICKS; i++)
+	    {
+		sprintf(buf, "%s%d_", nicks[i % NNICKS], i);
+		missnames[i] = mystrdup(buf);
+	    }
+	channels = (aChannel **)MyMalloc(BENCH_CHANNELS * sizeof(aChannel *));
+	chnames = (char **)MyMalloc(BENCH_CHANNELS * sizeof(char *));
+	for (i = 0; i < BENCH_CHANNELS; i++)
+	    {
+		sprintf(buf, "#%s-%d", nicks[i % NNICKS], i);
+		chnames[i] = mystrdup(buf);
+		channels[i] = (aChannel *)MyMalloc(sizeof(aChannel) +
+						   strlen(buf));
+		bzero((char *)channels[i], sizeof(aChannel));
+		strcpy(channels[i]->chname, buf);
+		(void)add_to_channel_hash_table(chnames[i], channels[i]);
+	    }
+
+	/* networks of I lines with a CIDR limit, addresses of clients */
+#ifdef INET6
+	tree = patricia_new(128);
+#else
+	tree = patricia_new(32);
+#endif
+	for (i = 0; i < BENCH_NETS; i++)
+	    {
+		struct	IN_ADDR	addr;
+#ifdef INET6
+		sprintf(buf, "::ffff:%d.%d.%d.0", 1 + (i * 37) % 223,
+			(i * 101) % 256, (i * 13) % 256);
+#else
+		sprintf(buf, "%d.%d.%d.0", 1 + (i * 37) % 223,
+			(i * 101) % 256, (i * 13) % 256);
+#endif
+		(void)inet_pton(AFINET, buf, &addr);
+		(void)patricia_make_and_lookup_ip(tree, &addr,
+#ifdef INET6
+						  96 +
+#endif
+						  16 + (i % 3) * 4);
+	    }
+	addrs = (struct IN_ADDR *)MyMalloc(NADDRS * sizeof(struct IN_ADDR));
+	for (i = 0; i < NADDRS; i++)
+	    {
+#ifdef INET6
+		sprintf(buf, "::ffff:%d.%d.%d.%d", 1 + (i * 53) % 223,
+			(i * 7) % 256, (i * 29) % 256, i % 251);
+#else
+		sprintf(buf, "%d.%d.%d.%d", 1 + (i * 53) % 223,
+			(i * 7) % 256, (i * 29) % 256, i % 251);
+#endif
+		(void)inet_pton(AFINET, buf, &addrs[i]);
+	    }
+}
+
+/*
+** The benchmarks, each one does n operations.
+*/
+static	int	bench_sink;	/* keeps results alive */
+
+static	void	b_match(long n)
+{
+	long	i;
+
+	for (i = 0; i < n; i++)
+		bench_sink += match(masks[i % NMASKS],
+				    idents[(i / NMASKS) % NIDENTS]);
+}
+
+static	void	b_collapse(long n)
+{
+	char	buf[128];
+	long	i;
+
+	for (i = 0; i < n; i++)
+	    {
+		strcpy(buf, smasks[i % NMASKS]);
+		bench_sink += *collapse(buf);
+	    }
+}
+
+/* the same, but for the case */
+static	void	b_mycmp(long n)
+{
+	long	i;
+
+	for (i = 0; i < n; i++)
+		bench_sink += mycmp(idents[i % NIDENTS], uidents[i % NIDENTS]);
+}
+
+static	void	b_hash_nick(long n)
+{
+	long	i;
+
+	for (i = 0; i < n; i++)
+		bench_sink += hash_find_client(remotes[(i * 7919) %
+					BENCH_NICKS]->name, NULL) != NULL;
+}
+
+static	void	b_hash_nick_miss(long n)
+{
+	long	i;
+
+	for (i = 0; i < n; i++)
+		bench_sink += hash_find_client(missnames[(i * 7919) %
+					       BENCH_NICKS], NULL) != NULL;
+}
+
+static	void	b_hash_channel(long n)
+{
+	long	i;
+
+	for (i = 0; i < n; i++)
+		bench_sink += hash_find_channel(chnames[(i * 7919) %
+					BENCH_CHANNELS], NULL) != NULL;
+}
+
+static	void	b_dbuf_line(long n)
+{
+	static	dbuf	d;
+	char	buf[BUFSIZE];
+	long	i;
+	int	len;
+
+	for (i = 0; i < n; i++)
+	    {
+		len = strlen(clines[i % NCLINES]);
+		(void)dbuf_put(&d, clines[i % NCLINES], len);
+		(void)dbuf_put(&d, "\r\n", 2);
+		bench_sink += dbuf_getmsg(&d, buf, sizeof(buf));
+	    }
+}
+
+/* a sendQ filled by lines, emptied by TCP segments */
+static	void	b_dbuf_sendq(long n)
+{
+	static	dbuf	d;
+	char	*p;
+	long	i;
+	int	len, j;
+
+	for (i = 0; i < n; i++)
+	    {
+		for (j = 0; j < 30; j++)
+			(void)dbuf_put(&d, texts[(i + j) % NTEXTS],
+				       strlen(texts[(i + j) % NTEXTS]));
+		while ((len = DBufLength(&d)) > 0)
+		    {
+			p = dbuf_map(&d, &len);
+			bench_sink += *p;
+			(void)dbuf_delete(&d, (len > 1448) ? 1448 : len);
+		    }
+	    }
+}
+
+static	void	b_parse(long n)
+{
+	char	buf[BUFSIZE];
+	long	i;
+	int	len;
+
+	for (i = 0; i < n; i++)
+	    {
+		len = sprintf(buf, "%s\r\n", clines[i % NCLINES]);
+		if (dopacket(locals[0], buf, len) == FLUSH_BUFFER)
+			exit(1);
+	    }
+}
+
+/* lines from a file (-l), the commands which change much are left out */
+static	void	b_parse_file(long n)
+{
+	char	buf[BUFSIZE];
+	long	i;
+	int	len;
+
+	for (i = 0; i < n; i++)
+	    {
+		len = sprintf(buf, "%s\r\n", lines[i % nlines]);
+		if (dopacket(locals[0], buf, len) == FLUSH_BUFFER)
+			exit(1);
+	    }
+}
+
+static	void	b_send_one(long n)
+{
+	aClient	*from = locals[1];
+	long	i;
+
+	for (i = 0; i < n; i++)
+		sendto_one(locals[i % BENCH_CLIENTS], ":%s!%s@%s PRIVMSG %s :%s",
+			   from->name, from->user->username, from->user->host,
+			   locals[i % BENCH_CLIENTS]->name, texts[i % NTEXTS]);
+}
+
+static	void	b_send_numeric(long n)
+{
+	aClient	*who = locals[1];
+	long	i;
+
+	for (i = 0; i < n; i++)
+		sendto_one(locals[0], replies[RPL_WHOISUSER], ME,
+			   locals[0]->name, who->name, who->user->username,
+			   who->user->host, who->info);
+}
+
+static	void	b_send_channel(long n)
+{
+	aChannel *chptr = hash_find_channel("#bench", NULL);
+	aClient	*from = locals[1];
+	long	i;
+
+	for (i = 0; i < n; i++)
+		sendto_channel_butone(from, from, chptr, ":%s PRIVMSG %s :%s",
+				      from->name, chptr->chname,
+				      texts[i % NTEXTS]);
+}
+
+static	void	b_patricia(long n)
+{
+	long	i;
+
+	for (i = 0; i < n; i++)
+		bench_sink += patricia_match_ip(tree, &addrs[i % NADDRS])
+			!= NULL;
+}
+
+/*
+** The scan benchmarks use their own clients, taken from the pools as
+** ircd does, made the first time one of them runs: BENCH_SCANLOCAL
+** local ones in an array like local[], BENCH_SCANLIST remote ones
+** linked in an order which has nothing to do with their addresses, as
+** the client list of a server up for a while.
+*/
+static	aClient	**scanlocal = NULL, *scanlist = NULL;
+
+static	void	bench_scan_setup(void)
+{
+	aClient	**rem, *cptr;
+	u_long	r = 1;
+	int	i, j;
+
+	if (scanlocal)
+		return;
+	scanlocal = (aClient **)MyMalloc(BENCH_SCANLOCAL * sizeof(aClient *));
+	for (i = 0; i < BENCH_SCANLOCAL; i++)
+	    {
+		cptr = scanlocal[i] = make_client(NULL);
+		cptr->status = (i % 10) ? STAT_CLIENT : STAT_SERVER;
+		cptr->ping = 120;
+		cptr->lasttime = timeofday - i % 100;
+		cptr->acpt = &me;
+	    }
+	rem = (aClient **)MyMalloc(BENCH_SCANLIST * sizeof(aClient *));
+	for (i = 0; i < BENCH_SCANLIST; i++)
+	    {
+		cptr = rem[i] = make_client(scanlocal[i % BENCH_SCANLOCAL]);
+		cptr->status = STAT_CLIENT;
+		cptr->flags = (i % 7) ? 0 : FLAGS_KILLED;
+	    }
+	/* shuffled, as clients come and go */
+	for (i = BENCH_SCANLIST - 1; i > 0; i--)
+	    {
+		r = r * 1103515245 + 12345;
+		j = (r >> 8) % (i + 1);
+		cptr = rem[i];
+		rem[i] = rem[j];
+		rem[j] = cptr;
+	    }
+	for (i = 0; i < BENCH_SCANLIST; i++)
+		rem[i]->next = (i + 1 < BENCH_SCANLIST) ? rem[i + 1] : NULL;
+	scanlist = rem[0];
+	MyFree(rem);
+}
+
+/* what check_pings() and flush_connections() look at, per client */
+static	void	b_scan_local(long n)
+{
+	aClient	*cptr;
+	long	i;
+	int	k = 0;
+
+	bench_scan_setup();
+	for (i = 0; i < n; i++)
+	    {
+		if (!(cptr = scanlocal[i % BENCH_SCANLOCAL]) ||
+		    IsListener(cptr))
+			continue;
+		if (IsRegistered(cptr) && cptr->ping >=
+		    timeofday - cptr->lasttime)
+			k++;
+		if (DBufLength(&cptr->sendQ) > 0 || DBufLength(&cptr->recvQ)
+		    > 0 || cptr->count > 0 || cptr->since > timeofday ||
+		    cptr->confs)
+			k += 2;
+	    }
+	bench_sink += k;
+}
+
+/* a walk of the client list, as who_find() or m_lusers() do */
+static	void	b_scan_list(long n)
+{
+	static	aClient	*cptr = NULL;
+	long	i;
+	int	k = 0;
+
+	bench_scan_setup();
+	for (i = 0; i < n; i++)
+	    {
+		if (!cptr)
+			cptr = scanlist;
+		if (IsClient(cptr) && !(cptr->flags & FLAGS_KILLED))
+			k++;
+		if (cptr->user || MyConnect(cptr->from))
+			k += 2;
+		cptr = cptr->next;
+	    }
+	bench_sink += k;
+}
+
+typedef	struct	{
+	char	*name;
+	void	(*func)(long);
+	char	*what;
+} aBench;
+
+static	aBench	benches[] = {
+	{ "match",		b_match,	"ban mask against n!u@h" },
+	{ "collapse",		b_collapse,	"mask with extra *" },
+	{ "mycmp",		b_mycmp,	"n!u@h, case differs" },
+	{ "hash_nick",		b_hash_nick,	"hash_find_client(), found" },
+	{ "hash_nick_miss",	b_hash_nick_miss, "hash_find_client(), not found" },
+	{ "hash_channel",	b_hash_channel,	"hash_find_channel()" },
+	{ "dbuf_line",		b_dbuf_line,	"dbuf_put() and dbuf_getmsg()" },
+	{ "dbuf_sendq",		b_dbuf_sendq,	"30 lines, sent 1448 bytes at once" },
+	{ "parse",		b_parse,	"dopacket() of client lines" },
+	{ "parse_file",		b_parse_file,	"dopacket() of -l lines" },
+	{ "send_one",		b_send_one,	"sendto_one() of a PRIVMSG" },
+	{ "send_numeric",	b_send_numeric,	"sendto_one() of RPL_WHOISUSER" },
+	{ "send_channel",	b_send_channel,	"sendto_channel_butone(), 50 users" },
+	{ "patricia",		b_patricia,	"patricia_match_ip()" },
+	{ "scan_local",		b_scan_local,	"check_pings() fields, 50k clients" },
+	{ "scan_list",		b_scan_list,	"client list walk, 500k clients" },
+	{ NULL, NULL, NULL }
+};
+
+/*
+** Running them.
+*/
+static	double	bench_ns(void)
+{
+#ifdef CLOCK_MONOTONIC
+	struct	timespec ts;
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+#else
+	struct	timeval tv;
+
+	(void)gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1e9 + tv.tv_usec * 1e3;
+#endif
+}
+
+static	int	dcmp(const void *a, const void *b)
+{
+	double	x = *(const double *)a, y = *(const double *)b;
+
+	return (x < y) ? -1 : (x > y);
+}
+
+/* ns and allocations per operation, median of the rounds */
+static	void	bench_run(aBench *b, int rounds, int ms, double *ns,
+	double *allocs)
+{
+	double	t, tns[BENCH_ROUNDS * 4], tal[BENCH_ROUNDS * 4];
+	u_long	a;
+	long	n;
+	int	r;
+
+	/* how many make a run */
+	for (n = 1; ; n *= 2)
+	    {
+		t = bench_ns();
+		b->func(n);
+		t = bench_ns() - t;
+		if (t > ms * 1e5 || n > (1L << 40))
+			break;
+	    }
+	n = (long)(n * (ms * 1e6 / t)) + 1;
+	for (r = 0; r < rounds; r++)
+	    {
+		a = bench_allocs;
+		t = bench_ns();
+		b->func(n);
+		t = bench_ns() - t;
+		tns[r] = t / n;
+		tal[r] = (double)(bench_allocs - a) / n;
+	    }
+	qsort(tns, rounds, sizeof(double), dcmp);
+	qsort(tal, rounds, sizeof(double), dcmp);
+	*ns = tns[rounds / 2];
+	*allocs = tal[rounds / 2];
+}
+
+/* baseline file: name ns allocs */
+static	int	bench_baseline(char *file, char *name, double *ns,
+	double *allocs)
+{
+	char	line[256], bname[64];
+	FILE	*fp;
+
+	if (!file || !(fp = fopen(file, "r")))
+		return 0;
+	while (fgets(line, sizeof(line), fp))
+		if (sscanf(line, "%63s %lf %lf", bname, ns, allocs) == 3 &&
+		    !strcmp(bname, name))
+		    {
+			fclose(fp);
+			return 1;
+		    }
+	fclose(fp);
+	return 0;
+}
+
+static	void	bench_lines(char *file)
+{
+	static	char	*skip[] = { "QUIT", "NICK", "JOIN", "PART", "KICK",
+				    "KILL", "SQUIT", "USER", "PASS", "OPER",
+				    "SERVER", "SERVICE", "CONNECT", "DIE",
+				    "RESTART", "REHASH", "SET", NULL };
+	char	line[BUFSIZE], *p, *cmd;
+	FILE	*fp;
+	int	i;
+
+	if (!(fp = fopen(file, "r")))
+	    {
+		perror(file);
+		exit(1);
+	    }
+	lines = (char **)MyMalloc(BENCH_MAXLINES * sizeof(char *));
+	while (nlines < BENCH_MAXLINES && fgets(line, sizeof(line), fp))
+	    {
+		if ((p = strpbrk(line, "\r\n")))
+			*p = '\0';
+		/* the prefix is ignored from clients, skip it */
+		cmd = line;
+		if (*cmd == ':' && (cmd = strchr(cmd, ' ')))
+			cmd++;
+		if (!cmd || !*cmd)
+			continue;
+		for (i = 0; skip[i]; i++)
+			if (!strncasecmp(cmd, skip[i], strlen(skip[i])) &&
+			    (cmd[strlen(skip[i])] == ' ' ||
+			     !cmd[strlen(skip[i])]))
+				break;
+		if (!skip[i])
+			lines[nlines++] = mystrdup(cmd);
+	    }
+	fclose(fp);
+	if (nlines == 0)
+	    {
+		fprintf(stderr, "ircd-bench: no usable line in %s\n", file);
+		exit(1);
+	    }
+}
+
+static	void	usage(void)
+{
+	aBench	*b;
+
+	fprintf(stderr, "usage: ircd-bench [-r rounds] [-t ms] [-l lines] "
+		"[-b baseline] [-o output] [benchmark mask...]\n");
+	for (b = benches; b->name; b++)
+		fprintf(stderr, "  %-16s %s\n", b->name, b->what);
+	exit(2);
+}
+
+int	main(int argc, char *argv[])
+{
+	char	*base = NULL, *out = NULL, *lfile = NULL;
+	int	rounds = BENCH_ROUNDS, ms = BENCH_TIME, c, i;
+	double	ns, allocs, bns, ballocs;
+	FILE	*ofp = NULL;
+	aBench	*b;
+
+	myargv = argv;
+	while ((c = getopt(argc, argv, "r:t:l:b:o:")) != -1)
+		switch (c)
+		    {
+		case 'r':
+			rounds = atoi(optarg);
+			break;
+		case 't':
+			ms = atoi(optarg);
+			break;
+		case 'l':
+			lfile = optarg;
+			break;
+		case 'b':
+			base = optarg;
+			break;
+		case 'o':
+			out = optarg;
+			break;
+		default:
+			usage();
+		    }
+	if (rounds < 1 || rounds > BENCH_ROUNDS * 4 || ms < 1)
+		usage();
+
+	bench_setup();
+	if (lfile)
+		bench_lines(lfile);
+	if (out && !(ofp = fopen(out, "w")))
+	    {
+		perror(out);
+		exit(1);
+	    }
+
+	printf("%-16s %12s %10s%s\n", "benchmark", "ns/op", "allocs/op",
+	       base ? "   baseline ns/op" : "");
+	for (b = benches; b->name; b++)
+	    {
+		if (b->func == b_parse_file && !nlines)
+			continue;
+		if (optind < argc)
+		    {
+			for (i = optind; i < argc; i++)
+				if (!match(argv[i], b->name))
+					break;
+			if (i == argc)
+				continue;
+		    }
+		bench_run(b, rounds, ms, &ns, &allocs);
+		printf("%-16s %12.1f %10.2f", b->name, ns, allocs);
+		if (bench_baseline(base, b->name, &bns, &ballocs))
+			printf("   %12.1f %+6.1f%%%s", bns,
+			       (ns - bns) * 100 / bns,
+			       (allocs - ballocs > 0.005 ||
+				ballocs - allocs > 0.005) ?
+			       " allocs differ" : "");
+		printf("\n");
+		fflush(stdout);
+		if (ofp)
+			fprintf(ofp, "%s %.1f %.2f\n", b->name, ns, allocs);
+	    }
+	if (ofp)
+		fclose(ofp);
+	return 0;
+}
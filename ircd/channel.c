@@ -77,6 +77,7 @@ static	char	*PartFmt = ":%s PART %s :%s";
  * some buffers for rebuilding channel/nick lists with ,'s
  */
 static	char	buf[BUFSIZE];
+static	char	njoinbuf[BUFSIZE * 32];	/* JOINs and MODEs of a NJOIN */
 static	char	modebuf[MODEBUFLEN], parabuf[MODEBUFLEN], uparabuf[MODEBUFLEN];
 
 /*
@@ -401,74 +402,90 @@ static	Link	*match_modeid(int type, aClient *cptr, aChannel *chptr)
 
 /*
  * adds a user to a channel by adding another link to the channels member
- * chain.
+ * chain.  The channel's clist (count of members per link) is not updated,
+ * see add_clist().
  */
-static	void	add_user_to_channel(aChannel *chptr, aClient *who, int flags)
+static	void	add_member(aChannel *chptr, aClient *who, int flags)
 {
 	Reg	Link *ptr;
 	Reg	int sz = sizeof(aChannel) + strlen(chptr->chname);
 
-	if (who->user)
+	ptr = make_link();
+	ptr->flags = flags;
+	ptr->value.cptr = who;
+	ptr->next = chptr->members;
+	chptr->members = ptr;
+	istat.is_chanusers++;
+	if (chptr->users++ == 0)
 	    {
-		ptr = make_link();
-		ptr->flags = flags;
-		ptr->value.cptr = who;
-		ptr->next = chptr->members;
-		chptr->members = ptr;
-		istat.is_chanusers++;
-		if (chptr->users++ == 0)
-		    {
-			istat.is_chan++;
-			istat.is_chanmem += sz;
-		    }
-		if (chptr->users == 1 && chptr->history)
-		    {
-			/* Locked channel */
-			istat.is_hchan--;
-			istat.is_hchanmem -= sz;
-			/*
-			** The modes had been kept, but now someone is joining,
-			** they should be reset to avoid desynchs
-			** (you wouldn't want to join a +i channel, either)
-			**
-			** This can be wrong in some cases such as a netjoin
-			** which will not complete, or on a mixed net (with
-			** servers that don't do channel delay) - kalt
-			*/
-			if (*chptr->chname != '!')
-				bzero((char *)&chptr->mode, sizeof(Mode));
-		    }
+		istat.is_chan++;
+		istat.is_chanmem += sz;
+	    }
+	if (chptr->users == 1 && chptr->history)
+	    {
+		/* Locked channel */
+		istat.is_hchan--;
+		istat.is_hchanmem -= sz;
+		/*
+		** The modes had been kept, but now someone is joining,
+		** they should be reset to avoid desynchs
+		** (you wouldn't want to join a +i channel, either)
+		**
+		** This can be wrong in some cases such as a netjoin
+		** which will not complete, or on a mixed net (with
+		** servers that don't do channel delay) - kalt
+		*/
+		if (*chptr->chname != '!')
+			bzero((char *)&chptr->mode, sizeof(Mode));
+	    }
+
+	ptr = make_link();
+	ptr->flags = flags;
+	ptr->value.chptr = chptr;
+	ptr->next = who->user->channel;
+	who->user->channel = ptr;
+	if (!IsQuiet(chptr))
+	{
+		who->user->joined++;
+		istat.is_userc++;
+	}
+}
+
+/*
+ * accounts for cnt members which joined chptr through the link from,
+ * after add_member() was called for each of them.
+ */
+static	void	add_clist(aChannel *chptr, aClient *from, int cnt)
+{
+	Reg	Link *ptr;
 
 #ifdef USE_SERVICES
-		if (chptr->users == 1)
-			check_services_butone(SERVICE_WANT_CHANNEL|
-					      SERVICE_WANT_VCHANNEL,
-					      NULL, &me, "CHANNEL %s %d",
-					      chptr->chname, chptr->users);
-		else
-			check_services_butone(SERVICE_WANT_VCHANNEL,
-					      NULL, &me, "CHANNEL %s %d",
-					      chptr->chname, chptr->users);
+	if (chptr->users == cnt)
+		check_services_butone(SERVICE_WANT_CHANNEL|
+				      SERVICE_WANT_VCHANNEL,
+				      NULL, &me, "CHANNEL %s %d",
+				      chptr->chname, chptr->users);
+	else
+		check_services_butone(SERVICE_WANT_VCHANNEL,
+				      NULL, &me, "CHANNEL %s %d",
+				      chptr->chname, chptr->users);
 #endif
+	if (!(ptr = find_user_link(chptr->clist, from)))
+	    {
 		ptr = make_link();
-		ptr->flags = flags;
-		ptr->value.chptr = chptr;
-		ptr->next = who->user->channel;
-		who->user->channel = ptr;
-		if (!IsQuiet(chptr))
-		{
-			who->user->joined++;
-			istat.is_userc++;
-		}
+		ptr->value.cptr = from;
+		ptr->next = chptr->clist;
+		chptr->clist = ptr;
+	    }
+	ptr->flags += cnt;
+}
 
-		if (!(ptr = find_user_link(chptr->clist, who->from)))
-		    {
-			ptr = make_link();
-			ptr->value.cptr = who->from;
-			ptr->next = chptr->clist;
-			chptr->clist = ptr;
-		    }
-		ptr->flags++;
+static	void	add_user_to_channel(aChannel *chptr, aClient *who, int flags)
+{
+	if (who->user)
+	    {
+		add_member(chptr, who, flags);
+		add_clist(chptr, who->from, 1);
 	    }
 }
 
@@ -543,6 +560,101 @@ void	remove_user_from_channel(aClient *sptr, aChannel *chptr)
 	istat.is_chanusers--;
 }
 
+/*
+** remove_split_members
+**	Remove from a channel, in a single pass, all members which are
+**	being exited because of a netsplit (FLAGS_SPLIT). This does what
+**	remove_user_from_channel() and exit_one_client() do for each of
+**	them, except for the users' own channel links which are left to
+**	the caller.
+*/
+void	remove_split_members(aChannel *chptr)
+{
+	Reg	Link	**curr, *tmp, *cl = NULL;
+	aClient	*who, *from = NULL;
+	int	removed = 0;
+
+	for (curr = &chptr->members; (tmp = *curr); )
+	{
+		who = tmp->value.cptr;
+		if (!(who->flags & FLAGS_SPLIT))
+		{
+			curr = &tmp->next;
+			continue;
+		}
+		/* channel locking, see exit_one_client() */
+		if (*chptr->chname == '!')
+		{
+			if (!(who->flags & FLAGS_QUIT))
+				chptr->history = timeofday +
+						 LDELAYCHASETIMELIMIT;
+		}
+		else if (
+#ifndef BETTER_CDELAY
+			 !(who->flags & FLAGS_QUIT) &&
+#endif
+			 (tmp->flags & (CHFL_CHANOP|CHFL_UNIQOP)))
+		{
+			chptr->history = timeofday + DELAYCHASETIMELIMIT;
+			chptr->reop = 0;
+		}
+		if (tmp->flags & CHFL_CHANOP)
+		{
+			chptr->reop = timeofday + LDELAYCHASETIMELIMIT +
+				myrand() % 300;
+		}
+		*curr = tmp->next;
+		free_link(tmp);
+
+		/* they're all behind the same link, but better be safe */
+		if (who->from != from)
+		{
+			from = who->from;
+			cl = find_user_link(chptr->clist, from);
+		}
+		if (cl && !--cl->flags)
+		{
+			Link	**cc;
+
+			for (cc = &chptr->clist; *cc != cl; cc = &(*cc)->next)
+				;
+			*cc = cl->next;
+			free_link(cl);
+			cl = NULL;
+			from = NULL;
+		}
+		if (!IsQuiet(chptr))
+		{
+			who->user->joined--;
+			istat.is_userc--;
+		}
+#ifdef USE_SERVICES
+		if (chptr->users == 1)
+			check_services_butone(SERVICE_WANT_CHANNEL|
+					      SERVICE_WANT_VCHANNEL, NULL, &me,
+					      "CHANNEL %s %d", chptr->chname,
+					      chptr->users-1);
+		else
+			check_services_butone(SERVICE_WANT_VCHANNEL, NULL, &me,
+					      "CHANNEL %s %d", chptr->chname,
+					      chptr->users-1);
+#endif
+		chptr->users--;
+		istat.is_chanusers--;
+		removed++;
+	}
+	if (removed && chptr->users <= 0)
+	{
+		u_int sz = sizeof(aChannel) + strlen(chptr->chname);
+
+		istat.is_chan--;
+		istat.is_chanmem -= sz;
+		istat.is_hchan++;
+		istat.is_hchanmem += sz;
+		free_channel(chptr);
+	}
+}
+
 static	void	change_chan_flag(Link *lp, aChannel *chptr)
 {
 	Reg	Link *tmp;
@@ -800,6 +912,201 @@ void	setup_server_channels(aClient *mp)
 	setup_svchans();
 }
 
+/*
+** save_channels
+**	Write the channels for a live upgrade, oldest first so that
+**	get_channel() rebuilds the list in the same order.  Members and
+**	invitations are given by UID, the server itself is left out (it
+**	is already on its & channels in the new ircd).
+*/
+void	save_channels(void)
+{
+	Reg	aChannel *chptr;
+	Reg	Link	*lp;
+	invLink	*inv;
+	int	n;
+
+	for (n = 0, chptr = channel; chptr && chptr->nextch;
+	     chptr = chptr->nextch)
+		n++;
+	upgrade_put_int(chptr ? n + 1 : 0);
+	for (; chptr; chptr = chptr->prevch)
+	    {
+		upgrade_put_str(chptr->chname);
+		upgrade_put_int(chptr->mode.mode);
+		upgrade_put_int(chptr->mode.limit);
+		upgrade_put_str(chptr->mode.key);
+		upgrade_put_str(chptr->topic);
+#ifdef TOPIC_WHO_TIME
+		upgrade_put_str(chptr->topic_nuh);
+		upgrade_put_int(chptr->topic_t);
+#else
+		upgrade_put_str("");
+		upgrade_put_int(0);
+#endif
+		upgrade_put_int(chptr->history);
+		upgrade_put_int(chptr->reop);
+
+		for (n = 0, lp = chptr->members; lp; lp = lp->next)
+			if (lp->value.cptr != &me)
+				n++;
+		upgrade_put_int(n);
+		for (lp = chptr->members; lp; lp = lp->next)
+			if (lp->value.cptr != &me)
+			    {
+				upgrade_put_str(lp->value.cptr->user->uid);
+				upgrade_put_int(lp->flags);
+			    }
+
+		for (n = 0, lp = chptr->mlist; lp; lp = lp->next)
+			n++;
+		upgrade_put_int(n);
+		for (lp = chptr->mlist; lp; lp = lp->next)
+		    {
+			upgrade_put_int(lp->flags);
+			upgrade_put_str(lp->value.alist->nick);
+			upgrade_put_str(lp->value.alist->user);
+			upgrade_put_str(lp->value.alist->host);
+		    }
+
+		for (n = 0, lp = chptr->invites; lp; lp = lp->next)
+			n++;
+		upgrade_put_int(n);
+		for (lp = chptr->invites; lp; lp = lp->next)
+		    {
+			upgrade_put_str(lp->value.cptr->user->uid);
+			for (inv = lp->value.cptr->user->invited; inv;
+			     inv = inv->next)
+				if (inv->chptr == chptr)
+					break;
+			upgrade_put_str(inv ? inv->who : "*!*@*");
+		    }
+	    }
+}
+
+/*
+** reverse a list built by prepending, to get the saved order back
+*/
+static	Link	*reverse_links(Link *lp)
+{
+	Link	*rev = NULL, *next;
+
+	for (; lp; lp = next)
+	    {
+		next = lp->next;
+		lp->next = rev;
+		rev = lp;
+	    }
+	return rev;
+}
+
+/*
+** load_channels
+**	Rebuild what save_channels() wrote, once the users are known.
+**	The server's own & channels only get their members back.
+*/
+void	load_channels(void)
+{
+	Reg	aChannel *chptr;
+	Reg	Link	*lp;
+	aClient	*acptr;
+	invLink	*inv, **tmp;
+	char	*name, *nick, *user, *host;
+	int	n, i, flags, len, old;
+	Mode	mode;
+
+	n = upgrade_get_int();
+	while (n-- > 0)
+	    {
+		if (!(name = upgrade_get_str()))
+			return;
+		old = (find_channel(name, NullChn) != NullChn);
+		chptr = get_channel(&me, name, CREATE);
+		bzero((char *)&mode, sizeof(mode));
+		mode.mode = upgrade_get_int();
+		mode.limit = upgrade_get_int();
+		strncpyzt(mode.key, upgrade_get_strz(), KEYLEN+1);
+		name = upgrade_get_strz();
+		if (!old)
+			strncpyzt(chptr->topic, name, TOPICLEN+1);
+		name = upgrade_get_strz();
+		i = upgrade_get_int();
+#ifdef TOPIC_WHO_TIME
+		if (!old)
+		    {
+			strncpyzt(chptr->topic_nuh, name, BANLEN+1);
+			chptr->topic_t = i;
+		    }
+#endif
+		chptr->history = upgrade_get_int();
+		chptr->reop = upgrade_get_int();
+
+		i = upgrade_get_int();
+		while (i-- > 0)
+		    {
+			name = upgrade_get_str();
+			flags = upgrade_get_int();
+			if (name && (acptr = find_uid(name, NULL)) &&
+			    acptr->user)
+				add_user_to_channel(chptr, acptr, flags);
+		    }
+		if (!old)
+		    {
+			chptr->members = reverse_links(chptr->members);
+			/* add_member() may have cleared them */
+			bcopy((char *)&mode, (char *)&chptr->mode,
+			      sizeof(Mode));
+			if (chptr->users == 0 && chptr->history)
+			    {
+				istat.is_hchan++;
+				istat.is_hchanmem += sizeof(aChannel) +
+					strlen(chptr->chname);
+			    }
+		    }
+
+		i = upgrade_get_int();
+		while (i-- > 0)
+		    {
+			flags = upgrade_get_int();
+			nick = upgrade_get_str();
+			user = upgrade_get_str();
+			host = upgrade_get_str();
+			if (nick && user && host)
+				(void)add_modeid(flags, &me, chptr,
+						 make_bei(nick, user, host));
+		    }
+		chptr->mlist = reverse_links(chptr->mlist);
+
+		i = upgrade_get_int();
+		while (i-- > 0)
+		    {
+			name = upgrade_get_str();
+			nick = upgrade_get_str();
+			if (!name || !nick || !(acptr = find_uid(name, NULL))
+			    || !acptr->user)
+				continue;
+			lp = make_link();
+			lp->value.cptr = acptr;
+			lp->next = chptr->invites;
+			chptr->invites = lp;
+			istat.is_useri++;
+			for (tmp = &(acptr->user->invited); *tmp;
+			     tmp = &((*tmp)->next))
+				;
+			inv = make_invlink();
+			(*tmp) = inv;
+			inv->chptr = chptr;
+			inv->next = NULL;
+			len = strlen(nick);
+			inv->who = (char *)MyMalloc(len + 1);
+			istat.is_banmem += len;
+			strcpy(inv->who, nick);
+			istat.is_invite++;
+		    }
+		chptr->invites = reverse_links(chptr->invites);
+	    }
+}
+
 /*
  * write the "simple" list of channel modes for channel chptr onto buffer mbuf
  * with the parameters in pbuf.
@@ -2151,8 +2458,7 @@ static	aChannel *get_channel(aClient *cptr, char *chname, int flag)
 		return (chptr);
 	if (flag == CREATE)
 	    {
-		chptr = (aChannel *)MyMalloc(sizeof(aChannel) + len);
-		bzero((char *)chptr, sizeof(aChannel));
+		chptr = make_chan(len);
 		strncpyzt(chptr->chname, chname, len+1);
 		if (channel)
 			channel->prevch = chptr;
@@ -2314,7 +2620,7 @@ static	void	free_channel(aChannel *chptr)
 		if (*chptr->chname == '!' && close_chid(chptr->chname+1))
 			cache_chid(chptr);
 		else
-			MyFree(chptr);
+			free_chan(chptr);
 	    }
 }
 
@@ -2649,7 +2955,7 @@ int	m_njoin(aClient *cptr, aClient *sptr, int parc, char *parv[])
 	char mbuf[3] /* "ov" */;
 	char uidbuf[BUFSIZE], *u;
 	char *p = NULL;
-	int chop, cnt = 0;
+	int chop, cnt = 0, joined = 0, blen = 0;
 	aChannel *chptr = NULL;
 	aClient *acptr;
 	int maxlen;
@@ -2781,8 +3087,17 @@ int	m_njoin(aClient *cptr, aClient *sptr, int parc, char *parv[])
 			/* ignore such join anyway */
 			continue;
 		}
-		/* add user to channel */
-		add_user_to_channel(chptr, acptr, UseModes(parv[1]) ? chop :0);
+		/* add user to channel, clist is updated once at the end */
+		add_member(chptr, acptr, UseModes(parv[1]) ? chop : 0);
+		joined++;
+
+		/* JOINs and MODEs for local users on channel are gathered
+		** in njoinbuf, flush it if it may not hold them. */
+		if (blen > (int) sizeof(njoinbuf) - 2 * BUFSIZE)
+		{
+			sendto_channel_block(chptr, njoinbuf, blen);
+			blen = 0;
+		}
 
 		/* build buffer for NJOIN and UID capable servers */
 
@@ -2819,7 +3134,8 @@ int	m_njoin(aClient *cptr, aClient *sptr, int parc, char *parv[])
 		** join from netjoin. 2.10.x is using NJOIN only during
 		** burst, but 2.11 always. Hence we check for EOB from 2.11
 		** to know what kind of NJOIN it is. --B. */
-		sendto_channel_butserv(chptr, acptr, ":%s JOIN %s%s", acptr->name, (
+		blen = sendprep_block(njoinbuf, blen, chptr, acptr,
+			":%s JOIN %s%s", acptr->name, (
 #ifdef JAPANESE
 			/* XXX-JP: explain why jp-patch had that! */
 			IsServer(sptr) ||
@@ -2854,11 +3170,12 @@ int	m_njoin(aClient *cptr, aClient *sptr, int parc, char *parv[])
 				    }
 				break;
 			case 2:
-				sendto_channel_butserv(chptr, &me,
-					       ":%s MODE %s +%s%c %s %s",
-						       sptr->name, chptr->chname,
-						       modebuf, mbuf[0],
-						       parabuf, acptr->name);
+				blen = sendprep_block(njoinbuf, blen, chptr,
+						      &me,
+						      ":%s MODE %s +%s%c %s %s",
+						      sptr->name, chptr->chname,
+						      modebuf, mbuf[0],
+						      parabuf, acptr->name);
 				if (mbuf[1])
 				    {
 					strcpy(modebuf, mbuf+1);
@@ -2871,18 +3188,22 @@ int	m_njoin(aClient *cptr, aClient *sptr, int parc, char *parv[])
 			    }
 			if (cnt == MAXMODEPARAMS)
 			    {
-				sendto_channel_butserv(chptr, &me,
-						       ":%s MODE %s +%s %s",
-						       sptr->name, chptr->chname,
-						       modebuf, parabuf);
+				blen = sendprep_block(njoinbuf, blen, chptr,
+						      &me, ":%s MODE %s +%s %s",
+						      sptr->name, chptr->chname,
+						      modebuf, parabuf);
 				cnt = 0;
 			    }
 		    }
 	    }
 	/* send eventual MODE leftover */
 	if (cnt)
-		sendto_channel_butserv(chptr, &me, ":%s MODE %s +%s %s",
-				       sptr->name, chptr->chname, modebuf, parabuf);
+		blen = sendprep_block(njoinbuf, blen, chptr, &me,
+				      ":%s MODE %s +%s %s",
+				      sptr->name, chptr->chname, modebuf, parabuf);
+	sendto_channel_block(chptr, njoinbuf, blen);
+	if (joined)
+		add_clist(chptr, cptr, joined);
 
 	/* send NJOIN */
 	*u = '\0';
@@ -35,6 +35,7 @@ extern aChannel *channel;
 #define EXTERN
 #endif /* CHANNEL_C */
 EXTERN void remove_user_from_channel (aClient *sptr, aChannel *chptr);
+EXTERN void remove_split_members (aChannel *chptr);
 EXTERN int is_chan_op (aClient *cptr, aChannel *chptr);
 EXTERN int has_voice (aClient *cptr, aChannel *chptr);
 EXTERN int can_send (aClient *cptr, aChannel *chptr);
@@ -48,6 +49,8 @@ EXTERN int jp_valid (aClient *, aChannel *, char *);
 
 EXTERN aChannel *find_channel (Reg char *chname, Reg aChannel *chptr);
 EXTERN void setup_server_channels (aClient *mp);
+EXTERN void save_channels (void);
+EXTERN void load_channels (void);
 EXTERN void channel_modes (aClient *cptr, Reg char *mbuf, Reg char *pbuf,
 			       aChannel *chptr);
 EXTERN void send_channel_modes (aClient *cptr, aChannel *chptr);
@@ -68,6 +68,7 @@ static	void	validate(aConfItem *);
 static	aClass	*get_class(int, int);
 static	aConfItem	*initconf(void);
 static	void	showconf(void);
+static	int	confimg_write(void);
 static	int	checkSID(char *, int);
 
 static	int	numclasses = 0, *classarr = (int *)NULL, debugflag = 0;
@@ -79,17 +80,19 @@ static	char	maxsendq[12];
 int	main(int argc, char *argv[])
 {
 	aConfItem *result;
-	int	showflag = 0;
+	int	showflag = 0, imgflag = 0;
 
 	if (argc > 1 && !strncmp(argv[1], "-h", 2))
 	{
-		(void)printf("Usage: %s [-h | -s | -d[#]] [ircd.conf]\n",
+		(void)printf("Usage: %s [-h | -s | -d[#]] [-b] [ircd.conf]\n",
 			      argv[0]);
 		(void)printf("\t-h\tthis help\n");
 		(void)printf("\t-s\tshows preprocessed config file (after "
 			"includes and/or M4)\n");
 		(void)printf("\t-d[#]\tthe bigger number, the more verbose "
 			"chkconf is in its checks\n");
+		(void)printf("\t-b\twrites the binary image ircd uses "
+			"instead of ircd.conf\n");
 		(void)printf("\tDefault ircd.conf = %s\n", IRCDCONF_PATH);
 		exit(0);
 	}
@@ -109,6 +112,12 @@ int	main(int argc, char *argv[])
 		argc--;
 		argv++;
 	}
+	if (argc > 1 && !strncmp(argv[1], "-b", 2))
+   	{
+		imgflag = 1;
+		argc--;
+		argv++;
+	}
 	if (argc > 1)
 		configfile = argv[1];
 	if (showflag)
@@ -136,7 +145,19 @@ int	main(int argc, char *argv[])
 #if defined(CONFIG_DIRECTIVE_INCLUDE)
 	config_free(files);
 #endif
-	return 0;
+	if (imgflag)
+	{
+		if (!result || config_errors)
+		{
+			(void)fprintf(stderr, "Errors found, %s not written\n",
+				      confimg_path());
+			return 1;
+		}
+		if (confimg_write() == -1)
+			return 1;
+	}
+	/* ircdwatch relies on it before HUPing ircd */
+	return (!result || config_errors) ? 1 : 0;
 }
 
 /*
@@ -268,6 +289,145 @@ static	void	showconf(void)
 	return;
 }
 
+/* add a string to the image, returns its offset */
+static	u_int	confimg_str(char **strs, u_int *len, char *str)
+{
+	u_int	off = *len, n = strlen(str) + 1;
+
+	*strs = (char *)realloc(*strs, *len + n);
+	memcpy(*strs + off, str, n);
+	*len += n;
+	return off;
+}
+
+/*
+** confimg_write()
+**    Writes the binary image of the config (see config_read.c) ircd
+**    uses instead of the text, the lines being split as ircd does it.
+*/
+static	int	confimg_write(void)
+{
+	aConfImgHead	head;
+	aConfImgFile	*file = NULL;
+	aConfImgRec	*rec = NULL;
+	char	*strs = NULL, *field[CONFIMG_FIELDS], tmpname[FILEMAX + 10];
+	u_int	slen = 0, nrecs = 0, nfiles = 0;
+	int	fd, i, nfield;
+	FILE	*fp;
+#if defined(CONFIG_DIRECTIVE_INCLUDE)
+	char	*line;
+	aConfig	*ConfigTop, *p;
+	aFile	*ftop, *f;
+	FILE	*fdn;
+#else
+	char	line[512], c[80], *tmp;
+#endif
+
+	if ((fd = openconf()) == -1)
+	    {
+#ifdef	M4_PREPROC
+		(void)wait(0);
+#endif
+		return -1;
+	    }
+#if defined(CONFIG_DIRECTIVE_INCLUDE)
+	ftop = new_config_file(configfile, NULL, 0);
+	fdn = fdopen(fd, "r");
+	ConfigTop = config_read(fdn, 0, ftop);
+	for (p = ConfigTop; p; p = p->next)
+	    {
+		line = p->line;
+#else
+	(void)dgets(-1, NULL, 0); /* make sure buffer is at empty pos */
+	while ((i = dgets(fd, line, sizeof(line) - 1)) > 0)
+	    {
+		line[i] = '\0';
+		if ((tmp = (char *)index(line, '\n')))
+			*tmp = 0;
+		else while(dgets(fd, c, sizeof(c) - 1) > 0)
+			if ((tmp = (char *)index(c, '\n')))
+			    {
+				*tmp = 0;
+				break;
+			    }
+#endif
+		if ((nfield = config_split(line, field, CONFIMG_FIELDS)) <= 0)
+			continue;
+		rec = (aConfImgRec *)realloc(rec, (nrecs + 1) * sizeof(*rec));
+		bzero((char *)(rec + nrecs), sizeof(*rec));
+		rec[nrecs].nfields = nfield;
+		for (i = 0; i < nfield; i++)
+			rec[nrecs].field[i] = confimg_str(&strs, &slen,
+							  field[i]);
+		nrecs++;
+	    }
+
+	/* files the image depends on */
+#if defined(CONFIG_DIRECTIVE_INCLUDE)
+	for (f = ftop; f; f = f->next)
+	    {
+		file = (aConfImgFile *)realloc(file,
+					(nfiles + 1) * sizeof(*file));
+		file[nfiles].name = confimg_str(&strs, &slen, f->filename);
+		nfiles++;
+	    }
+	config_free(ConfigTop);
+	(void)fclose(fdn);
+#else
+	file = (aConfImgFile *)malloc(2 * sizeof(*file));
+	file[nfiles++].name = confimg_str(&strs, &slen, configfile);
+# ifdef	M4_PREPROC
+	file[nfiles++].name = confimg_str(&strs, &slen, IRCDM4_PATH);
+# endif
+	(void)close(fd);
+#endif
+#ifdef	M4_PREPROC
+	(void)wait(0);
+#endif
+	for (i = 0; i < nfiles; i++)
+		if (config_filesum(strs + file[i].name, &file[i].size,
+				   &file[i].sum) == -1)
+		    {
+			perror(strs + file[i].name);
+			return -1;
+		    }
+
+	bzero((char *)&head, sizeof(head));
+	memcpy(head.magic, CONFIMG_MAGIC, 8);
+	head.nfiles = nfiles;
+	head.nrecs = nrecs;
+	head.size = sizeof(head) + nfiles * sizeof(*file) +
+		nrecs * sizeof(*rec) + slen;
+	head.sum = config_sum(CONFIMG_SEED, (char *)file,
+			      nfiles * sizeof(*file));
+	head.sum = config_sum(head.sum, (char *)rec, nrecs * sizeof(*rec));
+	head.sum = config_sum(head.sum, strs, slen);
+
+	/* ircd may be reading the old one */
+	snprintf(tmpname, sizeof(tmpname), "%s.tmp", confimg_path());
+	if (!(fp = fopen(tmpname, "w")))
+	    {
+		perror(tmpname);
+		return -1;
+	    }
+	(void)fwrite((char *)&head, sizeof(head), 1, fp);
+	(void)fwrite((char *)file, sizeof(*file), nfiles, fp);
+	if (nrecs)
+		(void)fwrite((char *)rec, sizeof(*rec), nrecs, fp);
+	(void)fwrite(strs, slen, 1, fp);
+	if (fclose(fp) || rename(tmpname, confimg_path()))
+	    {
+		perror(tmpname);
+		(void)unlink(tmpname);
+		return -1;
+	    }
+	(void)printf("%s: %u lines from %u file(s), %u bytes\n",
+		     confimg_path(), nrecs, nfiles, head.size);
+	free(file);
+	free(rec);
+	free(strs);
+	return 0;
+}
 
 /*
 ** initconf()
@@ -490,6 +650,10 @@ static	aConfItem 	*initconf(void)
 			case 'y':
 			        aconf->status = CONF_CLASS;
 		        	break;
+			case 'R': /* resolver cache tuning */
+			case 'r':
+				aconf->status = CONF_RESOLVER;
+				break;
 #ifdef XLINE
 			case 'X':
 				aconf->status = CONF_XLINE;
@@ -625,6 +789,27 @@ static	aConfItem 	*initconf(void)
 			goto print_confline;
 		    }
 
+		if (aconf->status & CONF_RESOLVER)
+		    {
+			if (BadPtr(aconf->host) || atoi(aconf->host) <= 0)
+				config_error(CF_WARN, CK_FILE, CK_LINE,
+					"bad cache size, default %d used",
+					MAXCACHED);
+			if (!BadPtr(aconf->passwd) && atoi(aconf->passwd) < 0)
+				config_error(CF_WARN, CK_FILE, CK_LINE,
+					"bad negative ttl, default %d used",
+					NEGCACHETTL);
+			if (!BadPtr(aconf->name) && atoi(aconf->name) <= 0)
+				config_error(CF_WARN, CK_FILE, CK_LINE,
+					"bad timeout, default %dms used",
+					AR_TIMEOUT);
+			if (aconf->port < 0)
+				config_error(CF_WARN, CK_FILE, CK_LINE,
+					"bad number of nameservers, all used");
+			aconf->class = get_class(0, nr);
+			goto print_confline;
+		    }
+
 		if (aconf->status & CONF_LISTEN_PORT)
 		{
 			if (!aconf->host)
@@ -44,6 +44,11 @@ struct Config
 	aConfig *next;
 };
 
+#ifdef CHKCONF_COMPILE
+/* no binary image is written for a config with errors */
+static int	config_errors = 0;
+#endif
+
 #ifdef CONFIG_DIRECTIVE_INCLUDE
 static aConfig	*config_read(FILE *, int, aFile *);
 static void	config_free(aConfig *);
@@ -288,6 +293,8 @@ void config_error(int level, char *filename, int line, char *pattern, ...)
 	if (0 == strncmp(filename, IRCDCONF_DIR, etclen))
 		filep += etclen;
 #ifdef CHKCONF_COMPILE
+	if (level == CF_ERR)
+		config_errors++;
 	if (level == CF_NONE)
 	{
 		fprintf(stdout, "%s\n", vbuf);
@@ -320,3 +327,153 @@ void config_error(int level, char *filename, int line, char *pattern, ...)
 #endif
 	return;
 }
+
+/*
+** Binary image of ircd.conf, written by "chkconf -b" once the text has
+** been checked, and used by ircd instead of the text as long as the
+** files it was made from are unchanged.  It holds the lines already
+** broken up in fields, as config_split() does it for ircd.  All is in
+** host order: an image is not to be copied to another machine.
+**
+**	header, nfiles aConfImgFile, nrecs aConfImgRec, strings
+*/
+#define CONFIMG_MAGIC	"IRCDCI01"
+#define CONFIMG_FIELDS	9	/* letter, host ... tmp5 */
+#define CONFIMG_SEED	2166136261U
+
+typedef struct ConfImgHead aConfImgHead;
+struct ConfImgHead
+{
+	char	magic[8];
+	u_int	size;		/* of the whole image */
+	u_int	sum;		/* of what follows this header */
+	u_int	nfiles;		/* files the image was made from */
+	u_int	nrecs;		/* conf lines */
+};
+
+typedef struct ConfImgFile aConfImgFile;
+struct ConfImgFile
+{
+	u_int	name;		/* offsets in the strings */
+	u_int	size;
+	u_int	sum;
+};
+
+typedef struct ConfImgRec aConfImgRec;
+struct ConfImgRec
+{
+	u_int	nfields;
+	u_int	field[CONFIMG_FIELDS];
+};
+
+#define CONFIMG_FILES(h)	((aConfImgFile *)((h) + 1))
+#define CONFIMG_RECS(h)		((aConfImgRec *)(CONFIMG_FILES(h) + (h)->nfiles))
+#define CONFIMG_STRS(h)		((char *)(CONFIMG_RECS(h) + (h)->nrecs))
+
+/* the image lives next to the configuration file */
+static	char	*confimg_path(void)
+{
+	static	char	path[FILEMAX + 5];
+
+	snprintf(path, sizeof(path), "%s.img", configfile);
+	return path;
+}
+
+/* FNV-1a, good enough to tell that a file was changed */
+static	u_int	config_sum(u_int sum, char *buf, int len)
+{
+	while (len-- > 0)
+	{
+		sum ^= (u_char)*buf++;
+		sum *= 16777619U;
+	}
+	return sum;
+}
+
+static	int	config_filesum(char *filename, u_int *size, u_int *sum)
+{
+	char	buf[8192];
+	int	fd, len;
+
+	if ((fd = open(filename, O_RDONLY)) == -1)
+		return -1;
+	*size = 0;
+	*sum = CONFIMG_SEED;
+	while ((len = read(fd, buf, sizeof(buf))) > 0)
+	{
+		*size += len;
+		*sum = config_sum(*sum, buf, len);
+	}
+	close(fd);
+	return (len == -1) ? -1 : 0;
+}
+
+/*
+** config_split
+**	Does the quoting of characters and # detection on a line of
+**	ircd.conf, then breaks it up in at most max fields, the first one
+**	being the letter.  Returns the number of fields, 0 if the line is
+**	to be ignored, -1 if it is not a conf line.
+*/
+static	int	config_split(char *line, char **field, int max)
+{
+	static	char	quotes[9][2] = {{'b', '\b'}, {'f', '\f'}, {'n', '\n'},
+					{'r', '\r'}, {'t', '\t'}, {'v', '\v'},
+					{'\\', '\\'}, { 0, 0}};
+	char	*tmp, *s, *end;
+	int	i, nf = 0;
+
+	for (tmp = line; *tmp; tmp++)
+	    {
+		if (*tmp == '\\')
+		    {
+			for (i = 0; quotes[i][0]; i++)
+				if (quotes[i][0] == *(tmp+1))
+				    {
+					*tmp = quotes[i][1];
+					break;
+				    }
+			if (!quotes[i][0])
+				*tmp = *(tmp+1);
+			if (!*(tmp+1))
+				break;
+			else
+				for (s = tmp; (*s = *(s+1)); s++)
+					;
+		    }
+		else if (*tmp == '#')
+		    {
+			*tmp = '\0';
+			break;	/* Ignore the rest of the line */
+		    }
+	    }
+	if (!*line || line[0] == '#' || line[0] == '\n' ||
+	    line[0] == ' ' || line[0] == '\t')
+		return 0;
+	if (line[1] != IRCDCONF_DELIMITER)
+		return -1;
+
+	/* a delimiter can be escaped, unless it ends the line */
+	for (tmp = line; tmp && nf < max; nf++)
+	    {
+		field[nf] = tmp;
+		end = index(tmp, IRCDCONF_DELIMITER);
+		if (end != tmp)
+			while (end && *(end - 1) == '\\' && *(end + 1))
+			    {
+				for (s = end - 1; (*s = *(s+1)); s++)
+					;
+				end = index(end + 1, IRCDCONF_DELIMITER);
+			    }
+		if (!end)
+		    {
+			tmp = NULL;
+			if (!(end = index(field[nf], '\n')))
+				end = field[nf] + strlen(field[nf]);
+		    }
+		else
+			tmp = end + 1;
+		*end = '\0';
+	    }
+	return nf;
+}
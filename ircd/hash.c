@@ -36,6 +36,9 @@ static	aHashEntry	*hostnameTable = NULL;
 #ifdef USE_IPHASH
 static	aHashEntry	*ipTable = NULL;
 #endif
+static	anIStr	**istrTable = NULL;
+static	int	istrsize = 0, istrcnt = 0;
+static	u_long	istrmem = 0, istrrefs = 0;
 static	unsigned int	*hashtab = NULL;
 static	int	clhits = 0, clmiss = 0, clsize = 0;
 static	int	uidhits = 0, uidmiss = 0, uidsize = 0;
@@ -228,7 +231,7 @@ static	u_int	hash_ip(char *hip, u_int *store)
  *
  * 13feb94 gbl
  */
-static	int	bigger_prime(int size)
+int	bigger_prime(int size)
 {
 	int	trial, failure, sq;
 
@@ -377,6 +380,10 @@ void	inithashtables(void)
 	hashtab = (u_int *) MyMalloc(256 * sizeof(u_int));
 	for (i = 0; i < 256; i++)
 		hashtab[i] = tolower((char)i) * 109;
+
+	istrsize = bigger_prime(ISTRSIZE);
+	istrTable = (anIStr **)MyMalloc(istrsize * sizeof(anIStr *));
+	bzero((char *)istrTable, istrsize * sizeof(anIStr *));
 }
 
 static	void	bigger_hash_table(int *size, aHashEntry *table, int new)
@@ -400,6 +407,7 @@ static	void	bigger_hash_table(int *size, aHashEntry *table, int new)
 		size, osize, table, new));
 
 	*size = new;
+	TRACE(TRACE_MEM, TEV_HASHGROW, -1, osize, new, 0);
 	ircd_writetune(tunefile);
 	table = (aHashEntry *)MyMalloc(sizeof(*table) * new);
 	bzero((char *)table, sizeof(*table) * new);
@@ -622,7 +630,9 @@ int	add_to_hostname_hash_table(char *hostname, anUser *user)
 {
 	Reg	u_int	hashv;
 
-	hashv = hash_host_name(hostname, &user->hhashv);
+	/* hostname is interned, its hash value is known already */
+	user->hhashv = ISTR(hostname)->hashv;
+	hashv = user->hhashv % _HOSTNAMEHASHSIZE;
 	user->hhnext = (anUser *)hostnameTable[hashv].list;
 	hostnameTable[hashv].list = (void *)user;
 	hostnameTable[hashv].links++;
@@ -642,7 +652,9 @@ int	add_to_ip_hash_table(char *ip, anUser *user)
 {
 	Reg	u_int	hashv;
 
-	hashv = hash_ip(ip, &user->iphashv);
+	/* ip is interned, its hash value is known already */
+	user->iphashv = ISTR(ip)->hashv;
+	hashv = user->iphashv % _IPHASHSIZE;
 	user->iphnext = (anUser *)ipTable[hashv].list;
 	ipTable[hashv].list = (void *)user;
 	ipTable[hashv].links++;
@@ -1214,7 +1226,8 @@ anUser	*hash_find_hostname(char *hostname, anUser *user)
 
 	for (tmp = (anUser *)tmp3->list; tmp; prv = tmp, tmp = tmp->hhnext)
 	{
-		if (hv == tmp->hhashv && !mycmp(hostname, tmp->host))
+		if (hv == tmp->hhashv && (hostname == tmp->host ||
+					  !mycmp(hostname, tmp->host)))
 		    {
 			cnhits++;
 			return (tmp);
@@ -1246,7 +1259,8 @@ anUser	*hash_find_ip(char *ip, anUser *user)
 
 	for (tmp = (anUser *)tmp3->list; tmp; prv = tmp, tmp = tmp->iphnext)
 	{
-		if (hv == tmp->iphashv && !mycmp(ip, tmp->sip))
+		if (hv == tmp->iphashv && (ip == tmp->sip ||
+					   !mycmp(ip, tmp->sip)))
 		    {
 			iphits++;
 			return (tmp);
@@ -1263,6 +1277,131 @@ anUser	*hash_find_ip(char *ip, anUser *user)
 #endif
 
 
+/*
+ * Interned strings.
+ *
+ *   Hostnames, IP addresses and usernames of users repeat a lot on a big
+ * network, so anUser only points to a reference counted copy kept in
+ * istrTable.  Users on the same host share the same string, and the
+ * hash value of the string, which is the one of hash_host_name() and
+ * hash_ip(), is computed only once.
+ */
+static	u_int	hash_istr(char *str, int len, int *size)
+{
+	Reg	u_char	*s = (u_char *)str;
+	Reg	u_int	hash = 0;
+
+	for (; *s && len > 0; s++, len--)
+		hash = 31 * hash + hashtab[*s];
+	*size = s - (u_char *)str;
+	return hash;
+}
+
+static	void	bigger_istr_table(void)
+{
+	anIStr	**otab = istrTable, *is, *next;
+	int	osize = istrsize, i;
+
+	istrsize = bigger_prime(2 * osize);
+	istrTable = (anIStr **)MyMalloc(istrsize * sizeof(anIStr *));
+	bzero((char *)istrTable, istrsize * sizeof(anIStr *));
+	for (i = 0; i < osize; i++)
+		for (is = otab[i]; is; is = next)
+		    {
+			next = is->next;
+			is->next = istrTable[is->hashv % istrsize];
+			istrTable[is->hashv % istrsize] = is;
+		    }
+	MyFree(otab);
+	sendto_flag(SCH_HASH, "String Hash Table from %d to %d (%d)",
+		    osize, istrsize, istrcnt);
+}
+
+/*
+ * make_istr
+ *	returns the interned copy of (at most len characters of) str,
+ *	which must be released by free_istr().
+ */
+char	*make_istr(char *str, int len)
+{
+	Reg	anIStr	*is;
+	u_int	hashv;
+	int	size;
+
+	hashv = hash_istr(str, len, &size);
+	for (is = istrTable[hashv % istrsize]; is; is = is->next)
+		if (is->hashv == hashv && !strncmp(is->str, str, size) &&
+		    is->str[size] == '\0')
+		    {
+			is->refcnt++;
+			istrrefs++;
+			return is->str;
+		    }
+	is = (anIStr *)MyMalloc(offsetof(anIStr, str) + size + 1);
+	is->hashv = hashv;
+	is->refcnt = 1;
+	bcopy(str, is->str, size);
+	is->str[size] = '\0';
+	is->next = istrTable[hashv % istrsize];
+	istrTable[hashv % istrsize] = is;
+	istrcnt++;
+	istrrefs++;
+	istrmem += offsetof(anIStr, str) + size + 1;
+	if (istrcnt > 2 * istrsize)
+		bigger_istr_table();
+	return is->str;
+}
+
+void	free_istr(char *str)
+{
+	Reg	anIStr	*is, **prev;
+
+	if (!str)
+		return;
+	is = ISTR(str);
+	istrrefs--;
+	if (--is->refcnt > 0)
+		return;
+	for (prev = &istrTable[is->hashv % istrsize]; *prev;
+	     prev = &(*prev)->next)
+		if (*prev == is)
+		    {
+			*prev = is->next;
+			istrcnt--;
+			istrmem -= offsetof(anIStr, str) + strlen(str) + 1;
+			MyFree(is);
+			return;
+		    }
+	sendto_flag(SCH_ERROR, "istr table failure (%s)", str);
+}
+
+/*
+ * set_istr
+ *	replaces the interned string pointed to by *where.
+ */
+void	set_istr(char **where, char *str, int len)
+{
+	char	*old = *where;
+
+	*where = make_istr(str, len);
+	free_istr(old);
+}
+
+/*
+ * istr_mem
+ *	returns the memory used by interned strings, for count_memory().
+ */
+u_long	istr_mem(aClient *cptr, char *nick)
+{
+	u_long	tot = istrmem + istrsize * sizeof(anIStr *);
+
+	if (cptr)
+		sendto_one(cptr, ":%s %d %s :Strings %d(%lu) refs %lu table %d",
+			   me.name, RPL_STATSDEBUG, nick, istrcnt, istrmem,
+			   istrrefs, istrsize);
+	return tot;
+}
+
 /*
  * NOTE: this command is not supposed to be an offical part of the ircd
  *       protocol.  It is simply here to help debug and to monitor the
@@ -1282,6 +1421,27 @@ struct HashTable_s
 	u_int (*hashfunc)(char *name, u_int *store);
 };
 
+static	struct HashTable_s HashTables[] =
+{
+	{'c', "client", &clientTable, &clhits, &clmiss, &clsize,
+		&_HASHSIZE, hash_nick_name},
+	{'u', "UID", &uidTable, &uidhits, &uidmiss, &uidsize, &_UIDSIZE,
+		hash_uid},
+	{'C', "channel", &channelTable, &chhits, &chmiss, &sidsize,
+		&_CHANNELHASHSIZE, NULL},
+	{'S', "SID", &sidTable, &sidhits, &sidmiss, &sidsize, &_SIDSIZE,
+		hash_sid },
+#ifdef USE_HOSTHASH
+	{'h', "hostname", &hostnameTable, &cnhits, &cnmiss, &cnsize,
+		&_HOSTNAMEHASHSIZE, hash_host_name},
+#endif
+#ifdef USE_IPHASH
+	{'i', "ip", &ipTable, &iphits, &ipmiss, &ipsize,
+		&_IPHASHSIZE, hash_ip},
+#endif
+	{0, NULL, NULL, NULL, NULL, NULL, NULL, NULL}
+};
+
 #if defined(DEBUGMODE) || defined(HASHDEBUG)
 static	void	show_hash_bucket(aClient *sptr, struct HashTable_s *HashTables,
 	int shash, int bucket)
@@ -1400,27 +1560,7 @@ int	m_hash(aClient *cptr, aClient *sptr, int parc, char *parv[])
 	int shash = -1, i, l;
 	int deepest = 0 , deeplink = 0, totlink = 0, mosthits = 0, mosthit = 0;
 	int tothits = 0, used = 0, used_now = 0, link_pop[11];
-	
-	struct HashTable_s HashTables[] =
-	{
-		{'c', "client", &clientTable, &clhits, &clmiss, &clsize,
-			&_HASHSIZE, hash_nick_name},
-		{'u', "UID", &uidTable, &uidhits, &uidmiss, &uidsize, &_UIDSIZE,
-			hash_uid},
-		{'C', "channel", &channelTable, &chhits, &chmiss, &sidsize,
-			&_CHANNELHASHSIZE, NULL},
-		{'S', "SID", &sidTable, &sidhits, &sidmiss, &sidsize, &_SIDSIZE,
-			hash_sid },
-#ifdef USE_HOSTHASH
-		{'h', "hostname", &hostnameTable, &cnhits, &cnmiss, &cnsize,
-			&_HOSTNAMEHASHSIZE, hash_host_name},
-#endif
-#ifdef USE_IPHASH
-		{'i', "ip", &ipTable, &iphits, &ipmiss, &ipsize,
-			&_IPHASHSIZE, hash_ip},
-#endif
-		{0, NULL, NULL, NULL, NULL, NULL, NULL, NULL}
-	};
+
 
 	if (!is_allowed(sptr, ACL_HAZH))
 		return m_nopriv(cptr, sptr, parc, parv);
@@ -1613,3 +1753,59 @@ int	m_hash(aClient *cptr, aClient *sptr, int parc, char *parv[])
 
 }
 
+
+#ifdef USE_METRICS
+/*
+** metrics_hash
+**	Hash tables statistics for the metrics socket, as HAZH shows them.
+*/
+void	metrics_hash(void)
+{
+	struct	HashTable_s *ht;
+	aHashEntry *tab;
+	int	i, used[sizeof(HashTables) / sizeof(HashTables[0])];
+	int	links[sizeof(HashTables) / sizeof(HashTables[0])];
+	int	deepest[sizeof(HashTables) / sizeof(HashTables[0])];
+
+	for (ht = HashTables; ht->hashname; ht++)
+	    {
+		used[ht - HashTables] = links[ht - HashTables] = 0;
+		deepest[ht - HashTables] = 0;
+		for (i = 0, tab = *ht->table; i < *ht->size; i++, tab++)
+		    {
+			if (tab->links == 0)
+				continue;
+			used[ht - HashTables]++;
+			links[ht - HashTables] += tab->links;
+			if (tab->links > deepest[ht - HashTables])
+				deepest[ht - HashTables] = tab->links;
+		    }
+	    }
+	metrics_head("hash_buckets", "gauge", "Size of the hash table.");
+	for (ht = HashTables; ht->hashname; ht++)
+		metrics_printf("ircd_hash_buckets{table=\"%s\"} %d\n",
+			ht->hashname, *ht->size);
+	metrics_head("hash_buckets_used", "gauge", "Buckets not empty.");
+	for (ht = HashTables; ht->hashname; ht++)
+		metrics_printf("ircd_hash_buckets_used{table=\"%s\"} %d\n",
+			ht->hashname, used[ht - HashTables]);
+	metrics_head("hash_entries", "gauge", "Entries hashed.");
+	for (ht = HashTables; ht->hashname; ht++)
+		metrics_printf("ircd_hash_entries{table=\"%s\"} %d\n",
+			ht->hashname, links[ht - HashTables]);
+	metrics_head("hash_chain_max", "gauge", "Deepest bucket.");
+	for (ht = HashTables; ht->hashname; ht++)
+		metrics_printf("ircd_hash_chain_max{table=\"%s\"} %d\n",
+			ht->hashname, deepest[ht - HashTables]);
+	metrics_head("hash_hits_total", "counter",
+		"Lookups which found an entry, since the table was sized.");
+	for (ht = HashTables; ht->hashname; ht++)
+		metrics_printf("ircd_hash_hits_total{table=\"%s\"} %d\n",
+			ht->hashname, *ht->hits);
+	metrics_head("hash_misses_total", "counter",
+		"Lookups which found nothing, since the table was sized.");
+	for (ht = HashTables; ht->hashname; ht++)
+		metrics_printf("ircd_hash_misses_total{table=\"%s\"} %d\n",
+			ht->hashname, *ht->miss);
+}
+#endif /* USE_METRICS */
@@ -37,5 +37,19 @@ typedef	struct	hashentry {
 #define	IPHASHSIZE ((int)((float)MAXCONNECTIONS*1.75))
 #endif
 #define	UIDSIZE	((int)((float)MAXCONNECTIONS*1.75))
+#define	ISTRSIZE	((int)((float)MAXCONNECTIONS*1.75))
+
+/*
+ * interned strings (hostnames, IPs and usernames of users), see hash.c
+ */
+typedef	struct	istr	anIStr;
+struct	istr	{
+	anIStr	*next;
+	u_int	hashv;		/* hash_host_name() value of str */
+	int	refcnt;
+	char	str[1];		/* allocated to real size */
+};
+
+#define	ISTR(s)	((anIStr *)((s) - offsetof(anIStr, str)))
 
 
@@ -43,6 +43,7 @@ extern int _IPHASHSIZE;
 #else /* HASH_C */
 #define EXTERN
 #endif /* HASH_C */
+EXTERN int bigger_prime (int size);
 EXTERN void inithashtables(void);
 EXTERN int add_to_client_hash_table (char *name, aClient *cptr);
 EXTERN int add_to_uid_hash_table (char *uid, aClient *cptr);
@@ -68,6 +69,13 @@ EXTERN int add_to_ip_hash_table (char *ip, anUser *user);
 EXTERN int del_from_ip_hash_table (char *ip, anUser *user);
 EXTERN anUser *hash_find_ip (char *ip, anUser *user);
 #endif
+EXTERN char *make_istr (char *str, int len);
+EXTERN void free_istr (char *str);
+EXTERN void set_istr (char **where, char *str, int len);
+EXTERN u_long istr_mem (aClient *cptr, char *nick);
 EXTERN int m_hash (aClient *cptr, aClient *sptr, int parc, char *parv[]);
+#ifdef USE_METRICS
+EXTERN void metrics_hash(void);
+#endif
 
 #undef EXTERN
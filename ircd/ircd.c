@@ -51,8 +51,11 @@ int	firstrejoindone = 0;		/* Server rejoined the network after
 char	*debugmode = "";		/*  -"-    -"-   -"-   -"- */
 char	*sbrk0;				/* initial sbrk(0) */
 char	*tunefile = IRCDTUNE_PATH;
+char	*dnsfile = IRCDDNS_PATH;
 volatile static	int	dorehash = 0,
 			dorestart = 0,
+			doupgrade = 0,
+			dotracedump = 0,
 			restart_iauth = 0;
 
 #ifdef DELAY_CLOSE
@@ -63,6 +66,7 @@ time_t	nextgarbage = 1;        /* time for next collect_channel_garbage call*/
 time_t	nextping = 1;		/* same as above for check_pings() */
 time_t	nextdnscheck = 0;	/* next time to poll dns to force timeouts */
 time_t	nextexpire = 1;		/* next expire run on the dns cache */
+time_t	nextdnssave = 0;	/* next snapshot of the dns cache */
 time_t	nextiarestart = 1;	/* next time to check if iauth is alive */
 time_t	nextpreference = 1;	/* time for next calculate_preference call */
 #ifdef TKLINE
@@ -80,6 +84,7 @@ RETSIGTYPE s_die(int s)
 #endif
 	logfiles_close();
 	ircd_writetune(tunefile);
+	(void)save_cache(dnsfile);
 	flush_connections(me.fd);
 #ifdef  UNIXPORT
 	{
@@ -137,6 +142,47 @@ static RETSIGTYPE s_rehash(int s)
 		dorehash = 1;
 }
 
+/*
+** SIGUSR2 asks for a live upgrade, see s_upgrade.c (ircdwatch sends it
+** when the binary was replaced).
+*/
+static RETSIGTYPE s_upgrade(int s)
+{
+#if POSIX_SIGNALS
+	struct	sigaction act;
+
+	act.sa_handler = s_upgrade;
+	act.sa_flags = 0;
+	(void)sigemptyset(&act.sa_mask);
+	(void)sigaddset(&act.sa_mask, SIGUSR2);
+	(void)sigaction(SIGUSR2, &act, NULL);
+#else
+	(void)signal(SIGUSR2, s_upgrade);
+#endif
+	doupgrade = 1;
+}
+
+#if defined(USE_TRACE) && defined(SIGWINCH)
+/*
+** SIGWINCH dumps the trace ring, see s_trace.c.
+*/
+static RETSIGTYPE s_tracedump(int s)
+{
+# if POSIX_SIGNALS
+	struct	sigaction act;
+
+	act.sa_handler = s_tracedump;
+	act.sa_flags = 0;
+	(void)sigemptyset(&act.sa_mask);
+	(void)sigaddset(&act.sa_mask, SIGWINCH);
+	(void)sigaction(SIGWINCH, &act, NULL);
+# else
+	(void)signal(SIGWINCH, s_tracedump);
+# endif
+	dotracedump = 1;
+}
+#endif
+
 void	restart(char *mesg)
 {
 #ifdef	USE_SYSLOG
@@ -198,6 +244,7 @@ void	server_reboot(void)
 	if ((bootopt & BOOT_CONSOLE) || isatty(0))
 		(void)close(0);
 	ircd_writetune(tunefile);
+	(void)save_cache(dnsfile);
 	if (!(bootopt & BOOT_INETD))
 	    {
 		(void)execv(IRCD_PATH, myargv);
@@ -428,7 +475,8 @@ time_t calculate_preference(time_t currenttime)
 	return currenttime + 60;
 }
 
-/* Checks all clients against KILL lines. (And remove them, if found.)
+/* Checks all clients against KILL lines added by the last rehash(es).
+** (And remove them, if found.)
 ** Only MAXDELAYEDKILLS at a time or all, if not defined.
 ** Returns 1, if still work to do, 0 if finished.
 */
@@ -438,7 +486,9 @@ static	int	delayed_kills(time_t currenttime)
 	static	int	dk_lastfd;		/* fd we last checked */
 	static	int	dk_checked;		/* # clients we checked */
 	static	int	dk_killed;		/* # clients we killed */
+	static	int	dk_klines;		/* # K:lines they're checked against */
 	Reg	aClient	*cptr;
+	Reg	aConfItem *aconf;
 	Reg	int	i, j;
 
 	if (dk_rehashed == 0)
@@ -447,6 +497,10 @@ static	int	delayed_kills(time_t currenttime)
 		dk_checked = 0;
 		dk_killed = 0;
 		dk_lastfd = highest_fd;
+		dk_klines = 0;
+		for (aconf = kconf; aconf; aconf = aconf->next)
+			if (aconf->flags & CFLAG_KNEW)
+				dk_klines++;
 	}
 #ifdef MAXDELAYEDKILLS
 	/* checking only this many clients each time */
@@ -470,7 +524,7 @@ static	int	delayed_kills(time_t currenttime)
 		}
 
 		dk_checked++;
-		kflag = find_kill(cptr, 0, &reason);
+		kflag = find_kill(cptr, 2, &reason);
 
 		/* If the client is a user and a KILL line was found
 		** to be active, close this connection. */
@@ -496,15 +550,17 @@ static	int	delayed_kills(time_t currenttime)
 
 	if (dk_lastfd < 0)
 	{
-		sendto_flag(SCH_NOTICE, "DelayedKills checked %d killed %d "
-			"in %d sec", dk_checked, dk_killed,
-			currenttime - dk_rehashed);
+		sendto_flag(SCH_NOTICE, "DelayedKills checked %d against %d "
+			"new K:lines killed %d in %d sec", dk_checked,
+			dk_klines, dk_killed, currenttime - dk_rehashed);
 		dk_rehashed = 0;
 		if (rehashed == 2)
 		{
 			/* there was rehash queued, start again */
 			return 1;
 		}
+		for (aconf = kconf; aconf; aconf = aconf->next)
+			aconf->flags &= ~CFLAG_KNEW;
 		return 0;
 	}
 	return rehashed;
@@ -720,17 +776,17 @@ static	void	setup_me(aClient *mp)
 	mp->fd = -1;
 	SetMe(mp);
 	mp->serv->snum = find_server_num (ME);
-	/* we don't fill our own IP -> 0 as ip lenght */
-	(void) make_user(mp,0);
+	/* we don't fill our own IP */
+	(void) make_user(mp);
 	istat.is_users++;	/* here, cptr->next is NULL, see make_user() */
 	mp->user->flags |= FLAGS_OPER;
 	mp->serv->up = mp;
 	mp->serv->maskedby = mp;
 	mp->serv->version |= SV_UID;
 	mp->user->server = find_server_string(mp->serv->snum);
-	strncpyzt(mp->user->username, (p) ? p->pw_name : "unknown",
-		  sizeof(mp->user->username));
-	(void) strcpy(mp->user->host, mp->name);
+	set_istr(&mp->user->username, (p) ? p->pw_name : "unknown",
+		 USERLEN);
+	set_istr(&mp->user->host, mp->name, HOSTLEN);
 	SetEOB(mp);
 	istat.is_eobservers = 1;
 
@@ -893,6 +949,9 @@ int	main(int argc, char *argv[])
 		    case 'T':
 			tunefile = p;
 			break;
+		    case 'U':	/* internal, see s_upgrade.c */
+			upgradefd = atoi(p);
+			break;
 		    case 'v':
 			(void)printf("ircd %s %s\n\tzlib %s\n\tircd.conf delimiter %c\n\t%s #%s\n",
 				     version, serveropts,
@@ -929,6 +988,9 @@ int	main(int argc, char *argv[])
 	}
 	if (argc > 0)
 		bad_command(); /* This exits out */
+	if (upgradefd >= 0)
+		/* a later RESTART shouldn't think it's an upgrade */
+		myargv = upgrade_argv(myargv, -1);
 
 #ifndef IRC_UID
 	if ((uid != euid) && !euid)
@@ -1042,7 +1104,8 @@ int	main(int argc, char *argv[])
 			acptr = NULL;
 		    }
 		/* exit if there is nothing to listen to */
-		if (acptr == NULL && !(bootopt & BOOT_INETD))
+		if (acptr == NULL && !(bootopt & BOOT_INETD) &&
+		    upgradefd < 0)
 		{
 			fprintf(stderr,
 			"Fatal Error: No working P-line in ircd.conf\n");
@@ -1144,9 +1207,20 @@ int	main(int argc, char *argv[])
 	
 	/* daemonize() closes 0,1,2 -- make sure you don't have any fd open */
 	daemonize();	
+	(void)load_cache(dnsfile);
+	nextdnssave = timeofday + AR_SAVE;
 	logfiles_open();
 	write_pidfile();
 	dbuf_init();
+#ifdef USE_METRICS
+	metrics_init();
+#endif
+	if (upgradefd >= 0)
+		upgrade_resume();
+#ifdef TKLINE
+	else
+		tkline_replay();
+#endif
 	
 	serverbooting = 0;
 	
@@ -1160,6 +1234,8 @@ static	void	io_loop(void)
 	static	time_t	delay = 0;
 	int maxs = 4;
 
+	loop_begin();
+	loop_phase(LOOP_PREFERENCE);
 	if (timeofday >= nextpreference)
 		nextpreference = calculate_preference(timeofday);
 	/*
@@ -1168,15 +1244,18 @@ static	void	io_loop(void)
 	** active C lines, this call to Tryconnections is
 	** made once only; it will return 0. - avalon
 	*/
+	loop_phase(LOOP_CONNECT);
 	if (nextconnect && timeofday >= nextconnect)
 		nextconnect = try_connections(timeofday);
 #ifdef DELAY_CLOSE
 	/* close all overdue delayed fds */
+	loop_phase(LOOP_DELAYCLOSE);
 	if (nextdelayclose && timeofday >= nextdelayclose)
 		nextdelayclose = delay_close(-1);
 #endif
 #ifdef TKLINE
 	/* expire tklines */
+	loop_phase(LOOP_TKLINE);
 	if (nexttkexpire && timeofday >= nexttkexpire)
 		nexttkexpire = tkline_expire(0);
 #endif
@@ -1184,15 +1263,22 @@ static	void	io_loop(void)
 	** Every once in a while, hunt channel structures that
 	** can be freed. Reop channels while at it, too.
 	*/
+	loop_phase(LOOP_GARBAGE);
 	if (timeofday >= nextgarbage)
 		nextgarbage = collect_channel_garbage(timeofday);
 	/*
 	** DNS checks. One to timeout queries, one for cache expiries.
 	*/
+	loop_phase(LOOP_DNS);
 	if (timeofday >= nextdnscheck)
 		nextdnscheck = timeout_query_list(timeofday);
 	if (timeofday >= nextexpire)
 		nextexpire = expire_cache(timeofday);
+	if (timeofday >= nextdnssave)
+	    {
+		(void)save_cache(dnsfile);
+		nextdnssave = timeofday + AR_SAVE;
+	    }
 	/*
 	** take the smaller of the two 'timed' event times as
 	** the time of next event (stops us being late :) - avalon
@@ -1223,6 +1309,15 @@ static	void	io_loop(void)
 		delay = 1;
 	else
 		delay = MIN(delay, TIMESEC);
+	loop_phase(LOOP_READSERV);
+#ifdef USE_METRICS
+	/* metrics readers still waiting for the rest of the text */
+	if (metrics_flush() && delay > 1)
+		delay = 1;
+#endif
+#ifdef USE_CAPTURE
+	capture_flush();
+#endif
 
 	/*
 	** First, try to drain traffic from servers and listening sockets.
@@ -1235,11 +1330,14 @@ static	void	io_loop(void)
 			break;
 
 	Debug((DEBUG_DEBUG, "delay for %d", delay));
+	loop_phase(LOOP_READ);
 	/*
 	** Second, deal with _all_ clients but only try to empty sendQ's for
 	** servers.  Other clients are dealt with below..
+	** A DNS timer due within the second makes it a short wait.
 	*/
-	if (read_message(1, &fdall, 1) == 0 && delay > 1)
+	if (read_message((nextdnscheck > timeofday) ? 1 : 0, &fdall, 1) == 0
+	    && delay > 1)
 	    {
 		/*
 		** Timed out (e.g. *NO* traffic at all).
@@ -1258,6 +1356,7 @@ static	void	io_loop(void)
 	** time might be too far away... (similarly with
 	** ping times) --msa
 	*/
+	loop_phase(LOOP_PINGS);
 	if (timeofday >= nextping)
 	    {
 		nextping = check_pings(timeofday);
@@ -1267,8 +1366,21 @@ static	void	io_loop(void)
 		}
 	    }
 
+	loop_phase(LOOP_REHASH);
 	if (dorestart)
 		restart("Caught SIGINT");
+	if (doupgrade)
+	    {
+		doupgrade = 0;
+		(void)upgrade_start(NULL);
+	    }
+#ifdef USE_TRACE
+	if (dotracedump)
+	    {
+		dotracedump = 0;
+		(void)trace_dump();
+	    }
+#endif
 	if (dorehash > 0)
 	    {	/* Only on signal, not on oper /rehash */
 		ircd_writetune(tunefile);
@@ -1286,12 +1398,13 @@ static	void	io_loop(void)
 	** have data in them (or at least try to flush)
 	** -avalon
 	*/
+	loop_phase(LOOP_FLUSH);
 	flush_connections(me.fd);
 
 #ifdef	DEBUGMODE
 	checklists();
 #endif
-
+	loop_end();
 }
 
 /*
@@ -1346,7 +1459,13 @@ static	void	setup_signals(void)
 	(void)sigaddset(&act.sa_mask, SIGALRM);
 # ifdef	SIGWINCH
 	(void)sigaddset(&act.sa_mask, SIGWINCH);
+#  ifdef USE_TRACE
+	act.sa_handler = s_tracedump;
+	(void)sigaction(SIGWINCH, &act, NULL);
+	act.sa_handler = SIG_IGN;
+#  else
 	(void)sigaction(SIGWINCH, &act, NULL);
+#  endif
 # endif
 	(void)sigaction(SIGPIPE, &act, NULL);
 	act.sa_handler = dummy;
@@ -1361,6 +1480,9 @@ static	void	setup_signals(void)
 	act.sa_handler = s_die;
 	(void)sigaddset(&act.sa_mask, SIGTERM);
 	(void)sigaction(SIGTERM, &act, NULL);
+	act.sa_handler = s_upgrade;
+	(void)sigaddset(&act.sa_mask, SIGUSR2);
+	(void)sigaction(SIGUSR2, &act, NULL);
 # if defined(USE_IAUTH)
 	act.sa_handler = s_slave;
 # else
@@ -1392,11 +1514,15 @@ static	void	setup_signals(void)
 
 # ifndef	HAVE_RELIABLE_SIGNALS
 	(void)signal(SIGPIPE, dummy);
-#  ifdef	SIGWINCH
+#  if defined(SIGWINCH) && defined(USE_TRACE)
+	(void)signal(SIGWINCH, s_tracedump);
+#  elif defined(SIGWINCH)
 	(void)signal(SIGWINCH, dummy);
 #  endif
 # else /* HAVE_RELIABLE_SIGNALS */
-#  ifdef	SIGWINCH
+#  if defined(SIGWINCH) && defined(USE_TRACE)
+	(void)signal(SIGWINCH, s_tracedump);
+#  elif defined(SIGWINCH)
 	(void)signal(SIGWINCH, SIG_IGN);
 #  endif
 	(void)signal(SIGPIPE, SIG_IGN);
@@ -1406,6 +1532,7 @@ static	void	setup_signals(void)
 	(void)signal(SIGHUP, s_rehash);
 	(void)signal(SIGTERM, s_die);
 	(void)signal(SIGINT, s_restart);
+	(void)signal(SIGUSR2, s_upgrade);
 # if defined(USE_IAUTH)
 	(void)signal(SIGUSR1, s_slave);
 	(void)signal(SIGCHLD, SIG_IGN);
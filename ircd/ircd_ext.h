@@ -39,6 +39,7 @@ extern int bootopt;
 extern char *debugmode;
 extern char *sbrk0;
 extern char *tunefile;
+extern char *dnsfile;
 #ifdef DELAY_CLOSE
 extern time_t nextdelayclose;
 #endif
@@ -47,6 +48,7 @@ extern time_t nextgarbage;
 extern time_t nextping;
 extern time_t nextdnscheck;
 extern time_t nextexpire;
+extern time_t nextdnssave;
 #ifdef TKLINE
 extern time_t nexttkexpire;
 #endif
@@ -41,6 +41,193 @@ aServer	*svrtop = NULL;
 
 int	numclients = 0;
 
+#define	POOLSZ(x)	(((x) + POOL_ALIGN - 1) & ~(POOL_ALIGN - 1))
+#define	POOLCL(x)	(((x) + POOL_CACHELINE - 1) & ~(POOL_CACHELINE - 1))
+#define	POOL_SLAB(x)	((aPoolSlab *)((u_long)(x) & \
+				       ~((u_long)POOL_SLABSIZE - 1)))
+
+static	aPool	pools[POOL_MAX] = {
+	/* aligned so that the head of aClient is a single cache line */
+	{ "LClient",	POOLCL(CLIENT_LOCAL_SIZE) },
+	{ "RClient",	POOLCL(CLIENT_REMOTE_SIZE) },
+	{ "User",	POOLSZ(sizeof(anUser)) },
+	{ "Server",	POOLSZ(sizeof(aServer)) },
+	{ "Link",	POOLSZ(sizeof(Link)) },
+	{ "Chan16",	POOLSZ(sizeof(aChannel) + 16) },
+	{ "Chan32",	POOLSZ(sizeof(aChannel) + 32) },
+	{ "Chan64",	POOLSZ(sizeof(aChannel) + 64) },
+};
+
+static	void	pool_link(aPool *pool, aPoolSlab *slab)
+{
+	slab->prev = NULL;
+	if ((slab->next = pool->partial))
+		slab->next->prev = slab;
+	pool->partial = slab;
+}
+
+static	void	pool_unlink(aPool *pool, aPoolSlab *slab)
+{
+	if (slab->prev)
+		slab->prev->next = slab->next;
+	else
+		pool->partial = slab->next;
+	if (slab->next)
+		slab->next->prev = slab->prev;
+	slab->next = slab->prev = NULL;
+}
+
+/*
+** pool_grow
+**	Allocate a new slab for the pool, aligned on POOL_SLABSIZE.
+**	Objects are only carved out of it when handed out, so that the
+**	pages of a fresh slab are not touched before they're needed.
+*/
+static	aPoolSlab	*pool_grow(aPool *pool)
+{
+	aPoolSlab *slab;
+	char	*base;
+
+	if (!pool->perslab)
+		pool->perslab = (POOL_SLABSIZE - POOLCL(sizeof(aPoolSlab)))
+				/ pool->size;
+#if defined(HAVE_SYS_MMAN_H) && defined(MAP_ANON)
+	/*
+	** Map twice what's needed and unmap whatever lies around the
+	** aligned slab.
+	*/
+	base = (char *)mmap(NULL, 2 * POOL_SLABSIZE, PROT_READ|PROT_WRITE,
+			    MAP_PRIVATE|MAP_ANON, -1, 0);
+	if (base == (char *)MAP_FAILED)
+	    {
+		outofmemory();
+		return NULL;
+	    }
+	slab = POOL_SLAB(base + POOL_SLABSIZE - 1);
+	if ((char *)slab > base)
+		(void)munmap(base, (char *)slab - base);
+	(void)munmap((char *)slab + POOL_SLABSIZE,
+		     base + POOL_SLABSIZE - (char *)slab);
+	slab->base = NULL;
+#else
+	base = MyMalloc(2 * POOL_SLABSIZE);
+	slab = POOL_SLAB(base + POOL_SLABSIZE - 1);
+	slab->base = base;
+#endif
+	slab->pool = pool;
+	slab->free = NULL;
+	slab->unused = (char *)slab + POOLCL(sizeof(aPoolSlab));
+	slab->nunused = pool->perslab;
+	slab->inuse = 0;
+	pool_link(pool, slab);
+	pool->slabs++;
+	pool->free += pool->perslab;
+	return slab;
+}
+
+static	void	*pool_alloc(aPool *pool)
+{
+	aPoolSlab *slab;
+	char	*obj;
+
+	if (!(slab = pool->partial) && !(slab = pool_grow(pool)))
+		return NULL;
+	if ((obj = slab->free))
+		slab->free = *(char **)obj;
+	else
+	    {
+		obj = slab->unused;
+		slab->unused += pool->size;
+		slab->nunused--;
+	    }
+	slab->inuse++;
+	pool->inuse++;
+	pool->free--;
+	if (!slab->free && !slab->nunused)
+		/* full, it'll be back on the list when something is freed */
+		pool_unlink(pool, slab);
+	return obj;
+}
+
+/*
+** pool_free
+**	Return an object to the slab it came from.  An empty slab is
+**	given back to the system once the rest of the pool is mostly
+**	unused, but never the last free one, so that a single object
+**	being allocated and freed over and over doesn't map and unmap
+**	a slab every time.
+*/
+static	void	pool_free(void *obj)
+{
+	aPoolSlab *slab = POOL_SLAB(obj);
+	aPool	*pool = slab->pool;
+	u_long	left;
+
+#ifdef	DEBUGMODE
+	if (pool < pools || pool >= pools + POOL_MAX)
+		dumpcore("pool_free %p: bad slab %p (pool %p)",
+			 obj, (void *)slab, (void *)pool);
+#endif
+	if (!slab->free && !slab->nunused)
+		pool_link(pool, slab);
+	*(char **)obj = slab->free;
+	slab->free = obj;
+	slab->inuse--;
+	pool->inuse--;
+	pool->free++;
+
+	if (slab->inuse)
+		return;
+	left = pool->free - pool->perslab;
+	if (left < pool->perslab || left < pool->inuse)
+		return;
+	pool_unlink(pool, slab);
+	pool->slabs--;
+	pool->free = left;
+	pool->released++;
+#if defined(HAVE_SYS_MMAN_H) && defined(MAP_ANON)
+	(void)munmap((char *)slab, POOL_SLABSIZE);
+#else
+	MyFree(slab->base);
+#endif
+}
+
+/*
+** send_poolinfo
+**	Report pools usage, return the memory they hold in addition to
+**	the objects in use (which are accounted for by the caller).
+*/
+u_long	send_poolinfo(aClient *cptr, char *nick)
+{
+	aPool	*pool;
+	u_long	mem = 0, tmp;
+
+	for (pool = pools; pool < pools + POOL_MAX; pool++)
+	    {
+		if (!pool->slabs && !pool->released)
+			continue;
+		tmp = pool->slabs * POOL_SLABSIZE;
+		sendto_one(cptr, ":%s %d %s :Pool %s(%u) inuse %lu free %lu "
+			   "slabs %lu(%lu) released %lu",
+			   me.name, RPL_STATSDEBUG, nick, pool->name,
+			   pool->size, pool->inuse, pool->free, pool->slabs,
+			   tmp, pool->released);
+		mem += tmp - pool->inuse * pool->size;
+	    }
+	return mem;
+}
+
+static	aPool	*chan_pool(int len)
+{
+	if (len <= 16)
+		return &pools[POOL_CHAN16];
+	if (len <= 32)
+		return &pools[POOL_CHAN32];
+	if (len <= 64)
+		return &pools[POOL_CHAN64];
+	return NULL;
+}
+
 void	initlists(void)
 {
 #ifdef	DEBUGMODE
@@ -94,14 +281,11 @@ aClient	*make_client(aClient *from)
 	Reg	aClient *cptr = NULL;
 	Reg	unsigned size = CLIENT_REMOTE_SIZE;
 
-	/*
-	 * Check freelists first to see if we can grab a client without
-	 * having to call malloc.
-	 */
 	if (!from)
 		size = CLIENT_LOCAL_SIZE;
 
-	cptr = (aClient *)MyMalloc(size);
+	cptr = (aClient *)pool_alloc(&pools[from ? POOL_RCLIENT :
+					    POOL_LCLIENT]);
 	bzero((char *)cptr, (int)size);
 
 #ifdef	DEBUGMODE
@@ -146,6 +330,8 @@ aClient	*make_client(aClient *from)
 
 void	free_client(aClient *cptr)
 {
+	if (cptr == loop_from)
+		loop_from = NULL;
 	if (cptr->info != DefInfo)
 		MyFree(cptr->info);
 	/* True only for local clients */
@@ -170,8 +356,10 @@ void	free_client(aClient *cptr)
 		if (cptr->user3)
 			MyFree(cptr->user3);
 #endif
+		if (cptr->hostp)
+			set_hostp(cptr, NULL);
 	}
-	MyFree(cptr);
+	pool_free(cptr);
 }
 
 /*
@@ -179,15 +367,15 @@ void	free_client(aClient *cptr)
 ** if it was not previously allocated.
 ** iplen is lenght of the IP we want to allocate.
 */
-anUser	*make_user(aClient *cptr, int iplen)
+anUser	*make_user(aClient *cptr)
 {
 	Reg	anUser	*user;
 
 	user = cptr->user;
 	if (!user)
 	    {
-		user = (anUser *)MyMalloc(sizeof(anUser) + iplen);
-		memset(user, 0, sizeof(anUser) + iplen);
+		user = (anUser *)pool_alloc(&pools[POOL_USER]);
+		memset(user, 0, sizeof(anUser));
 
 #ifdef	DEBUGMODE
 		users.inuse++;
@@ -203,6 +391,9 @@ anUser	*make_user(aClient *cptr, int iplen)
 		user->hashv = 0;
 		user->uhnext = NULL;
 		user->uid[0] = '\0';
+		user->username = make_istr("", 0);
+		user->host = make_istr("", 0);
+		user->sip = make_istr("", 0);
 		user->servp = NULL;
 		user->bcptr = cptr;
 		if (cptr->next)	/* the only cptr->next == NULL is me */
@@ -217,7 +408,7 @@ aServer	*make_server(aClient *cptr)
 
 	if (!serv)
 	    {
-		serv = (aServer *)MyMalloc(sizeof(aServer));
+		serv = (aServer *)pool_alloc(&pools[POOL_SERVER]);
 		memset(serv, 0, sizeof(aServer));
 #ifdef	DEBUGMODE
 		servs.inuse++;
@@ -304,7 +495,10 @@ void	free_user(anUser *user)
 			istat.is_awaymem -= (strlen(user->away) + 1);
 			MyFree(user->away);
 		}
-		MyFree(user);
+		free_istr(user->username);
+		free_istr(user->host);
+		free_istr(user->sip);
+		pool_free(user);
 #ifdef	DEBUGMODE
 		users.inuse--;
 #endif
@@ -358,7 +552,7 @@ void	free_server(aServer *serv)
 #endif
 		}
 
-		MyFree(serv);
+		pool_free(serv);
 	}
 }
 
@@ -518,7 +712,7 @@ Link	*make_link(void)
 {
 	Reg	Link	*lp;
 
-	lp = (Link *)MyMalloc(sizeof(Link));
+	lp = (Link *)pool_alloc(&pools[POOL_LINK]);
 #ifdef	DEBUGMODE
 	links.inuse++;
 #endif
@@ -540,7 +734,7 @@ invLink	*make_invlink(void)
 
 void	free_link(Link *lp)
 {
-	MyFree(lp);
+	pool_free(lp);
 #ifdef	DEBUGMODE
 	links.inuse--;
 #endif
@@ -554,6 +748,32 @@ void	free_invlink(invLink *lp)
 #endif
 }
 
+/*
+** make_chan
+**	Allocate and clear a channel block able to hold a name of len
+**	characters.
+*/
+aChannel	*make_chan(int len)
+{
+	aChannel *chptr;
+	aPool	*pool;
+
+	if ((pool = chan_pool(len)))
+		chptr = (aChannel *)pool_alloc(pool);
+	else
+		chptr = (aChannel *)MyMalloc(sizeof(aChannel) + len);
+	bzero((char *)chptr, sizeof(aChannel));
+	return chptr;
+}
+
+void	free_chan(aChannel *chptr)
+{
+	if (chan_pool(strlen(chptr->chname)))
+		pool_free(chptr);
+	else
+		MyFree(chptr);
+}
+
 aClass	*make_class(void)
 {
 	Reg	aClass	*tmp;
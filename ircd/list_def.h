@@ -0,0 +1,64 @@
+/************************************************************************
+ *   IRC - Internet Relay Chat, ircd/list_def.h
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 1, or (at your option)
+ *   any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+** Object pools used by list.c for the structures which are created and
+** destroyed by the hundred thousand (clients, users, servers, links and
+** channels).  Objects of a pool are carved out of slabs of POOL_SLABSIZE
+** bytes, which are aligned on their size so that the slab (and thus the
+** pool) owning an object can be found from its address alone.
+*/
+#define	POOL_SLABSIZE	65536	/* must be a power of 2 and of page size */
+#define	POOL_ALIGN	8	/* object sizes are rounded up to this */
+#define	POOL_CACHELINE	64	/* client objects are aligned on this */
+
+typedef	struct	PoolSlab	aPoolSlab;
+typedef	struct	Pool		aPool;
+
+struct	PoolSlab	{
+	aPoolSlab *next, *prev;	/* slabs of the pool having free objects */
+	aPool	*pool;		/* pool owning this slab */
+	char	*free;		/* free list of released objects */
+	char	*unused;	/* first object never handed out */
+	int	inuse;		/* objects of this slab in use */
+	int	nunused;	/* objects left after 'unused' */
+	char	*base;		/* what to give back, if not mmap()ed */
+};
+
+struct	Pool	{
+	char	*name;
+	u_int	size;		/* size of one object */
+	u_int	perslab;	/* objects per slab */
+	aPoolSlab *partial;	/* slabs with at least one free object */
+	u_long	inuse;		/* objects handed out */
+	u_long	free;		/* objects available in allocated slabs */
+	u_long	slabs;		/* slabs currently allocated */
+	u_long	released;	/* slabs given back so far */
+};
+
+typedef enum PoolType {
+	POOL_LCLIENT,	/* local aClient */
+	POOL_RCLIENT,	/* remote aClient (up to 'count') */
+	POOL_USER,
+	POOL_SERVER,
+	POOL_LINK,
+	POOL_CHAN16,	/* aChannel with chname[] up to 16 bytes */
+	POOL_CHAN32,
+	POOL_CHAN64,
+	POOL_MAX
+} PoolType;
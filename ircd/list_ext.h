@@ -38,6 +38,7 @@ extern const char *DefInfo;
 #define EXTERN
 #endif /* LIST_C */
 EXTERN void initlists(void);
+EXTERN u_long send_poolinfo (aClient *cptr, char *nick);
 EXTERN void outofmemory(void);
 #ifdef	DEBUGMODE
 EXTERN void checklists(void);
@@ -45,7 +46,7 @@ EXTERN void send_listinfo (aClient *cptr, char *name);
 #endif /* DEBUGMOE */
 EXTERN aClient *make_client (aClient *from);
 EXTERN void free_client (aClient *cptr);
-EXTERN anUser *make_user (aClient *cptr, int iplen);
+EXTERN anUser *make_user (aClient *cptr);
 EXTERN aServer *make_server (aClient *cptr);
 EXTERN void free_user (anUser *user);
 EXTERN void free_server (aServer *serv);
@@ -58,6 +59,8 @@ EXTERN Link *make_link(void);
 EXTERN invLink *make_invlink(void);
 EXTERN void free_link (Reg Link *lp);
 EXTERN void free_invlink (Reg invLink *lp);
+EXTERN aChannel *make_chan (int len);
+EXTERN void free_chan (aChannel *chptr);
 EXTERN aClass *make_class(void);
 EXTERN void free_class (Reg aClass *tmp);
 EXTERN aConfItem *make_conf(void);
@@ -33,24 +33,43 @@ static const volatile char rcsid[] = "@(#)$Id: res.c,v 1.53 2009/03/15 01:01:04
 static	char	hostbuf[HOSTLEN+1+100]; /* +100 for INET6 */
 static	char	dot[] = ".";
 static	int	incache = 0;
-static	CacheTable	hashtable[ARES_CACSIZE];
-static	aCache	*cachetop = NULL;
+static	int	maxcached = MAXCACHED;	/* both set by R: lines */
+static	int	negttl = NEGCACHETTL;
+static	int	restimeout = AR_TIMEOUT;
+static	int	resparallel = AR_PARALLEL;
+static	u_long	resnext = 0;		/* msec, earliest request timer */
+static	int	cachesize = 0;		/* buckets in hashtable */
+static	CacheTable	*hashtable = NULL;
+static	aCache	*cachetop = NULL, *cachebot = NULL;
 static	ResRQ	*last, *first;
+static	int	inqueue = 0;
+static	ResRQ	*idtable[ARES_IDSIZE];
 
 static	void	rem_cache (aCache *);
+static	void	free_cache (aCache *);
+static	aCacheAlias	*new_alias (aCache *, char *);
+static	void	hash_alias (aCacheAlias *);
+static	void	size_cache (int);
+static	void	hash_cache (aCache *);
+static	void	add_negative (ResRQ *);
 static	void	rem_request (ResRQ *);
 static	int	do_query_name (Link *, char *, ResRQ *, int);
 static	int	do_query_number (Link *, struct IN_ADDR *, ResRQ *);
 static	void	resend_query (ResRQ *);
 static	int	proc_answer (ResRQ *, HEADER *, char *, char *);
 static	int	query_name (char *, int, int, ResRQ *);
-static	aCache	*make_cache (ResRQ *), *rem_list (aCache *);
+static	aCache	*make_cache (ResRQ *);
 static	aCache	*find_cache_name (ResRQ *, char *, int);
 static	aCache	*find_cache_number (ResRQ *, char *);
+static	aCache	*find_negative (char *, char *);
 static	int	add_request (ResRQ *);
 static	ResRQ	*make_request (Link *);
 static	int	send_res_msg (char *, int, int);
+static	int	ns_count (ResRQ *);
+static	u_long	res_msec (void);
+static	void	res_latency (ResRQ *);
 static	ResRQ	*find_id (int);
+static	void	unhash_id (ResRQ *);
 static	int	hash_number (unsigned char *);
 static	void	update_list (ResRQ *, aCache *);
 static	int	hash_name (char *);
@@ -63,7 +82,12 @@ static	struct cacheinfo {
 	int	ca_lookups;
 	int	ca_na_hits;
 	int	ca_nu_hits;
+	int	ca_na_miss;
+	int	ca_nu_miss;
 	int	ca_updates;
+	int	ca_evicts;
+	int	ca_neg_adds;
+	int	ca_neg_hits;
 } cainfo;
 
 static	struct	resinfo {
@@ -79,6 +103,13 @@ static	struct	resinfo {
 	int	re_unkrep;
 } reinfo;
 
+/*
+ * time to answer histogram, upper bounds of the buckets in msec.
+ */
+static	u_int	reslatms[] = { 10, 25, 50, 100, 250, 500, 1000, 2500, 5000, 0 };
+static	u_long	reslat[sizeof(reslatms) / sizeof(u_int)];
+static	unsigned long long reslatsum;	/* msec */
+
 int	init_resolver(int op)
 {
 	int	ret = 0;
@@ -89,7 +120,11 @@ int	init_resolver(int op)
 	if (op & RES_INITLIST)
 	{
 		bzero((char *)&reinfo, sizeof(reinfo));
+		bzero((char *)reslat, sizeof(reslat));
+		reslatsum = 0;
+		bzero((char *)idtable, sizeof(idtable));
 		first = last = NULL;
+		inqueue = 0;
 	}
 	if (op & RES_CALLINIT)
 	{
@@ -144,8 +179,9 @@ int	init_resolver(int op)
 #endif
 	if (op & RES_INITCACH)
 	{
+		flush_cache();
 		bzero((char *)&cainfo, sizeof(cainfo));
-		bzero((char *)hashtable, sizeof(hashtable));
+		size_cache(maxcached);
 	}
 	if (op == 0)
 		ret = resfd;
@@ -161,9 +197,11 @@ static	int	add_request(ResRQ *new)
 	else
 	{
 		last->next = new;
+		new->prev = last;
 		last = new;
 	}
 	new->next = NULL;
+	inqueue++;
 	reinfo.re_requests++;
 	return 0;
 }
@@ -174,25 +212,25 @@ static	int	add_request(ResRQ *new)
  */
 static	void	rem_request(ResRQ *old)
 {
-	Reg	ResRQ	**rptr, *r2ptr = NULL;
+	Reg	ResRQ	*r2ptr;
 	Reg	int	i;
 	Reg	char	*s;
 
 	if (!old)
 		return;
-	for (rptr = &first; *rptr; r2ptr = *rptr, rptr = &(*rptr)->next)
-	{
-		if (*rptr == old)
-		{
-			*rptr = old->next;
-			if (last == old)
-				last = r2ptr;
-			break;
-		}
-	}
+	if (old->prev)
+		old->prev->next = old->next;
+	else
+		first = old->next;
+	if (old->next)
+		old->next->prev = old->prev;
+	else
+		last = old->prev;
+	unhash_id(old);
+	inqueue--;
 #ifdef	DEBUG
-	Debug((DEBUG_INFO,"rem_request:Remove %#x at %#x %#x",
-		old, *rptr, r2ptr));
+	Debug((DEBUG_INFO,"rem_request:Remove %#x prev %#x next %#x",
+		old, old->prev, old->next));
 #endif
 	r2ptr = old;
 	if (r2ptr->he.h_name)
@@ -217,7 +255,7 @@ static	ResRQ	*make_request(Link *lp)
 	nreq = (ResRQ *)MyMalloc(sizeof(ResRQ));
 	bzero((char *)nreq, sizeof(ResRQ));
 	nreq->next = NULL; /* where NULL is non-zero ;) */
-	nreq->sentat = timeofday;
+	nreq->firstat = nreq->sentat = res_msec();
 	nreq->retries = 3;
 	nreq->resend = 1;
 	nreq->srch = -1;
@@ -225,30 +263,37 @@ static	ResRQ	*make_request(Link *lp)
 		bcopy((char *)lp, (char *)&nreq->cinfo, sizeof(Link));
 	else
 		bzero((char *)&nreq->cinfo, sizeof(Link));
-	nreq->timeout = 4;	/* start at 4 and exponential inc. */
+	nreq->timeout = restimeout;	/* exponential inc. */
 	nreq->he.h_addrtype = AFINET;
 	nreq->he.h_name = NULL;
 	nreq->he.h_aliases[0] = NULL;
 	(void)add_request(nreq);
+	if (!resnext || (long)(resnext - (nreq->sentat + nreq->timeout)) > 0)
+		resnext = nreq->sentat + nreq->timeout;
 	return nreq;
 }
 
 /*
  * Remove queries from the list which have been there too long without
- * being resolved.
+ * being resolved, resend the others when their (millisecond) timer is up.
+ * Returns 'now' while a timer is due within the second, for io_loop() not
+ * to sleep for all of it.
  */
 time_t	timeout_query_list(time_t now)
 {
 	Reg	ResRQ	*rptr, *r2ptr;
-	Reg	time_t	next = 0, tout;
+	Reg	u_long	next = 0, tout;
+	u_long	nowms = res_msec();
 	aClient	*cptr;
 
+	if (resnext && (long)(resnext - nowms) > 0)
+		return now + (resnext - nowms) / 1000;
 	Debug((DEBUG_DNS,"timeout_query_list at %s",myctime(now)));
 	for (rptr = first; rptr; rptr = r2ptr)
 	{
 		r2ptr = rptr->next;
 		tout = rptr->sentat + rptr->timeout;
-		if (now >= tout)
+		if ((long)(nowms - tout) >= 0)
 		{
 			if (--rptr->retries <= 0)
 			{
@@ -257,6 +302,7 @@ time_t	timeout_query_list(time_t now)
 					rptr, now, rptr->cinfo.value.cptr));
 #endif
 				reinfo.re_timeouts++;
+				add_negative(rptr);
 				cptr = rptr->cinfo.value.cptr;
 				switch (rptr->cinfo.flags)
 				{
@@ -276,10 +322,10 @@ time_t	timeout_query_list(time_t now)
 			}
 			else
 			{
-				rptr->sentat = now;
+				rptr->sentat = nowms;
 				rptr->timeout += rptr->timeout;
 				resend_query(rptr);
-				tout = now + rptr->timeout;
+				tout = nowms + rptr->timeout;
 #ifdef DEBUG
 				Debug((DEBUG_INFO,"r %x now %d retry %d c %x",
 					rptr, now, rptr->retries,
@@ -287,12 +333,13 @@ time_t	timeout_query_list(time_t now)
 #endif
 			}
 		}
-		if (!next || tout < next)
+		if (!next || (long)(next - tout) > 0)
 		{
 			next = tout;
 		}
 	}
-	return (next > now) ? next : (now + AR_TTL);
+	resnext = next;
+	return next ? now + (next - nowms) / 1000 : now + AR_TTL;
 }
 
 /*
@@ -312,26 +359,20 @@ void	del_queries(char *cp)
 }
 
 /*
- * sends msg to all nameservers found in the "ircd_res" structure.
- * This should reflect /etc/resolv.conf. We will get responses
+ * sends msg to the first max nameservers found in the "ircd_res"
+ * structure. This should reflect /etc/resolv.conf. We will get responses
  * which arent needed but is easier than checking to see if nameserver
  * isnt present. Returns number of messages successfully sent to 
  * nameservers or -1 if no successful sends.
  */
-static	int	send_res_msg(char *msg, int len, int rcount)
+static	int	send_res_msg(char *msg, int len, int max)
 {
 	Reg	int	i;
-	int	sent = 0, max;
+	int	sent = 0;
 
 	if (!msg)
 		return -1;
 
-	max = MIN(ircd_res.nscount, rcount);
-	if (ircd_res.options & RES_PRIMARY)
-		max = 1;
-	if (!max)
-		max = 1;
-
 	for (i = 0; i < max; i++)
 	{
 		ircd_res.nsaddr_list[i].SIN_FAMILY = AFINET;
@@ -351,6 +392,31 @@ static	int	send_res_msg(char *msg, int len, int rcount)
 }
 
 
+/*
+ * milliseconds clock for the request timers.
+ */
+static	u_long	res_msec(void)
+{
+	struct	timeval	tv;
+
+	(void)gettimeofday(&tv, NULL);
+	return (u_long)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+/*
+ * account for the time it took to get an answer to a request.
+ */
+static	void	res_latency(ResRQ *rptr)
+{
+	u_long	ms = res_msec() - rptr->firstat;
+	int	i;
+
+	for (i = 0; reslatms[i] && ms >= reslatms[i]; i++)
+		;
+	reslat[i]++;
+	reslatsum += ms;
+}
+
 /*
  * find a dns request id (id is determined by dn_mkquery)
  */
@@ -358,12 +424,30 @@ static	ResRQ	*find_id(int id)
 {
 	Reg	ResRQ	*rptr;
 
-	for (rptr = first; rptr; rptr = rptr->next)
+	for (rptr = idtable[id & (ARES_IDSIZE - 1)]; rptr;
+	     rptr = rptr->id_next)
 		if (rptr->id == id)
 			return rptr;
 	return NULL;
 }
 
+/*
+ * remove a request from the id hash table, if it's there at all.
+ */
+static	void	unhash_id(ResRQ *rptr)
+{
+	Reg	ResRQ	**rpp;
+
+	for (rpp = &idtable[rptr->id & (ARES_IDSIZE - 1)]; *rpp;
+	     rpp = &(*rpp)->id_next)
+		if (*rpp == rptr)
+		{
+			*rpp = rptr->id_next;
+			break;
+		}
+	rptr->id_next = NULL;
+}
+
 /*
  * Get a host address of type type, by it's name.
  * lp contains the client info.
@@ -382,20 +466,31 @@ struct	hostent	*gethost_byname_type(char *name, Link *lp, int type)
 #endif
 		)
 		return NULL;
+	cainfo.ca_lookups++;
 	if ((cp = find_cache_name(NULL, name, 
 #ifdef INET6
 		(type == T_AAAA) ? FLG_AAAA_VALID : 
 #endif
 		FLG_A_VALID)))
 		return (struct hostent *)&(cp->he);
+	if (find_negative(NULL, name))
+	{
+		cainfo.ca_neg_hits++;
+		h_errno = HOST_NOT_FOUND;
+		return NULL;
+	}
 	if (!lp)
 		return NULL;
+	h_errno = 0;
 	(void)do_query_name(lp, name, NULL, type);
 	return NULL;
 }
 
 /*
  * Get a host address by it's name.
+ * Both gethost_byname() and gethost_byaddr() set h_errno to HOST_NOT_FOUND
+ * when returning NULL because the lookup recently failed, in which case
+ * no query is sent and the caller shouldn't wait for one.
  * For IPv6, this will first try T_AAAA, and if that fails tries T_A, 
  * inside get_res().
  * IPv4 is always T_A.
@@ -418,10 +513,18 @@ struct	hostent	*gethost_byaddr(char *addr, Link *lp)
 	aCache	*cp;
 
 	reinfo.re_nu_look++;
+	cainfo.ca_lookups++;
 	if ((cp = find_cache_number(NULL, addr)))
 		return (struct hostent *)&(cp->he);
+	if (find_negative(addr, NULL))
+	{
+		cainfo.ca_neg_hits++;
+		h_errno = HOST_NOT_FOUND;
+		return NULL;
+	}
 	if (!lp)
 		return NULL;
+	h_errno = 0;
 	(void)do_query_number(lp, (struct IN_ADDR *)addr, NULL);
 	return NULL;
 }
@@ -564,19 +667,43 @@ static	int	query_name(char *name, int class, int type, ResRQ *rptr)
 		hptr->id = htons(nstmp);
 		k++;
 	} while (find_id(ntohs(hptr->id)));
+	unhash_id(rptr);
 	rptr->id = ntohs(hptr->id);
+	rptr->id_next = idtable[rptr->id & (ARES_IDSIZE - 1)];
+	idtable[rptr->id & (ARES_IDSIZE - 1)] = rptr;
 	rptr->sends++;
-	s = send_res_msg(buf, r, rptr->sends);
+	rptr->nerr = 0;
+	s = send_res_msg(buf, r, ns_count(rptr));
 	if (s == -1)
 	{
+		rptr->nsent = 0;
 		h_errno = TRY_AGAIN;
 		return -1;
 	}
 	else
+	{
+		rptr->nsent = s;
 		rptr->sent += s;
+	}
 	return 0;
 }
 
+/*
+ * how many nameservers a request has been sent to so far: the first send
+ * goes to resparallel of them at once (the first answer wins), and each
+ * resend to one more.
+ */
+static	int	ns_count(ResRQ *rptr)
+{
+	int	max;
+
+	if (ircd_res.options & RES_PRIMARY)
+		return 1;
+	max = rptr->sends - 1 + (resparallel ? resparallel : ircd_res.nscount);
+	max = MIN(ircd_res.nscount, max);
+	return max ? max : 1;
+}
+
 static	void	resend_query(ResRQ *rptr)
 {
 	if (rptr->resend == 0)
@@ -887,9 +1014,7 @@ struct	hostent	*get_res(char *lp)
 	/*
 	 * check against possibly fake replies
 	 */
-	max = MIN(ircd_res.nscount, rptr->sends);
-	if (!max)
-		max = 1;
+	max = ns_count(rptr);
 
 	for (a = 0; a < max; a++)
 		if (!ircd_res.nsaddr_list[a].SIN_ADDR.S_ADDR ||
@@ -903,6 +1028,18 @@ struct	hostent	*get_res(char *lp)
 		goto getres_err;
 	}
 
+	/*
+	 * a nameserver failing doesn't matter as long as another one
+	 * queried at the same time may still answer.
+	 */
+	if (hptr->rcode != NOERROR && hptr->rcode != NXDOMAIN &&
+	    ++rptr->nerr < rptr->nsent)
+	{
+		reinfo.re_errors++;
+		return NULL;
+	}
+	res_latency(rptr);
+
 	if ((hptr->rcode != NOERROR) || (hptr->ancount == 0))
 	{
 		switch (hptr->rcode)
@@ -924,6 +1061,8 @@ struct	hostent	*get_res(char *lp)
 			break;
 		}
 		reinfo.re_errors++;
+		if (hptr->rcode == NXDOMAIN)
+			add_negative(rptr);
 		/*
 		** If a bad error was returned, we stop here and dont send
 		** send any more (no retries granted).
@@ -956,6 +1095,7 @@ struct	hostent	*get_res(char *lp)
 	if (a > 0 && rptr->type == T_PTR)
 	{
 		struct	hostent	*hp2 = NULL;
+		ResRQ	*queued = last;
 		int	type;
 
 		if (BadPtr(rptr->he.h_name))	/* Kludge!	960907/Vesa */
@@ -984,15 +1124,16 @@ struct	hostent	*get_res(char *lp)
 #endif
 			type = T_A;
 		hp2 = gethost_byname_type(rptr->he.h_name, &rptr->cinfo, type);
-		if (hp2 && lp)
+		if ((hp2 || last == queued) && lp)
 			bcopy((char *)&rptr->cinfo, lp, sizeof(Link));
 		/*
 		 * If name wasn't found, a request has been queued and it will
-		 * be the last one queued.  This is rather nasty way to keep
+		 * be the last one queued (unless the name is known not to
+		 * resolve).  This is rather nasty way to keep
 		 * a host alias with the query. -avalon
 		 * We also need 'authoritative' name to be kept --BitKoenig
 		 */
-		if (!hp2)
+		if (!hp2 && last != queued)
 		{
 			last->he.h_name = rptr->he.h_name;
 			rptr->he.h_name = NULL;
@@ -1087,7 +1228,7 @@ static	int	hash_number(u_char *ip)
 	hashv += hashv + (int)*ip++;
 #endif
 	hashv += hashv + (int)*ip;
-	hashv %= ARES_CACSIZE;
+	hashv %= cachesize;
 	return (hashv);
 }
 
@@ -1095,19 +1236,136 @@ static	int	hash_name(char *name)
 {
 	Reg	u_int	hashv = 0;
 
-	for (; *name && *name != '.'; name++)
-		hashv += *name;
-	hashv %= ARES_CACSIZE;
+	for (; *name; name++)
+		hashv = (hashv << 5) - hashv + tolower((u_char)*name);
+	hashv %= cachesize;
 	return (hashv);
 }
 
+/*
+** Give a cache item one more alias, which hash_cache() or hash_alias()
+** then put on the name hash chains.
+*/
+static	aCacheAlias	*new_alias(aCache *cp, char *name)
+{
+	Reg	aCacheAlias	*ap;
+
+	ap = (aCacheAlias *)MyMalloc(sizeof(aCacheAlias));
+	ap->name = name;
+	ap->cp = cp;
+	ap->hnext = NULL;
+	ap->next = cp->aliases;
+	cp->aliases = ap;
+	return ap;
+}
+
+static	void	hash_alias(aCacheAlias *ap)
+{
+	Reg	int	hashv;
+
+	hashv = hash_name(ap->name);
+	ap->hnext = hashtable[hashv].alias_list;
+	hashtable[hashv].alias_list = ap;
+}
+
+/*
+** Put a cache item on the hash chains for its name, aliases and first
+** address, negative entries only have one of them.
+*/
+static	void	hash_cache(aCache *ocp)
+{
+	Reg	aCacheAlias	*ap;
+	Reg	int	hashv;
+
+	if (ocp->he.h_name)
+	{
+		hashv = hash_name(ocp->he.h_name);
+		ocp->hname_next = hashtable[hashv].name_list;
+		hashtable[hashv].name_list = ocp;
+	}
+	if (ocp->he.h_addr)
+	{
+		hashv = hash_number((u_char *)ocp->he.h_addr);
+		ocp->hnum_next = hashtable[hashv].num_list;
+		hashtable[hashv].num_list = ocp;
+	}
+	for (ap = ocp->aliases; ap; ap = ap->next)
+		hash_alias(ap);
+}
+
+/*
+** Move a cache item to the top (most recently used end) of the list,
+** or link a new one there.
+*/
+static	void	top_list(aCache *cp, int new)
+{
+	if (!new)
+	{
+		if (cp == cachetop)
+			return;
+		cp->list_prev->list_next = cp->list_next;
+		if (cp->list_next)
+			cp->list_next->list_prev = cp->list_prev;
+		else
+			cachebot = cp->list_prev;
+	}
+	cp->list_prev = NULL;
+	cp->list_next = cachetop;
+	if (cachetop)
+		cachetop->list_prev = cp;
+	else
+		cachebot = cp;
+	cachetop = cp;
+}
+
+/*
+** (Re)allocate the hash table to hold up to max entries, dropping the
+** least recently used ones which don't fit anymore.
+*/
+static	void	size_cache(int max)
+{
+	Reg	aCache	*cp;
+	int	size;
+
+	maxcached = max;
+	while (incache > maxcached)
+	{
+		cainfo.ca_evicts++;
+		rem_cache(cachebot);
+	}
+	size = bigger_prime(2 * maxcached);
+	if (hashtable && size == cachesize)
+		return;
+	if (hashtable)
+		MyFree(hashtable);
+	cachesize = size;
+	hashtable = (CacheTable *)MyMalloc(sizeof(CacheTable) * cachesize);
+	bzero((char *)hashtable, sizeof(CacheTable) * cachesize);
+	/* oldest first, so chains keep their most recent entries first */
+	for (cp = cachebot; cp; cp = cp->list_prev)
+		hash_cache(cp);
+}
+
+/*
+** Set from R: lines, negative values restore the defaults.
+*/
+void	resolver_conf(int max, int ttl, int tout, int parallel)
+{
+	negttl = (ttl >= 0) ? ttl : NEGCACHETTL;
+	restimeout = (tout > 0) ? tout : AR_TIMEOUT;
+	resparallel = (parallel >= 0) ? parallel : AR_PARALLEL;
+	if (max <= 0)
+		max = MAXCACHED;
+	if (max != maxcached)
+		size_cache(max);
+}
+
 /*
 ** Add a new cache item to the queue and hash table.
 */
 static	aCache	*add_to_cache(aCache *ocp)
 {
-	Reg	aCache	*cp = NULL;
-	Reg	int	hashv;
+	Reg	int	i;
 
 #ifdef DEBUG
 	Debug((DEBUG_INFO,
@@ -1115,16 +1373,10 @@ static	aCache	*add_to_cache(aCache *ocp)
 		ocp, &ocp->he, ocp->he.h_name, ocp->he.h_addr_list,
 		ocp->he.h_addr_list[0]));
 #endif
-	ocp->list_next = cachetop;
-	cachetop = ocp;
-
-	hashv = hash_name(ocp->he.h_name);
-	ocp->hname_next = hashtable[hashv].name_list;
-	hashtable[hashv].name_list = ocp;
-
-	hashv = hash_number((u_char *)ocp->he.h_addr);
-	ocp->hnum_next = hashtable[hashv].num_list;
-	hashtable[hashv].num_list = ocp;
+	top_list(ocp, 1);
+	for (i = 0; ocp->he.h_aliases[i]; i++)
+		(void)new_alias(ocp, ocp->he.h_aliases[i]);
+	hash_cache(ocp);
 
 #ifdef	DEBUG
 # ifdef	INET6
@@ -1136,19 +1388,17 @@ static	aCache	*add_to_cache(aCache *ocp)
 		ocp->he.h_name, ocp->he.h_addr_list[0], ocp));
 # endif
 	Debug((DEBUG_INFO,
-		"add_to_cache:h1 %d h2 %x lnext %#x namnext %#x numnext %#x",
-		hash_name(ocp->he.h_name), hashv, ocp->list_next,
-		ocp->hname_next, ocp->hnum_next));
+		"add_to_cache:lnext %#x namnext %#x numnext %#x",
+		ocp->list_next, ocp->hname_next, ocp->hnum_next));
 #endif
 
 	/*
 	 * LRU deletion of excessive cache entries.
 	 */
-	if (++incache > MAXCACHED)
+	if (++incache > maxcached)
 	{
-		for (cp = cachetop; cp->list_next; cp = cp->list_next)
-			;
-		rem_cache(cp);
+		cainfo.ca_evicts++;
+		rem_cache(cachebot);
 	}
 	cainfo.ca_adds++;
 
@@ -1171,25 +1421,17 @@ static	aCache	*add_to_cache(aCache *ocp)
 */
 static	void	update_list(ResRQ *rptr, aCache *cachep)
 {
-	Reg	aCache	**cpp, *cp = cachep;
+	Reg	aCache	*cp = cachep;
 	Reg	char	*s, *t, **base;
 	Reg	int	i, j;
 	int	addrcount;
 
 	/*
-	** search for the new cache item in the cache list by hostname.
-	** If found, move the entry to the top of the list and return.
+	** move the entry to the top of the list.
 	*/
 	cainfo.ca_updates++;
 
-	for (cpp = &cachetop; *cpp; cpp = &((*cpp)->list_next))
-		if (cp == *cpp)
-			break;
-	if (!*cpp)
-		return;
-	*cpp = cp->list_next;
-	cp->list_next = cachetop;
-	cachetop = cp;
+	top_list(cp, 0);
 	if (!rptr)
 		return;
 
@@ -1230,6 +1472,7 @@ static	void	update_list(ResRQ *rptr, aCache *cachep)
 #endif
 				base[addrcount-1] = mystrdup(s);
 				base[addrcount] = NULL;
+				hash_alias(new_alias(cp, base[addrcount-1]));
 			}
 		}
 	}
@@ -1330,8 +1573,8 @@ static	void	update_list(ResRQ *rptr, aCache *cachep)
 static	aCache	*find_cache_name(ResRQ *rptr, char *name, int flags)
 {
 	Reg	aCache	*cp;
-	Reg	char	*s;
-	Reg	int	hashv, i;
+	Reg	aCacheAlias	*ap;
+	Reg	int	hashv;
 
 	hashv = hash_name(name);
 
@@ -1342,41 +1585,36 @@ static	aCache	*find_cache_name(ResRQ *rptr, char *name, int flags)
 
 	for (; cp; cp = cp->hname_next)
 	{
-		if ((cp->flags & flags) == 0) 
+		if ((cp->flags & flags) == 0 || (cp->flags & FLG_NEGATIVE))
 		{
 			continue;
 		} 
-		for (i = 0, s = cp->he.h_name; s; s = cp->he.h_aliases[i++])
-			if (mycmp(s, name) == 0)
-			{
-				cainfo.ca_na_hits++;
-				update_list(rptr, cp);
-				return cp;
-			}
+		if (mycmp(cp->he.h_name, name) == 0)
+		{
+			cainfo.ca_na_hits++;
+			update_list(rptr, cp);
+			return cp;
+		}
 	}
 
-	for (cp = cachetop; cp; cp = cp->list_next)
+	/*
+	 * aliases have their own chains, in the same hash table.
+	 */
+	for (ap = hashtable[hashv].alias_list; ap; ap = ap->hnext)
 	{
-		if ((cp->flags & flags) == 0) 
+		cp = ap->cp;
+		if ((cp->flags & flags) == 0 || (cp->flags & FLG_NEGATIVE))
 		{
 			continue;
 		} 
-		/*
-		 * if no aliases or the hash value matches, we've already
-		 * done this entry and all possiblilities concerning it.
-		 */
-		if (!*cp->he.h_aliases)
-			continue;
-		if (hashv == hash_name(cp->he.h_name))
-			continue;
-		for (i = 0, s = cp->he.h_aliases[i]; s && i < MAXALIASES; i++)
-			if (!mycmp(name, s))
-			{
-				cainfo.ca_na_hits++;
-				update_list(rptr, cp);
-				return cp;
-			}
+		if (mycmp(ap->name, name) == 0)
+		{
+			cainfo.ca_na_hits++;
+			update_list(rptr, cp);
+			return cp;
+		}
 	}
+	cainfo.ca_na_miss++;
 	return NULL;
 }
 
@@ -1386,7 +1624,7 @@ static	aCache	*find_cache_name(ResRQ *rptr, char *name, int flags)
 static	aCache	*find_cache_number(ResRQ *rptr, char *numb)
 {
 	Reg	aCache	*cp;
-	Reg	int	hashv,i;
+	Reg	int	hashv;
 
 	hashv = hash_number((u_char *)numb);
 
@@ -1401,58 +1639,100 @@ static	aCache	*find_cache_number(ResRQ *rptr, char *numb)
 		hashv));
 # endif
 #endif
+	/*
+	 * update_list() drops FLG_PTR_VALID from entries getting more than
+	 * one address, so only the first one needs to be looked at.
+	 */
 	for (; cp; cp = cp->hnum_next) 
 	{
 		if ((cp->flags & FLG_PTR_VALID) == 0) 
 		{
 			continue;
 		}
-		for (i = 0; cp->he.h_addr_list[i]; i++)
+		if (!bcmp(cp->he.h_addr_list[0], numb, sizeof(struct IN_ADDR)))
 		{
-			if (!bcmp(cp->he.h_addr_list[i], numb,
-				  sizeof(struct IN_ADDR)))
-			{
-				cainfo.ca_nu_hits++;
-				update_list(rptr, cp);
-				return cp;
-			}
+			cainfo.ca_nu_hits++;
+			update_list(rptr, cp);
+			return cp;
 		}
 	}
-	for (cp = cachetop; cp; cp = cp->list_next)
+	cainfo.ca_nu_miss++;
+	return NULL;
+}
+
+/*
+ * find the negative cache entry for an ip# or a name, dropping it if
+ * it has expired.
+ */
+static	aCache	*find_negative(char *numb, char *name)
+{
+	Reg	aCache	*cp;
+
+	if (numb)
+		cp = hashtable[hash_number((u_char *)numb)].num_list;
+	else
+		cp = hashtable[hash_name(name)].name_list;
+	for (; cp; cp = numb ? cp->hnum_next : cp->hname_next)
 	{
-		if ((cp->flags & FLG_PTR_VALID) == 0) 
-		{
-			continue;
-		}
-		if (!cp->he.h_addr_list && !cp->he.h_aliases)
-		{
-			cp = rem_list(cp);
-			continue;
-		}
-		/*
-		 * single address entry...would have been done by hashed
-		 * search above...
-		 */
-		if (!cp->he.h_addr_list[1])
-			continue;
-		/*
-		 * if the first IP# has the same hashnumber as the IP# we
-		 * are looking for, its been done already.
-		 */
-		if (hashv == hash_number((u_char *)cp->he.h_addr_list[0]))
+		if (!(cp->flags & FLG_NEGATIVE))
 			continue;
-		for (i = 1; cp->he.h_addr_list[i]; i++)
+		if (numb ? (cp->he.h_addr &&
+			    !bcmp(cp->he.h_addr, numb, sizeof(struct IN_ADDR)))
+			 : (cp->he.h_name && !mycmp(cp->he.h_name, name)))
+			break;
+	}
+	if (cp && timeofday >= cp->expireat)
+	{
+		cainfo.ca_expires++;
+		rem_cache(cp);
+		return NULL;
+	}
+	return cp;
+}
+
+/*
+ * remember that a client lookup failed (NXDOMAIN or no reply at all) so
+ * that clients reconnecting from the same place don't trigger a new query
+ * each time.  Reverse lookups are keyed by ip#, forward ones by name.
+ */
+static	void	add_negative(ResRQ *rptr)
+{
+	Reg	aCache	*cp;
+	Reg	struct	hostent	*hp;
+	char	*numb = NULL, *name = NULL;
+
+	if (negttl <= 0 || rptr->cinfo.flags != ASYNC_CLIENT)
+		return;
+	if (rptr->type == T_PTR)
+		numb = (char *)&rptr->addr;
+	else if (rptr->name)
+		name = rptr->name;
+	else
+		return;
+	if (!(cp = find_negative(numb, name)))
+	{
+		cp = (aCache *)MyMalloc(sizeof(aCache));
+		bzero((char *)cp, sizeof(aCache));
+		hp = &cp->he;
+		hp->h_aliases = (char **)MyMalloc(sizeof(char *));
+		hp->h_aliases[0] = NULL;
+		hp->h_addr_list = (char **)MyMalloc(sizeof(char *) * 2);
+		hp->h_addr_list[0] = hp->h_addr_list[1] = NULL;
+		if (numb)
 		{
-			if (!bcmp(cp->he.h_addr_list[i], numb,
-				  sizeof(struct IN_ADDR)))
-			{
-				cainfo.ca_nu_hits++;
-				update_list(rptr, cp);
-				return cp;
-			}
+			hp->h_addr_list[0] = MyMalloc(sizeof(struct IN_ADDR));
+			bcopy(numb, hp->h_addr_list[0], sizeof(struct IN_ADDR));
 		}
+		else
+			hp->h_name = mystrdup(name);
+		hp->h_addrtype = AFINET;
+		hp->h_length = sizeof(struct IN_ADDR);
+		cp->flags = FLG_NEGATIVE;
+		(void)add_to_cache(cp);
+		cainfo.ca_neg_adds++;
 	}
-	return NULL;
+	cp->ttl = negttl;
+	cp->expireat = timeofday + negttl;
 }
 
 static	aCache	*make_cache(ResRQ *rptr)
@@ -1519,6 +1799,14 @@ static	aCache	*make_cache(ResRQ *rptr)
 		}
 	}
 
+	/*
+	** forget about earlier failures of this lookup.
+	*/
+	if ((rptr->type == T_PTR || rptr->name) &&
+	    (cp = find_negative((rptr->type == T_PTR) ?
+				(char *)&rptr->addr : NULL, rptr->name)))
+		rem_cache(cp);
+
 	/*
 	** a matching entry wasnt found in the cache so go and make one up.
 	*/ 
@@ -1587,105 +1875,129 @@ static	aCache	*make_cache(ResRQ *rptr)
 			break;
 #endif
 	}
-	return add_to_cache(cp);
-}
-
-/*
- * rem_list
- */
-static	aCache	*rem_list(aCache *cp)
-{
-	aCache	**cpp, *cr = cp->list_next;
-
 	/*
-	 * remove cache entry from linked list
-	 */
-	for (cpp = &cachetop; *cpp; cpp = &((*cpp)->list_next))
-	{
-		if (*cpp == cp)
-		{
-			*cpp = cp->list_next;
-			MyFree(cp);
-			break;
-		}
-	}
-	return cr;
+	** as in update_list(), a single address is half of what it takes
+	** for the entry to be trusted for reverse lookups as well.
+	*/
+	if (cp->flags && !hp->h_addr_list[1])
+		cp->flags |= FLG_PTR_PEND_FWD;
+	return add_to_cache(cp);
 }
 
-
 /*
  * rem_cache
  *     delete a cache entry from the cache structures and lists and return
- *     all memory used for the cache back to the memory pool.
+ *     all memory used for the cache back to the memory pool, unless some
+ *     client still has it as hostp: it is then freed by set_hostp() once
+ *     the last of them is done with it.
  */
 static	void	rem_cache(aCache *ocp)
 {
 	Reg	aCache	**cp;
+	Reg	aCacheAlias	**app, *ap;
 	Reg	struct	hostent *hp = &ocp->he;
 	Reg	int	hashv;
-	Reg	aClient	*cptr;
 
 #ifdef	DEBUG
 	Debug((DEBUG_DNS, "rem_cache: ocp %#x hp %#x l_n %#x aliases %#x",
 		ocp, hp, ocp->list_next, hp->h_aliases));
 #endif
-	/*
-	** Cleanup any references to this structure by destroying the
-	** pointer.
-	*/
-	for (hashv = highest_fd; hashv >= 0; hashv--)
-		if ((cptr = local[hashv]) && (cptr->hostp == hp))
-			cptr->hostp = NULL;
 	/*
 	 * remove cache entry from linked list
 	 */
-	for (cp = &cachetop; *cp; cp = &((*cp)->list_next))
-	{
-		if (*cp == ocp)
-		{
-			*cp = ocp->list_next;
-			break;
-		}
-	}
+	if (ocp->list_prev)
+		ocp->list_prev->list_next = ocp->list_next;
+	else
+		cachetop = ocp->list_next;
+	if (ocp->list_next)
+		ocp->list_next->list_prev = ocp->list_prev;
+	else
+		cachebot = ocp->list_prev;
 	/*
 	 * remove cache entry from hashed name lists
 	 */
-	hashv = hash_name(hp->h_name);
+	if (hp->h_name)
+	{
+		hashv = hash_name(hp->h_name);
 #ifdef	DEBUG
-	Debug((DEBUG_DEBUG,"rem_cache: h_name %s hashv %d next %#x first %#x",
-		hp->h_name, hashv, ocp->hname_next,
-		hashtable[hashv].name_list));
+		Debug((DEBUG_DEBUG,
+			"rem_cache: h_name %s hashv %d next %#x first %#x",
+			hp->h_name, hashv, ocp->hname_next,
+			hashtable[hashv].name_list));
 #endif
-	for (cp = &hashtable[hashv].name_list; *cp; cp = &((*cp)->hname_next))
-	{
-		if (*cp == ocp)
+		for (cp = &hashtable[hashv].name_list; *cp;
+		     cp = &((*cp)->hname_next))
 		{
-			*cp = ocp->hname_next;
-			break;
+			if (*cp == ocp)
+			{
+				*cp = ocp->hname_next;
+				break;
+			}
 		}
 	}
 	/*
 	 * remove cache entry from hashed number list
 	 */
-	hashv = hash_number((u_char *)hp->h_addr);
+	if (hp->h_addr)
+	{
+		hashv = hash_number((u_char *)hp->h_addr);
 #ifdef	DEBUG
-	Debug((DEBUG_DEBUG,"rem_cache: h_addr %s hashv %d next %#x first %#x",
+		Debug((DEBUG_DEBUG,
+			"rem_cache: h_addr %s hashv %d next %#x first %#x",
 # ifdef INET6
-		inet_ntop(AF_INET6, hp->h_addr, ipv6string, sizeof(ipv6string)),
+			inet_ntop(AF_INET6, hp->h_addr, ipv6string,
+				sizeof(ipv6string)),
 # else
-		inetntoa(hp->h_addr),
+			inetntoa(hp->h_addr),
 # endif
-		hashv, ocp->hnum_next, hashtable[hashv].num_list));
+			hashv, ocp->hnum_next, hashtable[hashv].num_list));
 #endif
-	for (cp = &hashtable[hashv].num_list; *cp; cp = &((*cp)->hnum_next))
+		for (cp = &hashtable[hashv].num_list; *cp;
+		     cp = &((*cp)->hnum_next))
+		{
+			if (*cp == ocp)
+			{
+				*cp = ocp->hnum_next;
+				break;
+			}
+		}
+	}
+	/*
+	 * remove the aliases from their hashed name lists
+	 */
+	while ((ap = ocp->aliases))
 	{
-		if (*cp == ocp)
+		ocp->aliases = ap->next;
+		for (app = &hashtable[hash_name(ap->name)].alias_list; *app;
+		     app = &((*app)->hnext))
 		{
-			*cp = ocp->hnum_next;
-			break;
+			if (*app == ap)
+			{
+				*app = ap->hnext;
+				break;
+			}
 		}
+		MyFree(ap);
 	}
 
+	incache--;
+	cainfo.ca_dels++;
+
+	if (ocp->refs)
+		ocp->flags |= FLG_GONE;
+	else
+		free_cache(ocp);
+}
+
+/*
+ * free_cache
+ *     give back the memory of an entry which is not in the cache anymore.
+ */
+static	void	free_cache(aCache *ocp)
+{
+	Reg	struct	hostent *hp = &ocp->he;
+	Reg	int	i;
+
 	/*
 	 * free memory used to hold the various host names and the array
 	 * of alias pointers.
@@ -1694,8 +2006,8 @@ static	void	rem_cache(aCache *ocp)
 		MyFree(hp->h_name);
 	if (hp->h_aliases)
 	{
-		for (hashv = 0; hp->h_aliases[hashv]; hashv++)
-			MyFree(hp->h_aliases[hashv]);
+		for (i = 0; hp->h_aliases[i]; i++)
+			MyFree(hp->h_aliases[i]);
 		MyFree(hp->h_aliases);
 	}
 
@@ -1710,11 +2022,30 @@ static	void	rem_cache(aCache *ocp)
 	}
 
 	MyFree(ocp);
+}
 
-	incache--;
-	cainfo.ca_dels++;
+/*
+ * set_hostp
+ *     point a local client at the host info of a cache entry, or at
+ *     nothing, keeping count of the clients pointing at each entry.
+ */
+void	set_hostp(aClient *cptr, struct hostent *hp)
+{
+	Reg	aCache	*cp;
 
-	return;
+	if (cptr->hostp == hp)
+		return;
+	if (cptr->hostp)
+	{
+		cp = (aCache *)((char *)cptr->hostp - offsetof(aCache, he));
+		if (--cp->refs == 0 && (cp->flags & FLG_GONE))
+			free_cache(cp);
+	}
+	if ((cptr->hostp = hp))
+	{
+		cp = (aCache *)((char *)hp - offsetof(aCache, he));
+		cp->refs++;
+	}
 }
 
 /*
@@ -1752,6 +2083,230 @@ void	flush_cache(void)
 		rem_cache(cp);
 }
 
+/*
+** Snapshot of the cache, so that a restarted server does not have to
+** resolve again every host it has seen. Entries are written oldest first
+** so that reading them back through add_to_cache() restores the LRU order.
+*/
+static	char	snapbuf[8192];
+static	int	snaplen, snapfd;
+static	int	snap_loaded = 0, snap_expired = 0;
+static	u_long	snap_msec = 0;
+
+static	int	snap_write(char *data, int len)
+{
+	if (snaplen + len > sizeof(snapbuf) || !data)
+	    {
+		if (snaplen && write(snapfd, snapbuf, snaplen) != snaplen)
+			return -1;
+		snaplen = 0;
+	    }
+	if (!data)
+		return 0;
+	if (len > sizeof(snapbuf))
+		return (write(snapfd, data, len) == len) ? 0 : -1;
+	bcopy(data, snapbuf + snaplen, len);
+	snaplen += len;
+	return 0;
+}
+
+static	int	snap_string(char *s)
+{
+	u_char	len;
+
+	len = s ? MIN(strlen(s), 255) : 0;
+	if (snap_write((char *)&len, 1))
+		return -1;
+	return len ? snap_write(s, len) : 0;
+}
+
+int	save_cache(char *filename)
+{
+	Reg	aCache	*cp;
+	Reg	struct	hostent	*hp;
+	struct	snaphdr	sh;
+	struct	snapent	se;
+	char	tmpname[BUFSIZE];
+	int	i, err = 0;
+
+	if (!filename || !*filename)
+		return -1;
+	(void)sprintf(tmpname, "%.*s.tmp", (int)sizeof(tmpname) - 5, filename);
+	if ((snapfd = open(tmpname, O_CREAT|O_TRUNC|O_WRONLY, 0600)) < 0)
+	    {
+		sendto_flag(SCH_ERROR, "Failed (%d) to open dns file: %s.",
+			    errno, mybasename(tmpname));
+		return -1;
+	    }
+	snaplen = 0;
+	bzero((char *)&sh, sizeof(sh));
+	bcopy(ARES_MAGIC, sh.magic, sizeof(sh.magic));
+	sh.addrlen = sizeof(struct IN_ADDR);
+	sh.saved = timeofday;
+	for (cp = cachebot; cp; cp = cp->list_prev)
+		if (cp->expireat > timeofday)
+			sh.count++;
+	err = snap_write((char *)&sh, sizeof(sh));
+
+	for (cp = cachebot; cp && !err; cp = cp->list_prev)
+	    {
+		if (cp->expireat <= timeofday)
+			continue;
+		hp = &cp->he;
+		bzero((char *)&se, sizeof(se));
+		se.expireat = cp->expireat;
+		se.ttl = cp->ttl;
+		se.flags = cp->flags;
+		for (i = 0; hp->h_addr_list[i] && i < 255; i++)
+			;
+		se.naddr = i;
+		for (i = 0; hp->h_aliases[i] && i < 255; i++)
+			;
+		se.nalias = i;
+		err = snap_write((char *)&se, sizeof(se));
+		for (i = 0; i < se.naddr && !err; i++)
+			err = snap_write(hp->h_addr_list[i],
+					 sizeof(struct IN_ADDR));
+		if (!err)
+			err = snap_string(hp->h_name);
+		for (i = 0; i < se.nalias && !err; i++)
+			err = snap_string(hp->h_aliases[i]);
+	    }
+	if (!err)
+		err = snap_write(NULL, 0);
+	if (close(snapfd) || err || rename(tmpname, filename))
+	    {
+		sendto_flag(SCH_ERROR, "Failed (%d) to write dns file: %s.",
+			    errno, mybasename(filename));
+		(void)unlink(tmpname);
+		return -1;
+	    }
+	Debug((DEBUG_NOTICE, "save_cache: %u entries written to %s",
+		sh.count, filename));
+	return sh.count;
+}
+
+/*
+** Called from main() at startup only, before the first lookup.
+*/
+int	load_cache(char *filename)
+{
+	Reg	aCache	*cp;
+	Reg	struct	hostent	*hp;
+	struct	snaphdr	sh;
+	struct	snapent	se;
+	struct	stat	st;
+	char	*data, *s, *end, *a, **t;
+	u_long	start;
+	u_int	n;
+	int	fd, i, len;
+
+	if (!filename || !*filename || incache)
+		return -1;
+	if ((fd = open(filename, O_RDONLY)) < 0)
+		return -1;
+	if (fstat(fd, &st) || st.st_size < sizeof(sh))
+	    {
+		close(fd);
+		return -1;
+	    }
+	start = res_msec();
+	data = (char *)MyMalloc(st.st_size);
+	len = read(fd, data, st.st_size);
+	close(fd);
+	bcopy(data, (char *)&sh, sizeof(sh));
+	if (len != st.st_size || bcmp(sh.magic, ARES_MAGIC, sizeof(sh.magic))
+	    || sh.addrlen != sizeof(struct IN_ADDR))
+	    {
+		sendto_flag(SCH_ERROR, "Ignoring invalid dns file: %s.",
+			    mybasename(filename));
+		MyFree(data);
+		return -1;
+	    }
+	/*
+	** entries beyond the R: line cache size push out the oldest ones.
+	*/
+	snap_loaded = snap_expired = 0;
+	s = data + sizeof(sh);
+	end = data + len;
+	for (n = 0; n < sh.count; n++)
+	    {
+		if (s + sizeof(se) > end)
+			break;
+		bcopy(s, (char *)&se, sizeof(se));
+		s += sizeof(se);
+		if (s + se.naddr * sizeof(struct IN_ADDR) > end)
+			break;
+		a = s;
+		s += se.naddr * sizeof(struct IN_ADDR);
+		/* check the strings before allocating anything */
+		{
+			char	*p = s;
+
+			for (i = 0; i <= se.nalias && p < end; i++)
+				p += 1 + *(u_char *)p;
+			if (i <= se.nalias || p > end)
+				break;
+		}
+		if (se.expireat <= timeofday ||
+		    (!se.naddr && !*(u_char *)s))
+		    {
+			snap_expired++;
+			for (i = 0; i <= se.nalias; i++)
+				s += 1 + *(u_char *)s;
+			continue;
+		    }
+
+		cp = (aCache *)MyMalloc(sizeof(aCache));
+		bzero((char *)cp, sizeof(aCache));
+		hp = &cp->he;
+		t = hp->h_addr_list = (char **)MyMalloc(sizeof(char *) *
+							(se.naddr + 1));
+		if (se.naddr)
+		    {
+			*t = MyMalloc(sizeof(struct IN_ADDR) * se.naddr);
+			bcopy(a, *t, sizeof(struct IN_ADDR) * se.naddr);
+			for (i = 1; i < se.naddr; i++)
+				t[i] = t[i-1] + sizeof(struct IN_ADDR);
+		    }
+		t[se.naddr] = NULL;
+		if ((i = *(u_char *)s++))
+		    {
+			hp->h_name = (char *)MyMalloc(i + 1);
+			bcopy(s, hp->h_name, i);
+			hp->h_name[i] = '\0';
+			s += i;
+		    }
+		t = hp->h_aliases = (char **)MyMalloc(sizeof(char *) *
+						      (se.nalias + 1));
+		for (i = 0; i < se.nalias; i++)
+		    {
+			len = *(u_char *)s++;
+			t[i] = (char *)MyMalloc(len + 1);
+			bcopy(s, t[i], len);
+			t[i][len] = '\0';
+			s += len;
+		    }
+		t[se.nalias] = NULL;
+		hp->h_addrtype = AFINET;
+		hp->h_length = sizeof(struct IN_ADDR);
+		cp->flags = se.flags;
+		cp->ttl = se.ttl;
+		/* a clock gone backwards could keep entries forever */
+		cp->expireat = MIN(se.expireat, timeofday + se.ttl);
+		(void)add_to_cache(cp);
+		snap_loaded++;
+	    }
+	MyFree(data);
+	snap_msec = res_msec() - start;
+	if (n < sh.count)
+		sendto_flag(SCH_ERROR, "Truncated dns file: %s (%u/%u).",
+			    mybasename(filename), n, sh.count);
+	Debug((DEBUG_NOTICE, "load_cache: %d entries (%d expired) in %lums",
+		snap_loaded, snap_expired, snap_msec));
+	return snap_loaded;
+}
+
 int	m_dns(aClient *cptr, aClient *sptr, int parc, char *parv[])
 {
 	Reg	aCache	*cp;
@@ -1763,6 +2318,21 @@ int	m_dns(aClient *cptr, aClient *sptr, int parc, char *parv[])
 	if (parv[1] && *parv[1] == 'l') {
 		for(cp = cachetop; cp; cp = cp->list_next)
 		{
+			if (cp->flags & FLG_NEGATIVE)
+			{
+				sendto_one(sptr, "NOTICE %s :Ex %d ttl %d "
+					"failed %s %d", parv[0],
+					cp->expireat - timeofday, cp->ttl,
+					cp->he.h_name ? cp->he.h_name :
+#ifdef INET6
+					inetntop(AF_INET6, cp->he.h_addr,
+						ipv6string, sizeof(ipv6string))
+#else
+					inetntoa(cp->he.h_addr)
+#endif
+					, cp->flags);
+				continue;
+			}
 			sendto_one(sptr, "NOTICE %s :Ex %d ttl %d host %s(%s) %d",
 				parv[0], cp->expireat - timeofday, cp->ttl,
 				cp->he.h_name,
@@ -1800,6 +2370,10 @@ int	m_dns(aClient *cptr, aClient *sptr, int parc, char *parv[])
 		   cainfo.ca_adds, cainfo.ca_dels, cainfo.ca_expires,
 		   cainfo.ca_lookups,
 		   cainfo.ca_na_hits, cainfo.ca_nu_hits, cainfo.ca_updates);
+	sendto_one(sptr,"NOTICE %s :Cm %d:%d Cv %d Cn %d:%d Cs %d/%d",
+		   sptr->name, cainfo.ca_na_miss, cainfo.ca_nu_miss,
+		   cainfo.ca_evicts, cainfo.ca_neg_adds, cainfo.ca_neg_hits,
+		   incache, maxcached);
 
 	sendto_one(sptr,"NOTICE %s :Re %d Rl %d/%d Rp %d Rq %d",
 		   sptr->name, reinfo.re_errors, reinfo.re_nu_look,
@@ -1810,6 +2384,29 @@ int	m_dns(aClient *cptr, aClient *sptr, int parc, char *parv[])
 	return 2;
 }
 
+/*
+ * STATS t: resolver settings and time to answer histogram.
+ */
+void	report_res_stats(aClient *sptr, char *nick)
+{
+	char	buf[BUFSIZE];
+	int	i, len;
+
+	sendto_one(sptr, ":%s %d %s :dns timeout %dms nameservers %d/%d "
+		   "pending %d", me.name, RPL_STATSDEBUG, nick, restimeout,
+		   resparallel ? MIN(resparallel, ircd_res.nscount) :
+		   ircd_res.nscount, ircd_res.nscount, inqueue);
+	len = sprintf(buf, "dns answers");
+	for (i = 0; reslatms[i]; i++)
+		len += sprintf(buf + len, " <%ums %lu", reslatms[i], reslat[i]);
+	(void)sprintf(buf + len, " more %lu", reslat[i]);
+	sendto_one(sptr, ":%s %d %s :%s", me.name, RPL_STATSDEBUG, nick, buf);
+	if (snap_loaded || snap_expired)
+		sendto_one(sptr, ":%s %d %s :dns snapshot loaded %d entries "
+			   "(%d expired) in %lums", me.name, RPL_STATSDEBUG,
+			   nick, snap_loaded, snap_expired, snap_msec);
+}
+
 u_long	cres_mem(aClient *sptr, char *nick)
 {
 	register aCache	*c = cachetop;
@@ -1829,7 +2426,7 @@ u_long	cres_mem(aClient *sptr, char *nick)
 		im += sizeof(char *);
 		for (i = 0; h->h_aliases[i]; i++)
 		{
-			nm += sizeof(char *);
+			nm += sizeof(char *) + sizeof(aCacheAlias);
 			nm += strlen(h->h_aliases[i]);
 		}
 		nm += i - 1;
@@ -1837,9 +2434,15 @@ u_long	cres_mem(aClient *sptr, char *nick)
 		if (h->h_name)
 			nm += strlen(h->h_name);
 	}
-	ts = ARES_CACSIZE * sizeof(CacheTable);
-	sendto_one(sptr, ":%s %d %s :RES table %d",
-		   me.name, RPL_STATSDEBUG, nick, ts);
+	ts = cachesize * sizeof(CacheTable) + sizeof(idtable);
+	sendto_one(sptr, ":%s %d %s :RES table %d(%lu) entries %d/%d",
+		   me.name, RPL_STATSDEBUG, nick, cachesize, ts,
+		   incache, maxcached);
+	sendto_one(sptr, ":%s %d %s :RES hits %d misses %d evictions %d "
+		   "negative %d(%d hits)", me.name, RPL_STATSDEBUG, nick,
+		   cainfo.ca_na_hits + cainfo.ca_nu_hits,
+		   cainfo.ca_na_miss + cainfo.ca_nu_miss, cainfo.ca_evicts,
+		   cainfo.ca_neg_adds, cainfo.ca_neg_hits);
 	sendto_one(sptr, ":%s %d %s :Structs %d IP storage %d Name storage %d",
 		   me.name, RPL_STATSDEBUG, nick, sm, im, nm);
 	return ts + sm + im + nm;
@@ -1887,3 +2490,75 @@ static	int	bad_hostname(char *name, int len)
 	return 0;
 }
 
+
+#ifdef USE_METRICS
+/*
+** metrics_res
+**	Resolver and cache counters for the metrics socket.
+*/
+void	metrics_res(void)
+{
+	u_long	n;
+	int	i;
+
+	metrics_head("dns_requests_total", "counter", "Resolver requests.");
+	metrics_printf("ircd_dns_requests_total{type=\"name\"} %d\n"
+		"ircd_dns_requests_total{type=\"number\"} %d\n",
+		reinfo.re_na_look, reinfo.re_nu_look);
+	metrics_head("dns_queries_total", "counter",
+		"Queries sent to the nameservers.");
+	metrics_printf("ircd_dns_queries_total{type=\"new\"} %d\n"
+		"ircd_dns_queries_total{type=\"resend\"} %d\n",
+		reinfo.re_sent, reinfo.re_resends);
+	metrics_head("dns_replies_total", "counter", "Nameserver replies.");
+	metrics_printf("ircd_dns_replies_total{result=\"ok\"} %d\n"
+		"ircd_dns_replies_total{result=\"error\"} %d\n"
+		"ircd_dns_replies_total{result=\"unknown\"} %d\n",
+		reinfo.re_replies - reinfo.re_errors - reinfo.re_unkrep,
+		reinfo.re_errors, reinfo.re_unkrep);
+	metrics_head("dns_timeouts_total", "counter",
+		"Requests given up on.");
+	metrics_printf("ircd_dns_timeouts_total %d\n", reinfo.re_timeouts);
+	metrics_head("dns_answer_seconds", "histogram",
+		"Time to answer a request.");
+	for (i = 0, n = 0; reslatms[i]; i++)
+	    {
+		n += reslat[i];
+		metrics_printf("ircd_dns_answer_seconds_bucket{le=\"%u.%03u\"}"
+			" %lu\n", reslatms[i] / 1000, reslatms[i] % 1000, n);
+	    }
+	n += reslat[i];
+	metrics_printf("ircd_dns_answer_seconds_bucket{le=\"+Inf\"} %lu\n"
+		"ircd_dns_answer_seconds_sum %llu.%03llu\n"
+		"ircd_dns_answer_seconds_count %lu\n", n,
+		reslatsum / 1000, reslatsum % 1000, n);
+
+	metrics_head("dns_cache_entries", "gauge", "Cached entries.");
+	metrics_printf("ircd_dns_cache_entries %d\n", incache);
+	metrics_head("dns_cache_size", "gauge", "Most entries cached.");
+	metrics_printf("ircd_dns_cache_size %d\n", maxcached);
+	metrics_head("dns_cache_lookups_total", "counter", "Cache lookups.");
+	metrics_printf("ircd_dns_cache_lookups_total{type=\"name\","
+		"result=\"hit\"} %d\n"
+		"ircd_dns_cache_lookups_total{type=\"name\",result=\"miss\"}"
+		" %d\n"
+		"ircd_dns_cache_lookups_total{type=\"number\","
+		"result=\"hit\"} %d\n"
+		"ircd_dns_cache_lookups_total{type=\"number\","
+		"result=\"miss\"} %d\n"
+		"ircd_dns_cache_lookups_total{type=\"negative\","
+		"result=\"hit\"} %d\n",
+		cainfo.ca_na_hits, cainfo.ca_na_miss, cainfo.ca_nu_hits,
+		cainfo.ca_nu_miss, cainfo.ca_neg_hits);
+	metrics_head("dns_cache_changes_total", "counter",
+		"Changes to the cache.");
+	metrics_printf("ircd_dns_cache_changes_total{op=\"add\"} %d\n"
+		"ircd_dns_cache_changes_total{op=\"negative_add\"} %d\n"
+		"ircd_dns_cache_changes_total{op=\"update\"} %d\n"
+		"ircd_dns_cache_changes_total{op=\"delete\"} %d\n"
+		"ircd_dns_cache_changes_total{op=\"expire\"} %d\n"
+		"ircd_dns_cache_changes_total{op=\"evict\"} %d\n",
+		cainfo.ca_adds, cainfo.ca_neg_adds, cainfo.ca_updates,
+		cainfo.ca_dels, cainfo.ca_expires, cainfo.ca_evicts);
+}
+#endif /* USE_METRICS */
@@ -24,6 +24,8 @@
 #define FLG_PTR_PEND_REV	8
 #define FLG_PTR_PEND		(FLG_PTR_PEND_FWD|FLG_PTR_PEND_REV)
 #define FLG_PTR_VALID		16
+#define FLG_NEGATIVE		32	/* lookup failed, see negttl */
+#define FLG_GONE		64	/* out of the cache, still referenced */
 
 struct	hent {
 	char	*h_name;	/* official name of host */
@@ -44,11 +46,15 @@ typedef	struct	reslist {
 	char	retries; /* retry counter */
 	char	sends;	/* number of sends (>1 means resent) */
 	char	resend;	/* send flag. 0 == dont resend */
-	time_t	sentat;
-	time_t	timeout;
+	char	nsent;	/* nameservers the last send went to */
+	char	nerr;	/* and how many of them failed */
+	u_long	firstat;	/* msec, see res_msec() */
+	u_long	sentat;
+	u_long	timeout;
 	struct	IN_ADDR	addr;
 	char	*name;
-	struct	reslist	*next;
+	struct	reslist	*next, *prev;	/* queued requests, oldest first */
+	struct	reslist	*id_next;	/* chain in the id hash table */
 	Link	cinfo;
 	struct	hent he;
 	} ResRQ;
@@ -57,16 +63,58 @@ typedef	struct	cache {
 	time_t	expireat;
 	time_t	ttl;
 	int	flags;
+	int	refs;		/* local clients having he as hostp */
 	struct	hostent	he;
-	struct	cache	*hname_next, *hnum_next, *list_next;
+	struct	cache	*hname_next, *hnum_next;
+	struct	cache	*list_next, *list_prev;	/* LRU list, newest first */
+	struct	cachealias *aliases;
 	} aCache;
 
+/* one of he.h_aliases, on the name hash chains */
+typedef	struct	cachealias {
+	char	*name;
+	aCache	*cp;
+	struct	cachealias *hnext;	/* hash chain */
+	struct	cachealias *next;	/* other aliases of cp */
+	} aCacheAlias;
+
 typedef struct	cachetable {
 	aCache	*num_list;
 	aCache	*name_list;
+	aCacheAlias *alias_list;
 	} CacheTable;
 
-/* must be a prime */
-#define ARES_CACSIZE	1009
-/* should be around twice smaller */
+/*
+** Defaults for the R: line; the cache hash table is sized to the prime
+** above twice the number of cached entries.
+*/
 #define	MAXCACHED	512
+#define	NEGCACHETTL	60	/* seconds a failed lookup is remembered */
+#define	AR_TIMEOUT	4000	/* msec before the first resend */
+#define	AR_PARALLEL	0	/* nameservers queried at once, 0 is all */
+#define	AR_SAVE		900	/* seconds between cache snapshots */
+
+/* must be a power of 2 */
+#define	ARES_IDSIZE	1024
+
+/*
+** Cache snapshot file: a header, then the entries, oldest first. Each
+** entry is followed by its addresses, then its name and aliases, each as
+** a length byte and the characters (a 0 length name is no name).
+*/
+#define	ARES_MAGIC	"IRCDNS01"
+
+struct	snaphdr	{
+	char	magic[8];
+	u_int	addrlen;	/* sizeof(struct IN_ADDR) */
+	u_int	count;
+	time_t	saved;
+};
+
+struct	snapent	{
+	time_t	expireat;
+	time_t	ttl;
+	u_short	flags;
+	u_char	naddr;
+	u_char	nalias;
+};
@@ -38,6 +38,14 @@ EXTERN struct hostent *gethost_byaddr (char *addr, Link *lp);
 EXTERN struct hostent *get_res (char *lp);
 EXTERN time_t expire_cache (time_t now);
 EXTERN void flush_cache(void);
+EXTERN void set_hostp (aClient *cptr, struct hostent *hp);
+EXTERN int save_cache (char *filename);
+EXTERN int load_cache (char *filename);
+EXTERN void resolver_conf (int max, int ttl, int tout, int parallel);
 EXTERN int m_dns (aClient *cptr, aClient *sptr, int parc, char *parv[]);
+EXTERN void report_res_stats (aClient *sptr, char *nick);
 EXTERN u_long cres_mem (aClient *sptr, char *nick);
+#ifdef USE_METRICS
+EXTERN void metrics_res(void);
+#endif
 #undef EXTERN
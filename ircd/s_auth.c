@@ -97,46 +97,76 @@ char		*iauth_version = NULL;
 static aExtCf	*iauth_conf = NULL;
 static aExtData	*iauth_stats = NULL;
 
+/*
+** Lines for iauth are queued in iauth_obuf, and written by flush_iauth()
+** once per read_message() rather than with a write() each.
+*/
+#define	IAUTH_OBUFSIZE	(8*BUFSIZ)
+static char	iauth_obuf[IAUTH_OBUFSIZE];
+static int	iauth_olen = 0, iauth_ofd = -1;
+
+/*
+ * flush_iauth
+ *
+ *	Write what is queued for the authentication slave process.
+ *	Return how much of it is still waiting.
+ */
+int	flush_iauth(void)
+{
+	int	i;
+
+	if (adfd != iauth_ofd)
+	{
+		/* iauth was restarted, what was queued is for the old one */
+		iauth_ofd = adfd;
+		iauth_olen = 0;
+	}
+	if (adfd < 0 || iauth_olen == 0)
+		return 0;
+	i = write(adfd, iauth_obuf, iauth_olen);
+	if (i == -1)
+	{
+		if (errno != EAGAIN && errno != EWOULDBLOCK)
+		{
+			sendto_flag(SCH_AUTH, "Aiiie! lost slave "
+				"authentication process");
+			close(adfd);
+			adfd = -1;
+			iauth_olen = 0;
+			start_iauth(0);
+			return 0;
+		}
+		i = 0;
+	}
+	if ((iauth_olen -= i))
+		bcopy(iauth_obuf + i, iauth_obuf, iauth_olen);
+	return iauth_olen;
+}
+
 /*
  * sendto_iauth
  *
- *	Send the buffer to the authentication slave process.
+ *	Queue the line for the authentication slave process.
  *	Return 0 if everything went well, -1 otherwise.
  */
 int	vsendto_iauth(char *pattern, va_list va)
 {
-	static char abuf[BUFSIZ], *p;
-	int	i, len;
+	int	len;
 
+	if (adfd != iauth_ofd || iauth_olen + BUFSIZ > IAUTH_OBUFSIZE)
+		/* iauth isn't keeping up: wait for it, as we always did */
+		while (flush_iauth() + BUFSIZ > IAUTH_OBUFSIZE)
+			;
 	if (adfd < 0)
 	{
 		return -1;
 	}
 
-	vsprintf(abuf, pattern, va);
-	strcat(abuf, "\n");
-	p = abuf;
-	len = strlen(p);
-
-	do
-	{
-		i = write(adfd, abuf, len);
-		if ( i == -1 )
-		{
-			if (errno != EAGAIN && errno != EWOULDBLOCK)
-			{
-				sendto_flag(SCH_AUTH, "Aiiie! lost slave "
-					"authentication process");
-				close(adfd);
-				adfd = -1;
-				start_iauth(0);
-				return -1;
-			}
-			i = 0;
-		}
-		p += i;
-		len -= i;
-	} while (len > 0);
+	len = vsnprintf(iauth_obuf + iauth_olen, BUFSIZ - 1, pattern, va);
+	if (len > BUFSIZ - 2)
+		len = BUFSIZ - 2;
+	iauth_obuf[iauth_olen + len] = '\n';
+	iauth_olen += len + 1;
 
 	return 0;
 }
@@ -159,9 +189,9 @@ int	sendto_iauth(char *pattern, ...)
  */
 void	read_iauth(void)
 {
-    static char obuf[READBUF_SIZE+1], last = '?';
+    static char buf[READBUF_SIZE+1], last = '?';
     static int olen = 0, ia_dbg = 0;
-    char buf[READBUF_SIZE+1], *start, *end, tbuf[BUFSIZ];
+    char *start, *end, tbuf[BUFSIZ];
     aClient *cptr;
     int i;
 
@@ -172,8 +202,7 @@ void	read_iauth(void)
 	}
     while (1)
 	{
-	    if (olen)
-		    bcopy(obuf, buf, olen);
+	    /* lines are parsed in place, only a partial one is moved */
 	    if ((i = recv(adfd, buf+olen, READBUF_SIZE-olen, 0)) <= 0)
 		{
 		    if (errno != EAGAIN && errno != EWOULDBLOCK)
@@ -419,7 +448,7 @@ void	read_iauth(void)
 				    start = end;
 				    continue;
 				}
-			    strncpyzt(cptr->user->username, tbuf, USERLEN+1);
+			    set_istr(&cptr->user->username, tbuf, USERLEN);
 			}
 		    else if (start[0] == 'D')
 		      {
@@ -479,8 +508,8 @@ void	read_iauth(void)
 		    start = end;
 		}
 	    olen -= start - buf;
-	    if (olen)
-		    memcpy(obuf, start, olen);
+	    if (olen && start != buf)
+		    bcopy(start, buf, olen);
 	}
 }
 
@@ -37,6 +37,7 @@ extern u_int iauth_spawn;
 #if defined(USE_IAUTH)
 EXTERN int vsendto_iauth (char *pattern, va_list va);
 EXTERN int sendto_iauth (char *pattern, ...);
+EXTERN int flush_iauth (void);
 EXTERN void read_iauth(void);
 EXTERN void report_iauth_conf (aClient *, char *);
 EXTERN void report_iauth_stats (aClient *, char *);
@@ -482,6 +482,11 @@ void	open_listener(aClient *cptr)
 	{
 		return;
 	}
+	/* the previous ircd hands us its sockets, see upgrade_resume() */
+	if (upgradefd >= 0)
+	{
+		return;
+	}
 	
 #ifdef	UNIXPORT
 	if (*aconf->host == '/')
@@ -636,50 +641,62 @@ void	start_iauth(int rcvdsig)
 	if (first)
 		first = 0;
 	else
+		iauth_old_clients();
+#endif
+}
+
+/*
+ * iauth_old_clients
+ *	Tell iauth about the connections it doesn't know of: after it was
+ *	restarted, or after a live upgrade.
+ */
+void	iauth_old_clients(void)
+{
+#if defined(USE_IAUTH)
+	int i;
+	aClient *cptr;
+	char	abuf[BUFSIZ];	/* size of abuf in vsendto_iauth */
+	/* 20 is biggest possible ending "%d O\n\0", which means
+	** 16-digit fd -- very unlikely :> */
+	char	*e = abuf + BUFSIZ - 20;
+	char	*s = abuf;
+
+	if (adfd < 0)
+		return;
+	/* Build abuf to send big buffer once (or twice) to iauth,
+	** which goes faster than many consecutive small writes.
+	** BitKoenig claims it saves metadata overhead on Linux and
+	** does not harm other systems --B. */
+	for (i = 0; i <= highest_fd; i++)
 	{
-		int i;
-		aClient *cptr;
-		char	abuf[BUFSIZ];	/* size of abuf in vsendto_iauth */
-		/* 20 is biggest possible ending "%d O\n\0", which means
-		** 16-digit fd -- very unlikely :> */
-		char	*e = abuf + BUFSIZ - 20;
-		char	*s = abuf;
-
-		/* Build abuf to send big buffer once (or twice) to iauth,
-		** which goes faster than many consecutive small writes.
-		** BitKoenig claims it saves metadata overhead on Linux and
-		** does not harm other systems --B. */
-		for (i = 0; i <= highest_fd; i++)
-		{
-			if (!(cptr = local[i]))
-				continue;
-			if (IsServer(cptr) || IsService(cptr))
-				continue;
-			
-			/* if not enough room in abuf, send whatever we have
-			** now and start writing from begin of abuf again. */
-			if (s > e)
-			{
-				/* sendto_iauth() appends "\n", so we
-				** remove last one */
-				*(s - 1) = '\0';	
-				sendto_iauth(abuf);
-				s = abuf;
-			}
-			/* A little trick: we sprintf onto s and move s (which 
-			** points inside abuf) forward, at the end of s (number
-			** of bytes returned by sprintf). This makes s always 
-			** point to the end of things written on abuf, which 
-			** allows both next sprintf at the end (no strcat!) and
-			** removing last \n when needed. */
-			s += sprintf(s, "%d O\n", i);
-		}
-		/* send the rest */
-		if (s != abuf)
+		if (!(cptr = local[i]))
+			continue;
+		if (IsServer(cptr) || IsService(cptr))
+			continue;
+		
+		/* if not enough room in abuf, send whatever we have
+		** now and start writing from begin of abuf again. */
+		if (s > e)
 		{
-			*(s - 1) = '\0';
+			/* sendto_iauth() appends "\n", so we
+			** remove last one */
+			*(s - 1) = '\0';	
 			sendto_iauth(abuf);
+			s = abuf;
 		}
+		/* A little trick: we sprintf onto s and move s (which 
+		** points inside abuf) forward, at the end of s (number
+		** of bytes returned by sprintf). This makes s always 
+		** point to the end of things written on abuf, which 
+		** allows both next sprintf at the end (no strcat!) and
+		** removing last \n when needed. */
+		s += sprintf(s, "%d O\n", i);
+	}
+	/* send the rest */
+	if (s != abuf)
+	{
+		*(s - 1) = '\0';
+		sendto_iauth(abuf);
 	}
 #endif
 }
@@ -772,7 +789,8 @@ void	init_sys(void)
 	for (fd = 3; fd < MAXCONNECTIONS; fd++)
 	{
 		local[fd] = NULL;
-		(void)close(fd);
+		if (fd != upgradefd)	/* see s_upgrade.c */
+			(void)close(fd);
 	}
 }
 
@@ -795,7 +813,7 @@ void	daemonize(void)
 	}
 
 	if (((bootopt & BOOT_CONSOLE) || isatty(0)) &&
-	    !(bootopt & BOOT_INETD))
+	    !(bootopt & BOOT_INETD) && upgradefd < 0)
 	    {
 		if (fork())
 			exit(0);
@@ -948,7 +966,7 @@ int	check_client(aClient *cptr)
 				    *((unsigned long *)hp->h_addr));
 #endif
 			hp = NULL;
-			cptr->hostp = NULL;
+			set_hostp(cptr, NULL);
 		    }
 	    }
 
@@ -1395,7 +1413,8 @@ void	close_connection(aClient *cptr)
 	/*
 	 * remove outstanding DNS queries.
 	 */
-	del_queries((char *)cptr);
+	if (DoingDNS(cptr))
+		del_queries((char *)cptr);
 	/*
 	 * If the server connection has been up for a long amount of time,
 	 * schedule a 'quick' reconnect, else reset the next-connect cycle.
@@ -1427,6 +1446,9 @@ void	close_connection(aClient *cptr)
 
 	if (cptr->fd >= 0)
 	{
+#ifdef USE_CAPTURE
+		capture_close(cptr);
+#endif
 #if defined(USE_IAUTH)
 		if (!IsListener(cptr) && !IsConnecting(cptr))
 		{
@@ -1783,8 +1805,9 @@ aClient	*add_connection(aClient *cptr, int fd)
 		Debug((DEBUG_DNS, "lookup %s",
 		       inetntoa((char *)&addr.sin_addr)));
 #endif
-		acptr->hostp = gethost_byaddr((char *)&acptr->ip, &lin);
-		if (!acptr->hostp)
+		set_hostp(acptr, gethost_byaddr((char *)&acptr->ip, &lin));
+		/* HOST_NOT_FOUND: failed recently, no query was sent */
+		if (!acptr->hostp && h_errno != HOST_NOT_FOUND)
 			SetDNS(acptr);
 		nextdnscheck = 1;
 	    }
@@ -1803,9 +1826,12 @@ aClient	*add_connection(aClient *cptr, int fd)
 	local[fd] = acptr;
 	add_fd(fd, &fdall);
 	add_client_to_list(acptr);
+	TRACE(TRACE_CONN, TEV_ACCEPT, fd, acptr->port, cptr->port, 0);
 	start_auth(acptr);
 #if defined(USE_IAUTH)
-	if (!isatty(fd) && !DoingDNS(acptr))
+	if (!isatty(fd) && !DoingDNS(acptr) && !acptr->hostp)
+		sendto_iauth("%d d", acptr->fd);
+	else if (!isatty(fd) && !DoingDNS(acptr))
 	    {
 		int i = 0;
 		
@@ -2059,6 +2085,10 @@ static	int	read_packet(aClient *cptr, int msg_ready)
 			return 1;
 		if (length <= 0)
 			return length;
+#ifdef USE_CAPTURE
+		if (iconf.capture)
+			capture_read(cptr, readbuf, length);
+#endif
 	    }
 	else if (msg_ready)
 		return exit_client(cptr, cptr, &me, "EOF From Client");
@@ -2153,6 +2183,9 @@ int	read_message(time_t delay, FdAry *fdp, int ro)
 	struct pollfd * res_pfd = NULL;
 	struct pollfd * udp_pfd = NULL;
 	struct pollfd * ad_pfd = NULL;
+# ifdef USE_METRICS
+	struct pollfd * mt_pfd = NULL;
+# endif
 	aClient	 * authclnts[MAXCONNECTIONS];	/* mapping of auth fds to client ptrs */
 	int	   nbr_pfds = 0;
 #endif
@@ -2164,6 +2197,9 @@ int	read_message(time_t delay, FdAry *fdp, int ro)
 	int	res, length, fd, i;
 	int	auth;
 	int	write_err = 0;
+#if defined(USE_IAUTH)
+	int	ad_pending = 0;
+#endif
 
 	for (res = 0;;)
 	    {
@@ -2178,6 +2214,9 @@ int	read_message(time_t delay, FdAry *fdp, int ro)
 		res_pfd  = NULL;
 		udp_pfd  = NULL;
 		ad_pfd = NULL;
+# ifdef USE_METRICS
+		mt_pfd = NULL;
+# endif
 #endif	/* USE_POLL */
 		auth = 0;
 
@@ -2288,6 +2327,18 @@ int	read_message(time_t delay, FdAry *fdp, int ro)
 			udp_pfd = pfd;
 #endif
 		    }
+#ifdef USE_METRICS
+		if (metricsfd >= 0)
+		    {
+			SET_READ_EVENT(metricsfd);
+# if ! USE_POLL
+			if (metricsfd > highfd)
+				highfd = metricsfd;
+# else
+			mt_pfd = pfd;
+# endif
+		    }
+#endif
 		if (resfd >= 0)
 		    {
 			SET_READ_EVENT(resfd);
@@ -2299,9 +2350,13 @@ int	read_message(time_t delay, FdAry *fdp, int ro)
 #endif			
 		    }
 #if defined(USE_IAUTH)
+		/* what was queued for iauth since last time */
+		ad_pending = flush_iauth();
 		if (adfd >= 0)
 		    {
 			SET_READ_EVENT(adfd);
+			if (ad_pending)
+				SET_WRITE_EVENT(adfd);
 # if ! USE_POLL
 			if (adfd > highfd)
 				highfd = adfd;
@@ -2318,6 +2373,7 @@ int	read_message(time_t delay, FdAry *fdp, int ro)
 		
 		wait.tv_sec = MIN(delay2, delay);
 		wait.tv_usec = (delay == 0) ? 200000 : 0;
+		loop_wait(0);
 #if !defined(USE_POLL)
 		nfds = select(highfd + 1, (SELECT_FDSET_TYPE *)&read_set,
 			      (SELECT_FDSET_TYPE *)&write_set, 0, &wait);
@@ -2325,6 +2381,7 @@ int	read_message(time_t delay, FdAry *fdp, int ro)
 		nfds = poll( poll_fdarray, nbr_pfds,
 			     wait.tv_sec * 1000 + wait.tv_usec/1000 );
 #endif
+		loop_wait(1);
 		ret = nfds;
 		if (nfds == -1 && errno == EINTR)
 			return -1;
@@ -2367,6 +2424,20 @@ int	read_message(time_t delay, FdAry *fdp, int ro)
 		nfds--;
 		polludp();
 	    }
+#ifdef USE_METRICS
+	if (nfds > 0 &&
+# if ! USE_POLL
+	    metricsfd >= 0 &&
+# else
+	    (pfd = mt_pfd) &&
+# endif
+	    TST_READ_EVENT(metricsfd))
+	    {
+		CLR_READ_EVENT(metricsfd);
+		nfds--;
+		metrics_accept();
+	    }
+#endif
 #if defined(USE_IAUTH)
 	if (nfds > 0 &&
 # if ! USE_POLL
@@ -2380,6 +2451,20 @@ int	read_message(time_t delay, FdAry *fdp, int ro)
 		nfds--;
 		read_iauth();
 	    }
+	if (nfds > 0 && ad_pending &&
+# if ! USE_POLL
+	    adfd >= 0 &&
+# else
+	    (pfd = ad_pfd) &&
+# endif
+	    TST_WRITE_EVENT(adfd))
+	    {
+		CLR_WRITE_EVENT(adfd);
+# if ! USE_POLL
+		nfds--;
+# endif
+		(void)flush_iauth();
+	    }
 #endif
 
 #if !defined(USE_POLL)
@@ -2615,7 +2700,7 @@ int	connect_server(aConfItem *aconf, aClient *by, struct hostent *hp)
 		free_client(cptr);
 		return -1;
 	}
-	cptr->hostp = hp;
+	set_hostp(cptr, hp);
 	/*
 	 * Copy these in so we have something for error detection.
 	 */
@@ -3434,7 +3519,7 @@ static	void	do_dns_async(void)
 			    {
 				del_queries((char *)cptr);
 				ClearDNS(cptr);
-				cptr->hostp = hp;
+				set_hostp(cptr, hp);
 #if defined(USE_IAUTH)
 				if (hp)
 				    {
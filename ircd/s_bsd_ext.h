@@ -47,6 +47,7 @@ EXTERN void open_listener(aClient *cptr);
 EXTERN void reopen_listeners(void);
 EXTERN void activate_delayed_listeners(void);
 EXTERN void start_iauth (int);
+EXTERN void iauth_old_clients (void);
 EXTERN void init_sys(void);
 EXTERN void daemonize(void);
 EXTERN void write_pidfile(void);
@@ -0,0 +1,223 @@
+/************************************************************************
+ *   IRC - Internet Relay Chat, ircd/s_capture.c
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 1, or (at your option)
+ *   any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * Traffic capture: while SET CAPTURE is ON, whatever read_packet() reads
+ * from a local connection is written to IRCDCAPTURE_PATH with the time
+ * it was read, for the replay scenario of contrib/ircbench to play back
+ * against another server.  The file format is in s_capture_def.h.
+ *
+ * A connection gets its OPEN record with its first data: connections
+ * which were already there when the capture (or the current file) was
+ * started are marked as such.  Compressed links are not captured, a
+ * link is closed in the capture when it starts compressing.
+ *
+ * The file is rotated once it grows over CAPTURE_SIZE megabytes, the
+ * last CAPTURE_KEEP files are kept as IRCDCAPTURE_PATH.1 (the newest)
+ * and so on.  Writes go through stdio and are flushed once a second.
+ */
+
+#ifndef lint
+static const volatile char rcsid[] = "@(#)$Id$";
+#endif
+
+#include "os.h"
+#include "s_defines.h"
+#define S_CAPTURE_C
+#include "s_externs.h"
+#undef S_CAPTURE_C
+
+#ifdef USE_CAPTURE
+
+#define	CAPTURE_SKIP	((u_int) ~0)	/* connection not captured */
+
+static	FILE	*capfp = NULL;
+static	u_long	capsize;		/* bytes in the current file */
+static	u_int	capserial = 0;		/* last connection serial given */
+static	u_int	capid[MAXCONNECTIONS];	/* by fd, 0 until opened */
+static	time_t	capflushed;
+
+static	void	capture_record(u_int conn, int type, int kind, char *buf,
+			int len)
+{
+	aCapRec	rec;
+	struct	timeval	tv;
+
+	(void)gettimeofday(&tv, NULL);
+	rec.sec = htonl((u_int) tv.tv_sec);
+	rec.usec = htonl((u_int) tv.tv_usec);
+	rec.conn = htonl(conn);
+	rec.len = htons((u_short) len);
+	rec.type = (u_char) type;
+	rec.kind = (u_char) kind;
+	if (fwrite((char *)&rec, sizeof(rec), 1, capfp) != 1 ||
+	    (len > 0 && fwrite(buf, len, 1, capfp) != 1))
+	    {
+		sendto_flag(SCH_ERROR, "Capture stopped: write error (%s)",
+			    strerror(errno));
+		capture_stop();
+		return;
+	    }
+	capsize += sizeof(rec) + len;
+}
+
+/*
+** capture_open
+**	Starts a new capture file, existing ones are moved down the list.
+**	All connections will be opened again in it.
+*/
+static	int	capture_open(void)
+{
+	char	from[BUFSIZE], to[BUFSIZE];
+	aCapHead head;
+	int	i;
+
+	if (capfp)
+		(void)fclose(capfp);
+	for (i = CAPTURE_KEEP; i > 0; i--)
+	    {
+		if (i > 1)
+			sprintf(from, "%s.%d", IRCDCAPTURE_PATH, i - 1);
+		else
+			strcpy(from, IRCDCAPTURE_PATH);
+		sprintf(to, "%s.%d", IRCDCAPTURE_PATH, i);
+		(void)rename(from, to);
+	    }
+	if (!(capfp = fopen(IRCDCAPTURE_PATH, "w")))
+	    {
+		sendto_flag(SCH_ERROR, "Cannot open %s (%s)",
+			    IRCDCAPTURE_PATH, strerror(errno));
+		return -1;
+	    }
+	/* not for whatever RESTART execs */
+	(void)fcntl(fileno(capfp), F_SETFD, FD_CLOEXEC);
+	bzero((char *)&head, sizeof(head));
+	memcpy(head.magic, CAPTURE_MAGIC, sizeof(head.magic));
+	head.start = htonl((u_int) timeofday);
+	if (fwrite((char *)&head, sizeof(head), 1, capfp) != 1)
+	    {
+		(void)fclose(capfp);
+		capfp = NULL;
+		return -1;
+	    }
+	capsize = sizeof(head);
+	capflushed = timeofday;
+	bzero((char *)capid, sizeof(capid));
+	return 0;
+}
+
+/*
+** capture_start
+**	SET CAPTURE ON, returns -1 if the file cannot be written.
+*/
+int	capture_start(void)
+{
+	if (capture_open() == -1)
+		return -1;
+	iconf.capture = 1;
+	return 0;
+}
+
+/*
+** capture_stop
+**	SET CAPTURE OFF, or a write error.
+*/
+void	capture_stop(void)
+{
+	iconf.capture = 0;
+	if (capfp)
+		(void)fclose(capfp);
+	capfp = NULL;
+}
+
+/*
+** capture_read
+**	Called by read_packet() with what it has just read from cptr.
+*/
+void	capture_read(aClient *cptr, char *buf, int len)
+{
+	char	line[BUFSIZE];
+	int	kind;
+
+	if (!capfp || cptr->fd < 0 || cptr->fd >= MAXCONNECTIONS)
+		return;
+	if (capid[cptr->fd] == CAPTURE_SKIP)
+		return;
+	if (cptr->flags & FLAGS_ZIP)
+	    {
+		if (capid[cptr->fd])
+			capture_record(capid[cptr->fd], CAP_CLOSE, 0, NULL, 0);
+		capid[cptr->fd] = CAPTURE_SKIP;
+		return;
+	    }
+	if (capid[cptr->fd] == 0)
+	    {
+		if (IsServer(cptr))
+			kind = CAPK_SERVER;
+		else if (IsService(cptr))
+			kind = CAPK_SERVICE;
+		else if (IsPerson(cptr))
+			kind = CAPK_CLIENT;
+		else
+			kind = CAPK_NEW;
+		sprintf(line, "%s %u %s %s", cptr->sockhost,
+			(u_int) cptr->port, cptr->name[0] ? cptr->name : "*",
+			cptr->user ? cptr->user->username :
+			(cptr->username[0] ? cptr->username : "*"));
+		if (kind == CAPK_SERVER)
+			sprintf(line + strlen(line), " %s", cptr->serv->sid);
+		capid[cptr->fd] = ++capserial;
+		if (capserial == CAPTURE_SKIP)
+			capserial = 0;
+		capture_record(capid[cptr->fd], CAP_OPEN, kind, line,
+			       strlen(line));
+		if (!capfp)
+			return;
+	    }
+	capture_record(capid[cptr->fd], CAP_DATA, 0, buf, len);
+	if (capfp && capsize > (u_long) CAPTURE_SIZE * 1024 * 1024 &&
+	    capture_open() == -1)
+		capture_stop();
+}
+
+/*
+** capture_close
+**	Called by close_connection().
+*/
+void	capture_close(aClient *cptr)
+{
+	if (cptr->fd < 0 || cptr->fd >= MAXCONNECTIONS)
+		return;
+	if (capfp && capid[cptr->fd] && capid[cptr->fd] != CAPTURE_SKIP)
+		capture_record(capid[cptr->fd], CAP_CLOSE, 0, NULL, 0);
+	capid[cptr->fd] = 0;
+}
+
+/*
+** capture_flush
+**	Called from the main loop.
+*/
+void	capture_flush(void)
+{
+	if (capfp && timeofday != capflushed)
+	    {
+		(void)fflush(capfp);
+		capflushed = timeofday;
+	    }
+}
+#endif /* USE_CAPTURE */
@@ -0,0 +1,55 @@
+/************************************************************************
+ *   IRC - Internet Relay Chat, ircd/s_capture_def.h
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 1, or (at your option)
+ *   any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+** Traffic capture file, written by s_capture.c and read back by the
+** replay scenario of contrib/ircbench.
+**
+** The file starts with an aCapHead, then comes a record per event: an
+** aCapRec followed by len bytes of data.  Integers are in network order.
+*/
+#define	CAPTURE_MAGIC	"ircdcap1"
+
+typedef	struct	{
+	char	magic[8];	/* CAPTURE_MAGIC, not terminated */
+	u_int	start;		/* when the file was started */
+	u_int	unused;
+} aCapHead;
+
+typedef	struct	{
+	u_int	sec, usec;	/* when it happened */
+	u_int	conn;		/* connection serial, from 1 */
+	u_short	len;		/* of the data which follows */
+	u_char	type;		/* CAP_* */
+	u_char	kind;		/* CAP_OPEN: CAPK_* */
+} aCapRec;
+
+#define	CAP_OPEN	1	/* data: "ip port name user [sid]" */
+#define	CAP_DATA	2	/* data: what was read */
+#define	CAP_CLOSE	3	/* no data */
+
+/*
+** A connection is opened before its first data.  CAPK_NEW ones are taken
+** from their beginning, the others were already registered when the
+** capture (or the file) started.  The open data of CAPK_SERVER ones also
+** has their SID.
+*/
+#define	CAPK_NEW	'u'
+#define	CAPK_CLIENT	'c'
+#define	CAPK_SERVER	's'
+#define	CAPK_SERVICE	'v'
@@ -0,0 +1,37 @@
+/************************************************************************
+ *   IRC - Internet Relay Chat, ircd/s_capture_ext.h
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 1, or (at your option)
+ *   any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*  This file contains external definitions for global variables and functions
+    defined in ircd/s_capture.c.
+ */
+
+#ifdef USE_CAPTURE
+/*  External definitions for global functions.
+ */
+#ifndef S_CAPTURE_C
+#define EXTERN extern
+#else /* S_CAPTURE_C */
+#define EXTERN
+#endif /* S_CAPTURE_C */
+EXTERN int capture_start (void);
+EXTERN void capture_stop (void);
+EXTERN void capture_read (aClient *cptr, char *buf, int len);
+EXTERN void capture_close (aClient *cptr);
+EXTERN void capture_flush (void);
+#undef EXTERN
+#endif /* USE_CAPTURE */
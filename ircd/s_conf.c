@@ -64,10 +64,14 @@ static const volatile char rcsid[] = "@(#)$Id: s_conf.c,v 1.195 2010/08/11 17:16
 static	int	check_time_interval (char *, char *);
 #endif
 static	int	lookup_confhost (aConfItem *);
+#ifdef TKLINE
+static	void	tkline_journal (int, aConfItem *);
+static	void	tkline_journal_rewrite (void);
+static	int	tkline_replaying = 0;
+#endif
 
-#ifdef CONFIG_DIRECTIVE_INCLUDE
+/* also for the binary image shared with chkconf */
 #include "config_read.c"
-#endif
 
 aConfItem	*conf = NULL;
 aConfItem	*kconf = NULL;
@@ -819,7 +823,8 @@ int	attach_conf(aClient *cptr, aConfItem *aconf)
 #ifdef YLINE_LIMITS_IPHASH
 			for ((user = hash_find_ip(cptr->user->sip, NULL));
 			     user; user = user->iphnext)
-				if (!mycmp(cptr->user->sip, user->sip))
+				if (user->sip == cptr->user->sip ||
+				    !mycmp(cptr->user->sip, user->sip))
 #else
 			for ((user = hash_find_hostname(cptr->sockhost, NULL));
 			     user; user = user->hhnext)
@@ -884,6 +889,33 @@ int	attach_conf(aClient *cptr, aConfItem *aconf)
 	return 0;
 }
 
+/*
+** reattach_conf
+**	Attach aconf to a connection handed over by a live upgrade.  The
+**	limits were checked by the previous ircd, only the counts are
+**	rebuilt here.
+*/
+void	reattach_conf(aClient *cptr, aConfItem *aconf)
+{
+	Reg	Link	*lp;
+
+	if (is_attached(aconf, cptr))
+		return;
+#ifdef ENABLE_CIDR_LIMITS
+	if ((aconf->status & CONF_CLIENT) && Class(aconf))
+		(void)add_cidr_limit(cptr, aconf);
+#endif
+	lp = make_link();
+	istat.is_conflink++;
+	lp->next = cptr->confs;
+	lp->value.aconf = aconf;
+	cptr->confs = lp;
+	cptr->ping = get_client_ping(cptr);
+	aconf->clients++;
+	if (aconf->status & CONF_CLIENT_MASK)
+		ConfLinks(aconf)++;
+}
+
 
 aConfItem	*find_admin(void)
 {
@@ -1190,6 +1222,171 @@ aConfItem	*find_conf_entry(aConfItem *aconf, u_int mask)
 	return bconf;
 }
 
+/*
+** While rehashing, the previous items are kept in a hash by line type
+** and identity, and initconf() takes back those found unchanged: their
+** clients counts stay, and only what was really added or removed is
+** dealt with afterwards.
+*/
+#define	CONFDIFF_HASHSIZE	1024
+
+static	aConfItem	*confdiff[CONFDIFF_HASHSIZE];
+static	int	confdiffing = 0;
+static	struct
+{
+	int	kept, changed, added, removed;	/* all lines */
+	int	kadded, kremoved;		/* K: lines */
+	int	iadded, iremoved;		/* I: lines */
+} cdstat;
+
+static	u_int	confdiff_hash(aConfItem *aconf)
+{
+	u_int	h = (aconf->status & ~CONF_ILLEGAL) + aconf->port;
+	char	*fields[3], *s;
+	int	i;
+
+	fields[0] = aconf->host;
+	fields[1] = aconf->passwd;
+	fields[2] = aconf->name;
+	/* case insensitive, like find_conf_entry() */
+	for (i = 0; i < 3; i++)
+		for (s = fields[i]; s && *s; s++)
+			h = (h << 5) + h + (u_char)tolower(*s);
+	return h % CONFDIFF_HASHSIZE;
+}
+
+static	int	confdiff_strcmp(char *a, char *b)
+{
+	if (BadPtr(a) || BadPtr(b))
+		return BadPtr(a) != BadPtr(b);
+	return mycmp(a, b);
+}
+
+/*
+ * confdiff_find
+ *
+ * - takes back the previous item identical to aconf, if any.  For I: and
+ *   P: lines, only the fields find_conf_entry() used are compared.
+ */
+static	aConfItem	*confdiff_find(aConfItem *aconf, int full)
+{
+	aConfItem **last, *bconf;
+
+	if (!confdiffing)
+		return NULL;
+	for (last = &confdiff[confdiff_hash(aconf)]; (bconf = *last);
+	     last = &bconf->next)
+	    {
+		if ((bconf->status & ~CONF_ILLEGAL) != aconf->status ||
+		    bconf->port != aconf->port ||
+		    confdiff_strcmp(bconf->host, aconf->host) ||
+		    confdiff_strcmp(bconf->passwd, aconf->passwd) ||
+		    confdiff_strcmp(bconf->name, aconf->name))
+			continue;
+		/* K: lines only have CFLAG_KNEW in flags */
+		if (full && (bconf->class != aconf->class ||
+		    (!(bconf->status & (CONF_KILL|CONF_OTHERKILL)) &&
+		     bconf->flags != aconf->flags) ||
+		    confdiff_strcmp(bconf->name2, aconf->name2) ||
+#ifdef XLINE
+		    confdiff_strcmp(bconf->name3, aconf->name3) ||
+#endif
+		    confdiff_strcmp(bconf->source_ip, aconf->source_ip) ||
+		    (!bconf->ping != !aconf->ping) || (bconf->ping &&
+		     bconf->ping->port != aconf->ping->port)))
+			continue;
+		*last = bconf->next;
+		bconf->next = NULL;
+		bconf->status &= ~CONF_ILLEGAL;
+		return bconf;
+	    }
+	return NULL;
+}
+
+/*
+ * confdiff_start
+ *
+ * - moves the current configuration aside before it is read again.
+ */
+static	void	confdiff_start(void)
+{
+	aConfItem *aconf;
+	u_int	h;
+
+	bzero((char *)&cdstat, sizeof(cdstat));
+	while ((aconf = conf) || (aconf = kconf))
+	    {
+		if (aconf == conf)
+			conf = aconf->next;
+		else
+			kconf = aconf->next;
+		h = confdiff_hash(aconf);
+		aconf->next = confdiff[h];
+		confdiff[h] = aconf;
+	    }
+	confdiffing = 1;
+}
+
+/*
+ * confdiff_end
+ *
+ * - deals with what is left of the previous configuration.
+ */
+static	void	confdiff_end(void)
+{
+	aConfItem *aconf;
+	int	i;
+
+	confdiffing = 0;
+	for (i = 0; i < CONFDIFF_HASHSIZE; i++)
+		while ((aconf = confdiff[i]))
+		    {
+			confdiff[i] = aconf->next;
+			aconf->next = NULL;
+			/* M: line is always read again */
+			if (!(aconf->status & (CONF_ILLEGAL|CONF_ME)))
+			    {
+				cdstat.removed++;
+				if (aconf->status & (CONF_KILL|CONF_OTHERKILL))
+					cdstat.kremoved++;
+				if (aconf->status & CONF_CLIENT)
+					cdstat.iremoved++;
+			    }
+			if (aconf->clients ||
+			    aconf->status & CONF_LISTEN_PORT)
+			    {
+				/*
+				** Configuration entry is still in use by some
+				** local clients, cannot delete it--mark it so
+				** that it will be deleted when the last client
+				** exits...
+				*/
+				aconf->status |= CONF_ILLEGAL;
+				if (aconf->status &
+				    (CONF_LISTEN_PORT|CONF_CLIENT))
+				    {
+					aconf->next = conf;
+					conf = aconf;
+				    }
+			    }
+			else
+				free_conf(aconf);
+		    }
+}
+
+/* milliseconds since *tv, which is updated */
+static	int	rehash_lap(struct timeval *tv)
+{
+	struct	timeval	now;
+	int	ms;
+
+	(void)gettimeofday(&now, NULL);
+	ms = (now.tv_sec - tv->tv_sec) * 1000 +
+		(now.tv_usec - tv->tv_usec) / 1000;
+	*tv = now;
+	return ms;
+}
+
 /*
  * rehash
  *
@@ -1201,9 +1398,8 @@ int	rehash(aClient *cptr, aClient *sptr, int sig)
 {
 	Reg	aConfItem **tmp = &conf, *tmp2 = NULL;
 	Reg	aClass	*cltmp;
-	Reg	aClient	*acptr;
-	Reg	int	i;
-	int	ret = 0;
+	int	ret = 0, tparse, tdiff, tlisten;
+	struct	timeval	tv;
 
 	if (sig == 1)
 	    {
@@ -1218,48 +1414,12 @@ int	rehash(aClient *cptr, aClient *sptr, int sig)
 #endif
 	    }
 
-	for (i = 0; i <= highest_fd; i++)
-		if ((acptr = local[i]) && !IsMe(acptr))
-		    {
-			/*
-			 * Nullify any references from client structures to
-			 * this host structure which is about to be freed.
-			 * Could always keep reference counts instead of
-			 * this....-avalon
-			 */
-			acptr->hostp = NULL;
-		    }
-
-	while ((tmp2 = *tmp))
-		if (tmp2->clients || tmp2->status & CONF_LISTEN_PORT)
-		    {
-			/*
-			** Configuration entry is still in use by some
-			** local clients, cannot delete it--mark it so
-			** that it will be deleted when the last client
-			** exits...
-			*/
-			if (!(tmp2->status & (CONF_LISTEN_PORT|CONF_CLIENT)))
-			    {
-				*tmp = tmp2->next;
-				tmp2->next = NULL;
-			    }
-			else
-				tmp = &tmp2->next;
-			tmp2->status |= CONF_ILLEGAL;
-		    }
-		else
-		    {
-			*tmp = tmp2->next;
-			free_conf(tmp2);
-	    	    }
-
-	tmp = &kconf;
-	while ((tmp2 = *tmp))
-	    {
-		*tmp = tmp2->next;
-		free_conf(tmp2);
-	    }
+	(void)gettimeofday(&tv, NULL);
+	/*
+	 * The current items are not deleted yet, initconf() takes back
+	 * those which did not change.
+	 */
+	confdiff_start();
 
 	/*
 	 * We don't delete the class table, rather mark all entries
@@ -1281,6 +1441,9 @@ int	rehash(aClient *cptr, aClient *sptr, int sig)
 		tkline_expire(1);
 #endif
 	(void) initconf(0);
+	tparse = rehash_lap(&tv);
+	confdiff_end();
+	tdiff = rehash_lap(&tv);
 	close_listeners();
 	reopen_listeners();
 
@@ -1296,16 +1459,33 @@ int	rehash(aClient *cptr, aClient *sptr, int sig)
 			tmp2->next = NULL;
 			free_conf(tmp2);
 		}
+	tlisten = rehash_lap(&tv);
 	
 	read_motd(IRCDMOTD_PATH);
-	if (rehashed == 1)
-	{
-		/* queue another rehash for later */
-		rehashed = 2;
-	}
-	else if (rehashed == 0)
+	sendto_flag(SCH_NOTICE, "Rehash: %d lines kept, %d changed, "
+		    "%d added, %d removed (K: +%d -%d, I: +%d -%d); "
+		    "parse %dms diff %dms listeners %dms",
+		    cdstat.kept, cdstat.changed, cdstat.added, cdstat.removed,
+		    cdstat.kadded, cdstat.kremoved, cdstat.iadded,
+		    cdstat.iremoved, tparse, tdiff, tlisten);
+	/*
+	** Only new K: lines can hit anyone, they are marked for
+	** delayed_kills() which checks clients against them.
+	** Clients of a changed I: or Y: line are not checked again:
+	** they keep the flags (+r, kline exemption) and limits they
+	** were given when they registered, until they reconnect.
+	*/
+	if (cdstat.kadded > 0)
 	{
-		rehashed = 1;
+		if (rehashed == 1)
+		{
+			/* queue another rehash for later */
+			rehashed = 2;
+		}
+		else if (rehashed == 0)
+		{
+			rehashed = 1;
+		}
 	}
 	mysrand(timeofday);
 	return ret;
@@ -1465,6 +1645,83 @@ char	*ipv6_convert(char *orig)
 }
 #endif
 
+/*
+** confimg_open()
+**    Maps the binary image written by chkconf -b, if there is one and
+**    the files it was made from have not changed since.
+**
+**    returns NULL if the text is to be read instead
+*/
+static	aConfImgHead	*confimg_open(void)
+{
+#ifdef HAVE_SYS_MMAN_H
+	struct	stat	st;
+	aConfImgHead	*img;
+	aConfImgFile	*file;
+	aConfImgRec	*rec;
+	char	*strs;
+	u_int	i, j, size, sum, strsize;
+	int	fd;
+
+	if ((fd = open(confimg_path(), O_RDONLY)) == -1)
+		return NULL;
+	if (fstat(fd, &st) == -1 || st.st_size < sizeof(aConfImgHead))
+	    {
+		(void)close(fd);
+		return NULL;
+	    }
+	/* private, as some fields get modified while parsed */
+	img = (aConfImgHead *)mmap(NULL, st.st_size, PROT_READ|PROT_WRITE,
+				   MAP_PRIVATE, fd, 0);
+	(void)close(fd);
+	if (img == (aConfImgHead *)MAP_FAILED)
+		return NULL;
+	if (memcmp(img->magic, CONFIMG_MAGIC, 8) || img->size != st.st_size
+	    || img->nfiles > img->size / sizeof(aConfImgFile)
+	    || img->nrecs > img->size / sizeof(aConfImgRec)
+	    || CONFIMG_STRS(img) >= (char *)img + img->size
+	    || ((char *)img)[img->size - 1] != '\0'
+	    || config_sum(CONFIMG_SEED, (char *)(img + 1),
+			  img->size - sizeof(*img)) != img->sum)
+	    {
+		sendto_flag(SCH_ERROR, "Ignoring corrupted %s",
+			    confimg_path());
+		(void)munmap((char *)img, st.st_size);
+		return NULL;
+	    }
+	strs = CONFIMG_STRS(img);
+	strsize = (char *)img + img->size - strs;
+	for (i = 0, rec = CONFIMG_RECS(img); i < img->nrecs; i++, rec++)
+	    {
+		if (rec->nfields == 0 || rec->nfields > CONFIMG_FIELDS)
+			break;
+		for (j = 0; j < rec->nfields; j++)
+			if (rec->field[j] >= strsize)
+				break;
+		if (j < rec->nfields)
+			break;
+	    }
+	for (j = 0, file = CONFIMG_FILES(img); j < img->nfiles; j++, file++)
+		if (file->name >= strsize ||
+		    config_filesum(strs + file->name, &size, &sum) == -1 ||
+		    size != file->size || sum != file->sum)
+			break;
+	if (i < img->nrecs || j < img->nfiles || img->nfiles == 0)
+	    {
+		sendto_flag(SCH_NOTICE, "%s is not up to date, reading %s",
+			    confimg_path(), configfile);
+		(void)munmap((char *)img, img->size);
+		return NULL;
+	    }
+	return img;
+#else
+	return NULL;
+#endif
+}
+
+/* next field of the current line, NULL once they are all used */
+#define	NEXTFIELD	((fi < nfield) ? field[fi++] : NULL)
+
 /*
 ** initconf() 
 **    Read configuration file.
@@ -1477,27 +1734,35 @@ char	*ipv6_convert(char *orig)
 
 int 	initconf(int opt)
 {
-	static	char	quotes[9][2] = {{'b', '\b'}, {'f', '\f'}, {'n', '\n'},
-					{'r', '\r'}, {'t', '\t'}, {'v', '\v'},
-					{'\\', '\\'}, { 0, 0}};
-	Reg	char	*tmp, *s;
-	int	fd, i;
+	Reg	char	*tmp;
+	int	fd = -1, i;
 	char	*tmp2 = NULL, *tmp3 = NULL, *tmp4 = NULL;
 #ifdef ENABLE_CIDR_LIMITS
 	char	*tmp5 = NULL;
 #endif
-	int	ccount = 0, ncount = 0;
+	int	ccount = 0, ncount = 0, rcount = 0;
 	aConfItem *aconf = NULL;
+	aConfImgHead	*img;
+	aConfImgRec	*rec = NULL;
+	char	*field[CONFIMG_FIELDS], *strs = NULL;
+	int	nfield, fi;
+	u_int	nrec = 0;
 #if defined(CONFIG_DIRECTIVE_INCLUDE)
 	char	*line;
-	aConfig	*ConfigTop, *p;
-	FILE	*fdn;
+	aConfig	*ConfigTop = NULL, *p = NULL;
+	FILE	*fdn = NULL;
 #else
 	char	line[512], c[80];
 #endif
 
 	Debug((DEBUG_DEBUG, "initconf(): ircd.conf = %s", configfile));
-	if ((fd = openconf()) == -1)
+	if ((img = confimg_open()))
+	    {
+		Debug((DEBUG_DEBUG, "initconf(): using %s", confimg_path()));
+		rec = CONFIMG_RECS(img);
+		strs = CONFIMG_STRS(img);
+	    }
+	else if ((fd = openconf()) == -1)
 	    {
 #if defined(M4_PREPROC) && !defined(USE_IAUTH)
 		(void)wait(0);
@@ -1505,73 +1770,65 @@ int 	initconf(int opt)
 		return -1;
 	    }
 #if defined(CONFIG_DIRECTIVE_INCLUDE)
-	fdn = fdopen(fd, "r");
-	if (fdn == NULL)
-	{
-		if (serverbooting)
+	else
+	    {
+		fdn = fdopen(fd, "r");
+		if (fdn == NULL)
 		{
-			fprintf(stderr,
-			"Fatal Error: Can not open configuration file %s (%s)\n",
-			configfile,strerror(errno));
+			if (serverbooting)
+			{
+				fprintf(stderr,
+				"Fatal Error: Can not open configuration file "
+				"%s (%s)\n", configfile, strerror(errno));
+			}
+			return -1;
 		}
-		return -1;
-	}
-	ConfigTop = config_read(fdn, 0, new_config_file(configfile, NULL, 0));
-	for(p = ConfigTop; p; p = p->next)
+		p = ConfigTop = config_read(fdn, 0,
+			new_config_file(configfile, NULL, 0));
+	    }
 #else
-	(void)dgets(-1, NULL, 0); /* make sure buffer is at empty pos */
-	while ((i = dgets(fd, line, sizeof(line) - 1)) > 0)
+	else
+		(void)dgets(-1, NULL, 0); /* make sure buffer is at empty pos */
 #endif
+	for (;;)
 	{
+		if (img)
+		    {
+			/* the lines are already split in fields */
+			if (nrec >= img->nrecs)
+				break;
+			for (nfield = 0; nfield < rec[nrec].nfields; nfield++)
+				field[nfield] = strs + rec[nrec].field[nfield];
+			nrec++;
+		    }
+		else
+		    {
 #if defined(CONFIG_DIRECTIVE_INCLUDE)
-		line = p->line;
+			if (!p)
+				break;
+			line = p->line;
+			p = p->next;
 #else
-		line[i] = '\0';
-		if ((tmp = (char *)index(line, '\n')))
-			*tmp = 0;
-		else while(dgets(fd, c, sizeof(c) - 1) > 0)
-			if ((tmp = (char *)index(c, '\n')))
-			    {
-				*tmp = 0;
+			if ((i = dgets(fd, line, sizeof(line) - 1)) <= 0)
 				break;
-			    }
-#endif
-		/*
-		 * Do quoting of characters and # detection.
-		 */
-		for (tmp = line; *tmp; tmp++)
-		    {
-			if (*tmp == '\\')
-			    {
-				for (i = 0; quotes[i][0]; i++)
-					if (quotes[i][0] == *(tmp+1))
-					    {
-						*tmp = quotes[i][1];
-						break;
-					    }
-				if (!quotes[i][0])
-					*tmp = *(tmp+1);
-				if (!*(tmp+1))
+			line[i] = '\0';
+			if ((tmp = (char *)index(line, '\n')))
+				*tmp = 0;
+			else while(dgets(fd, c, sizeof(c) - 1) > 0)
+				if ((tmp = (char *)index(c, '\n')))
+				    {
+					*tmp = 0;
 					break;
-				else
-					for (s = tmp; (*s = *(s+1)); s++)
-						;
-			    }
-			else if (*tmp == '#')
-			    {
-				*tmp = '\0';
-				break;	/* Ignore the rest of the line */
-			    }
+				    }
+#endif
+			/* Could we test if it's conf line at all?	-Vesa */
+			if ((nfield = config_split(line, field,
+						   CONFIMG_FIELDS)) == -1)
+				Debug((DEBUG_ERROR, "Bad config line: %s",
+				       line));
+			if (nfield <= 0)
+				continue;
 		    }
-		if (!*line || line[0] == '#' || line[0] == '\n' ||
-		    line[0] == ' ' || line[0] == '\t')
-			continue;
-		/* Could we test if it's conf line at all?	-Vesa */
-		if (line[1] != IRCDCONF_DELIMITER)
-		    {
-                        Debug((DEBUG_ERROR, "Bad config line: %s", line));
-                        continue;
-                    }
 		if (aconf)
 			free_conf(aconf);
 		aconf = make_conf();
@@ -1582,9 +1839,8 @@ int 	initconf(int opt)
 #ifdef ENABLE_CIDR_LIMITS
 		tmp5 = NULL;
 #endif
-		tmp = getfield(line);
-		if (!tmp)
-			continue;
+		fi = 0;
+		tmp = NEXTFIELD;
 		switch (*tmp)
 		{
 			case 'A': /* Name, e-mail address of administrator */
@@ -1665,13 +1921,17 @@ int 	initconf(int opt)
 			case 'y':
 			        aconf->status = CONF_CLASS;
 		        	break;
+			case 'R': /* resolver cache tuning */
+			case 'r':
+				aconf->status = CONF_RESOLVER;
+				break;
 #ifdef XLINE
 			case 'X':
 				aconf->status = CONF_XLINE;
 				break;
 #endif
 		    default:
-			Debug((DEBUG_ERROR, "Error in config file: %s", line));
+			Debug((DEBUG_ERROR, "Error in config file: %s", tmp));
 			break;
 		    }
 		if (IsIllegal(aconf))
@@ -1679,7 +1939,7 @@ int 	initconf(int opt)
 
 		do
 		{
-			if ((tmp = getfield(NULL)) == NULL)
+			if ((tmp = NEXTFIELD) == NULL)
 				break;
 #ifdef	INET6
 			if (aconf->status & 
@@ -1694,22 +1954,22 @@ int 	initconf(int opt)
 #else
 			DupString(aconf->host, tmp);
 #endif
-			if ((tmp = getfield(NULL)) == NULL)
+			if ((tmp = NEXTFIELD) == NULL)
 				break;
 			DupString(aconf->passwd, tmp);
-			if ((tmp = getfield(NULL)) == NULL)
+			if ((tmp = NEXTFIELD) == NULL)
 				break;
 			DupString(aconf->name, tmp);
-			if ((tmp = getfield(NULL)) == NULL)
+			if ((tmp = NEXTFIELD) == NULL)
 				break;
 #ifdef XLINE
 			if (aconf->status == CONF_XLINE)
 			{
 				DupString(aconf->name2, tmp);
-				if ((tmp = getfield(NULL)) == NULL)
+				if ((tmp = NEXTFIELD) == NULL)
 					break;
 				DupString(aconf->name3, tmp);
-				if ((tmp = getfield(NULL)) == NULL)
+				if ((tmp = NEXTFIELD) == NULL)
 					break;
 				DupString(aconf->source_ip, tmp);
 				break;
@@ -1723,17 +1983,17 @@ int 	initconf(int opt)
 				DupString(tmp2, tmp);
 			if (aconf->status == CONF_ZCONNECT_SERVER)
 				DupString(tmp2, tmp);
-			if ((tmp = getfield(NULL)) == NULL)
+			if ((tmp = NEXTFIELD) == NULL)
 				break;
 			Class(aconf) = find_class(atoi(tmp));
 			/* used in Y: local limits and I: and P: flags */
-			if ((tmp3 = getfield(NULL)) == NULL)
+			if ((tmp3 = NEXTFIELD) == NULL)
 				break;
 			/* used in Y: global limits */
-			if((tmp4 = getfield(NULL)) == NULL)
+			if((tmp4 = NEXTFIELD) == NULL)
 				break;
 #ifdef ENABLE_CIDR_LIMITS
-			tmp5 = getfield(NULL);
+			tmp5 = NEXTFIELD;
 #endif
 		} while (0); /* to use break without compiler warnings */
 		istat.is_confmem += aconf->host ? strlen(aconf->host)+1 : 0;
@@ -1776,6 +2036,18 @@ int 	initconf(int opt)
 			continue;
 		}
 		/*
+		** Resolver lines are not kept either.
+		*/
+		if (aconf->status & CONF_RESOLVER)
+		{
+			resolver_conf(BadPtr(aconf->host) ? -1 :
+				atoi(aconf->host), BadPtr(aconf->passwd) ?
+				-1 : atoi(aconf->passwd), BadPtr(aconf->name) ?
+				-1 : atoi(aconf->name), aconf->port);
+			rcount++;
+			continue;
+		}
+		/*
 		** associate each conf line with a class by using a pointer
 		** to the correct class record. -avalon
 		*/
@@ -1801,17 +2073,16 @@ int 	initconf(int opt)
 
 			/* trying to find exact conf line in already existing
 			 * conf, so we don't delete old one, just update it */
-			if (
-#ifdef FASTER_ILINE_REHASH
-				(aconf->status & CONF_LISTEN_PORT) &&
-#endif
-				(bconf = find_conf_entry(aconf, aconf->status)))
+			if ((bconf = confdiff_find(aconf, 0)))
 			{
-				/* we remove bconf (already existing) from conf
-				 * so that we can add it back uniformly at the
-				 * end of while(dgets) loop. --B. */
-				delist_conf(bconf);
-				bconf->status &= ~CONF_ILLEGAL;
+				/* bconf (already existing) is not in conf,
+				 * it's added back uniformly at the end of
+				 * while(dgets) loop. --B. */
+				if (bconf->flags != aconf->flags ||
+				    bconf->class != aconf->class)
+					cdstat.changed++;
+				else
+					cdstat.kept++;
 				/* aconf is a new item, it can contain +r flag
 				 * (from lowercase i:lines). In any case we
 				 * don't want old flags to remain. --B. */
@@ -1830,6 +2101,12 @@ int 	initconf(int opt)
 			}
 			else	/* no such conf line was found */
 			{
+				if (confdiffing)
+				{
+					cdstat.added++;
+					if (aconf->status == CONF_CLIENT)
+						cdstat.iadded++;
+				}
 				if (aconf->host &&
 					aconf->status == CONF_LISTEN_PORT)
 				{
@@ -1878,13 +2155,9 @@ int 	initconf(int opt)
 			if (aconf->flags & ACL_LOCOP)
 				aconf->flags &= ~ACL_ALL_REMOTE;
 		}
-		if (aconf->status & CONF_SERVER_MASK)
-		    {
-			if (BadPtr(aconf->passwd))
-				continue;
-			else if (!(opt & BOOT_QUICK))
-				(void)lookup_confhost(aconf);
-		    }
+		if ((aconf->status & CONF_SERVER_MASK) &&
+		    BadPtr(aconf->passwd))
+			continue;
 		if (aconf->status & (CONF_CONNECT_SERVER | CONF_ZCONNECT_SERVER))
 		    {
 			aconf->ping = (aCPing *)MyMalloc(sizeof(aCPing));
@@ -1951,6 +2224,35 @@ int 	initconf(int opt)
 		      aconf->name, aconf->port,
 		      aconf->class ? ConfClass(aconf) : 0));
 
+		/* I: and P: lines were looked for above */
+		if (confdiffing &&
+		    !(aconf->status & (CONF_ME|CONF_LISTEN_PORT|CONF_CLIENT)))
+		    {
+			aConfItem *bconf;
+
+			if ((bconf = confdiff_find(aconf, 1)))
+			    {
+				free_conf(aconf);
+				aconf = bconf;
+				cdstat.kept++;
+			    }
+			else
+			    {
+				cdstat.added++;
+				if (aconf->status & (CONF_KILL|CONF_OTHERKILL))
+				    {
+					aconf->flags |= CFLAG_KNEW;
+					cdstat.kadded++;
+				    }
+			    }
+		    }
+		/*
+		** Looked up after confdiff_find(), a kept C:/N: line is
+		** resolved again like a new one: its host may have moved.
+		*/
+		if ((aconf->status & CONF_SERVER_MASK) && !(opt & BOOT_QUICK))
+			(void)lookup_confhost(aconf);
+
 		if (aconf->status & (CONF_KILL|CONF_OTHERKILL))
 		    {
 			aconf->next = kconf;
@@ -1963,21 +2265,28 @@ int 	initconf(int opt)
 		    }
 		aconf = NULL;
 	}
-#if defined(CONFIG_DIRECTIVE_INCLUDE)
-	config_free(ConfigTop);
-#endif
 	if (aconf)
 		free_conf(aconf);
-	(void)dgets(-1, NULL, 0); /* make sure buffer is at empty pos */
+	if (img)
+		(void)munmap((char *)img, img->size);
+	else
+	    {
+#if defined(CONFIG_DIRECTIVE_INCLUDE)
+		config_free(ConfigTop);
+#endif
+		(void)dgets(-1, NULL, 0); /* make sure buffer is at empty pos */
 #if defined(CONFIG_DIRECTIVE_INCLUDE)
-	(void)fclose(fdn);
+		(void)fclose(fdn);
 #else
-	(void)close(fd);
+		(void)close(fd);
 #endif
 #if defined(M4_PREPROC) && !defined(USE_IAUTH)
-	(void)wait(0);
+		(void)wait(0);
 #endif
+	    }
 	check_class();
+	if (!rcount)
+		resolver_conf(-1, -1, -1, -1);
 	nextping = nextconnect = timeofday;
 	return 0;
 }
@@ -2049,7 +2358,13 @@ badlookup:
 	return -1;
 }
 
-int	find_kill(aClient *cptr, int timedklines, char **comment)
+/*
+ * find_kill
+ *
+ * - which is 0 for all K: lines, 1 for the timed ones (check_pings()),
+ *   2 for those added by the last rehash (delayed_kills()).
+ */
+int	find_kill(aClient *cptr, int which, char **comment)
 {
 #ifdef TIMEDKLINES
 	static char	reply[256];
@@ -2097,6 +2412,11 @@ int	find_kill(aClient *cptr, int timedklines, char **comment)
 #ifdef TIMEDKLINES
 	*reply = '\0';
 #endif
+#ifdef TKLINE
+	/* rehash does not touch tklines */
+	if (which == 2)
+		tklines = 0;
+#endif
 
 findkline:
 	tmp = 
@@ -2107,9 +2427,12 @@ findkline:
 	for (; tmp; tmp = tmp->next)
 	{
 #ifdef TIMEDKLINES
-		if (timedklines && (BadPtr(tmp->passwd) || !isdigit(*tmp->passwd)))
+		if (which == 1 &&
+		    (BadPtr(tmp->passwd) || !isdigit(*tmp->passwd)))
 			continue;
 #endif
+		if (which == 2 && !(tmp->flags & CFLAG_KNEW))
+			continue;
 		if (!(tmp->status & (
 #ifdef TKLINE
 			tklines ? (CONF_TKILL | CONF_TOTHERKILL) :
@@ -2529,6 +2852,10 @@ void do_kline(int tkline, char *who, time_t time, char *user, char *host, char *
 			0==strcasecmp(aconf->name, user))
 		{
 			aconf->hold = timeofday + time;
+#ifdef TKLINE
+			if (tkline)
+				tkline_journal('+', aconf);
+#endif
 			break;
 		}
 	}
@@ -2555,6 +2882,9 @@ void do_kline(int tkline, char *who, time_t time, char *user, char *host, char *
 				aconf->next = tkconf;
 			}
 			tkconf = aconf;
+#ifdef TKLINE
+			tkline_journal('+', aconf);
+#endif
 			sendto_flag(SCH_TKILL, "TKLINE %s@%s (%u) by %s :%s",
 				aconf->name, aconf->host, time, who, reason);
 		}
@@ -2861,6 +3191,7 @@ int	m_untkline(aClient *cptr, aClient *sptr, int parc, char **parv)
 				tkconf = tmp->next;
 			else
 				prev->next = tmp->next;
+			tkline_journal('-', tmp);
 			free_conf(tmp);
 			deleted = 1;
 			break;
@@ -2880,6 +3211,7 @@ time_t	tkline_expire(int all)
 {
 	aConfItem	*tmp = NULL, *tmp2 = tkconf, *prev = tkconf;
 	time_t	min = 0;
+	int	expired = 0;
 	
 	while ((tmp = tmp2))
 	{
@@ -2891,6 +3223,7 @@ time_t	tkline_expire(int all)
 			else
 				prev->next = tmp->next;
 			free_conf(tmp);
+			expired++;
 			continue;
 		}
 		if (min == 0 || tmp->hold < min)
@@ -2899,8 +3232,201 @@ time_t	tkline_expire(int all)
 		}
 		prev = tmp;
 	}
+	/* keep the journal from growing forever */
+	if (expired)
+		tkline_journal_rewrite();
 	if (min && min < nexttkexpire + 60)
 		min = nexttkexpire + 60;
 	return min;
 }
+
+/*
+** The temporary K-lines journal (TKLINE_PATH) keeps tkconf over a
+** restart.  Every change is appended to it as a line of its own:
+**	+<hold> <user> <host> <reason>
+**	-<user> <host>
+** (user starts with '=' for CONF_TOTHERKILL), and the file is written
+** over from tkconf whenever some of them expire.
+*/
+static	void	tkline_journal(int what, aConfItem *aconf)
+{
+	char	buf[2*BUFSIZE];
+	int	fd, len;
+
+	if (tkline_replaying)
+		return;
+	if (what == '+')
+		len = snprintf(buf, sizeof(buf), "+%ld %s%s %s %s\n",
+			(long) aconf->hold,
+			aconf->status == CONF_TOTHERKILL ? "=" : "",
+			aconf->name, aconf->host, aconf->passwd);
+	else
+		len = snprintf(buf, sizeof(buf), "-%s %s\n",
+			aconf->name, aconf->host);
+	if (len >= (int) sizeof(buf))
+	{
+		len = sizeof(buf) - 1;
+		buf[len - 1] = '\n';
+	}
+	if ((fd = open(TKLINE_PATH, O_WRONLY|O_APPEND|O_CREAT, 0600)) < 0)
+	{
+		sendto_flag(SCH_ERROR, "Cannot open %s: %s", TKLINE_PATH,
+			strerror(errno));
+		return;
+	}
+	if (write(fd, buf, len) != len)
+		sendto_flag(SCH_ERROR, "Error writing to %s", TKLINE_PATH);
+	close(fd);
+}
+
+static	void	tkline_journal_rewrite(void)
+{
+	aConfItem *aconf;
+	FILE	*fp;
+
+	if (!(fp = fopen(TKLINE_PATH ".tmp", "w")))
+	{
+		sendto_flag(SCH_ERROR, "Cannot open %s.tmp: %s", TKLINE_PATH,
+			strerror(errno));
+		return;
+	}
+	for (aconf = tkconf; aconf; aconf = aconf->next)
+		fprintf(fp, "+%ld %s%s %s %s\n", (long) aconf->hold,
+			aconf->status == CONF_TOTHERKILL ? "=" : "",
+			aconf->name, aconf->host, aconf->passwd);
+	if (fclose(fp) == EOF || rename(TKLINE_PATH ".tmp", TKLINE_PATH))
+	{
+		sendto_flag(SCH_ERROR, "Error writing to %s", TKLINE_PATH);
+		(void)unlink(TKLINE_PATH ".tmp");
+	}
+}
+
+/*
+** tkline_replay
+**	Reads the journal back into tkconf at boot (there is no client
+**	to check against yet), then compacts it.
+*/
+void	tkline_replay(void)
+{
+	aConfItem *aconf, **prev;
+	FILE	*fp;
+	char	line[2*BUFSIZE], *user, *host, *reason, *s;
+	time_t	hold;
+	int	n = 0;
+
+	if (!(fp = fopen(TKLINE_PATH, "r")))
+		return;
+	tkline_replaying = 1;
+	while (fgets(line, sizeof(line), fp))
+	{
+		if ((s = index(line, '\n')))
+			*s = '\0';
+		hold = 0;
+		if (*line == '+')
+		{
+			hold = strtol(line + 1, &s, 10);
+			if (*s++ != ' ')
+				continue;
+			user = s;
+		}
+		else if (*line == '-')
+			user = line + 1;
+		else
+			continue;
+		if (!(host = index(user, ' ')))
+			continue;
+		*host++ = '\0';
+		if ((reason = index(host, ' ')))
+			*reason++ = '\0';
+		if (*user == '\0' || *host == '\0')
+			continue;
+		if (*line == '+')
+		{
+			if (hold <= timeofday || !reason)
+				continue;
+			do_kline(1, ME, hold - timeofday,
+				*user == '=' ? user + 1 : user, host, reason,
+				*user == '=' ? CONF_TOTHERKILL : CONF_TKILL);
+			n++;
+			continue;
+		}
+		if (*user == '=')
+			user++;
+		for (prev = &tkconf; (aconf = *prev); prev = &aconf->next)
+			if (!strcasecmp(aconf->host, host) &&
+			    !strcasecmp(aconf->name, user))
+			{
+				*prev = aconf->next;
+				free_conf(aconf);
+				break;
+			}
+	}
+	fclose(fp);
+	tkline_replaying = 0;
+	tkline_journal_rewrite();
+	Debug((DEBUG_NOTICE, "%d temporary K-lines replayed from %s",
+		n, TKLINE_PATH));
+}
 #endif /* TKLINE */
+
+/*
+** save_tklines / load_tklines
+**	Carry the temporary K-lines over a live upgrade.  The count is
+**	always there, so that the snapshot doesn't depend on TKLINE.
+*/
+void	save_tklines(void)
+{
+#ifdef TKLINE
+	aConfItem *aconf;
+	int	n = 0;
+
+	for (aconf = tkconf; aconf; aconf = aconf->next)
+		n++;
+	upgrade_put_int(n);
+	for (aconf = tkconf; aconf; aconf = aconf->next)
+	{
+		upgrade_put_int(aconf->status);
+		upgrade_put_int(aconf->hold);
+		upgrade_put_str(aconf->name);
+		upgrade_put_str(aconf->host);
+		upgrade_put_str(aconf->passwd);
+	}
+#else
+	upgrade_put_int(0);
+#endif
+}
+
+void	load_tklines(void)
+{
+	aConfItem *aconf;
+#ifdef TKLINE
+	aConfItem **last;
+#endif
+	int	n;
+
+	n = upgrade_get_int();
+#ifdef TKLINE
+	for (last = &tkconf; *last; last = &(*last)->next)
+		;
+#endif
+	while (n-- > 0)
+	{
+		aconf = make_conf();
+		aconf->status = upgrade_get_int();
+		aconf->hold = upgrade_get_int();
+		aconf->port = 0;
+		Class(aconf) = find_class(0);
+		DupString(aconf->name, upgrade_get_strz());
+		DupString(aconf->host, upgrade_get_strz());
+		DupString(aconf->passwd, upgrade_get_strz());
+		istat.is_confmem += strlen(aconf->name) + 1;
+		istat.is_confmem += strlen(aconf->host) + 1;
+		istat.is_confmem += strlen(aconf->passwd) + 1;
+#ifdef TKLINE
+		*last = aconf;
+		last = &aconf->next;
+#else
+		free_conf(aconf);
+#endif
+	}
+}
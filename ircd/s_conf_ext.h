@@ -46,6 +46,7 @@ EXTERN int attach_Iline (aClient *cptr, Reg struct hostent *hp,
 EXTERN aConfItem *count_cnlines (Reg Link *lp);
 EXTERN int detach_conf (aClient *cptr, aConfItem *aconf);
 EXTERN int attach_conf (aClient *cptr, aConfItem *aconf);
+EXTERN void reattach_conf (aClient *cptr, aConfItem *aconf);
 EXTERN aConfItem *find_admin(void);
 EXTERN aConfItem *find_me(void);
 EXTERN aConfItem *attach_confs (aClient *cptr, char *name, int statmask);
@@ -66,7 +67,7 @@ EXTERN aConfItem *find_conf_entry (aConfItem *aconf, u_int mask);
 EXTERN int rehash (aClient *cptr, aClient *sptr, int sig);
 EXTERN int openconf(void);
 EXTERN int initconf (int opt);
-EXTERN int find_kill (aClient *cptr, int timedklines, char **comment);
+EXTERN int find_kill (aClient *cptr, int which, char **comment);
 EXTERN int find_two_masks (char *name, char *host, int stat);
 EXTERN int find_conf_flags (char *name, char *key, int stat);
 EXTERN int find_restrict (aClient *cptr);
@@ -83,7 +84,10 @@ EXTERN char *ipv6_convert (char *orig);
 EXTERN int m_tkline(aClient *, aClient *, int, char **);
 EXTERN int m_untkline(aClient *, aClient *, int, char **);
 EXTERN time_t tkline_expire(int);
+EXTERN void tkline_replay(void);
 #endif
+EXTERN void save_tklines (void);
+EXTERN void load_tklines (void);
 #ifdef KLINE
 EXTERN int m_kline(aClient *, aClient *, int, char **);
 #endif
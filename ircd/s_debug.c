@@ -398,6 +398,8 @@ void	count_memory(aClient *cptr, char *nick, int debug)
 		com = 0, d_com = 0,	/* memory used by conf lines */
 		db = 0, d_db = 0,	/* memory used by dbufs */
 		rm = 0, d_rm = 0,	/* res memory used */
+		pm = 0, d_pm = 0,	/* pools overhead */
+		sm = 0, d_sm = 0,	/* interned strings */
 		totcl = 0, d_totcl = 0,
 		totch = 0, d_totch = 0,
 		totww = 0, d_totww = 0,
@@ -666,13 +668,16 @@ void	count_memory(aClient *cptr, char *nick, int debug)
 		(u_int) (((u_int)BUFFERPOOL) / ((u_int)sizeof(dbufbuf))),
 		istat.is_dbufuse, istat.is_dbufmax, istat.is_dbufmore);
 
+	d_pm = pm = send_poolinfo(cptr, nick);
+	d_sm = sm = istr_mem(cptr, nick);
 	d_rm = rm = cres_mem(cptr, nick);
 
-	tot = totww + totch + totcl + com + cl*sizeof(aClass) + db + rm;
+	tot = totww + totch + totcl + com + cl*sizeof(aClass) + db + rm + pm;
+	tot += sm;
 	tot += sizeof(aHashEntry) * _HASHSIZE;
 	tot += sizeof(aHashEntry) * _CHANNELHASHSIZE;
 	d_tot = d_totww + d_totch + d_totcl + d_com + d_cl*sizeof(aClass);
-	d_tot += d_db + d_rm;
+	d_tot += d_db + d_rm + d_pm + d_sm;
 	d_tot += sizeof(aHashEntry) * _HASHSIZE;
 	d_tot += sizeof(aHashEntry) * _CHANNELHASHSIZE;
 
@@ -34,7 +34,11 @@
 #include "hash_def.h"
 #include "res_def.h"
 #include "whowas_def.h"
+#include "list_def.h"
 #include "service_def.h"
 #include "sys_def.h"
 #include "resolv_def.h"
 #include "nameser_def.h"
+#include "s_loop_def.h"
+#include "s_capture_def.h"
+#include "s_trace_def.h"
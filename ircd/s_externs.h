@@ -48,6 +48,11 @@
 #include "s_user_ext.h"
 #include "s_zip_ext.h"
 #include "s_id_ext.h"
+#include "s_upgrade_ext.h"
+#include "s_metrics_ext.h"
+#include "s_loop_ext.h"
+#include "s_capture_ext.h"
+#include "s_trace_ext.h"
 #include "send_ext.h"
 #include "support_ext.h"
 #include "version_ext.h"
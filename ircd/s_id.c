@@ -149,7 +149,7 @@ void	cache_chid(aChannel *chptr)
     if (chptr->history == 0 ||
 	(timeofday - chptr->history) >LDELAYCHASETIMELIMIT+DELAYCHASETIMELIMIT)
 	{
-	    MyFree(chptr);
+	    free_chan(chptr);
 	    return;
 	}
 
@@ -188,7 +188,7 @@ void	collect_chid(void)
 		    *chptr = del->nextch;
 		    istat.is_cchan--;
 		    istat.is_cchanmem -= sizeof(aChannel) +strlen(del->chname);
-		    MyFree(del);
+		    free_chan(del);
 		}
 	    else
 		    chptr = &((*chptr)->nextch);
@@ -250,11 +250,12 @@ void	init_sid(char *conf)
 }
 #endif
 
+static	long	curr_cid = 0;
+static	int	needfinduid = 0;
+
 char	*next_uid(void)
 {
 static	char	uid[UIDLEN+1+5];	/* why +5? --Beeth */
-static	long	curr_cid = 0;
-static	int	needfinduid = 0;
 
 	do
 	{
@@ -284,6 +285,51 @@ static	int	needfinduid = 0;
 	return uid;
 }
 
+/*
+ * save_ids / load_ids
+ *	Used by the live upgrade (s_upgrade.c) to carry over the UID
+ *	counter and the channel ID cache, so that the new ircd does not
+ *	give out IDs still in use.
+ */
+void	save_ids(void)
+{
+	aChannel *chptr;
+	int	n = 0;
+
+	upgrade_put_int(curr_cid);
+	upgrade_put_int(needfinduid);
+	for (chptr = idcache; chptr; chptr = chptr->nextch)
+		n++;
+	upgrade_put_int(n);
+	for (chptr = idcache; chptr; chptr = chptr->nextch)
+	{
+		upgrade_put_str(chptr->chname);
+		upgrade_put_int(chptr->history);
+	}
+}
+
+void	load_ids(void)
+{
+	aChannel *chptr, **last = &idcache;
+	char	*name;
+	int	n;
+
+	curr_cid = upgrade_get_int();
+	needfinduid = upgrade_get_int();
+	n = upgrade_get_int();
+	while (n-- > 0 && (name = upgrade_get_str()))
+	{
+		/* keep the order, collect_chid() doesn't care much though */
+		chptr = make_chan(strlen(name));
+		strcpy(chptr->chname, name);
+		chptr->history = upgrade_get_int();
+		*last = chptr;
+		last = &chptr->nextch;
+		istat.is_cchan++;
+		istat.is_cchanmem += sizeof(aChannel) + strlen(chptr->chname);
+	}
+}
+
 /*
  * check_uid
  *	various sanity checks to ensure that a UID is valid.
@@ -24,7 +24,7 @@
 /*  External definitions for global variables.
  */
 #ifndef S_ID_C
-/* none */
+extern aChannel *idcache;
 #endif /* S_ID_C */
 
 /*  External definitions for global functions.
@@ -47,5 +47,7 @@ EXTERN char *ltoid (long l, int n);
 EXTERN long idtol (char *id, int n);
 EXTERN int sid_valid (char *sid);
 EXTERN int cid_ok (char *name, int n);
+EXTERN void save_ids (void);
+EXTERN void load_ids (void);
 
 #undef EXTERN
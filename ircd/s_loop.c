@@ -0,0 +1,294 @@
+/************************************************************************
+ *   IRC - Internet Relay Chat, ircd/s_loop.c
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 1, or (at your option)
+ *   any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * Main loop timing: io_loop() announces each of its phases with
+ * loop_phase(), the time spent waiting in select()/poll() is taken out
+ * with loop_wait().  The last LOOP_SAMPLES iterations are kept for the
+ * percentiles shown by STATS w and the metrics socket.
+ *
+ * Watchdog: an iteration longer than iconf.watchdog milliseconds is
+ * reported to &NOTICES, naming its longest phase and the slowest command
+ * it ran when SET CMDPROF is on, else the last one: parse() only notes
+ * which command it runs, the clock is read once per phase.
+ */
+
+#ifndef lint
+static const volatile char rcsid[] = "@(#)$Id$";
+#endif
+
+#include "os.h"
+#include "s_defines.h"
+#define S_LOOP_C
+#include "s_externs.h"
+#undef S_LOOP_C
+
+#define	LOOP_WATCHDOG_GAP	10	/* seconds between watchdog notices */
+
+static	char	*phase_name[LOOP_PHASES] = {
+	"preference", "connect", "delay_close", "tkline", "garbage", "dns",
+	"read_servers", "read", "pings", "rehash", "flush"
+};
+
+/* last command run, set by parse(), loop_from by free_client() too */
+char	*loop_cmd = NULL;
+aClient	*loop_from = NULL;
+
+/* current iteration */
+static	int	phase = -1;
+static	unsigned long long phase_start, wait_start;
+static	u_long	cur[LOOP_PHASES];		/* usec */
+static	u_long	slow_usec;			/* slowest command */
+static	char	slow_cmd[20], slow_name[HOSTLEN+1];
+
+/* history */
+static	u_int	samples[LOOP_SAMPLES][LOOP_PHASES + 1];	/* last is total */
+static	int	nsamples = 0, nextsample = 0;
+static	u_long	calls = 0, last = 0, longest = 0;
+static	unsigned long long total[LOOP_PHASES + 1];	/* usec */
+
+/* watchdog */
+static	time_t	lastnotice = 0;
+static	u_int	slowloops = 0, unreported = 0;
+
+/*
+** loop_usec
+**	Microseconds from some fixed point (monotonic when possible).
+*/
+unsigned long long	loop_usec(void)
+{
+#ifdef CLOCK_MONOTONIC
+	struct	timespec ts;
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#else
+	struct	timeval tv;
+
+	(void)gettimeofday(&tv, NULL);
+	return (unsigned long long)tv.tv_sec * 1000000 + tv.tv_usec;
+#endif
+}
+
+void	loop_begin(void)
+{
+	bzero((char *)cur, sizeof(cur));
+	slow_usec = 0;
+	loop_cmd = NULL;
+	loop_from = NULL;
+	phase = -1;
+}
+
+/*
+** loop_phase
+**	Ends the current phase and starts the given one (-1: none).
+*/
+void	loop_phase(int next)
+{
+	unsigned long long now = loop_usec();
+
+	if (phase >= 0)
+		cur[phase] += now - phase_start;
+	phase = next;
+	phase_start = now;
+}
+
+/*
+** loop_wait
+**	Called before (end = 0) and after (end = 1) select()/poll(), the
+**	wait isn't accounted to the phase.
+*/
+void	loop_wait(int end)
+{
+	unsigned long long now = loop_usec();
+
+	if (!end)
+		wait_start = now;
+	else
+		phase_start += now - wait_start;
+}
+
+/*
+** loop_command
+**	parse() tells how long a command took, the slowest of the iteration
+**	is remembered for the watchdog.
+*/
+void	loop_command(char *cmd, char *name, u_long usec)
+{
+	if (usec <= slow_usec)
+		return;
+	slow_usec = usec;
+	strncpyzt(slow_cmd, cmd, sizeof(slow_cmd));
+	strncpyzt(slow_name, name, sizeof(slow_name));
+}
+
+void	loop_end(void)
+{
+	u_long	sum;
+	int	i, worst;
+
+	loop_phase(-1);
+	for (i = 0, sum = 0, worst = 0; i < LOOP_PHASES; i++)
+	    {
+		sum += cur[i];
+		total[i] += cur[i];
+		samples[nextsample][i] = cur[i];
+		if (cur[i] > cur[worst])
+			worst = i;
+	    }
+	total[LOOP_PHASES] += sum;
+	samples[nextsample][LOOP_PHASES] = sum;
+	nextsample = (nextsample + 1) % LOOP_SAMPLES;
+	if (nsamples < LOOP_SAMPLES)
+		nsamples++;
+	calls++;
+	last = sum;
+	if (sum > longest)
+		longest = sum;
+
+	if (iconf.watchdog <= 0 || sum < (u_long)iconf.watchdog * 1000)
+		return;
+	slowloops++;
+	if (timeofday - lastnotice < LOOP_WATCHDOG_GAP)
+	    {
+		unreported++;
+		return;
+	    }
+	if (slow_usec)
+		sendto_flag(SCH_NOTICE, "Slow loop: %lu ms, %s %lu ms, "
+			    "slowest command %s from %s %lu ms%s",
+			    sum / 1000, phase_name[worst], cur[worst] / 1000,
+			    slow_cmd, slow_name, slow_usec / 1000,
+			    unreported ? " (more slow loops unreported)" : "");
+	else if (loop_cmd)
+		sendto_flag(SCH_NOTICE, "Slow loop: %lu ms, %s %lu ms, "
+			    "last command %s from %s%s",
+			    sum / 1000, phase_name[worst], cur[worst] / 1000,
+			    loop_cmd, !loop_from ? "a client gone since" :
+			    *loop_from->name ? loop_from->name :
+			    loop_from->sockhost,
+			    unreported ? " (more slow loops unreported)" : "");
+	else
+		sendto_flag(SCH_NOTICE, "Slow loop: %lu ms, %s %lu ms%s",
+			    sum / 1000, phase_name[worst], cur[worst] / 1000,
+			    unreported ? " (more slow loops unreported)" : "");
+	lastnotice = timeofday;
+	unreported = 0;
+}
+
+static	int	ucmp(const void *a, const void *b)
+{
+	u_int	x = *(const u_int *)a, y = *(const u_int *)b;
+
+	return (x < y) ? -1 : (x > y);
+}
+
+/*
+** loop_percentiles
+**	50th, 90th, 99th percentiles and maximum of the kept samples of a
+**	phase (LOOP_PHASES: whole iterations).
+*/
+static	void	loop_percentiles(int p, u_int pc[4])
+{
+	static	u_int	sorted[LOOP_SAMPLES];
+	int	i;
+
+	if (nsamples == 0)
+	    {
+		pc[0] = pc[1] = pc[2] = pc[3] = 0;
+		return;
+	    }
+	for (i = 0; i < nsamples; i++)
+		sorted[i] = samples[i][p];
+	qsort(sorted, nsamples, sizeof(u_int), ucmp);
+	pc[0] = sorted[(nsamples - 1) * 50 / 100];
+	pc[1] = sorted[(nsamples - 1) * 90 / 100];
+	pc[2] = sorted[(nsamples - 1) * 99 / 100];
+	pc[3] = sorted[nsamples - 1];
+}
+
+/*
+** report_loop
+**	STATS w: per phase, total time and percentiles of the last
+**	iterations, in microseconds.
+*/
+void	report_loop(aClient *sptr, char *to)
+{
+	u_int	pc[4];
+	int	i;
+
+	sendto_one(sptr, ":%s %d %s :watchdog %d ms, %u slow loops, "
+		   "%lu loops, last %lu us, longest %lu us", ME,
+		   RPL_STATSDEBUG, to, iconf.watchdog, slowloops, calls,
+		   last, longest);
+	for (i = 0; i <= LOOP_PHASES; i++)
+	    {
+		loop_percentiles(i, pc);
+		sendto_one(sptr, ":%s %d %s :%s %llu %u %u %u %u", ME,
+			   RPL_STATSDEBUG, to,
+			   i < LOOP_PHASES ? phase_name[i] : "total",
+			   total[i], pc[0], pc[1], pc[2], pc[3]);
+	    }
+}
+
+#ifdef USE_METRICS
+/*
+** metrics_loop
+**	Main loop timing for the metrics socket.
+*/
+void	metrics_loop(void)
+{
+	static	char	*quantile[3] = { "0.5", "0.9", "0.99" };
+	u_int	pc[4];
+	int	i, q;
+
+	metrics_head("loop_iterations_total", "counter",
+		"Iterations of the main loop.");
+	metrics_printf("ircd_loop_iterations_total %lu\n", calls);
+	metrics_head("loop_busy_seconds_total", "counter",
+		"Time spent in the main loop, waiting for events excluded.");
+	metrics_printf("ircd_loop_busy_seconds_total %llu.%06llu\n",
+		total[LOOP_PHASES] / 1000000, total[LOOP_PHASES] % 1000000);
+	metrics_head("loop_busy_last_seconds", "gauge",
+		"Time spent in the last iteration.");
+	metrics_printf("ircd_loop_busy_last_seconds %lu.%06lu\n",
+		last / 1000000, last % 1000000);
+	metrics_head("loop_busy_max_seconds", "gauge", "Longest iteration.");
+	metrics_printf("ircd_loop_busy_max_seconds %lu.%06lu\n",
+		longest / 1000000, longest % 1000000);
+	metrics_head("loop_slow_total", "counter",
+		"Iterations longer than the watchdog threshold.");
+	metrics_printf("ircd_loop_slow_total %u\n", slowloops);
+	metrics_head("loop_phase_seconds", "summary",
+		"Time spent in each phase of the main loop, quantiles over "
+		"the last iterations.");
+	for (i = 0; i < LOOP_PHASES; i++)
+	    {
+		loop_percentiles(i, pc);
+		for (q = 0; q < 3; q++)
+			metrics_printf("ircd_loop_phase_seconds{phase=\"%s\","
+				"quantile=\"%s\"} %u.%06u\n", phase_name[i],
+				quantile[q], pc[q] / 1000000, pc[q] % 1000000);
+		metrics_printf("ircd_loop_phase_seconds_sum{phase=\"%s\"} "
+			"%llu.%06llu\n"
+			"ircd_loop_phase_seconds_count{phase=\"%s\"} %lu\n",
+			phase_name[i], total[i] / 1000000, total[i] % 1000000,
+			phase_name[i], calls);
+	    }
+}
+#endif /* USE_METRICS */
@@ -0,0 +1,35 @@
+/************************************************************************
+ *   IRC - Internet Relay Chat, ircd/s_loop_def.h
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 1, or (at your option)
+ *   any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+** Phases of io_loop(), timed by s_loop.c.
+*/
+#define	LOOP_PREFERENCE		0	/* calculate_preference() */
+#define	LOOP_CONNECT		1	/* try_connections() */
+#define	LOOP_DELAYCLOSE		2	/* delay_close() */
+#define	LOOP_TKLINE		3	/* tkline_expire() */
+#define	LOOP_GARBAGE		4	/* collect_channel_garbage() */
+#define	LOOP_DNS		5	/* resolver timeouts, cache expiry */
+#define	LOOP_READSERV		6	/* read_message() on servers */
+#define	LOOP_READ		7	/* read_message() on all */
+#define	LOOP_PINGS		8	/* check_pings(), delayed_kills() */
+#define	LOOP_REHASH		9	/* signals: restart, rehash, iauth */
+#define	LOOP_FLUSH		10	/* flush_connections() */
+#define	LOOP_PHASES		11
+
+#define	LOOP_SAMPLES		1024	/* iterations kept for percentiles */
@@ -0,0 +1,47 @@
+/************************************************************************
+ *   IRC - Internet Relay Chat, ircd/s_loop_ext.h
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 1, or (at your option)
+ *   any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*  This file contains external definitions for global variables and functions
+    defined in ircd/s_loop.c.
+ */
+
+/*  External definitions for global variables.
+ */
+#ifndef S_LOOP_C
+extern char *loop_cmd;
+extern aClient *loop_from;
+#endif /* S_LOOP_C */
+
+/*  External definitions for global functions.
+ */
+#ifndef S_LOOP_C
+#define EXTERN extern
+#else /* S_LOOP_C */
+#define EXTERN
+#endif /* S_LOOP_C */
+EXTERN unsigned long long loop_usec (void);
+EXTERN void loop_begin (void);
+EXTERN void loop_phase (int phase);
+EXTERN void loop_wait (int end);
+EXTERN void loop_command (char *cmd, char *name, u_long usec);
+EXTERN void loop_end (void);
+EXTERN void report_loop (aClient *sptr, char *to);
+#ifdef USE_METRICS
+EXTERN void metrics_loop (void);
+#endif
+#undef EXTERN
@@ -0,0 +1,459 @@
+/************************************************************************
+ *   IRC - Internet Relay Chat, ircd/s_metrics.c
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 1, or (at your option)
+ *   any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * Metrics: a unix socket (IRCDMETRICS_PATH) which answers every
+ * connection with the server counters in the Prometheus text format,
+ * then closes it.  Nothing is read from the socket.
+ *
+ * The text is built at most once a second and written without blocking;
+ * a reader which doesn't take it all at once gets the rest as the main
+ * loop goes, and is dropped after METRICS_TIMEOUT seconds.
+ */
+
+#ifndef lint
+static const volatile char rcsid[] = "@(#)$Id$";
+#endif
+
+#include "os.h"
+#include "s_defines.h"
+#define S_METRICS_C
+#include "s_externs.h"
+#undef S_METRICS_C
+
+#ifdef USE_METRICS
+
+int	metricsfd = -1;		/* listening socket */
+
+#define	METRICS_MAXCONN	4	/* readers served at once */
+#define	METRICS_TIMEOUT	5	/* seconds to take the text */
+
+static	char	*mbuf = NULL;		/* the text */
+static	int	mlen = 0, msize = 0;
+static	time_t	mtime = 0;		/* when it was built */
+
+static	struct	{
+	int	fd;
+	char	*buf;		/* what is left to write */
+	int	len, pos;
+	time_t	since;
+} mconn[METRICS_MAXCONN];
+
+static	u_long	tv_usec_since(struct timeval *tv)
+{
+	struct	timeval	now;
+	long	d;
+
+	(void)gettimeofday(&now, NULL);
+	d = (now.tv_sec - tv->tv_sec) * 1000000 + now.tv_usec - tv->tv_usec;
+	return (d < 0) ? 0 : d;
+}
+
+/*
+** metrics_printf
+**	Adds to the text being built.
+*/
+void	metrics_printf(char *fmt, ...)
+{
+	va_list	va;
+	int	len;
+
+	while (1)
+	    {
+		va_start(va, fmt);
+		len = vsnprintf(mbuf + mlen, msize - mlen, fmt, va);
+		va_end(va);
+		if (len < 0)
+			return;
+		if (mlen + len < msize)
+			break;
+		msize = MAX(msize * 2, mlen + len + 1);
+		mbuf = (char *)MyRealloc(mbuf, msize);
+	    }
+	mlen += len;
+}
+
+/* one metric without labels */
+static	void	metric(char *name, char *type, char *help,
+	unsigned long long value)
+{
+	metrics_printf("# HELP ircd_%s %s\n# TYPE ircd_%s %s\nircd_%s %llu\n",
+		name, help, name, type, name, value);
+}
+
+/* one metric without labels, in seconds */
+static	void	metric_usec(char *name, char *type, char *help,
+	unsigned long long usec)
+{
+	metrics_printf("# HELP ircd_%s %s\n# TYPE ircd_%s %s\n"
+		"ircd_%s %llu.%06llu\n", name, help, name, type, name,
+		usec / 1000000, usec % 1000000);
+}
+
+/* the head of a metric with labels */
+void	metrics_head(char *name, char *type, char *help)
+{
+	metrics_printf("# HELP ircd_%s %s\n# TYPE ircd_%s %s\n",
+		name, help, name, type);
+}
+
+static	void	metrics_istat(void)
+{
+	metrics_printf("# HELP ircd_info Server name and version.\n"
+		"# TYPE ircd_info gauge\n"
+		"ircd_info{server=\"%s\",version=\"%s\"} 1\n", ME, version);
+	metric("start_time_seconds", "gauge", "Time the server started.",
+		me.since);
+
+	metrics_head("users", "gauge", "Users on the network.");
+	metrics_printf("ircd_users{mode=\"visible\"} %lu\n"
+		"ircd_users{mode=\"invisible\"} %lu\n",
+		istat.is_user[0], istat.is_user[1]);
+	metric("servers", "gauge", "Servers on the network.", istat.is_serv);
+	metric("services", "gauge", "Services on the network.",
+		istat.is_service);
+	metric("opers", "gauge", "Operators on the network.", istat.is_oper);
+	metric("channels", "gauge", "Channels.", istat.is_chan);
+	metric("channel_members", "gauge", "Channel memberships.",
+		istat.is_chanusers);
+	metric("channels_history", "gauge", "Channels kept in history.",
+		istat.is_hchan);
+	metric("away", "gauge", "Users away.", istat.is_away);
+	metric("bans", "gauge", "Channel bans.", istat.is_bans);
+	metric("invites", "gauge", "Pending invitations.", istat.is_invite);
+	metrics_head("local", "gauge", "Local connections.");
+	metrics_printf("ircd_local{type=\"client\"} %lu\n"
+		"ircd_local{type=\"server\"} %lu\n"
+		"ircd_local{type=\"service\"} %lu\n"
+		"ircd_local{type=\"unknown\"} %lu\n",
+		istat.is_myclnt, istat.is_myserv, istat.is_myservice,
+		istat.is_unknown);
+	metric("max_users", "gauge", "Most users seen.", istat.is_m_users);
+	metric("max_local_clients", "gauge", "Most local clients seen.",
+		istat.is_m_myclnt);
+	metric("whowas_users", "gauge", "Users kept for WHOWAS.",
+		istat.is_wwusers);
+	metric("conf_items", "gauge", "Configuration lines.", istat.is_conf);
+
+	metric("connections_accepted_total", "counter",
+		"Connections accepted.", ircst.is_ac);
+	metric("connections_refused_total", "counter",
+		"Connections refused.", ircst.is_ref);
+	metric("connections_client_total", "counter",
+		"Client connections closed.", ircst.is_cl);
+	metric("connections_server_total", "counter",
+		"Server connections closed.", ircst.is_sv);
+	metrics_head("bytes_total", "counter", "Bytes of closed connections.");
+	metrics_printf("ircd_bytes_total{peer=\"client\",dir=\"sent\"} %llu\n"
+		"ircd_bytes_total{peer=\"client\",dir=\"received\"} %llu\n"
+		"ircd_bytes_total{peer=\"server\",dir=\"sent\"} %llu\n"
+		"ircd_bytes_total{peer=\"server\",dir=\"received\"} %llu\n",
+		ircst.is_cbs, ircst.is_cbr, ircst.is_sbs, ircst.is_sbr);
+	metrics_head("messages_dropped_total", "counter",
+		"Messages not processed.");
+	metrics_printf("ircd_messages_dropped_total{reason=\"unknown\"} %u\n"
+		"ircd_messages_dropped_total{reason=\"direction\"} %u\n"
+		"ircd_messages_dropped_total{reason=\"prefix\"} %u\n"
+		"ircd_messages_dropped_total{reason=\"empty\"} %u\n",
+		ircst.is_unco, ircst.is_wrdi, ircst.is_unpf, ircst.is_empt);
+	metric("collision_kills_total", "counter", "Kills on collisions.",
+		ircst.is_kill);
+	metric("collision_saves_total", "counter", "Clients saved.",
+		ircst.is_save);
+	metrics_head("auth_total", "counter", "Ident lookups.");
+	metrics_printf("ircd_auth_total{result=\"ok\"} %u\n"
+		"ircd_auth_total{result=\"bad\"} %u\n",
+		ircst.is_asuc, ircst.is_abad);
+}
+
+/* label for the handlers[] of msgtab */
+static	char	*from[STAT_MAX] =
+	{ "server", "client", "oper", "service", "unregistered" };
+
+static	void	metrics_msgtab(void)
+{
+	struct	Message	*mptr;
+	int	i, n;
+
+	metrics_head("commands_total", "counter", "Commands processed.");
+	for (mptr = msgtab; mptr->cmd; mptr++)
+	    {
+		for (i = 0, n = 0; i < STAT_MAX; i++)
+			n += mptr->handlers[i].count;
+		if (n == 0)
+			continue;
+		for (i = 0; i < STAT_MAX; i++)
+			metrics_printf("ircd_commands_total{command=\"%s\","
+				"from=\"%s\"} %u\n", mptr->cmd, from[i],
+				mptr->handlers[i].count);
+	    }
+	metrics_head("command_bytes_total", "counter",
+		"Bytes of the commands processed.");
+	for (mptr = msgtab; mptr->cmd; mptr++)
+	    {
+		for (i = 0, n = 0; i < STAT_MAX; i++)
+			n += mptr->handlers[i].count;
+		if (n == 0)
+			continue;
+		for (i = 0; i < STAT_MAX; i++)
+			metrics_printf("ircd_command_bytes_total{command=\"%s\","
+				"from=\"%s\"} %lu\n", mptr->cmd, from[i],
+				mptr->handlers[i].bytes);
+	    }
+	metrics_head("commands_remote_total", "counter",
+		"Commands processed which came from remote clients.");
+	for (mptr = msgtab; mptr->cmd; mptr++)
+	    {
+		for (i = 0, n = 0; i < STAT_MAX; i++)
+			n += mptr->handlers[i].rcount;
+		if (n == 0)
+			continue;
+		for (i = 0; i < STAT_MAX; i++)
+			metrics_printf("ircd_commands_remote_total{command=\"%s\","
+				"from=\"%s\"} %u\n", mptr->cmd, from[i],
+				mptr->handlers[i].rcount);
+	    }
+}
+
+/* SET CMDPROF */
+static	void	metrics_cmdprof(void)
+{
+	struct	Message	*mptr;
+	struct	CmdProf	*prof;
+	u_long	n, le;
+	int	i, b;
+
+	metrics_head("command_seconds", "histogram",
+		"Time spent in the command handlers, when SET CMDPROF is on.");
+	for (mptr = msgtab; mptr->cmd; mptr++)
+		for (i = 0; i < STAT_MAX; i++)
+		    {
+			if (!(prof = mptr->handlers[i].prof))
+				continue;
+			for (b = 0, n = 0; b < CMDPROF_BUCKETS - 1; b++)
+			    {
+				n += prof->hist[b];
+				le = 1UL << b;
+				metrics_printf("ircd_command_seconds_bucket{"
+					"command=\"%s\",from=\"%s\","
+					"le=\"%lu.%06lu\"} %lu\n", mptr->cmd,
+					from[i], le / 1000000, le % 1000000, n);
+			    }
+			metrics_printf("ircd_command_seconds_bucket{"
+				"command=\"%s\",from=\"%s\",le=\"+Inf\"} %u\n"
+				"ircd_command_seconds_sum{command=\"%s\","
+				"from=\"%s\"} %llu.%06llu\n"
+				"ircd_command_seconds_count{command=\"%s\","
+				"from=\"%s\"} %u\n",
+				mptr->cmd, from[i], prof->calls,
+				mptr->cmd, from[i], prof->usec / 1000000,
+				prof->usec % 1000000,
+				mptr->cmd, from[i], prof->calls);
+		    }
+}
+
+static	void	metrics_dbuf(void)
+{
+	metric("dbuf_pool_bytes", "gauge", "Size of the dbuf pool.",
+		poolsize);
+	metric("dbuf_size_bytes", "gauge", "Size of a dbuf.", DBUFSIZ);
+	metric("dbufs_allocated", "gauge", "Dbufs allocated.",
+		istat.is_dbufnow);
+	metric("dbufs_used", "gauge", "Dbufs in use.", istat.is_dbufuse);
+	metric("dbufs_used_max", "gauge", "Most dbufs in use.",
+		istat.is_dbufmax);
+	metric("dbuf_pool_grown_total", "counter",
+		"Times the dbuf pool was grown.", istat.is_dbufmore);
+}
+
+static	aClass	*client_class(aClient *cptr)
+{
+	Link	*tmp;
+
+	for (tmp = cptr->confs; tmp; tmp = tmp->next)
+		if (tmp->value.aconf && tmp->value.aconf->class)
+			return tmp->value.aconf->class;
+	return NULL;
+}
+
+static	void	metrics_class(void)
+{
+	aClass	*cl;
+	aClient	*cptr;
+	int	i, max;
+
+	metrics_head("class_links", "gauge", "Connections in the class.");
+	for (cl = FirstClass(); cl; cl = NextClass(cl))
+		if (MaxLinks(cl) >= 0)
+			metrics_printf("ircd_class_links{class=\"%d\"} %d\n",
+				Class(cl), Links(cl));
+	/* one pass over the clients for the sendQs of all classes */
+	for (cl = FirstClass(); cl; cl = NextClass(cl))
+		cl->sendq = 0;
+	for (i = highest_fd, max = 0; i >= 0; i--)
+	    {
+		if (!(cptr = local[i]) || IsListener(cptr))
+			continue;
+		if ((int)DBufLength(&cptr->sendQ) > max)
+			max = DBufLength(&cptr->sendQ);
+		if (!IsMe(cptr) && (cl = client_class(cptr)))
+			cl->sendq += DBufLength(&cptr->sendQ);
+	    }
+	metrics_head("class_sendq_bytes", "gauge",
+		"Bytes in the sendQs of the class.");
+	for (cl = FirstClass(); cl; cl = NextClass(cl))
+		if (MaxLinks(cl) >= 0)
+			metrics_printf("ircd_class_sendq_bytes{class=\"%d\"} "
+				"%llu\n", Class(cl), cl->sendq);
+	metrics_head("sendq_max_bytes", "gauge", "Largest sendQ.");
+	metrics_printf("ircd_sendq_max_bytes %d\n", max);
+}
+
+static	void	metrics_build(void)
+{
+	struct	timeval	tv;
+
+	if (mtime == timeofday && mlen)
+		return;
+	(void)gettimeofday(&tv, NULL);
+	mlen = 0;
+	metrics_istat();
+	metrics_msgtab();
+	metrics_cmdprof();
+	metrics_dbuf();
+	metrics_hash();
+	metrics_res();
+	metrics_class();
+	metrics_loop();
+	metric_usec("metrics_build_seconds", "gauge",
+		"Time it took to build this text.", tv_usec_since(&tv));
+	mtime = timeofday;
+}
+
+/*
+** metrics_init
+**	Opens the socket at boot.  A socket left by a previous server is
+**	removed (a live upgrade takes it over this way).
+*/
+void	metrics_init(void)
+{
+	struct	sockaddr_un un;
+	int	i;
+
+	for (i = 0; i < METRICS_MAXCONN; i++)
+		mconn[i].fd = -1;
+	if ((metricsfd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+	    {
+		report_error("metrics socket %s:%s", &me);
+		return;
+	    }
+	bzero((char *)&un, sizeof(un));
+	un.sun_family = AF_UNIX;
+	strncpyzt(un.sun_path, IRCDMETRICS_PATH, sizeof(un.sun_path));
+	(void)unlink(IRCDMETRICS_PATH);
+	if (bind(metricsfd, (SAP)&un, sizeof(un)) == -1 ||
+	    listen(metricsfd, METRICS_MAXCONN) == -1)
+	    {
+		report_error("metrics socket " IRCDMETRICS_PATH " %s:%s", &me);
+		(void)close(metricsfd);
+		metricsfd = -1;
+		return;
+	    }
+	(void)chmod(IRCDMETRICS_PATH, 0660);
+	(void)fcntl(metricsfd, F_SETFD, FD_CLOEXEC);
+	set_non_blocking(metricsfd, &me);
+	if (metricsfd > highest_fd)
+		highest_fd = metricsfd;
+}
+
+static	void	metrics_close(int i)
+{
+	(void)close(mconn[i].fd);
+	mconn[i].fd = -1;
+	if (mconn[i].buf)
+		MyFree(mconn[i].buf);
+	mconn[i].buf = NULL;
+}
+
+/*
+** metrics_accept
+**	Called when the socket is readable: serves the waiting readers.
+*/
+void	metrics_accept(void)
+{
+	int	fd, i, n;
+
+	while ((fd = accept(metricsfd, NULL, NULL)) >= 0)
+	    {
+		for (i = 0; i < METRICS_MAXCONN; i++)
+			if (mconn[i].fd < 0)
+				break;
+		if (i == METRICS_MAXCONN)
+		    {
+			/* too many slow readers already */
+			(void)close(fd);
+			continue;
+		    }
+		(void)fcntl(fd, F_SETFD, FD_CLOEXEC);
+		set_non_blocking(fd, &me);
+		metrics_build();
+		n = write(fd, mbuf, mlen);
+		if (n == mlen || (n < 0 && errno != EAGAIN &&
+				  errno != EWOULDBLOCK))
+		    {
+			(void)close(fd);
+			continue;
+		    }
+		if (n < 0)
+			n = 0;
+		mconn[i].fd = fd;
+		mconn[i].len = mlen - n;
+		mconn[i].pos = 0;
+		mconn[i].buf = (char *)MyMalloc(mconn[i].len);
+		bcopy(mbuf + n, mconn[i].buf, mconn[i].len);
+		mconn[i].since = timeofday;
+	    }
+}
+
+/*
+** metrics_flush
+**	Gives the slow readers some more.  Returns how many are left.
+*/
+int	metrics_flush(void)
+{
+	int	i, n, left = 0;
+
+	for (i = 0; i < METRICS_MAXCONN; i++)
+	    {
+		if (mconn[i].fd < 0)
+			continue;
+		n = write(mconn[i].fd, mconn[i].buf + mconn[i].pos,
+			  mconn[i].len - mconn[i].pos);
+		if (n > 0)
+			mconn[i].pos += n;
+		if (mconn[i].pos == mconn[i].len ||
+		    (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) ||
+		    timeofday - mconn[i].since > METRICS_TIMEOUT)
+			metrics_close(i);
+		else
+			left++;
+	    }
+	return left;
+}
+
+#endif /* USE_METRICS */
@@ -0,0 +1,43 @@
+/************************************************************************
+ *   IRC - Internet Relay Chat, ircd/s_metrics_ext.h
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 1, or (at your option)
+ *   any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*  This file contains external definitions for global variables and functions
+    defined in ircd/s_metrics.c.
+ */
+
+#ifdef USE_METRICS
+/*  External definitions for global variables.
+ */
+#ifndef S_METRICS_C
+extern int metricsfd;
+#endif /* S_METRICS_C */
+
+/*  External definitions for global functions.
+ */
+#ifndef S_METRICS_C
+#define EXTERN extern
+#else /* S_METRICS_C */
+#define EXTERN
+#endif /* S_METRICS_C */
+EXTERN void metrics_printf (char *fmt, ...);
+EXTERN void metrics_head (char *name, char *type, char *help);
+EXTERN void metrics_init (void);
+EXTERN void metrics_accept (void);
+EXTERN int metrics_flush (void);
+#undef EXTERN
+#endif /* USE_METRICS */
@@ -32,6 +32,12 @@ static const volatile char rcsid[] = "@(#)$Id: s_misc.c,v 1.121 2011/01/20 14:26
 #undef S_MISC_C
 
 static	void	exit_one_client (aClient *, aClient *, aClient *, const char *);
+static	void	exit_quit_user (aClient *, aClient *, const char *);
+static	void	exit_user_channels (aClient *, aClient *);
+static	void	exit_user_cleanup (aClient *, aClient *);
+static	void	exit_unlist_client (aClient *);
+static	void	exit_split_users (aClient *, aClient *, aClient *, const char *,
+				  int);
 static	void	exit_server(aClient *, aClient *, aClient *, const char *,
 			const char *);
 
@@ -352,7 +358,6 @@ int	mark_blind_servers (aClient *cptr, aClient *server)
 static	void	exit_server(aClient *cptr, aClient *acptr, aClient *from,
 			const char *comment, const char *comment2)
 {
-	aClient	*acptr2;
 	int	flags;
 
 	/* Remove all the servers recursively. */
@@ -382,12 +387,7 @@ static	void	exit_server(aClient *cptr, aClient *acptr, aClient *from,
 	}
 
 	/* Quit all users and services. */
-	while (GotDependantClient(acptr))
-	{
-		acptr2 = acptr->prev;
-		acptr2->flags |= flags;
-		exit_one_client(cptr->from, acptr2, from, comment2);
-	}
+	exit_split_users(cptr, acptr, from, comment2, flags);
 
 	/* Make sure we only send the last SQUIT to a 2.11 server. */
 	if (acptr == cptr)
@@ -446,6 +446,8 @@ int	exit_client(aClient *cptr, aClient *sptr, aClient *from,
 {
 	char	comment1[HOSTLEN + HOSTLEN + 2];
 
+	TRACE(TRACE_CONN, TEV_EXIT, MyConnect(sptr) ? sptr->fd : -1,
+	      sptr->exitc, sptr->status, 0);
 	if (MyConnect(sptr))
 	{
 		if (sptr->flags & FLAGS_KILLED)
@@ -680,8 +682,6 @@ static	void	exit_one_client(aClient *cptr, aClient *sptr, aClient *from,
 {
 	Reg	aClient *acptr;
 	Reg	int	i;
-	Reg	Link	*lp;
-	invLink		*ilp;
 
 	/*
 	**  For a server or user quitting, propagage the information to
@@ -760,157 +760,13 @@ static	void	exit_one_client(aClient *cptr, aClient *sptr, aClient *from,
 	}
 	else if (sptr->name[0] && !IsService(sptr)) /* clean with QUIT... */
 	{
-		/*
-		** If this exit is generated from "m_kill", then there
-		** is no sense in sending the QUIT--KILL's have been
-		** sent instead.
-		*/
-		if ((sptr->flags & FLAGS_KILLED) == 0)
-		{
-			if ((sptr->flags & FLAGS_SPLIT) == 0)
-			{
-				sendto_serv_butone(cptr, ":%s QUIT :%s",
-						   sptr->user->uid, comment);
-#ifdef	USE_SERVICES
-				check_services_butone(SERVICE_WANT_QUIT|
-						      SERVICE_WANT_RQUIT, 
-						      (sptr->user) ?
-						      sptr->user->servp
-						      : NULL, cptr,
-						      ":%s QUIT :%s",
-						      sptr->name, comment);
-#endif
-			}
-			else
-			{
-				if (sptr->flags & FLAGS_HIDDEN)
-					/* joys of hostmasking */
-					for (i = fdas.highest; i >= 0; i--)
-					{
-						if (!(acptr =local[fdas.fd[i]])
-						    || acptr == cptr
-						    || IsMe(acptr))
-							continue;
-						if (acptr->flags & FLAGS_HIDDEN)
-							sendto_one(acptr,
-								":%s QUIT :%s",
-								sptr->user->uid,
-								comment);
-					}
-#ifdef	USE_SERVICES
-				check_services_butone(SERVICE_WANT_QUIT, 
-					      (sptr->user) ? sptr->user->servp
-						      : NULL, cptr,
-						      ":%s QUIT :%s",
-						      sptr->name, comment);
-#endif
-			}
-		}
-#ifdef USE_SERVICES
-		else
-		{
-			/* Send QUIT to services which desire such as well.
-			** Services with both _QUIT and _KILL will get both
-			** for now --jv
-			*/
-			check_services_butone(SERVICE_WANT_QUIT, 
-					     (sptr->user) ? sptr->user->servp
-						      : NULL, cptr,
-						      ":%s QUIT :%s",
-						      sptr->name, comment);
-
-		}
-#endif
-		/*
-		** If a person is on a channel, send a QUIT notice
-		** to every client (person) on the same channel (so
-		** that the client can show the "**signoff" message).
-		** (Note: The notice is to the local clients *only*)
-		*/
+		exit_quit_user(cptr, sptr, comment);
 		if (sptr->user)
 		{
-			if (IsInvisible(sptr))
-			{
-				istat.is_user[1]--;
-				sptr->user->servp->usercnt[1]--;
-			}
-			else
-			{
-				istat.is_user[0]--;
-				sptr->user->servp->usercnt[0]--;
-			}
-			if (IsAnOper(sptr))
-			{
-				sptr->user->servp->usercnt[2]--;
-				istat.is_oper--;
-			}
-			sendto_common_channels(sptr, ":%s QUIT :%s",
-						sptr->name, comment);
-
-			if (!(acptr = cptr ? cptr : sptr->from))
-				acptr = sptr;
-			while ((lp = sptr->user->channel))
-			{
-				/*
-				** Mark channels from where remote chop left,
-				** this will eventually lock the channel.
-				** close_connection() has already been called,
-				** it makes MyConnect == False - krys
-				*/
-				if (sptr != cptr)
-				{
-					if (*lp->value.chptr->chname == '!')
-					{
-						if (!(sptr->flags &FLAGS_QUIT))
-							lp->value.chptr->history = timeofday + LDELAYCHASETIMELIMIT;
-					}
-					else if (
-#ifndef BETTER_CDELAY
-						 !(sptr->flags & FLAGS_QUIT) &&
-#endif
-						 is_chan_op(sptr, lp->value.chptr))
-					{
-						lp->value.chptr->history = timeofday + DELAYCHASETIMELIMIT;
-					}
-				}
-				if (IsAnonymous(lp->value.chptr) &&
-				    !IsQuiet(lp->value.chptr))
-				{
-					sendto_channel_butserv(lp->value.chptr, sptr, ":%s PART %s :None", sptr->name, lp->value.chptr->chname);
-				}
-				remove_user_from_channel(sptr,lp->value.chptr);
-			}
-
-			/* Clean up invitefield */
-			while ((ilp = sptr->user->invited))
-			{
-				del_invite(sptr, ilp->chptr);
-				/* again, this is all that is needed */
-			}
-
-			/* remove from uid hash table */
-			if (sptr->user)
-			{
-				del_from_uid_hash_table(sptr->user->uid, sptr);
-			}
-
-			/* Add user to history */
-#ifndef BETTER_NDELAY
-			add_history(sptr, (sptr->flags & FLAGS_QUIT) ?
-				    &me : NULL);
-#else
-			add_history(sptr, (sptr == cptr) ? &me : NULL);
-#endif
-			off_history(sptr);
-#ifdef USE_HOSTHASH
-			del_from_hostname_hash_table(sptr->user->host,
-						     sptr->user);
-#endif
-#ifdef USE_IPHASH
-			del_from_ip_hash_table(sptr->user->sip, sptr->user);
-#endif
-		    }
-	    }
+			exit_user_channels(cptr, sptr);
+			exit_user_cleanup(cptr, sptr);
+		}
+	}
 	else if (sptr->name[0] && IsService(sptr))
 	    {
 		/*
@@ -958,6 +814,190 @@ static	void	exit_one_client(aClient *cptr, aClient *sptr, aClient *from,
 	    }
 
 	/* Remove sptr from the client list */
+	exit_unlist_client(sptr);
+	return;
+}
+
+/*
+** exit_quit_user
+**	Propagate the QUIT of a user to servers and services, and send it
+**	to the local users sharing a channel with him.
+*/
+static	void	exit_quit_user(aClient *cptr, aClient *sptr, const char *comment)
+{
+	Reg	aClient *acptr;
+	Reg	int	i;
+
+	/*
+	** If this exit is generated from "m_kill", then there
+	** is no sense in sending the QUIT--KILL's have been
+	** sent instead.
+	*/
+	if ((sptr->flags & FLAGS_KILLED) == 0)
+	{
+		if ((sptr->flags & FLAGS_SPLIT) == 0)
+		{
+			sendto_serv_butone(cptr, ":%s QUIT :%s",
+					   sptr->user->uid, comment);
+#ifdef	USE_SERVICES
+			check_services_butone(SERVICE_WANT_QUIT|
+					      SERVICE_WANT_RQUIT, 
+					      (sptr->user) ?
+					      sptr->user->servp
+					      : NULL, cptr,
+					      ":%s QUIT :%s",
+					      sptr->name, comment);
+#endif
+		}
+		else
+		{
+			if (sptr->flags & FLAGS_HIDDEN)
+				/* joys of hostmasking */
+				for (i = fdas.highest; i >= 0; i--)
+				{
+					if (!(acptr =local[fdas.fd[i]])
+					    || acptr == cptr
+					    || IsMe(acptr))
+						continue;
+					if (acptr->flags & FLAGS_HIDDEN)
+						sendto_one(acptr,
+							":%s QUIT :%s",
+							sptr->user->uid,
+							comment);
+				}
+#ifdef	USE_SERVICES
+			check_services_butone(SERVICE_WANT_QUIT, 
+				      (sptr->user) ? sptr->user->servp
+					      : NULL, cptr,
+					      ":%s QUIT :%s",
+					      sptr->name, comment);
+#endif
+		}
+	}
+#ifdef USE_SERVICES
+	else
+	{
+		/* Send QUIT to services which desire such as well.
+		** Services with both _QUIT and _KILL will get both
+		** for now --jv
+		*/
+		check_services_butone(SERVICE_WANT_QUIT, 
+				     (sptr->user) ? sptr->user->servp
+					      : NULL, cptr,
+					      ":%s QUIT :%s",
+					      sptr->name, comment);
+
+	}
+#endif
+	if (!sptr->user)
+		return;
+	if (IsInvisible(sptr))
+	{
+		istat.is_user[1]--;
+		sptr->user->servp->usercnt[1]--;
+	}
+	else
+	{
+		istat.is_user[0]--;
+		sptr->user->servp->usercnt[0]--;
+	}
+	if (IsAnOper(sptr))
+	{
+		sptr->user->servp->usercnt[2]--;
+		istat.is_oper--;
+	}
+	/*
+	** If a person is on a channel, send a QUIT notice
+	** to every client (person) on the same channel (so
+	** that the client can show the "**signoff" message).
+	** (Note: The notice is to the local clients *only*)
+	*/
+	sendto_common_channels(sptr, ":%s QUIT :%s", sptr->name, comment);
+}
+
+/*
+** exit_user_channels
+**	Remove a user from all his channels.
+*/
+static	void	exit_user_channels(aClient *cptr, aClient *sptr)
+{
+	Reg	Link	*lp;
+
+	while ((lp = sptr->user->channel))
+	{
+		/*
+		** Mark channels from where remote chop left,
+		** this will eventually lock the channel.
+		** close_connection() has already been called,
+		** it makes MyConnect == False - krys
+		*/
+		if (sptr != cptr)
+		{
+			if (*lp->value.chptr->chname == '!')
+			{
+				if (!(sptr->flags &FLAGS_QUIT))
+					lp->value.chptr->history = timeofday + LDELAYCHASETIMELIMIT;
+			}
+			else if (
+#ifndef BETTER_CDELAY
+				 !(sptr->flags & FLAGS_QUIT) &&
+#endif
+				 is_chan_op(sptr, lp->value.chptr))
+			{
+				lp->value.chptr->history = timeofday + DELAYCHASETIMELIMIT;
+			}
+		}
+		if (IsAnonymous(lp->value.chptr) &&
+		    !IsQuiet(lp->value.chptr))
+		{
+			sendto_channel_butserv(lp->value.chptr, sptr, ":%s PART %s :None", sptr->name, lp->value.chptr->chname);
+		}
+		remove_user_from_channel(sptr,lp->value.chptr);
+	}
+}
+
+/*
+** exit_user_cleanup
+**	Forget about a user who left all his channels: invites, hash
+**	tables and history.
+*/
+static	void	exit_user_cleanup(aClient *cptr, aClient *sptr)
+{
+	invLink	*ilp;
+
+	/* Clean up invitefield */
+	while ((ilp = sptr->user->invited))
+	{
+		del_invite(sptr, ilp->chptr);
+		/* again, this is all that is needed */
+	}
+
+	/* remove from uid hash table */
+	del_from_uid_hash_table(sptr->user->uid, sptr);
+
+	/* Add user to history */
+#ifndef BETTER_NDELAY
+	add_history(sptr, (sptr->flags & FLAGS_QUIT) ?
+		    &me : NULL);
+#else
+	add_history(sptr, (sptr == cptr) ? &me : NULL);
+#endif
+	off_history(sptr);
+#ifdef USE_HOSTHASH
+	del_from_hostname_hash_table(sptr->user->host,
+				     sptr->user);
+#endif
+#ifdef USE_IPHASH
+	del_from_ip_hash_table(sptr->user->sip, sptr->user);
+#endif
+}
+
+/*
+** exit_unlist_client
+**	Last step of an exit, remove sptr from the client list.
+*/
+static	void	exit_unlist_client(aClient *sptr)
+{
 	if (del_from_client_hash_table(sptr->name, sptr) != 1)
 	{
 		Debug((DEBUG_ERROR, "%#x !in tab %s[%s] %#x %#x %#x %d %d %#x",
@@ -967,7 +1007,96 @@ static	void	exit_one_client(aClient *cptr, aClient *sptr, aClient *from,
 			sptr->status, sptr->user));
 	}
 	remove_client_from_list(sptr);
-	return;
+}
+
+static	int	chptr_cmp(const void *a, const void *b)
+{
+	const aChannel	*ca = *(aChannel * const *)a;
+	const aChannel	*cb = *(aChannel * const *)b;
+
+	return (ca < cb) ? -1 : (ca > cb);
+}
+
+/*
+** exit_split_users
+**	Exit all users and services depending on server acptr, which is
+**	going away in a netsplit.  This does what exit_one_client() does
+**	for each of them, but channels are cleaned up afterwards, in one
+**	pass over the members of each channel, rather than looking for
+**	every user in every channel he was on.  The QUITs for local
+**	clients are held in their sendQ and written in large chunks
+**	(sendq_hold), the main loop flushes what is left.
+*/
+static	void	exit_split_users(aClient *cptr, aClient *acptr, aClient *from,
+				 const char *comment, int flags)
+{
+	static	aChannel **chans = NULL;
+	static	int	chansize = 0;
+	aClient	*acptr2, *last;
+	Link	*lp;
+	int	nchans = 0, i;
+
+	/*
+	** First, send QUITs and mark the channels they're leaving.
+	** Services go right away, they're not on channels.
+	*/
+	sendq_hold = 1;
+	for (last = acptr; (acptr2 = last->prev) && DependsOn(acptr2, acptr); )
+	{
+		acptr2->flags |= flags;
+		if (!IsPerson(acptr2))
+		{
+			exit_one_client(cptr->from, acptr2, from, comment);
+			continue;
+		}
+		exit_quit_user(cptr->from, acptr2, comment);
+		for (lp = acptr2->user->channel; lp; lp = lp->next)
+		{
+			if (IsAnonymous(lp->value.chptr) &&
+			    !IsQuiet(lp->value.chptr))
+			{
+				sendto_channel_butserv(lp->value.chptr, acptr2,
+					":%s PART %s :None", acptr2->name,
+					lp->value.chptr->chname);
+			}
+			if (nchans == chansize)
+			{
+				chansize = chansize ? chansize * 2 : 1024;
+				chans = (aChannel **)MyRealloc((char *)chans,
+					chansize * sizeof(aChannel *));
+			}
+			chans[nchans++] = lp->value.chptr;
+		}
+		last = acptr2;
+	}
+	sendq_hold = 0;
+
+	/* Then remove all of them from each channel at once. */
+	if (nchans > 1)
+	{
+		qsort(chans, nchans, sizeof(aChannel *), chptr_cmp);
+	}
+	for (i = 0; i < nchans; i++)
+	{
+		if (i && chans[i] == chans[i - 1])
+		{
+			continue;
+		}
+		remove_split_members(chans[i]);
+	}
+
+	/* Finally, free their channel links and forget about them. */
+	while (GotDependantClient(acptr))
+	{
+		acptr2 = acptr->prev;
+		while ((lp = acptr2->user->channel))
+		{
+			acptr2->user->channel = lp->next;
+			free_link(lp);
+		}
+		exit_user_cleanup(cptr->from, acptr2);
+		exit_unlist_client(acptr2);
+	}
 }
 
 void	checklist(void)
@@ -1013,6 +1142,7 @@ void	initruntimeconf(void)
 	/* Defaults set in config.h */
 	iconf.split_minservers = MAX(DEFAULT_SPLIT_SERVERS, SPLIT_SERVERS);
 	iconf.split_minusers = MAX(DEFAULT_SPLIT_USERS, SPLIT_USERS);
+	iconf.watchdog = LOOP_WATCHDOG;
 
 	if ((bootopt & BOOT_STANDALONE))
 	{
@@ -1106,6 +1236,7 @@ void	tstats(aClient *cptr, char *name)
 		   sp->is_cbr, sp->is_sbr);
 	sendto_one(cptr, ":%s %d %s :time connected %lu %lu",
 		   ME, RPL_STATSDEBUG, name, sp->is_cti, sp->is_sti);
+	report_res_stats(cptr, name);
 #if defined(USE_IAUTH)
 	report_iauth_stats(cptr, name);
 #endif
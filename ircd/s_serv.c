@@ -1187,6 +1187,7 @@ int	m_server_estab(aClient *cptr, char *sid, char *versionbuf)
 	istat.is_myserv++;
 	if (istat.is_myserv > istat.is_m_myserv)
 		istat.is_m_myserv = istat.is_myserv;
+	TRACE(TRACE_CONN, TEV_REGSERVER, cptr->fd, istat.is_myserv, 0, 0);
 	nextping = timeofday;
 	sendto_flag(SCH_NOTICE, "Link with %s established. (%X%s)", inpath,
 		    cptr->hopcount, (cptr->flags & FLAGS_ZIP) ? "z" : "");
@@ -1862,6 +1863,38 @@ static void report_fd(aClient *sptr, aClient *acptr, char *to)
 		);
 }
 
+/*
+** report_cmdprof
+**	STATS e: time spent in the command handlers, per command and kind
+**	of sender, since SET CMDPROF ON (or RESET).  The histogram counts
+**	calls under 1, 2, 4, ... usec, the last one the slower calls.
+*/
+static	void	report_cmdprof(aClient *cptr, char *to)
+{
+	static	char	*from[STAT_MAX] =
+		{ "server", "client", "oper", "service", "unreg" };
+	struct	Message	*mptr;
+	struct	CmdProf	*prof;
+	char	hist[CMDPROF_BUCKETS * 11 + 1];
+	int	i, b, len, last;
+
+	for (mptr = msgtab; mptr->cmd; mptr++)
+		for (i = 0; i < STAT_MAX; i++)
+		    {
+			if (!(prof = mptr->handlers[i].prof))
+				continue;
+			for (last = CMDPROF_BUCKETS - 1; last > 0; last--)
+				if (prof->hist[last])
+					break;
+			for (b = 0, len = 0; b <= last; b++)
+				len += sprintf(hist + len, " %u",
+					       prof->hist[b]);
+			sendto_one(cptr, ":%s %d %s :%s %s %u %llu %lu%s",
+				   ME, RPL_STATSDEBUG, to, mptr->cmd, from[i],
+				   prof->calls, prof->usec, prof->max, hist);
+		    }
+}
+
 int	m_stats(aClient *cptr, aClient *sptr, int parc, char *parv[])
 {
 	static	char	Lformat[]  = ":%s %d %s %s %u %lu %llu %lu %llu :%d";
@@ -1882,6 +1915,7 @@ int	m_stats(aClient *cptr, aClient *sptr, int parc, char *parv[])
 		case 'c': case 'C':
 		case 'k': case 'K':
 		case 'm': case 'M':
+		case 'e': case 'E':
 		case 't': case 'T':
 		case 'z': case 'Z':
 			if (check_link(sptr))
@@ -2073,6 +2107,9 @@ int	m_stats(aClient *cptr, aClient *sptr, int parc, char *parv[])
 #undef _mh
 		}
 		break;
+	case 'E' : case 'e' : /* commands timing */
+		report_cmdprof(cptr, parv[0]);
+		break;
 	case 'o' : case 'O' : /* O (and o) lines */
 		report_configured_links(cptr, parv[0], CONF_OPS);
 		break;
@@ -2103,6 +2140,9 @@ int	m_stats(aClient *cptr, aClient *sptr, int parc, char *parv[])
 			   now/86400, (now/3600)%24, (now/60)%60, now%60);
 		break;
 	    }
+	case 'W' : case 'w' : /* main loop timing */
+		report_loop(cptr, parv[0]);
+		break;
 	case 'V' : case 'v' : /* V conf lines */
 		report_configured_links(cptr, parv[0], CONF_VER);
 		break;
@@ -2606,6 +2646,13 @@ int	m_restart(aClient *cptr, aClient *sptr, int parc, char *parv[])
 	if (!is_allowed(sptr, ACL_RESTART))
 		return m_nopriv(cptr, sptr, parc, parv);
 
+	/* RESTART UPGRADE: only comes back if it failed */
+	if (parc > 1 && !strcasecmp(parv[1], "UPGRADE"))
+	    {
+		(void)upgrade_start(sptr);
+		return 2;
+	    }
+
 	strcpy(killer, get_client_name(sptr, TRUE));
 	sprintf(buf, "RESTART by %s", get_client_name(sptr, TRUE));
 	for (i = 0; i <= highest_fd; i++)
@@ -3216,6 +3263,14 @@ int	m_set(aClient *cptr, aClient *sptr, int parc, char *parv[])
 		{ TSET_ACONNECT, "ACONNECT" },
 		{ TSET_CACCEPT, "CACCEPT" },
 		{ TSET_SPLIT, "SPLIT" },
+		{ TSET_CMDPROF, "CMDPROF" },
+		{ TSET_WATCHDOG, "WATCHDOG" },
+#ifdef USE_CAPTURE
+		{ TSET_CAPTURE, "CAPTURE" },
+#endif
+#ifdef USE_TRACE
+		{ TSET_TRACE, "TRACE" },
+#endif
 		{ 0, NULL }
 	};
 	int i, acmd = 0;
@@ -3364,6 +3419,112 @@ int	m_set(aClient *cptr, aClient *sptr, int parc, char *parv[])
 				check_split();
 				break;
 			}
+			case TSET_CMDPROF:
+				if (!mycmp(parv[2], "ON"))
+				{
+					iconf.cmdprof = 1;
+				}
+				else if (!mycmp(parv[2], "OFF"))
+				{
+					iconf.cmdprof = 0;
+				}
+				else if (!mycmp(parv[2], "RESET"))
+				{
+					cmdprof_reset();
+				}
+				else
+				{
+					sendto_one(sptr, ":%s NOTICE %s SET "
+						":Illegal value for CMDPROF. "
+						"Possible values: ON OFF RESET",
+						ME, parv[0]);
+					break;
+				}
+				sendto_flag(SCH_NOTICE, "%s changed value of "
+					"CMDPROF to %s", sptr->name, parv[2]);
+				break;
+			case TSET_WATCHDOG:
+			{
+				int tmp;
+
+				tmp = atoi(parv[2]);
+				if (tmp < 0)
+					tmp = 0;
+				if (tmp != iconf.watchdog)
+				{
+					sendto_flag(SCH_NOTICE, "%s changed"
+						" value of WATCHDOG"
+						" from %d to %d", sptr->name,
+						iconf.watchdog, tmp);
+					iconf.watchdog = tmp;
+				}
+				break;
+			}
+#ifdef USE_CAPTURE
+			case TSET_CAPTURE:
+				if (!mycmp(parv[2], "ON"))
+				{
+					if (capture_start() == -1)
+					{
+						sendto_one(sptr, ":%s NOTICE %s"
+							" :Cannot start capture",
+							ME, parv[0]);
+						break;
+					}
+				}
+				else if (!mycmp(parv[2], "OFF"))
+				{
+					capture_stop();
+				}
+				else
+				{
+					sendto_one(sptr, ":%s NOTICE %s SET "
+						":Illegal value for CAPTURE. "
+						"Possible values: ON OFF",
+						ME, parv[0]);
+					break;
+				}
+				sendto_flag(SCH_NOTICE, "%s changed value of "
+					"CAPTURE to %s", sptr->name, parv[2]);
+				break;
+#endif
+#ifdef USE_TRACE
+			case TSET_TRACE:
+			{
+				char old[64];
+				int tmp;
+
+				if (!mycmp(parv[2], "DUMP"))
+				{
+					tmp = trace_dump();
+					sendto_one(sptr, ":%s NOTICE %s :%s",
+						ME, parv[0], (tmp < 0) ?
+						"Cannot dump the trace" :
+						"Trace dumped");
+					break;
+				}
+				if ((tmp = trace_mask(parv[2])) < 0)
+				{
+					sendto_one(sptr, ":%s NOTICE %s SET "
+						":Illegal value for TRACE. "
+						"Possible values: CONN PARSE "
+						"SEND MEM (comma separated) "
+						"ALL OFF DUMP", ME, parv[0]);
+					break;
+				}
+				if (tmp != iconf.trace)
+				{
+					/* trace_cats() has a static buffer */
+					strcpy(old, trace_cats(iconf.trace));
+					sendto_flag(SCH_NOTICE, "%s changed"
+						" value of TRACE from %s to %s",
+						sptr->name, old,
+						trace_cats(tmp));
+					iconf.trace = tmp;
+				}
+				break;
+			}
+#endif
 		} /* switch(acmd) */
 	} /* parc > 2 */
 
@@ -3392,6 +3553,30 @@ int	m_set(aClient *cptr, aClient *sptr, int parc, char *parv[])
 				ME, parv[0], iconf.split_minservers,
 				iconf.split_minusers);
 		}
+		if (acmd & TSET_CMDPROF)
+		{
+			sendto_one(sptr, ":%s NOTICE %s :CMDPROF = %s", ME,
+				parv[0], iconf.cmdprof ? "ON" : "OFF");
+		}
+		if (acmd & TSET_WATCHDOG)
+		{
+			sendto_one(sptr, ":%s NOTICE %s :WATCHDOG = %d", ME,
+				parv[0], iconf.watchdog);
+		}
+#ifdef USE_CAPTURE
+		if (acmd & TSET_CAPTURE)
+		{
+			sendto_one(sptr, ":%s NOTICE %s :CAPTURE = %s", ME,
+				parv[0], iconf.capture ? "ON" : "OFF");
+		}
+#endif
+#ifdef USE_TRACE
+		if (acmd & TSET_TRACE)
+		{
+			sendto_one(sptr, ":%s NOTICE %s :TRACE = %s", ME,
+				parv[0], trace_cats(iconf.trace));
+		}
+#endif
 	}
 	return 1;
 }
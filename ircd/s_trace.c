@@ -0,0 +1,237 @@
+/************************************************************************
+ *   IRC - Internet Relay Chat, ircd/s_trace.c
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 1, or (at your option)
+ *   any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * Trace ring: hot points of the server record fixed size events (time,
+ * event, fd and three integers) in a ring of TRACE_SIZE records, for the
+ * categories set with SET TRACE.  A category which is off costs a test
+ * of iconf.trace where its events are, nothing else.
+ *
+ * The server is single threaded and signal handlers only set a flag,
+ * so the ring needs no locking.  SET TRACE DUMP, or a SIGWINCH, writes
+ * it to IRCDTRACE_PATH with the tables needed to decode it (see
+ * s_trace_def.h and contrib/ircdtrace).
+ */
+
+#ifndef lint
+static const volatile char rcsid[] = "@(#)$Id$";
+#endif
+
+#include "os.h"
+#include "s_defines.h"
+#define S_TRACE_C
+#include "s_externs.h"
+#undef S_TRACE_C
+
+#ifdef USE_TRACE
+
+#if (TRACE_SIZE & (TRACE_SIZE - 1))
+# error TRACE_SIZE must be a power of 2
+#endif
+
+static	aTraceRec ring[TRACE_SIZE];
+static	u_long	tracepos = 0;		/* events recorded so far */
+
+static	struct	{
+	int	cat;
+	char	*name;
+} tcats[] = {
+	{ TRACE_CONN, "CONN" },
+	{ TRACE_PARSE, "PARSE" },
+	{ TRACE_SEND, "SEND" },
+	{ TRACE_MEM, "MEM" },
+	{ 0, NULL }
+};
+
+/*
+** Arguments are integers, "name:c" is a character (exit codes), "name:m"
+** an index in the command table.
+*/
+static	struct	{
+	int	event, cat;
+	char	*name, *args;
+} tevents[] = {
+	{ TEV_ACCEPT, TRACE_CONN, "accept", "port listener" },
+	{ TEV_REGUSER, TRACE_CONN, "register-user", "clients" },
+	{ TEV_REGSERVER, TRACE_CONN, "register-server", "servers" },
+	{ TEV_PARSE, TRACE_PARSE, "parse", "cmd:m status parc" },
+	{ TEV_PARTIAL, TRACE_SEND, "partial-write", "written tried sendq" },
+	{ TEV_DEADLINK, TRACE_CONN, "dead-link", "exitc:c sendq" },
+	{ TEV_EXIT, TRACE_CONN, "exit", "exitc:c status" },
+	{ TEV_HASHGROW, TRACE_MEM, "hash-grow", "from to" },
+	{ TEV_POOLGROW, TRACE_MEM, "poolsize-grow", "from to" },
+	{ 0, 0, NULL, NULL }
+};
+
+/*
+** trace_emit
+**	Records an event, called by the TRACE() macro.
+*/
+void	trace_emit(int event, int fd, int a, int b, int c)
+{
+	aTraceRec *rec = &ring[tracepos++ & (TRACE_SIZE - 1)];
+	struct	timeval	tv;
+
+	(void)gettimeofday(&tv, NULL);
+	rec->sec = (u_int) tv.tv_sec;
+	rec->usec = (u_int) tv.tv_usec;
+	rec->event = (u_short) event;
+	rec->fd = (short) fd;
+	rec->arg[0] = a;
+	rec->arg[1] = b;
+	rec->arg[2] = c;
+}
+
+/*
+** trace_mask
+**	Categories from "CONN,PARSE", "ALL" or "OFF", -1 if one is unknown.
+*/
+int	trace_mask(char *cats)
+{
+	char	buf[BUFSIZE], *s, *p = NULL;
+	int	i, mask = 0;
+
+	strncpyzt(buf, cats, sizeof(buf));
+	for (s = strtoken(&p, buf, ","); s; s = strtoken(&p, NULL, ","))
+	    {
+		if (!mycmp(s, "ALL"))
+		    {
+			mask |= TRACE_ALL;
+			continue;
+		    }
+		if (!mycmp(s, "OFF"))
+			continue;
+		for (i = 0; tcats[i].name; i++)
+			if (!mycmp(s, tcats[i].name))
+				break;
+		if (!tcats[i].name)
+			return -1;
+		mask |= tcats[i].cat;
+	    }
+	return mask;
+}
+
+/*
+** trace_cats
+**	The reverse of trace_mask().
+*/
+char	*trace_cats(int mask)
+{
+	static	char	buf[64];
+	int	i;
+
+	buf[0] = '\0';
+	for (i = 0; tcats[i].name; i++)
+		if (mask & tcats[i].cat)
+		    {
+			if (buf[0])
+				strcat(buf, ",");
+			strcat(buf, tcats[i].name);
+		    }
+	return buf[0] ? buf : "OFF";
+}
+
+static	char	*trace_catname(int cat)
+{
+	int	i;
+
+	for (i = 0; tcats[i].name; i++)
+		if (tcats[i].cat == cat)
+			return tcats[i].name;
+	return "?";
+}
+
+static	void	trace_table(char **buf, int *len, int *size, char *line,
+			    int llen)
+{
+	if (*len + llen > *size)
+		*buf = (char *)MyRealloc(*buf, *size *= 2);
+	memcpy(*buf + *len, line, llen);
+	*len += llen;
+}
+
+/*
+** trace_dump
+**	Writes the ring to IRCDTRACE_PATH, returns how many records, or -1.
+**	The ring is left as it is.
+*/
+int	trace_dump(void)
+{
+	aTraceHead head;
+	aTraceRec rec;
+	struct	Message	*mptr;
+	char	*tables, line[BUFSIZE];
+	int	tlen = 0, tsize = 4096, len;
+	u_long	first, pos;
+	FILE	*fp;
+	int	i;
+
+	if (!(fp = fopen(IRCDTRACE_PATH, "w")))
+	    {
+		sendto_flag(SCH_ERROR, "Cannot open %s (%s)",
+			    IRCDTRACE_PATH, strerror(errno));
+		return -1;
+	    }
+	/* the events, then the commands, a line each */
+	tables = (char *)MyMalloc(tsize);
+	for (i = 0; tevents[i].name; i++)
+	    {
+		len = sprintf(line, "%d %s %s %s\n", tevents[i].event,
+			      trace_catname(tevents[i].cat), tevents[i].name,
+			      tevents[i].args);
+		trace_table(&tables, &tlen, &tsize, line, len);
+	    }
+	trace_table(&tables, &tlen, &tsize, "-\n", 2);
+	for (mptr = msgtab; mptr->cmd; mptr++)
+	    {
+		len = sprintf(line, "%s\n", mptr->cmd);
+		trace_table(&tables, &tlen, &tsize, line, len);
+	    }
+
+	first = (tracepos > TRACE_SIZE) ? tracepos - TRACE_SIZE : 0;
+	bzero((char *)&head, sizeof(head));
+	memcpy(head.magic, TRACE_MAGIC, sizeof(head.magic));
+	head.dumped = htonl((u_int) timeofday);
+	head.records = htonl((u_int) (tracepos - first));
+	head.lost = htonl((u_int) first);
+	head.tables = htonl((u_int) tlen);
+	(void)fwrite((char *)&head, sizeof(head), 1, fp);
+	(void)fwrite(tables, tlen, 1, fp);
+	MyFree(tables);
+	for (pos = first; pos < tracepos; pos++)
+	    {
+		rec = ring[pos & (TRACE_SIZE - 1)];
+		rec.sec = htonl(rec.sec);
+		rec.usec = htonl(rec.usec);
+		rec.event = htons(rec.event);
+		rec.fd = htons(rec.fd);
+		for (i = 0; i < 3; i++)
+			rec.arg[i] = htonl(rec.arg[i]);
+		(void)fwrite((char *)&rec, sizeof(rec), 1, fp);
+	    }
+	if (fclose(fp) == EOF)
+	    {
+		sendto_flag(SCH_ERROR, "Cannot write %s (%s)",
+			    IRCDTRACE_PATH, strerror(errno));
+		return -1;
+	    }
+	sendto_flag(SCH_NOTICE, "Trace dumped to %s (%lu events)",
+		    IRCDTRACE_PATH, tracepos - first);
+	return (int) (tracepos - first);
+}
+#endif /* USE_TRACE */
@@ -0,0 +1,61 @@
+/************************************************************************
+ *   IRC - Internet Relay Chat, ircd/s_trace_def.h
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 1, or (at your option)
+ *   any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+** Trace ring, see s_trace.c.  Events are recorded when their category is
+** in iconf.trace (SET TRACE).
+*/
+#define	TRACE_CONN	0x01	/* accept, registration, dead link, exit */
+#define	TRACE_PARSE	0x02	/* command dispatch */
+#define	TRACE_SEND	0x04	/* partial writes */
+#define	TRACE_MEM	0x08	/* hash tables and poolsize growing */
+#define	TRACE_ALL	0x0f
+
+/* events, their names and arguments are in s_trace.c */
+#define	TEV_ACCEPT	1
+#define	TEV_REGUSER	2
+#define	TEV_REGSERVER	3
+#define	TEV_PARSE	4
+#define	TEV_PARTIAL	5
+#define	TEV_DEADLINK	6
+#define	TEV_EXIT	7
+#define	TEV_HASHGROW	8
+#define	TEV_POOLGROW	9
+#define	TEV_MAX		10
+
+typedef	struct	{
+	u_int	sec, usec;
+	u_short	event;		/* TEV_* */
+	short	fd;		/* -1 if none */
+	int	arg[3];
+} aTraceRec;
+
+/*
+** Dump file: a header, the event table (for each event, one line with its
+** number, category, name and arguments), the command names (one per
+** line), then the records, oldest first.  Integers are in network order.
+*/
+#define	TRACE_MAGIC	"ircdtrc1"
+
+typedef	struct	{
+	char	magic[8];	/* TRACE_MAGIC, not terminated */
+	u_int	dumped;		/* when */
+	u_int	records;	/* how many follow the tables */
+	u_int	lost;		/* overwritten before the dump */
+	u_int	tables;		/* bytes of event and command tables */
+} aTraceHead;
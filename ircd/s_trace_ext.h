@@ -0,0 +1,42 @@
+/************************************************************************
+ *   IRC - Internet Relay Chat, ircd/s_trace_ext.h
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 1, or (at your option)
+ *   any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*  This file contains external definitions for global variables and functions
+    defined in ircd/s_trace.c.
+ */
+
+#ifdef USE_TRACE
+/*  External definitions for global functions.
+ */
+#ifndef S_TRACE_C
+#define EXTERN extern
+#else /* S_TRACE_C */
+#define EXTERN
+#endif /* S_TRACE_C */
+EXTERN void trace_emit (int event, int fd, int a, int b, int c);
+EXTERN int trace_dump (void);
+EXTERN int trace_mask (char *cats);
+EXTERN char *trace_cats (int mask);
+#undef EXTERN
+
+/* costs a test when the category is not traced */
+#define	TRACE(cat, ev, fd, a, b, c)	do { if (iconf.trace & (cat)) \
+				trace_emit(ev, fd, a, b, c); } while (0)
+#else
+#define	TRACE(cat, ev, fd, a, b, c)
+#endif /* USE_TRACE */
@@ -0,0 +1,1174 @@
+/************************************************************************
+ *   IRC - Internet Relay Chat, ircd/s_upgrade.c
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 1, or (at your option)
+ *   any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * Live upgrade: RESTART UPGRADE starts the new binary with a unix socket
+ * (-U fd), the new ircd says hello once its configuration is loaded, then
+ * gets a snapshot of the network state along with all the sockets
+ * (SCM_RIGHTS) and takes over without dropping any connection.
+ *
+ * What cannot be carried is closed before the snapshot is taken:
+ * unregistered connections, local services, links still bursting and
+ * compressed links (a new link resynchronizes them).
+ */
+
+#ifndef lint
+static const volatile char rcsid[] = "@(#)$Id$";
+#endif
+
+#include "os.h"
+#include "s_defines.h"
+#define S_UPGRADE_C
+#include "s_externs.h"
+#undef S_UPGRADE_C
+
+int	upgradefd = -1;		/* -U, socket to the previous ircd */
+
+#define	UPGRADE_MAGIC	"IRCDUPG2"
+#define	UPGRADE_HELLO	5	/* seconds for the new ircd to start */
+#define	UPGRADE_TIMEOUT	60	/* seconds for it to load the snapshot */
+#define	UPGRADE_FDBATCH	128	/* descriptors per message */
+/* client flags which make sense in the new ircd */
+#ifdef JAPANESE
+#define	UPGRADE_FLAGS	(FLAGS_PINGSENT|FLAGS_XAUTHDONE|FLAGS_LOCAL|\
+			 FLAGS_GOTID|FLAGS_NONL|FLAGS_UNKCMD|FLAGS_EOB|\
+			 FLAGS_JP)
+#else
+#define	UPGRADE_FLAGS	(FLAGS_PINGSENT|FLAGS_XAUTHDONE|FLAGS_LOCAL|\
+			 FLAGS_GOTID|FLAGS_NONL|FLAGS_UNKCMD|FLAGS_EOB)
+#endif
+
+static	char	*ubuf = NULL;		/* the snapshot */
+static	long	ulen = 0, usize = 0, upos = 0;
+static	int	*ufds = NULL;		/* descriptors going with it */
+static	int	unfds = 0, ufdsize = 0;
+static	int	uerror = 0;
+static	aClient	**ulisteners = NULL;
+static	int	unlisteners = 0;
+
+/*
+ * The snapshot is a flat buffer: integers are 8 bytes, big endian;
+ * strings are a length (-1 for NULL) and the bytes, NUL included.
+ */
+static	void	upgrade_grow(long len)
+{
+	if (ulen + len <= usize)
+		return;
+	while (ulen + len > usize)
+		usize = usize ? usize * 2 : 65536;
+	ubuf = (char *)MyRealloc(ubuf, usize);
+}
+
+void	upgrade_put_int(long l)
+{
+	int	i;
+
+	upgrade_grow(8);
+	for (i = 7; i >= 0; i--, l >>= 8)
+		ubuf[ulen + i] = (char)(l & 0xff);
+	ulen += 8;
+}
+
+void	upgrade_put_data(char *s, int len)
+{
+	upgrade_put_int(len);
+	upgrade_grow(len + 1);
+	if (len > 0)
+		bcopy(s, ubuf + ulen, len);
+	ubuf[ulen + len] = '\0';
+	ulen += len + 1;
+}
+
+void	upgrade_put_str(char *s)
+{
+	if (!s)
+		upgrade_put_int(-1);
+	else
+		upgrade_put_data(s, strlen(s));
+}
+
+static	void	upgrade_put_fd(int fd)
+{
+	if (unfds == ufdsize)
+	    {
+		ufdsize = ufdsize ? ufdsize * 2 : 256;
+		ufds = (int *)MyRealloc((char *)ufds, ufdsize * sizeof(int));
+	    }
+	upgrade_put_int(unfds);
+	ufds[unfds++] = fd;
+}
+
+long	upgrade_get_int(void)
+{
+	long	l = 0;
+	int	i;
+
+	if (upos + 8 > ulen)
+	    {
+		uerror = 1;
+		return 0;
+	    }
+	for (i = 0; i < 8; i++)
+		l = (l << 8) | (u_char)ubuf[upos++];
+	return l;
+}
+
+/*
+ * returns a pointer in the snapshot, NULL if it was, or on error.
+ */
+char	*upgrade_get_data(int *len)
+{
+	char	*s;
+	long	l = upgrade_get_int();
+
+	*len = 0;
+	if (l == -1 || uerror)
+		return NULL;
+	if (l < 0 || upos + l + 1 > ulen)
+	    {
+		uerror = 1;
+		return NULL;
+	    }
+	s = ubuf + upos;
+	upos += l + 1;
+	*len = (int)l;
+	return s;
+}
+
+char	*upgrade_get_str(void)
+{
+	int	len;
+
+	return upgrade_get_data(&len);
+}
+
+/*
+ * same, for fields which are never NULL: "" instead.
+ */
+char	*upgrade_get_strz(void)
+{
+	char	*s = upgrade_get_str();
+
+	return s ? s : "";
+}
+
+static	int	upgrade_get_fd(void)
+{
+	long	i = upgrade_get_int();
+
+	if (i < 0 || i >= unfds)
+	    {
+		uerror = 1;
+		return -1;
+	    }
+	return ufds[i];
+}
+
+/*
+ * upgrade_argv
+ *	returns a copy of av without -U, with "-U fd" added if fd >= 0.
+ */
+char	**upgrade_argv(char **av, int fd)
+{
+	char	**nav, num[16];
+	int	i, n;
+
+	for (n = 0; av[n]; n++)
+		;
+	nav = (char **)MyMalloc((n + 3) * sizeof(char *));
+	for (i = n = 0; av[i]; i++)
+	    {
+		if (!strncmp(av[i], "-U", 2))
+		    {
+			if (av[i][2] == '\0' && av[i+1] && av[i+1][0] != '-')
+				i++;
+			continue;
+		    }
+		nav[n++] = av[i];
+	    }
+	if (fd >= 0)
+	    {
+		sprintf(num, "%d", fd);
+		nav[n++] = "-U";
+		nav[n++] = mystrdup(num);
+	    }
+	nav[n] = NULL;
+	return nav;
+}
+
+/*
+ * wait up to secs for fd to be readable, returns > 0 if it is.
+ */
+static	int	upgrade_wait(int fd, int secs)
+{
+#ifdef USE_POLL
+	struct	pollfd	pfd;
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	return poll(&pfd, 1, secs * 1000);
+#else
+	fd_set	rfds;
+	struct	timeval	tv;
+
+	FD_ZERO(&rfds);
+	FD_SET(fd, &rfds);
+	tv.tv_sec = secs;
+	tv.tv_usec = 0;
+	return select(fd + 1, &rfds, NULL, NULL, &tv);
+#endif
+}
+
+/*
+ * read a line (without the \n), returns its length or -1.
+ */
+static	int	upgrade_readline(int fd, char *line, int size, int secs)
+{
+	int	n = 0;
+
+	while (n < size - 1)
+	    {
+		if (secs && upgrade_wait(fd, secs) <= 0)
+			return -1;
+		if (read(fd, line + n, 1) != 1)
+			return -1;
+		if (line[n] == '\n')
+			break;
+		n++;
+	    }
+	line[n] = '\0';
+	return n;
+}
+
+static	int	upgrade_write(int fd, char *s, long len)
+{
+	long	n;
+
+	while (len > 0)
+	    {
+		if ((n = write(fd, s, len)) <= 0)
+		    {
+			if (n < 0 && (errno == EINTR || errno == EAGAIN))
+				continue;
+			return -1;
+		    }
+		s += n;
+		len -= n;
+	    }
+	return 0;
+}
+
+static	int	upgrade_read(int fd, char *s, long len)
+{
+	long	n;
+
+	while (len > 0)
+	    {
+		if ((n = read(fd, s, len)) <= 0)
+		    {
+			if (n < 0 && errno == EINTR)
+				continue;
+			return -1;
+		    }
+		s += n;
+		len -= n;
+	    }
+	return 0;
+}
+
+/*
+ * descriptors go UPGRADE_FDBATCH at a time, each batch with one byte.
+ */
+static	int	upgrade_sendfds(int fd, int *fds, int n)
+{
+	struct	msghdr	msg;
+	struct	iovec	iov;
+	struct	cmsghdr	*cm;
+	union	{
+		struct	cmsghdr	hdr;
+		char	buf[CMSG_SPACE(sizeof(int) * UPGRADE_FDBATCH)];
+	} cmsg;
+	char	c = 'F';
+	int	cnt;
+
+	while (n > 0)
+	    {
+		cnt = MIN(n, UPGRADE_FDBATCH);
+		bzero((char *)&msg, sizeof(msg));
+		iov.iov_base = &c;
+		iov.iov_len = 1;
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = cmsg.buf;
+		msg.msg_controllen = CMSG_SPACE(sizeof(int) * cnt);
+		cm = CMSG_FIRSTHDR(&msg);
+		cm->cmsg_level = SOL_SOCKET;
+		cm->cmsg_type = SCM_RIGHTS;
+		cm->cmsg_len = CMSG_LEN(sizeof(int) * cnt);
+		bcopy((char *)fds, (char *)CMSG_DATA(cm), sizeof(int) * cnt);
+		while (sendmsg(fd, &msg, 0) != 1)
+			if (errno != EINTR)
+				return -1;
+		fds += cnt;
+		n -= cnt;
+	    }
+	return 0;
+}
+
+static	int	upgrade_recvfds(int fd, int *fds, int n)
+{
+	struct	msghdr	msg;
+	struct	iovec	iov;
+	struct	cmsghdr	*cm;
+	union	{
+		struct	cmsghdr	hdr;
+		char	buf[CMSG_SPACE(sizeof(int) * UPGRADE_FDBATCH)];
+	} cmsg;
+	char	c;
+	int	cnt;
+
+	while (n > 0)
+	    {
+		cnt = MIN(n, UPGRADE_FDBATCH);
+		bzero((char *)&msg, sizeof(msg));
+		iov.iov_base = &c;
+		iov.iov_len = 1;
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = cmsg.buf;
+		msg.msg_controllen = sizeof(cmsg.buf);
+		while (recvmsg(fd, &msg, 0) != 1)
+			if (errno != EINTR)
+				return -1;
+		if ((msg.msg_flags & MSG_CTRUNC) ||
+		    !(cm = CMSG_FIRSTHDR(&msg)) ||
+		    cm->cmsg_level != SOL_SOCKET ||
+		    cm->cmsg_type != SCM_RIGHTS ||
+		    cm->cmsg_len != CMSG_LEN(sizeof(int) * cnt))
+			return -1;
+		bcopy((char *)CMSG_DATA(cm), (char *)fds, sizeof(int) * cnt);
+		fds += cnt;
+		n -= cnt;
+	    }
+	return 0;
+}
+
+/*
+ * configuration lines are looked up in the new ircd.conf, those which
+ * are gone get an illegal copy, freed when the last client leaves.
+ */
+static	void	save_conf(aConfItem *aconf)
+{
+	upgrade_put_int(aconf->status & ~CONF_ILLEGAL);
+	upgrade_put_str(aconf->host);
+	upgrade_put_str(aconf->passwd);
+	upgrade_put_str(aconf->name);
+	upgrade_put_int(aconf->port);
+	upgrade_put_int(Class(aconf) ? Class(Class(aconf)) : 0);
+	upgrade_put_int(aconf->flags);
+}
+
+static	aConfItem	*load_conf(void)
+{
+	aConfItem	tmp, *aconf;
+	int	class;
+
+	bzero((char *)&tmp, sizeof(tmp));
+	tmp.status = upgrade_get_int();
+	tmp.host = upgrade_get_str();
+	tmp.passwd = upgrade_get_str();
+	tmp.name = upgrade_get_str();
+	tmp.port = upgrade_get_int();
+	class = upgrade_get_int();
+	tmp.flags = upgrade_get_int();
+	if (uerror)
+		return NULL;
+	if ((aconf = find_conf_entry(&tmp, tmp.status)) && !IsIllegal(aconf))
+		return aconf;
+
+	aconf = make_conf();
+	aconf->status = tmp.status | CONF_ILLEGAL;
+	DupString(aconf->host, tmp.host ? tmp.host : "");
+	DupString(aconf->passwd, tmp.passwd ? tmp.passwd : "");
+	DupString(aconf->name, tmp.name ? tmp.name : "");
+	istat.is_confmem += strlen(aconf->host) + 1;
+	istat.is_confmem += strlen(aconf->passwd) + 1;
+	istat.is_confmem += strlen(aconf->name) + 1;
+	aconf->port = tmp.port;
+	aconf->flags = tmp.flags;
+	Class(aconf) = find_class(class);
+	aconf->next = conf;
+	conf = aconf;
+	return aconf;
+}
+
+/*
+ * what is needed for connections to this server
+ */
+static	void	save_local(aClient *cptr)
+{
+	Link	*lp;
+	int	i, n;
+	char	*buf;
+
+	upgrade_put_fd(cptr->fd);
+	for (i = 0, lp = NULL; i < unlisteners; i++)
+		if (ulisteners[i] == cptr->acpt)
+			break;
+	upgrade_put_int(i < unlisteners ? i : -1);
+	upgrade_put_int(cptr->lasttime);
+	upgrade_put_int(cptr->firsttime);
+	upgrade_put_int(cptr->since);
+	upgrade_put_int(cptr->sendM);
+	upgrade_put_int(cptr->receiveM);
+	upgrade_put_int((long)cptr->sendB);
+	upgrade_put_int((long)cptr->receiveB);
+	upgrade_put_int(cptr->lastsq);
+	upgrade_put_int(cptr->exitc);
+	upgrade_put_str(cptr->username);
+	upgrade_put_str(cptr->auth == cptr->username ? NULL : cptr->auth);
+	upgrade_put_str(cptr->sockhost);
+	upgrade_put_data((char *)&cptr->ip, sizeof(cptr->ip));
+	upgrade_put_int(cptr->port);
+#ifdef XLINE
+	upgrade_put_str(cptr->user2);
+	upgrade_put_str(cptr->user3);
+#else
+	upgrade_put_str(NULL);
+	upgrade_put_str(NULL);
+#endif
+	upgrade_put_data(cptr->buffer, cptr->count);
+
+	/* the queues are copied, the old ircd keeps them if this fails */
+	n = DBufLength(&cptr->sendQ);
+	buf = (char *)MyMalloc(n + 1);
+	upgrade_put_data(buf, dbuf_copy(&cptr->sendQ, buf, n));
+	MyFree(buf);
+	n = DBufLength(&cptr->recvQ);
+	buf = (char *)MyMalloc(n + 1);
+	upgrade_put_data(buf, dbuf_copy(&cptr->recvQ, buf, n));
+	MyFree(buf);
+
+	for (n = 0, lp = cptr->confs; lp; lp = lp->next)
+		n++;
+	upgrade_put_int(n);
+	for (lp = cptr->confs; lp; lp = lp->next)
+		save_conf(lp->value.aconf);
+}
+
+static	int	load_local(aClient *cptr)
+{
+	aConfItem	**confs;
+	char	*s;
+	int	i, n, len;
+
+	if ((cptr->fd = upgrade_get_fd()) < 0)
+		return -1;
+	i = upgrade_get_int();
+	cptr->acpt = (i >= 0 && i < unlisteners) ? ulisteners[i] : &me;
+	if (cptr->acpt != &me)
+		cptr->acpt->confs->value.aconf->clients++;
+	cptr->lasttime = upgrade_get_int();
+	cptr->firsttime = upgrade_get_int();
+	cptr->since = upgrade_get_int();
+	cptr->sendM = upgrade_get_int();
+	cptr->receiveM = upgrade_get_int();
+	cptr->sendB = upgrade_get_int();
+	cptr->receiveB = upgrade_get_int();
+	cptr->lastsq = upgrade_get_int();
+	cptr->exitc = upgrade_get_int();
+	strncpyzt(cptr->username, upgrade_get_strz(), USERLEN+1);
+	if ((s = upgrade_get_str()))
+	    {
+		cptr->auth = mystrdup(s);
+		istat.is_authmem += strlen(cptr->auth) + 1;
+		istat.is_auth += 1;
+	    }
+	strncpyzt(cptr->sockhost, upgrade_get_strz(), HOSTLEN+1);
+	if ((s = upgrade_get_data(&len)) && len == sizeof(cptr->ip))
+		bcopy(s, (char *)&cptr->ip, len);
+	cptr->port = upgrade_get_int();
+#ifdef XLINE
+	if ((s = upgrade_get_str()))
+		cptr->user2 = mystrdup(s);
+	if ((s = upgrade_get_str()))
+		cptr->user3 = mystrdup(s);
+#else
+	(void)upgrade_get_str();
+	(void)upgrade_get_str();
+#endif
+	if ((s = upgrade_get_data(&len)) && len < BUFSIZE)
+	    {
+		bcopy(s, cptr->buffer, len);
+		cptr->count = len;
+	    }
+	if ((s = upgrade_get_data(&len)) && len > 0)
+		(void)dbuf_put(&cptr->sendQ, s, len);
+	if ((s = upgrade_get_data(&len)) && len > 0)
+		(void)dbuf_put(&cptr->recvQ, s, len);
+
+	/* attach them in the same order */
+	n = upgrade_get_int();
+	if (n < 0 || n > 64)
+		return -1;
+	confs = (aConfItem **)MyMalloc((n + 1) * sizeof(aConfItem *));
+	for (i = 0; i < n; i++)
+		confs[i] = load_conf();
+	while (--i >= 0)
+		if (confs[i])
+			reattach_conf(cptr, confs[i]);
+	MyFree(confs);
+
+	local[cptr->fd] = cptr;
+	if (cptr->fd > highest_fd)
+		highest_fd = cptr->fd;
+	add_fd(cptr->fd, &fdall);
+	set_non_blocking(cptr->fd, cptr);
+	return uerror ? -1 : 0;
+}
+
+static	void	save_listeners(void)
+{
+	aClient	*acptr;
+	int	n;
+
+	for (n = 0, acptr = ListenerLL; acptr; acptr = acptr->next)
+		n++;
+	ulisteners = (aClient **)MyMalloc((n + 1) * sizeof(aClient *));
+	unlisteners = 0;
+	upgrade_put_int(n);
+	for (acptr = ListenerLL; acptr; acptr = acptr->next)
+	    {
+		ulisteners[unlisteners++] = acptr;
+		save_conf(acptr->confs->value.aconf);
+		upgrade_put_str(acptr->sockhost);
+		upgrade_put_str(acptr->auth == acptr->username ?
+				NULL : acptr->auth);
+		upgrade_put_int(IsListenerInactive(acptr) ? 1 : 0);
+		if (acptr->fd >= 0)
+		    {
+			upgrade_put_int(1);
+			upgrade_put_fd(acptr->fd);
+		    }
+		else
+			upgrade_put_int(0);
+	    }
+}
+
+static	int	load_listeners(void)
+{
+	struct	SOCKADDR_IN	addr;
+	SOCK_LEN_TYPE	len;
+	aConfItem	*aconf;
+	aClient	*acptr;
+	char	*host, *auth;
+	int	i, n, inactive, fd;
+
+	n = upgrade_get_int();
+	if (n < 0 || n > MAXCONNECTIONS)
+		return -1;
+	ulisteners = (aClient **)MyMalloc((n + 1) * sizeof(aClient *));
+	for (unlisteners = 0; unlisteners < n; unlisteners++)
+	    {
+		if (!(aconf = load_conf()))
+			return -1;
+		host = upgrade_get_str();
+		auth = upgrade_get_str();
+		inactive = upgrade_get_int();
+		fd = upgrade_get_int() ? upgrade_get_fd() : -1;
+		for (acptr = ListenerLL; acptr; acptr = acptr->next)
+			if (acptr->confs->value.aconf == aconf &&
+			    acptr->fd < 0)
+				break;
+		if (!acptr)
+		    {
+			/* gone from ircd.conf, closed by close_listeners() */
+			(void)add_listener(aconf);
+			acptr = ListenerLL;
+		    }
+		ulisteners[unlisteners] = acptr;
+		if (fd < 0)
+			continue;
+		acptr->fd = fd;
+		strncpyzt(acptr->sockhost, host ? host : "", HOSTLEN+1);
+		if (auth)
+			DupString(acptr->auth, auth);
+		len = sizeof(addr);
+		if (!getsockname(fd, (struct SOCKADDR *)&addr, &len))
+#ifdef INET6
+			bcopy(addr.sin6_addr.s6_addr, acptr->ip.s6_addr,
+			      IN6ADDRSZ);
+#else
+			acptr->ip.s_addr = addr.sin_addr.s_addr;
+#endif
+		acptr->port = aconf->port;
+		local[fd] = acptr;
+		if (fd > highest_fd)
+			highest_fd = fd;
+		add_fd(fd, &fdas);
+		add_fd(fd, &fdall);
+		set_non_blocking(fd, acptr);
+		if (inactive)
+			SetListenerInactive(acptr);
+		else
+		    {
+			ClearListenerInactive(acptr);
+			(void)listen(fd, LISTENQUEUE);
+		    }
+	    }
+	for (i = 0; i < unlisteners; i++)
+		if (!ulisteners[i])
+			return -1;
+	return uerror ? -1 : 0;
+}
+
+/*
+ * servers are written from the top of the tree down, so that the
+ * uplink is always known when loading; siblings last first, as
+ * add_server_to_tree() prepends.
+ */
+static	void	save_servers(aClient *up)
+{
+	aClient	*acptr, *last;
+
+	if (!(last = up->serv->down))
+		return;
+	while (last->serv->right)
+		last = last->serv->right;
+	for (acptr = last; acptr; acptr = (acptr == up->serv->down) ?
+	     NULL : acptr->serv->left)
+	    {
+		upgrade_put_int(1);
+		upgrade_put_str(acptr->serv->sid);
+		upgrade_put_str(up->serv->sid);
+		upgrade_put_int(MyConnect(acptr) ? 1 : 0);
+		upgrade_put_str(acptr->serv->namebuf);
+		upgrade_put_int(acptr->hopcount);
+		upgrade_put_int(acptr->flags & UPGRADE_FLAGS);
+		upgrade_put_str(acptr->info);
+		upgrade_put_str(acptr->serv->verstr);
+		upgrade_put_int(acptr->serv->version);
+		upgrade_put_str(acptr->serv->maskedby->serv->sid);
+		upgrade_put_str(acptr->serv->by);
+		upgrade_put_str(acptr->serv->byuid);
+		if (MyConnect(acptr))
+			save_local(acptr);
+		save_servers(acptr);
+	    }
+}
+
+static	int	load_server(void)
+{
+	aClient	*acptr, *up, *mask;
+	char	*sid, *s;
+	Link	*lp;
+	int	local;
+
+	sid = upgrade_get_str();
+	s = upgrade_get_str();
+	if (!sid || !s || !(up = find_sid(s, NULL)) || !up->serv)
+		return -1;
+	/* remote servers only take the common part of aClient */
+	local = upgrade_get_int();
+	acptr = make_client(local ? NULL : up->from);
+	make_server(acptr);
+	strncpyzt(acptr->serv->namebuf, upgrade_get_strz(),
+		  sizeof(acptr->serv->namebuf));
+	acptr->hopcount = upgrade_get_int();
+	acptr->flags = upgrade_get_int();
+	if ((s = upgrade_get_str()))
+		acptr->info = mystrdup(s);
+	acptr->serv->up = up;
+	strncpyzt(acptr->serv->verstr, upgrade_get_strz(),
+		  sizeof(acptr->serv->verstr));
+	acptr->serv->version = upgrade_get_int();
+	s = upgrade_get_str();
+	if (!s || !strcmp(s, sid))
+		mask = acptr;
+	else if (!(mask = find_sid(s, NULL)) || !mask->serv)
+		return -1;
+	acptr->serv->maskedby = mask;
+	strncpyzt(acptr->serv->by, upgrade_get_strz(), NICKLEN+1);
+	strncpyzt(acptr->serv->byuid, upgrade_get_strz(), UIDLEN+1);
+	if (acptr->serv->by[0] == '*')
+		acptr->serv->by[0] = acptr->serv->byuid[0] = '\0';
+	acptr->serv->snum = (mask == acptr) ?
+		find_server_num(acptr->name) : mask->serv->snum;
+	SetServer(acptr);
+	if (mask == acptr)
+		istat.is_serv++;
+	else
+		istat.is_masked++;
+	if (acptr->flags & FLAGS_EOB)
+		istat.is_eobservers++;
+	add_client_to_list(acptr);
+	register_server(acptr);
+	strncpyzt(acptr->serv->sid, sid, SIDLEN+1);
+	add_to_sid_hash_table(acptr->serv->sid, acptr);
+	add_server_to_tree(acptr);
+	if (mask == acptr)
+		(void)add_to_client_hash_table(acptr->name, acptr);
+	if (local)
+	    {
+		if (load_local(acptr))
+			return -1;
+		for (lp = acptr->confs; lp; lp = lp->next)
+			if (lp->value.aconf->status & CONF_NOCONNECT_SERVER)
+			    {
+				acptr->serv->nline = lp->value.aconf;
+				break;
+			    }
+		istat.is_myserv++;
+		add_fd(acptr->fd, &fdas);
+	    }
+	return uerror ? -1 : 0;
+}
+
+static	void	save_services(void)
+{
+	aClient	*acptr;
+	int	n;
+
+	for (n = 0, acptr = client; acptr; acptr = acptr->next)
+		if (IsService(acptr))
+			n++;
+	upgrade_put_int(n);
+	for (acptr = client; acptr; acptr = acptr->next)
+	    {
+		if (!IsService(acptr))
+			continue;
+		upgrade_put_str(acptr->service->namebuf);
+		upgrade_put_str(acptr->service->servp->sid);
+		upgrade_put_int(acptr->hopcount);
+		upgrade_put_str(acptr->info);
+		upgrade_put_str(acptr->service->dist);
+		upgrade_put_int(acptr->service->wants);
+		upgrade_put_int(acptr->service->type);
+	    }
+}
+
+static	int	load_service(void)
+{
+	aClient	*acptr, *sptr;
+	aService *svc;
+	char	*name, *s;
+
+	name = upgrade_get_str();
+	s = upgrade_get_str();
+	if (!name || !s || !(sptr = find_sid(s, NULL)) || !sptr->serv)
+		return -1;
+	acptr = make_client(sptr->from);
+	svc = make_service(acptr);
+	add_client_to_list(acptr);
+	strncpyzt(svc->namebuf, name, sizeof(svc->namebuf));
+	acptr->hopcount = upgrade_get_int();
+	if ((s = upgrade_get_str()))
+		acptr->info = mystrdup(s);
+	strncpyzt(svc->dist, upgrade_get_strz(), HOSTLEN);
+	svc->wants = upgrade_get_int();
+	svc->type = upgrade_get_int();
+	istat.is_service++;
+	SetService(acptr);
+	svc->servp = sptr->serv;
+	sptr->serv->refcnt++;
+	svc->server = mystrdup(sptr->name);
+	reorder_client_in_list(acptr);
+	(void)add_to_client_hash_table(acptr->name, acptr);
+	return uerror ? -1 : 0;
+}
+
+static	void	save_users(void)
+{
+	aClient	*acptr;
+	int	n;
+
+	for (n = 0, acptr = client; acptr; acptr = acptr->next)
+		if (IsPerson(acptr))
+			n++;
+	upgrade_put_int(n);
+	for (acptr = client; acptr; acptr = acptr->next)
+	    {
+		if (!IsPerson(acptr))
+			continue;
+		upgrade_put_str(acptr->user->uid);
+		upgrade_put_str(acptr->name);
+		upgrade_put_str(acptr->user->servp->sid);
+		upgrade_put_int(acptr->hopcount);
+		upgrade_put_int(acptr->status);
+		upgrade_put_int(acptr->flags & UPGRADE_FLAGS);
+		upgrade_put_int(acptr->user->flags);
+		upgrade_put_str(acptr->user->username);
+		upgrade_put_str(acptr->user->host);
+		upgrade_put_str(acptr->user->sip);
+		upgrade_put_str(acptr->info);
+		upgrade_put_int(acptr->user->last);
+		upgrade_put_str(acptr->user->away);
+		upgrade_put_int(MyConnect(acptr) ? 1 : 0);
+		if (MyConnect(acptr))
+			save_local(acptr);
+	    }
+}
+
+static	int	load_user(void)
+{
+	aClient	*acptr, *sptr;
+	anUser	*user;
+	char	*uid, *nick, *s;
+
+	uid = upgrade_get_str();
+	nick = upgrade_get_str();
+	s = upgrade_get_str();
+	if (!uid || !nick || !s || !(sptr = find_sid(s, NULL)) || !sptr->serv)
+		return -1;
+	acptr = make_client((sptr == &me) ? NULL : sptr->from);
+	add_client_to_list(acptr);
+	user = make_user(acptr);
+	user->servp = sptr->serv;
+	sptr->serv->refcnt++;
+	user->server = find_server_string(sptr->serv->snum);
+	acptr->hopcount = upgrade_get_int();
+	acptr->status = upgrade_get_int();
+	acptr->flags = upgrade_get_int();
+	user->flags = upgrade_get_int();
+	set_istr(&user->username, upgrade_get_strz(), USERLEN);
+	set_istr(&user->host, upgrade_get_strz(), HOSTLEN);
+	set_istr(&user->sip, upgrade_get_strz(), HOSTLEN);
+	if ((s = upgrade_get_str()))
+		acptr->info = mystrdup(s);
+	user->last = upgrade_get_int();
+	if ((s = upgrade_get_str()))
+	    {
+		user->away = mystrdup(s);
+		istat.is_awaymem += strlen(s) + 1;
+	    }
+	strncpyzt(acptr->namebuf, nick, NICKLEN+1);
+	reorder_client_in_list(acptr);
+	(void)add_to_client_hash_table(acptr->name, acptr);
+	strncpyzt(user->uid, uid, UIDLEN+1);
+	(void)add_to_uid_hash_table(user->uid, acptr);
+
+	/* what register_user() and m_umode() count */
+	if (IsInvisible(acptr))
+	    {
+		istat.is_user[1]++;
+		user->servp->usercnt[1]++;
+	    }
+	else
+	    {
+		istat.is_user[0]++;
+		user->servp->usercnt[0]++;
+	    }
+	if (IsAnOper(acptr))
+	    {
+		istat.is_oper++;
+		user->servp->usercnt[2]++;
+	    }
+	if (user->flags & FLAGS_AWAY)
+		istat.is_away++;
+#ifdef USE_HOSTHASH
+	add_to_hostname_hash_table(user->host, user);
+#endif
+#ifdef USE_IPHASH
+	add_to_ip_hash_table(user->sip, user);
+#endif
+	if (upgrade_get_int())
+	    {
+		if (load_local(acptr))
+			return -1;
+		istat.is_myclnt++;
+	    }
+	return uerror ? -1 : 0;
+}
+
+/*
+ * upgrade_save
+ *	The whole snapshot, in the order upgrade_load() needs it.
+ */
+static	void	upgrade_save(struct timeval *start)
+{
+	ulen = 0;
+	unfds = 0;
+	upgrade_put_str(ME);
+	upgrade_put_str(me.serv->sid);
+	upgrade_put_int(start->tv_sec);
+	upgrade_put_int(start->tv_usec);
+	upgrade_put_int(me.firsttime);
+	upgrade_put_int(me.since);
+	upgrade_put_int(firstrejoindone);
+	upgrade_put_int(istat.is_m_users);
+	upgrade_put_int(istat.is_m_users_t);
+	upgrade_put_int(istat.is_m_myclnt);
+	upgrade_put_int(istat.is_m_myclnt_t);
+	upgrade_put_int(istat.is_l_myclnt);
+	upgrade_put_int(istat.is_l_myclnt_t);
+	upgrade_put_int(istat.is_m_serv);
+	upgrade_put_int(istat.is_m_myserv);
+	upgrade_put_int(istat.is_m_service);
+	upgrade_put_int(istat.is_m_myservice);
+	save_ids();
+	save_listeners();
+	save_servers(&me);
+	upgrade_put_int(0);
+	save_services();
+	save_users();
+	save_channels();
+	save_whowas();
+	save_tklines();
+	upgrade_put_str(UPGRADE_MAGIC);
+}
+
+static	int	upgrade_load(struct timeval *start)
+{
+	char	*s;
+	int	n;
+
+	upos = 0;
+	if (!(s = upgrade_get_str()) || strcmp(s, ME) ||
+	    !(s = upgrade_get_str()) || strcmp(s, me.serv->sid))
+		return -1;
+	start->tv_sec = upgrade_get_int();
+	start->tv_usec = upgrade_get_int();
+	me.firsttime = upgrade_get_int();
+	me.since = upgrade_get_int();
+	firstrejoindone = upgrade_get_int();
+	istat.is_m_users = upgrade_get_int();
+	istat.is_m_users_t = upgrade_get_int();
+	istat.is_m_myclnt = upgrade_get_int();
+	istat.is_m_myclnt_t = upgrade_get_int();
+	istat.is_l_myclnt = upgrade_get_int();
+	istat.is_l_myclnt_t = upgrade_get_int();
+	istat.is_m_serv = upgrade_get_int();
+	istat.is_m_myserv = upgrade_get_int();
+	istat.is_m_service = upgrade_get_int();
+	istat.is_m_myservice = upgrade_get_int();
+	load_ids();
+	if (uerror || load_listeners())
+		return -1;
+	while (upgrade_get_int() == 1)
+		if (load_server())
+			return -1;
+	n = upgrade_get_int();
+	while (n-- > 0)
+		if (load_service())
+			return -1;
+	n = upgrade_get_int();
+	while (n-- > 0)
+		if (load_user())
+			return -1;
+	load_channels();
+	load_whowas();
+	load_tklines();
+	if (uerror || !(s = upgrade_get_str()) || strcmp(s, UPGRADE_MAGIC))
+		return -1;
+	return 0;
+}
+
+/*
+ * connections which the new ircd can take over as they are
+ */
+static	int	upgrade_carried(aClient *cptr)
+{
+	if (IsListener(cptr))
+		return 1;
+	if (IsPerson(cptr))
+		return !IsDead(cptr);
+	if (IsServer(cptr))
+		return !IsDead(cptr) && !CBurst(cptr) && !IsBursting(cptr) &&
+			!(cptr->flags & FLAGS_ZIP);
+	return 0;
+}
+
+static	int	upgrade_error(aClient *sptr, char *err)
+{
+	sendto_flag(SCH_ERROR, "Upgrade failed: %s", err);
+	if (sptr)
+		sendto_one(sptr, ":%s NOTICE %s :Upgrade failed: %s",
+			   ME, sptr->name, err);
+	return -1;
+}
+
+/*
+ * upgrade_start
+ *	RESTART UPGRADE, or SIGUSR2 (sptr is NULL then): does not return
+ *	if the new ircd took over.
+ */
+int	upgrade_start(aClient *sptr)
+{
+	static	char	hdr[24];
+	struct	timeval	start;
+	aClient	*acptr;
+	char	line[HOSTLEN+SIDLEN+8], expect[HOSTLEN+SIDLEN+8], *err;
+	int	sp[2], fd, i;
+	pid_t	pid;
+
+	if (bootopt & BOOT_INETD)
+		return upgrade_error(sptr, "started from inetd");
+	(void)gettimeofday(&start, NULL);
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sp) < 0)
+		return upgrade_error(sptr, strerror(errno));
+	sendto_flag(SCH_NOTICE, "Upgrade requested by %s",
+		    sptr ? get_client_name(sptr, TRUE) : "signal");
+	ircd_writetune(tunefile);
+	(void)save_cache(dnsfile);
+
+	switch ((pid = fork()))
+	    {
+	case -1:
+		close(sp[0]);
+		close(sp[1]);
+		return upgrade_error(sptr, strerror(errno));
+	case 0:
+		/* 0-2 may be anything since daemonize() */
+		if ((fd = fcntl(sp[1], F_DUPFD, 3)) < 0)
+			_exit(-1);
+		if (!(bootopt & BOOT_TTY) && (i = open("/dev/null", O_RDWR)) >= 0)
+		    {
+			(void)dup2(i, 0);
+			(void)dup2(i, 1);
+			(void)dup2(i, 2);
+		    }
+		for (i = 3; i < MAXCONNECTIONS; i++)
+			if (i != fd)
+				(void)close(i);
+		(void)execv(IRCD_PATH, upgrade_argv(myargv, fd));
+		_exit(-1);
+	default:
+		close(sp[1]);
+	    }
+
+	err = NULL;
+	sprintf(expect, "%s %s", ME, me.serv->sid);
+	if (upgrade_readline(sp[0], line, sizeof(line), UPGRADE_HELLO) < 0)
+		err = "no answer from the new ircd";
+	else if (strcmp(line, expect))
+		err = "the new ircd has a different name or SID";
+	if (err)
+		goto failed;
+
+	/* whatever the new ircd can't take over is closed now */
+	for (i = highest_fd; i >= 0; i--)
+	    {
+		if (!(acptr = local[i]) || acptr == sptr ||
+		    upgrade_carried(acptr))
+			continue;
+		if (IsServer(acptr))
+			sendto_flag(SCH_NOTICE,
+				    "Dropping link %s for the upgrade",
+				    acptr->name);
+		acptr->exitc = EXITC_DIE;
+		(void)exit_client(acptr, acptr, &me,
+				  "Server upgrading, please reconnect");
+	    }
+	sendto_flag(SCH_NOTICE, "Handing over to the new ircd (pid %d)",
+		    (int)pid);
+
+	upgrade_save(&start);
+	bcopy(UPGRADE_MAGIC, hdr, 8);
+	for (i = 0; i < 8; i++)
+	    {
+		hdr[15 - i] = (char)((ulen >> (8 * i)) & 0xff);
+		hdr[23 - i] = (char)(((long)unfds >> (8 * i)) & 0xff);
+	    }
+	if (upgrade_write(sp[0], hdr, sizeof(hdr)) ||
+	    upgrade_write(sp[0], ubuf, ulen) ||
+	    upgrade_sendfds(sp[0], ufds, unfds))
+		err = "cannot send the snapshot";
+	else if (upgrade_readline(sp[0], line, sizeof(line),
+				  UPGRADE_TIMEOUT) < 0 || strcmp(line, "OK"))
+		err = "the new ircd could not resume";
+	if (err)
+		goto failed;
+
+#ifdef USE_SYSLOG
+	syslog(LOG_NOTICE, "Upgraded, now running as pid %d", (int)pid);
+#endif
+	exit(0);
+
+failed:
+	kill(pid, SIGKILL);
+	(void)waitpid(pid, NULL, 0);
+	close(sp[0]);
+	MyFree(ulisteners);
+	ulisteners = NULL;
+	unlisteners = 0;
+	write_pidfile();
+	return upgrade_error(sptr, err);
+}
+
+/*
+ * upgrade_resume
+ *	called from main() with -U: get everything from the previous ircd.
+ */
+void	upgrade_resume(void)
+{
+	struct	timeval	start, now;
+	char	hdr[24], line[HOSTLEN+SIDLEN+8];
+	long	len = 0, nfds = 0;
+	int	i;
+
+	sprintf(line, "%s %s\n", ME, me.serv->sid);
+	if (upgrade_write(upgradefd, line, strlen(line)) ||
+	    upgrade_read(upgradefd, hdr, sizeof(hdr)) ||
+	    memcmp(hdr, UPGRADE_MAGIC, 8))
+		exit(-1);
+	for (i = 0; i < 8; i++)
+	    {
+		len = (len << 8) | (u_char)hdr[8 + i];
+		nfds = (nfds << 8) | (u_char)hdr[16 + i];
+	    }
+	if (len <= 0 || nfds < 0 || nfds > MAXCONNECTIONS)
+		exit(-1);
+	usize = ulen = len;
+	ubuf = (char *)MyMalloc(usize);
+	ufdsize = unfds = nfds;
+	ufds = (int *)MyMalloc((ufdsize + 1) * sizeof(int));
+	if (upgrade_read(upgradefd, ubuf, ulen) ||
+	    upgrade_recvfds(upgradefd, ufds, unfds))
+		exit(-1);
+	if (upgrade_load(&start))
+		exit(-1);
+	if (upgrade_write(upgradefd, "OK\n", 3))
+		exit(-1);
+	close(upgradefd);
+	upgradefd = -1;
+
+	MyFree(ubuf);
+	ubuf = NULL;
+	usize = ulen = upos = 0;
+	MyFree(ufds);
+	ufds = NULL;
+	ufdsize = unfds = 0;
+	MyFree(ulisteners);
+	ulisteners = NULL;
+	unlisteners = 0;
+
+	/* ircd.conf may have changed */
+	reopen_listeners();
+	close_listeners();
+	iauth_old_clients();
+#ifdef TKLINE
+	nexttkexpire = tkline_expire(0);
+#endif
+	check_split();
+	(void)gettimeofday(&now, NULL);
+	sendto_flag(SCH_NOTICE, "Upgrade done: %d clients, %d servers "
+		    "taken over in %d ms", istat.is_myclnt, istat.is_myserv,
+		    (int)((now.tv_sec - start.tv_sec) * 1000 +
+			  (now.tv_usec - start.tv_usec) / 1000));
+}
@@ -0,0 +1,46 @@
+/************************************************************************
+ *   IRC - Internet Relay Chat, ircd/s_upgrade_ext.h
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 1, or (at your option)
+ *   any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*  This file contains external definitions for global variables and functions
+    defined in ircd/s_upgrade.c.
+ */
+
+/*  External definitions for global variables.
+ */
+#ifndef S_UPGRADE_C
+extern int upgradefd;
+#endif /* S_UPGRADE_C */
+
+/*  External definitions for global functions.
+ */
+#ifndef S_UPGRADE_C
+#define EXTERN extern
+#else /* S_UPGRADE_C */
+#define EXTERN
+#endif /* S_UPGRADE_C */
+EXTERN void upgrade_put_int (long l);
+EXTERN void upgrade_put_str (char *s);
+EXTERN void upgrade_put_data (char *s, int len);
+EXTERN long upgrade_get_int (void);
+EXTERN char *upgrade_get_str (void);
+EXTERN char *upgrade_get_strz (void);
+EXTERN char *upgrade_get_data (int *len);
+EXTERN char **upgrade_argv (char **av, int fd);
+EXTERN int upgrade_start (aClient *sptr);
+EXTERN void upgrade_resume (void);
+#undef EXTERN
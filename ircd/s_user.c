@@ -414,7 +414,7 @@ int	register_user(aClient *cptr, aClient *sptr, char *nick, char *username)
 			/* fool check_pings() and give iauth more time! */
 			cptr->firsttime = timeofday;
 			cptr->lasttime = timeofday;
-			strncpyzt(sptr->user->username, username, USERLEN+1);
+			set_istr(&sptr->user->username, username, USERLEN);
 			if (sptr->passwd[0])
 				sendto_iauth("%d P %s", sptr->fd, sptr->passwd);
 			sendto_iauth("%d U %s", sptr->fd, sptr->user->username);
@@ -526,15 +526,17 @@ int	register_user(aClient *cptr, aClient *sptr, char *nick, char *username)
 
 		if (prefix)
 		{
-			*user->username = prefix;
-			strncpy(&user->username[1], buf2, USERLEN);
+			char	pbuf[USERLEN+2];
+
+			*pbuf = prefix;
+			strcpy(pbuf + 1, buf2);
+			set_istr(&user->username, pbuf, USERLEN);
 		}
 		else
-			strncpy(user->username, buf2, USERLEN+1);
-		user->username[USERLEN] = '\0';
+			set_istr(&user->username, buf2, USERLEN);
 		/* eos */
 #else
-		strncpyzt(user->username, username, USERLEN+1);
+		set_istr(&user->username, username, USERLEN);
 #endif
 
 		if (sptr->exitc == EXITC_AREF || sptr->exitc == EXITC_AREFQ)
@@ -592,9 +594,13 @@ int	register_user(aClient *cptr, aClient *sptr, char *nick, char *username)
 					prefix = '=';
 				else
 					prefix = '+';
-			*user->username = prefix;
-			strncpy(&user->username[1], buf2, USERLEN);
-			user->username[USERLEN] = '\0';
+			{
+				char	pbuf[USERLEN+2];
+
+				*pbuf = prefix;
+				strcpy(pbuf + 1, buf2);
+				set_istr(&user->username, pbuf, USERLEN);
+			}
 		}
 #endif
 
@@ -602,7 +608,7 @@ int	register_user(aClient *cptr, aClient *sptr, char *nick, char *username)
 #ifdef UNIXPORT
 		if (IsUnixSocket(sptr))
 		{
-			strncpyzt(user->host, me.sockhost, HOSTLEN+1);
+			set_istr(&user->host, me.sockhost, HOSTLEN);
 		}
 		else
 #endif
@@ -611,13 +617,12 @@ int	register_user(aClient *cptr, aClient *sptr, char *nick, char *username)
 			{
 				/* sockhost contains resolved hostname (if any),
 				 * which we'll use in match_modeid to match. */
-				strncpyzt(user->host, user->sip,
-					HOSTLEN+1);
+				set_istr(&user->host, user->sip, HOSTLEN);
 			}
 			else
 			{
-				strncpyzt(user->host, sptr->sockhost,
-					HOSTLEN+1);
+				set_istr(&user->host, sptr->sockhost,
+					 HOSTLEN);
 			}
 		}
 
@@ -644,7 +649,7 @@ int	register_user(aClient *cptr, aClient *sptr, char *nick, char *username)
 	else
 	{
 		/* Received from other server in UNICK */
-		strncpyzt(user->username, username, USERLEN+1);
+		set_istr(&user->username, username, USERLEN);
 	}
 
 	SetClient(sptr);
@@ -748,6 +753,8 @@ int	register_user(aClient *cptr, aClient *sptr, char *nick, char *username)
 		sprintf(buf, "%s!%s@%s", nick, user->username, user->host);
 		add_to_uid_hash_table(sptr->user->uid, sptr);
 		sptr->exitc = EXITC_REG;
+		TRACE(TRACE_CONN, TEV_REGUSER, sptr->fd, istat.is_myclnt, 0,
+		      0);
 		sendto_one(sptr, replies[RPL_WELCOME], ME, BadTo(nick), buf);
 		/* This is a duplicate of the NOTICE but see below...*/
 		sendto_one(sptr, replies[RPL_YOURHOST], ME, BadTo(nick),
@@ -1389,7 +1396,7 @@ int	m_unick(aClient *cptr, aClient *sptr, int parc, char *parv[])
 	*/
 	acptr = make_client(cptr);
 	add_client_to_list(acptr);
-	(void)make_user(acptr, strlen(parv[5]));
+	(void)make_user(acptr);
 	/* more corrrect is this, but we don't yet have ->mask, so...
 	acptr->user->servp = find_server_name(sptr->serv->mask->serv->snum);
 	... just remember to change it one day --Beeth */
@@ -1401,8 +1408,8 @@ int	m_unick(aClient *cptr, aClient *sptr, int parc, char *parv[])
 		realname[REALLEN] = '\0';
 	}
 	acptr->info = mystrdup(realname);
-	strncpyzt(acptr->user->username, parv[3], USERLEN+1);
-	strncpyzt(acptr->user->host, host, sizeof(acptr->user->host));
+	set_istr(&acptr->user->username, parv[3], USERLEN);
+	set_istr(&acptr->user->host, host, HOSTLEN);
 	reorder_client_in_list(acptr);
 
 	/*
@@ -1421,7 +1428,7 @@ int	m_unick(aClient *cptr, aClient *sptr, int parc, char *parv[])
 	acptr->hopcount = sptr->hopcount;
 	/* The client is already killed if the uid is too long. */
 	strcpy(acptr->user->uid, uid);
-	strcpy(acptr->user->sip, parv[5]);
+	set_istr(&acptr->user->sip, parv[5], HOSTLEN);
 	add_to_uid_hash_table(uid, acptr);
 	{
 	    char	*pv[4];
@@ -2235,8 +2242,8 @@ int	m_user(aClient *cptr, aClient *sptr, int parc, char *parv[])
 #else
 	strcpy(ipbuf, (char *)inetntoa((char *)&sptr->ip));
 #endif
-	user = make_user(sptr, strlen(ipbuf));
-	strcpy(user->sip, ipbuf);
+	user = make_user(sptr);
+	set_istr(&user->sip, ipbuf, HOSTLEN);
 
 	user->servp = me.serv;
 	me.serv->refcnt++;
@@ -2314,7 +2321,7 @@ int	m_user(aClient *cptr, aClient *sptr, int parc, char *parv[])
 	}
 	else
 	{
-		strncpyzt(sptr->user->username, username, USERLEN+1);
+		set_istr(&sptr->user->username, username, USERLEN);
 	}
 	return 2;
 }
@@ -3409,7 +3416,7 @@ int	is_allowed(aClient *cptr, long function)
 	/* minimal control, but nothing else service can do anyway. */
 	if (IsService(cptr))
 	{
-		if (function == ACL_TKLINE &&
+		if ((function == ACL_TKLINE || function == ACL_UNTKLINE) &&
 			(cptr->service->wants & SERVICE_WANT_TKLINE))
 			return 1;
 		if (function == ACL_KLINE &&
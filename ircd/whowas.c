@@ -364,6 +364,168 @@ void	initwhowas(void)
 }
 
 
+/*
+** save_whowas
+**	Write the history (and locked nicknames) for a live upgrade.
+**	Entries are tagged: 0 is locked, 1 is offline, 2 is online, in
+**	which case the user is found by its UID when loading.
+*/
+void	save_whowas(void)
+{
+	Reg	aName	*np;
+	Reg	Link	*uwas;
+	int	i, n;
+
+	upgrade_put_int(ww_size);
+	upgrade_put_int(ww_index);
+	for (n = 0, i = 0; i < ww_size; i++)
+		if (was[i].ww_user)
+			n++;
+	upgrade_put_int(n);
+	for (i = 0; i < ww_size; i++)
+	    {
+		np = &was[i];
+		if (!np->ww_user)
+			continue;
+		upgrade_put_int(i);
+		upgrade_put_int(np->ww_logout);
+		upgrade_put_str(np->ww_nick);
+		upgrade_put_str(np->ww_info);
+		if (np->ww_online && np->ww_online != &me)
+		    {
+			upgrade_put_int(2);
+			upgrade_put_str(np->ww_user->uid);
+			for (uwas = np->ww_user->uwas; uwas; uwas = uwas->next)
+				if (uwas->value.i == i)
+					break;
+			upgrade_put_int(uwas ? uwas->flags : np->ww_logout);
+			continue;
+		    }
+		upgrade_put_int(np->ww_online ? 1 : 0);
+		upgrade_put_str(np->ww_user->username);
+		upgrade_put_str(np->ww_user->host);
+		upgrade_put_str(np->ww_user->server);
+		upgrade_put_str(np->ww_user->away);
+	    }
+
+	upgrade_put_int(lk_size);
+	upgrade_put_int(lk_index);
+	for (n = 0, i = 0; i < lk_size; i++)
+		if (locked[i].logout)
+			n++;
+	upgrade_put_int(n);
+	for (i = 0; i < lk_size; i++)
+		if (locked[i].logout)
+		    {
+			upgrade_put_int(i);
+			upgrade_put_int(locked[i].logout);
+			upgrade_put_str(locked[i].nick);
+		    }
+}
+
+/*
+** load_whowas
+**	Rebuild what save_whowas() wrote, once the users are known.
+**	Offline entries which shared a user structure get one each.
+*/
+void	load_whowas(void)
+{
+	static	aClient	tmp;
+	Reg	aName	*np;
+	Reg	Link	*uwas;
+	aClient	*acptr;
+	char	*s;
+	int	i, n, size;
+
+	size = upgrade_get_int();
+	if (size > 0 && size != ww_size)
+	    {
+		ww_size = size;
+		was = (aName *)MyRealloc((char *)was, sizeof(*was) * ww_size);
+		bzero((char *)was, sizeof(*was) * ww_size);
+	    }
+	ww_index = upgrade_get_int();
+	if (ww_index < 0 || ww_index >= ww_size)
+		ww_index = 0;
+	n = upgrade_get_int();
+	while (n-- > 0)
+	    {
+		i = upgrade_get_int();
+		if (i < 0 || i >= ww_size)
+			return;
+		np = &was[i];
+		np->ww_logout = upgrade_get_int();
+		strncpyzt(np->ww_nick, upgrade_get_strz(), NICKLEN+1);
+		strncpyzt(np->ww_info, upgrade_get_strz(), REALLEN+1);
+		switch (upgrade_get_int())
+		    {
+		case 2:
+			s = upgrade_get_str();
+			if (!s || !(acptr = find_uid(s, NULL)) || !acptr->user)
+			    {
+				(void)upgrade_get_int();
+				np->ww_logout = 0;
+				continue;
+			    }
+			np->ww_user = acptr->user;
+			np->ww_online = acptr;
+			acptr->user->refcnt++;
+			uwas = make_link();
+			istat.is_wwuwas++;
+			uwas->value.i = i;
+			uwas->flags = upgrade_get_int();
+			uwas->next = acptr->user->uwas;
+			acptr->user->uwas = uwas;
+			break;
+		case 1:
+			np->ww_online = &me;
+			/* fall through */
+		default:
+			/* tmp.next is NULL, this is not counted in is_users */
+			np->ww_user = make_user(&tmp);
+			tmp.user = NULL;
+			np->ww_user->bcptr = NULL;
+			set_istr(&np->ww_user->username,
+				 upgrade_get_strz(), USERLEN);
+			set_istr(&np->ww_user->host,
+				 upgrade_get_strz(), HOSTLEN);
+			s = upgrade_get_str();
+			np->ww_user->server = find_server_string(
+						find_server_num(BadTo(s)));
+			if ((s = upgrade_get_str()))
+			    {
+				np->ww_user->away = mystrdup(s);
+				istat.is_wwaways++;
+				istat.is_wwawaysmem += strlen(s) + 1;
+			    }
+			istat.is_wwusers++;
+			break;
+		    }
+	    }
+
+	size = upgrade_get_int();
+	if (size > 0 && size != lk_size)
+	    {
+		lk_size = size;
+		locked = (aLock *)MyRealloc((char *)locked,
+					    sizeof(*locked) * lk_size);
+		bzero((char *)locked, sizeof(*locked) * lk_size);
+	    }
+	lk_index = upgrade_get_int();
+	if (lk_index < 0 || lk_index >= lk_size)
+		lk_index = 0;
+	n = upgrade_get_int();
+	while (n-- > 0)
+	    {
+		i = upgrade_get_int();
+		if (i < 0 || i >= lk_size)
+			return;
+		locked[i].logout = upgrade_get_int();
+		strncpyzt(locked[i].nick, upgrade_get_strz(),
+			  NICKLEN+1);
+	    }
+}
+
 /*
 ** m_whowas
 **	parv[0] = sender prefix
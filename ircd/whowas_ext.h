@@ -40,6 +40,8 @@ EXTERN aClient *get_history (char *nick, time_t timelimit);
 EXTERN int find_history (char *nick, time_t timelimit);
 EXTERN void off_history (Reg aClient *cptr);
 EXTERN void initwhowas(void);
+EXTERN void save_whowas (void);
+EXTERN void load_whowas (void);
 EXTERN int m_whowas (aClient *cptr, aClient *sptr, int parc,
 			 char *parv[]);
 EXTERN void count_whowas_memory (int *wwu, int *wwa, u_long *wwam,